@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cpu.h"
+
+// Per-core utilisation: batched kernel vs. one cpu_usage() per core.
+// usage: bench/cpu_usage [cores] [iterations]
+
+static double now_ns(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+static void fill(struct cpu_cores *c, unsigned seed, long base){
+	for(int i = 0; i < c->cap; i++){
+		seed = seed * 1103515245u + 12345u;
+		c->user[i]    = base + (seed >> 8) % 100;
+		c->nice[i]    = base / 8;
+		c->system[i]  = base / 2 + (seed >> 16) % 50;
+		c->idle[i]    = base * 4 + (seed >> 4) % 100;
+		c->iowait[i]  = base / 16;
+		c->irq[i]     = base / 32;
+		c->softirq[i] = base / 32;
+		c->steal[i]   = base / 64 + (seed >> 20) % 10;
+		c->online[i]  = 1;
+	}
+	c->n = c->cap;
+}
+
+int main(int argc, char *argv[]){
+	int cores = argc > 1 ? atoi(argv[1]) : 192;
+	long iters = argc > 2 ? atol(argv[2]) : 200000;
+	struct cpu_cores prev, curr;
+	if(cores < 1 || iters < 1) return 2;
+	if(cpu_cores_init(&prev, cores) != 0 || cpu_cores_init(&curr, cores) != 0)
+		return 1;
+	double *out = calloc((size_t)cores, sizeof(double));
+	if(!out) return 1;
+	fill(&prev, 1, 100000);
+	fill(&curr, 7, 100100);
+
+	volatile double sink = 0.0;
+	double t0 = now_ns();
+	for(long it = 0; it < iters; it++){
+		cpu_cores_usage(&prev, &curr, out);
+		sink += out[it % cores];
+	}
+	double t1 = now_ns();
+
+	struct cpu_stat p, c;
+	for(long it = 0; it < iters; it++){
+		for(int i = 0; i < cores; i++){
+			p = (struct cpu_stat){ prev.user[i], prev.nice[i], prev.system[i],
+				prev.idle[i], prev.iowait[i], prev.irq[i], prev.softirq[i],
+				prev.steal[i] };
+			c = (struct cpu_stat){ curr.user[i], curr.nice[i], curr.system[i],
+				curr.idle[i], curr.iowait[i], curr.irq[i], curr.softirq[i],
+				curr.steal[i] };
+			out[i] = cpu_usage(&p, &c);
+		}
+		sink += out[it % cores];
+	}
+	double t2 = now_ns();
+	(void)sink;
+
+	double n = (double)iters * cores;
+	printf("cores=%d iterations=%ld\n", cores, iters);
+	printf("cpu_cores_usage  %8.3f ns/core\n", (t1 - t0) / n);
+	printf("cpu_usage x core %8.3f ns/core\n", (t2 - t1) / n);
+
+	free(out);
+	cpu_cores_free(&prev);
+	cpu_cores_free(&curr);
+	return 0;
+}
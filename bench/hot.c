@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "mem.h"
+#include "output.h"
+#include "probe.h"
+#include "rules.h"
+#include "window.h"
+
+// Per-call cost of everything sysprobe does on a tick, against live
+// /proc and against recorded fixtures (bench/fixtures).
+// usage: bench/hot [-t MS] [-d FIXTURE_DIR] [NAME...]
+//
+// ns/op is wall time. syscalls/op and allocs/op count the calls made
+// from sysprobe's own code: the Makefile links this binary with
+// --wrap for the syscalls and allocators it uses, so libc-internal
+// calls are not included.
+
+static unsigned long n_syscalls, n_allocs;
+
+#define WRAP_SYSCALL(ret, name, params, args) \
+	ret __real_##name params; \
+	ret __wrap_##name params { n_syscalls++; return __real_##name args; }
+
+WRAP_SYSCALL(ssize_t, pread, (int fd, void *buf, size_t n, off_t off), (fd, buf, n, off))
+WRAP_SYSCALL(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n))
+WRAP_SYSCALL(ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n))
+WRAP_SYSCALL(int, close, (int fd), (fd))
+
+// open/openat are variadic; sysprobe never creates files through them
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...){
+	n_syscalls++;
+	return __real_open(path, flags);
+}
+int __real_openat(int dir, const char *path, int flags, ...);
+int __wrap_openat(int dir, const char *path, int flags, ...){
+	n_syscalls++;
+	return __real_openat(dir, path, flags);
+}
+
+void *__real_malloc(size_t n);
+void *__wrap_malloc(size_t n){
+	n_allocs++;
+	return __real_malloc(n);
+}
+void *__real_calloc(size_t n, size_t size);
+void *__wrap_calloc(size_t n, size_t size){
+	n_allocs++;
+	return __real_calloc(n, size);
+}
+void *__real_realloc(void *p, size_t n);
+void *__wrap_realloc(void *p, size_t n){
+	n_allocs++;
+	return __real_realloc(p, n);
+}
+
+// ---- state shared by the benchmarks ----
+
+struct bench_ctx {
+	struct probe_ctx live;
+	struct probe_ctx fix;
+	int live_cores;
+	int fix_cores;
+	struct cpu_stat stat;
+	struct cpu_cores cores;
+	mem_stat mem;
+	struct cpu_stat prev, curr;
+	cpu_window win;
+	struct rule_engine rules;
+	struct sample s;
+	double *core_pct;
+	struct out_buf out;
+	long i;
+	volatile double sink;
+};
+
+static void b_read_cpu_stat_live(struct bench_ctx *b){
+	read_cpu_stat(&b->live, &b->stat, &b->cores);
+}
+
+static void b_read_cpu_stat_fixture(struct bench_ctx *b){
+	read_cpu_stat(&b->fix, &b->stat, &b->cores);
+}
+
+static void b_parse_cpu_stat(struct bench_ctx *b){
+	parse_cpu_stat(b->fix.stat.buf, b->fix.stat.len, &b->stat, &b->cores);
+}
+
+static void b_read_mem_stat_live(struct bench_ctx *b){
+	read_mem_stat(&b->live, &b->mem);
+}
+
+static void b_read_mem_stat_fixture(struct bench_ctx *b){
+	read_mem_stat(&b->fix, &b->mem);
+}
+
+static void b_cpu_usage(struct bench_ctx *b){
+	b->curr.user = b->prev.user + 1 + (b->i & 63);
+	b->curr.idle = b->prev.idle + 100;
+	b->sink += cpu_usage(&b->prev, &b->curr);
+	b->i++;
+}
+
+static void b_cpu_window(struct bench_ctx *b){
+	cpu_window_add(&b->win, (double)(b->i++ & 127));
+	b->sink += cpu_window_avg(&b->win);
+}
+
+static void b_rules_eval(struct bench_ctx *b){
+	sys_state st[GROUP_NR];
+	b->s.t += 0.05;
+	b->s.cpu_pct = (double)(b->i++ & 127);
+	rules_eval(&b->rules, &b->s, st);
+	b->sink += st[GROUP_CPU];
+}
+
+static void b_emit_sample(struct bench_ctx *b){
+	b->s.t += 0.05;
+	emit_sample(&b->out, &b->s);
+}
+
+struct bench {
+	const char *name;
+	void (*fn)(struct bench_ctx *b);
+	int live;
+};
+
+static const struct bench benches[] = {
+	{ "read_cpu_stat/live",    b_read_cpu_stat_live,    1 },
+	{ "read_cpu_stat/fixture", b_read_cpu_stat_fixture, 0 },
+	{ "parse_cpu_stat/fixture", b_parse_cpu_stat,       0 },
+	{ "read_mem_stat/live",    b_read_mem_stat_live,    1 },
+	{ "read_mem_stat/fixture", b_read_mem_stat_fixture, 0 },
+	{ "cpu_usage",             b_cpu_usage,             0 },
+	{ "cpu_window_add+avg",    b_cpu_window,            0 },
+	{ "rules_eval/defaults",   b_rules_eval,            0 },
+	{ "emit_sample/jsonl",     b_emit_sample,           0 },
+};
+
+#define NBENCH (int)(sizeof(benches) / sizeof(benches[0]))
+
+static double now_ns(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+// Doubles the batch until one takes `target_ns`, then reports that batch.
+static void run(const struct bench *bn, struct bench_ctx *b, double target_ns){
+	long iters = 16;
+	for(;;){
+		unsigned long sc = n_syscalls, al = n_allocs;
+		double t0 = now_ns();
+		for(long i = 0; i < iters; i++) bn->fn(b);
+		double dt = now_ns() - t0;
+		if(dt >= target_ns || iters >= (1L << 40)){
+			printf("%-24s %10.1f %12.3f %10.3f\n", bn->name, dt / iters,
+					(double)(n_syscalls - sc) / iters, (double)(n_allocs - al) / iters);
+			return;
+		}
+		iters *= 2;
+	}
+}
+
+static int probe_fixture(struct probe_ctx *ctx, const char *dir, char *stat_path,
+		char *mem_path, size_t len, int *cores){
+	snprintf(stat_path, len, "%s/stat-64", dir);
+	snprintf(mem_path, len, "%s/meminfo", dir);
+	*cores = 64;
+	if(proc_file_open(&ctx->stat, stat_path, (size_t)(*cores + 1) * PROBE_STAT_LINE) != 0){
+		perror(stat_path);
+		return -1;
+	}
+	if(proc_file_open(&ctx->meminfo, mem_path, PROBE_MEMINFO_BUF) != 0){
+		perror(mem_path);
+		proc_file_close(&ctx->stat);
+		return -1;
+	}
+	return 0;
+}
+
+static void usage(const char *prog){
+	fprintf(stderr, "usage: %s [-t MS] [-d FIXTURE_DIR] [NAME...]\n", prog);
+	for(int i = 0; i < NBENCH; i++) fprintf(stderr, "  %s\n", benches[i].name);
+}
+
+int main(int argc, char *argv[]){
+	const char *dir = "bench/fixtures";
+	double target_ms = 200.0;
+	int opt;
+	while((opt = getopt(argc, argv, "t:d:h")) != -1){
+		switch(opt){
+		case 't': target_ms = atof(optarg); break;
+		case 'd': dir = optarg; break;
+		default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+		}
+	}
+
+	struct bench_ctx *b = calloc(1, sizeof(*b));
+	if(!b) return 1;
+	static char stat_path[4096], mem_path[4096];
+	if(probe_fixture(&b->fix, dir, stat_path, mem_path, sizeof(stat_path), &b->fix_cores) != 0)
+		return 1;
+	struct cpu_capacity cap;
+	read_cpu_capacity(&cap);
+	b->live_cores = cap.cores;
+	int live = probe_open(&b->live, b->live_cores) == 0;
+	int cores = b->fix_cores > b->live_cores ? b->fix_cores : b->live_cores;
+	if(cpu_cores_init(&b->cores, cores) != 0 || cpu_window_init(&b->win, CPU_WINDOW, 0.0) != 0)
+		return 1;
+	proc_file_read(&b->fix.stat);
+	rules_init(&b->rules);
+	if(rules_defaults(&b->rules, CPU_WINDOW) != 0) return 1;
+
+	// a sample as emitted on a 64-core host
+	b->core_pct = calloc((size_t)b->fix_cores, sizeof(double));
+	if(!b->core_pct) return 1;
+	for(int i = 0; i < b->fix_cores; i++) b->core_pct[i] = (i * 37) % 100 + 0.25;
+	read_mem_stat(&b->fix, &b->mem);
+	b->s.cpu_pct = 42.5;
+	b->s.cpu_avg = 40.1;
+	b->s.mem_used_gb = 12.3;
+	b->s.mem_avail_gb = 19.7;
+	b->s.interval = 0.05;
+	b->s.fresh = SRC_ALL;
+	b->s.ncores = b->fix_cores;
+	b->s.core_pct = b->core_pct;
+	int null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if(null_fd < 0 || out_init(&b->out, null_fd, OUT_BUF_SIZE, FORMAT_JSONL, FLUSH_FULL, 1, 0.0) != 0){
+		perror("/dev/null");
+		return 1;
+	}
+
+	printf("live cores=%d fixture cores=%d target=%.0fms\n", b->live_cores, b->fix_cores,
+			target_ms);
+	printf("%-24s %10s %12s %10s\n", "benchmark", "ns/op", "syscalls/op", "allocs/op");
+	for(int i = 0; i < NBENCH; i++){
+		int want = optind == argc;
+		for(int a = optind; a < argc; a++)
+			if(strncmp(argv[a], benches[i].name, strlen(argv[a])) == 0) want = 1;
+		if(!want) continue;
+		if(benches[i].live && !live){
+			printf("%-24s skipped, /proc not readable\n", benches[i].name);
+			continue;
+		}
+		run(&benches[i], b, target_ms * 1e6);
+	}
+
+	out_close(&b->out);
+	rules_free(&b->rules);
+	cpu_window_free(&b->win);
+	cpu_cores_free(&b->cores);
+	free(b->core_pct);
+	if(live) probe_close(&b->live);
+	probe_close(&b->fix);
+	free(b);
+	return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Fixed-footprint memory for a probe run. One anonymous mapping is
+// reserved at startup; the rings, windows, hash tables, parse and output
+// buffers are carved out of it by a bump pointer while the sampler,
+// ring and writer are set up. arena_seal() then fixes the size: what
+// startup used plus ARENA_HEADROOM_MB, or exactly --arena MB; startup
+// past ARENA_RESERVE_MB needs a larger --arena, as the headroom must fit
+// in the reservation. With --mlock that whole size is locked up front,
+// so neither the probe's state nor its growth can be swapped out or
+// page-faulted in under memory pressure.
+//
+// Nothing is ever returned: arena_free() is a no-op on arena memory, so
+// an outgrown table stays behind when it is replaced. Tables are
+// therefore sized once wherever a bound is known:
+//   top-N hot files   3 x --top stat/statm buffers, at procs_init()
+//   cgroups           the whole CGROUP_MAX (or fd-limited) table
+//   rules             compiled on the heap, moved in at their final size
+// The one table that still grows after the seal is the pid table: 64
+// bytes a slot, at most half full, doubled with the old copy left
+// behind, so ~256 bytes of headroom per process beyond twice the count
+// at startup. The trace index grows with the trace and is only read at
+// close, so it stays on the heap. Once the size is reached an
+// allocation fails like malloc does, and the caller degrades as it
+// already does without memory; the footprint never moves.
+//
+// Without an arena in use (the tools, bench/) the calls fall through to
+// calloc/realloc/free.
+
+#define ARENA_RESERVE_MB 256	// address space only, untouched pages cost nothing
+#define ARENA_HEADROOM_MB 8
+#define ARENA_ALIGN 64		// a cache line, so no two users share one
+
+struct arena {
+	unsigned char *base;
+	size_t reserved;
+	size_t limit;		// usable bytes, == reserved until sealed
+	_Atomic size_t used;
+	size_t startup;		// used when sealed
+	_Atomic unsigned long refused;
+	int locked;
+};
+
+// Reserves max(ARENA_RESERVE_MB, size_mb) and makes it the arena every
+// arena_* call below uses. -1 with a message on failure.
+int arena_init(struct arena *a, unsigned size_mb);
+// size_mb 0: startup use + ARENA_HEADROOM_MB. -1 with a message if
+// startup already took more than size_mb, or if the lock fails.
+int arena_seal(struct arena *a, unsigned size_mb, int lock);
+// Pages come from NUMA node `node` while it has room. Call it before
+// anything is allocated: pages already touched stay where they are.
+int arena_bind_node(struct arena *a, int node);
+void arena_destroy(struct arena *a);
+
+// Zeroed like calloc.
+void *arena_calloc(size_t n, size_t size);
+// old: the size p was allocated with, copied over when p cannot grow
+// in place.
+void *arena_realloc(void *p, size_t old, size_t size);
+void arena_free(void *p);
+
+#endif
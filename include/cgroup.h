@@ -0,0 +1,104 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+#include <stddef.h>
+#include "collector.h"
+#include "procs.h"
+#include "state.h"
+
+#define CGROUP_MAX 4096		// cgroups tracked under one root
+#define CGROUP_PATH 256		// relative to the root
+#define CGROUP_NAME 96		// tail of the path in a report
+#define CGROUP_REPORT_MAX 8
+#define CGROUP_BUF 8192		// memory.stat is the longest file read
+#define CGROUP_LIMIT_EVERY 10	// memory.max and cpu.max re-read every N samples
+#define CGROUP_FDS 3		// kept open per cgroup
+
+// A cgroup's state is its worse share of a limit: the working set of
+// memory.max or the CPU use of the cpu.max quota. A level is only left
+// once the share is CGROUP_HYST_PCT back under its threshold.
+#define CGROUP_WARN_PCT 85.0
+#define CGROUP_DANGER_PCT 95.0
+#define CGROUP_HYST_PCT 5.0
+
+struct cgroup {
+	char path[CGROUP_PATH];	// "" for the root itself
+	int wd;			// inotify watch on the directory, -1 if none
+	int cpu_fd;		// cpu.stat
+	int mem_fd;		// memory.current, -1 without the memory controller
+	int stat_fd;		// memory.stat
+	unsigned long long usage_usec;
+	unsigned long long nr_periods;
+	unsigned long long nr_throttled;
+	double read_t;		// < 0 until the counters were read once
+	double mem_max;		// bytes, INFINITY when unlimited or unknown
+	double cpu_quota;	// cores, INFINITY when unlimited or unknown
+	double cpu_pct;		// percent of one core
+	double cpu_limit_pct;	// of the quota, NaN without one
+	double throttled_pct;	// of the enforcement periods, NaN without a quota
+	double mem_bytes;	// working set: memory.current - inactive_file
+	double mem_limit_pct;	// of memory.max, NaN if unlimited
+	sys_state state;
+	int changed;		// state moved since the last change report
+};
+
+struct cgroup_report_entry {
+	char name[CGROUP_NAME];
+	sys_state state;
+	double cpu_pct;
+	double cpu_limit_pct;
+	double throttled_pct;
+	double mem_mb;
+	double mem_limit_pct;
+};
+
+// reason as for the top lists: the cgroups whose state just changed,
+// or the worst ones on a summary
+struct cgroup_report {
+	double t;
+	enum top_reason reason;
+	int count;		// cgroups tracked
+	int warn;
+	int danger;
+	int n;
+	struct cgroup_report_entry e[CGROUP_REPORT_MAX];
+};
+
+// Every cgroup under a --cgroup-root. The tree is walked once at start;
+// after that an inotify watch on each directory reports cgroups coming
+// and going, drained without blocking before each sample, so a tick
+// costs three pread()s per cgroup and no directory scan. A queue
+// overflow falls back to one more walk. Cgroups whose files stop
+// reading are dropped even if their removal event was lost.
+struct cgroup_set {
+	char root[CGROUP_PATH];
+	int ifd;		// inotify
+	struct cgroup *cg;	// `max` of them, dense, removal moves the last one in
+	int n;
+	int max;		// CGROUP_MAX, or less when the fd limit is lower
+	int overflow;		// the table filled up: some are not tracked
+	int unwatched;		// out of inotify watches: some are not discovered
+	unsigned long tick;
+	char *buf;		// CGROUP_BUF, shared by every read
+	double worst_mem_pct;	// of the cgroups, NaN if none has a limit
+	double worst_cpu_pct;
+};
+
+// "usage_usec N", "nr_periods N", "nr_throttled N" out of cpu.stat
+int parse_cgroup_cpu_stat(const char *buf, size_t len, unsigned long long *usage_usec,
+		unsigned long long *nr_periods, unsigned long long *nr_throttled);
+// memory.max or cpu.max as a limit in bytes or cores, INFINITY for "max"
+double parse_cgroup_mem_max(const char *buf, size_t len);
+double parse_cgroup_cpu_max(const char *buf, size_t len);
+// one "KEY N" line of memory.stat, -1 if missing
+long long parse_cgroup_stat_key(const char *buf, size_t len, const char *key);
+
+// Fills `rep` and returns 1 when there is anything to report: for
+// TOP_STATE_CHANGE the cgroups changed since the last such call (their
+// flags are cleared), for TOP_SUMMARY the worst cgroups right now.
+int cgroup_report(struct cgroup_set *cs, double t, enum top_reason reason,
+		struct cgroup_report *rep);
+
+extern const struct collector_ops cgroup_collector;
+
+#endif
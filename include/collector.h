@@ -0,0 +1,59 @@
+#ifndef COLLECTOR_H
+#define COLLECTOR_H
+
+#include "sample.h"
+#include "selfstat.h"
+
+struct sampler;
+struct sample;
+struct collector;
+
+// One data source. sample() reads it and updates whatever the
+// collector keeps; emit() copies the latest values into the outgoing
+// sample on every tick, whether or not sample() ran on that tick.
+// init() returning -1 aborts startup.
+struct collector_ops {
+	const char *name;
+	int (*init)(struct collector *c, struct sampler *sp);
+	int (*sample)(struct collector *c, struct sampler *sp, double t);
+	void (*emit)(const struct collector *c, const struct sampler *sp, struct sample *s);
+	void (*teardown)(struct collector *c, struct sampler *sp);
+	unsigned src;	// SRC_* fields emit() fills (sample.h)
+};
+
+struct collector {
+	const struct collector_ops *ops;
+	void *priv;
+	double period_s;	// 0: every tick
+	unsigned long due;	// wheel tick of the next run
+	int ready;		// due on the current tick
+	int initialized;
+	struct collector *next;	// wheel slot chain
+	struct lat_hist lat;	// sample() time, kept with --self
+};
+
+#define COLLECTOR_MAX 16
+#define WHEEL_SLOTS 64	// power of two
+
+// Hashed timing wheel in sampler ticks. A collector due in d ticks sits
+// in slot (now + d) % WHEEL_SLOTS; periods longer than the wheel just
+// stay in their slot for more than one revolution.
+struct timing_wheel {
+	struct collector *slot[WHEEL_SLOTS];
+	unsigned long now;
+};
+
+void wheel_init(struct timing_wheel *w);
+// Due on tick now + ticks (0 = the current tick, if not yet advanced).
+void wheel_schedule(struct timing_wheel *w, struct collector *c, unsigned long ticks);
+// Moves to the next tick and sets ->ready on every collector due on
+// it; those are taken off the wheel and must be rescheduled.
+void wheel_advance(struct timing_wheel *w);
+// Ticks until the next run for a period at the current tick length.
+unsigned long wheel_ticks(double period_s, double tick_s);
+// The tick length changed: every pending run is moved to the tick
+// closest to the time it was due, so a period stays a period in
+// seconds and not in ticks.
+void wheel_rescale(struct timing_wheel *w, double old_tick_s, double new_tick_s);
+
+#endif
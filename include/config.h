@@ -0,0 +1,68 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "output.h"
+#include "placement.h"
+#include "psi.h"
+
+#define CONFIG_MAX_PERIODS 16
+#define CONFIG_MAX_RULES 32
+
+struct collector_period {
+	const char *name;
+	double period_s;
+};
+
+struct probe_config {
+	double interval_s;	// sampling period
+	int adaptive;		// switch between slow_s and fast_s
+	double slow_s;
+	double fast_s;
+	double calm_s;		// calm time before falling back to slow_s
+	int window;		// cpu window slots
+	double ewma_alpha;	// <= 0: derived from window
+	double summary_s;	// period of summary records, 0 disables
+	double self_s;		// period of self records, 0 disables
+	double deadband;	// percent points a metric must move, 0 disables
+	double heartbeat_s;	// with deadband: longest gap between samples
+	unsigned queue;		// writer ring slots
+	int top_n;		// processes per top list, 0 disables
+	int proc_rescan;	// full /proc scan every N ticks
+	const char *psi_cgroup;	// NULL: system-wide /proc/pressure
+	int bpf;		// CPU time and sched/mm counters from eBPF
+	const char *cgroup_root;	// cgroup v2 tree to track per cgroup, NULL: off
+	struct psi_trigger psi_trig[PSI_MAX_TRIGGERS];
+	int psi_ntrig;
+	struct collector_period periods[CONFIG_MAX_PERIODS];
+	int nperiods;		// collectors not listed run every tick
+	const char *rules_file;	// threshold rules (rules.h), compiled at startup
+	const char *rules[CONFIG_MAX_RULES];
+	int nrules;		// no file and no rules: the built-in set
+	const char *replay;	// capture directory or binary trace to replay
+	const char *capture;	// directory to record /proc snapshots into
+	const char *flight;	// flight recorder file (flight.h)
+	unsigned flight_mb;
+	const char *push;	// udp:HOST:PORT or unix:PATH of a sysprobe-agg
+	const char *listen;	// [HOST]:PORT of the OpenMetrics endpoint
+	unsigned arena_mb;	// fixed arena size, 0: startup use + headroom
+	int mlock;		// lock the arena in memory
+	const char *cpu_list;	// CPUs to keep the probe on, NULL: any
+	int nice;
+	int have_nice;
+	enum probe_sched sched;
+	int sched_prio;		// fifo and rr
+	int numa;		// arena on the node of the probe's CPUs
+	double predict_s;	// forecast horizon (forecast.h), 0: off
+	double predict_fit_s;
+	enum out_format format;
+	enum flush_policy flush;
+	unsigned flush_every_n;
+	double flush_every_ms;
+};
+
+void config_defaults(struct probe_config *cfg);
+// 0 on success, 1 if usage was printed on request, -1 on bad arguments
+int config_parse_args(struct probe_config *cfg, int argc, char *argv[]);
+void config_usage(const char *prog);
+
+#endif
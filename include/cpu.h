@@ -1,8 +1,11 @@
 #ifndef CPU_H
 #define CPU_H
 
+#include <stddef.h>
+#include "probe.h"
+
 struct cpu_capacity {
-	int cores;
+	int cores;	// CPU ids that can come online, offline ones included
 	long max_freq_khz;
 };
 
@@ -12,12 +15,58 @@ struct cpu_stat {
 	long nice;
 	long system;
 	long idle;
+	long iowait;
+	long irq;
+	long softirq;
+	long steal;
+};
+
+// Per-core counters from the cpuN lines of /proc/stat, one contiguous
+// array per field so per-core deltas run as a single loop over i. Slot
+// i is CPU i: /proc/stat lists online CPUs only, so an offline one
+// leaves its slot with online[i] == 0 rather than shifting the rest.
+struct cpu_cores {
+	int cap;	// slots allocated (cpu_capacity.cores)
+	int n;		// highest CPU id seen by the last parse, plus one
+	unsigned char *online;
+	long *user;
+	long *nice;
+	long *system;
+	long *idle;
+	long *iowait;
+	long *irq;
+	long *softirq;
+	long *steal;
 };
 
 int read_cpu_capacity(struct cpu_capacity *cap);
-int read_cpu_stat(struct cpu_stat *out);
+
+int cpu_cores_init(struct cpu_cores *c, int cores);
+void cpu_cores_free(struct cpu_cores *c);
+
+// Parses the aggregate "cpu" line of a /proc/stat image and, when
+// `cores` is non-NULL, the cpuN lines that follow it.
+int parse_cpu_stat(const char *buf, size_t len, struct cpu_stat *out,
+		struct cpu_cores *cores);
+int read_cpu_stat(struct probe_ctx *ctx, struct cpu_stat *out,
+		struct cpu_cores *cores);
+
 double cpu_usage(const struct cpu_stat *prev,
 		const struct cpu_stat *curr);
+// prev/curr counter arrays -> n utilisation values in percent.
+void cpu_usage_kernel(int n,
+		const long *restrict p_user, const long *restrict p_nice,
+		const long *restrict p_system, const long *restrict p_idle,
+		const long *restrict p_iowait, const long *restrict p_irq,
+		const long *restrict p_softirq, const long *restrict p_steal,
+		const long *restrict c_user, const long *restrict c_nice,
+		const long *restrict c_system, const long *restrict c_idle,
+		const long *restrict c_iowait, const long *restrict c_irq,
+		const long *restrict c_softirq, const long *restrict c_steal,
+		double *restrict out);
+// Slots not online in both snapshots come out as NaN.
+void cpu_cores_usage(const struct cpu_cores *prev,
+		const struct cpu_cores *curr, double *out);
 
 
 #endif
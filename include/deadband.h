@@ -0,0 +1,32 @@
+#ifndef DEADBAND_H
+#define DEADBAND_H
+
+#include "sample.h"
+
+// --deadband D: a sample is written only when one of the percent
+// metrics moved more than D points since the last written sample, when
+// a state changed, or when --heartbeat S passed without a write. The
+// sample that is written carries the count of those left out before it
+// (skipped), and since a state change is always written, the state of a
+// written sample holds until the next one.
+
+#define DEADBAND_HEARTBEAT_S 60.0
+#define DEADBAND_NVAL 11
+
+struct deadband {
+	double delta;
+	double heartbeat_s;
+	double mem_total_gb;
+	double swap_total_gb;
+	int have;		// a sample was written
+	double last_t;
+	double last[DEADBAND_NVAL];
+	unsigned long long skipped;	// since the last written sample
+};
+
+void deadband_init(struct deadband *d, double delta, double heartbeat_s,
+		const struct sample_meta *meta);
+// 1 if s goes out; if not it is counted in d->skipped.
+int deadband_pass(struct deadband *d, const struct sample *s, int state_change);
+
+#endif
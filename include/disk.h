@@ -0,0 +1,47 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include <stddef.h>
+#include "collector.h"
+
+#define DISK_MAX 128
+#define DISK_NAME 32
+#define DISK_BUF (32 * 1024)
+
+// /proc/diskstats counters, one array slot per device (loop and ram
+// devices are skipped). `whole` marks the leaf disks: a /sys/block
+// entry with nothing in its slaves/. Partitions and stacked devices
+// (dm-*, md*, whose I/O the leaves see again) are kept but not added to
+// the totals or the worst await/util.
+struct disk_counters {
+	int n;
+	char name[DISK_MAX][DISK_NAME];
+	unsigned char whole[DISK_MAX];
+	unsigned long long rd_ios[DISK_MAX];
+	unsigned long long rd_sect[DISK_MAX];
+	unsigned long long rd_ms[DISK_MAX];
+	unsigned long long wr_ios[DISK_MAX];
+	unsigned long long wr_sect[DISK_MAX];
+	unsigned long long wr_ms[DISK_MAX];
+	unsigned long long io_ms[DISK_MAX];	// time with I/O in flight
+};
+
+struct disk_rates {
+	double rd_iops;
+	double wr_iops;
+	double rd_mb_s;
+	double wr_mb_s;
+	double await_ms;	// worst device: ms per completed I/O
+	double util_pct;	// busiest device
+};
+
+// Fills names and counters; `whole` is left to the caller.
+int parse_diskstats(const char *buf, size_t len, struct disk_counters *out);
+// Pairs the snapshots by device name; a device missing from `prev` is
+// new and has no rate yet.
+void disk_rates(const struct disk_counters *prev, const struct disk_counters *curr,
+		double dt_s, struct disk_rates *out);
+
+extern const struct collector_ops disk_collector;
+
+#endif
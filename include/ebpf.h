@@ -0,0 +1,46 @@
+#ifndef EBPF_H
+#define EBPF_H
+
+#include <linux/types.h>
+#include "cpu.h"
+#include "ebpf_maps.h"
+
+// --bpf: CPU time from sched_switch instead of /proc/stat, plus what
+// /proc cannot give cheaply: run-queue latency, user page faults and
+// direct reclaim. The BPF program (source/bpf/sysprobe.bpf.c)
+// aggregates in a per-CPU map; a read is one map lookup for every CPU,
+// with no text to parse. Only built when the Makefile finds libbpf
+// (SYSPROBE_BPF); otherwise ebpf_open() says so and fails.
+//
+// The CPU counters come out as struct cpu_stat / cpu_cores in
+// microseconds (busy time as user, the rest as idle), so cpu_usage()
+// and everything after it work unchanged.
+
+struct ebpf_source {
+	void *skel;
+	int map_fd;
+	int ncpus;		// possible CPUs: values per lookup
+	struct ebpf_cpu *vals;	// ncpus, filled by one lookup
+	int faults_on;		// the page fault tracepoint exists here
+	unsigned long long open_ns;
+	// totals of the previous read, for the rates
+	unsigned long long runq_count;
+	unsigned long long runq_ns;
+	unsigned long long runq_slot[EBPF_RUNQ_SLOTS];
+	unsigned long long faults;
+	unsigned long long reclaim_ns;
+	double read_t;
+	// rates over the last read interval, NaN until there are two reads
+	double runq_avg_us;
+	double runq_p99_us;	// upper edge of the log2 bucket
+	double pgfault_s;
+	double reclaim_ms_s;	// direct reclaim time per second, all tasks
+};
+
+// -1 with a message: not built in, no permission, no BTF, ...
+int ebpf_open(struct ebpf_source *e);
+// Fills st and cores (may be NULL) and updates the rates at time t.
+int ebpf_read(struct ebpf_source *e, double t, struct cpu_stat *st, struct cpu_cores *cores);
+void ebpf_close(struct ebpf_source *e);
+
+#endif
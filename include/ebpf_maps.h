@@ -0,0 +1,26 @@
+#ifndef EBPF_MAPS_H
+#define EBPF_MAPS_H
+
+// Shared between source/bpf/sysprobe.bpf.c and the loader (ebpf.c):
+// the value of the per-CPU `cpu_acct` map. Every field is only written
+// by its own CPU, so the BPF side needs no atomics, and a single lookup
+// of key 0 returns all CPUs at once.
+
+#define EBPF_RUNQ_SLOTS 32	// log2 buckets of run-queue latency in microseconds
+#define EBPF_MAX_TASKS 16384	// tasks waiting to run, or in direct reclaim
+
+struct ebpf_cpu {
+	__u64 busy_ns;		// non-idle time up to last_ns
+	__u64 last_ns;		// last context switch, bpf_ktime_get_ns()
+	__u64 running;		// a task other than idle is on since last_ns
+	__u64 switches;
+	__u64 runq_count;	// wakeup or preemption -> on CPU
+	__u64 runq_ns;
+	__u64 runq_slot[EBPF_RUNQ_SLOTS];
+	__u64 faults;		// user page faults
+	__u64 reclaims;		// direct reclaim passes
+	__u64 reclaim_ns;
+	__u64 kswapd_wakeups;
+};
+
+#endif
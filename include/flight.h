@@ -0,0 +1,72 @@
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "output.h"
+#include "sample.h"
+
+// Flight recorder (--flight FILE): a fixed-size file, mmap'd shared,
+// holding the most recent samples as a circular array of slots. Writing
+// a sample is a memcpy into the page cache, so it costs no syscall and
+// outlives the process; the file is msync'ed every FLIGHT_SYNC_S so the
+// last stretch also survives the host. Restarting on the same file with
+// the same geometry appends to what is there.
+//
+// header, one page:
+//   struct flight_hdr
+// slot i at hdr_size + i * slot_size:
+//   struct flight_rec, then ncores doubles (core_pct)
+//
+// A slot's seq is 0 while it is being written and its 1-based record
+// number after, so a reader can tell a torn slot from a complete one.
+// The layout is the in-memory struct sample, so a file is only read by
+// a build with the same sample_size.
+
+#define FLIGHT_MAGIC "SPFLIGHT"
+#define FLIGHT_MAGIC_LEN 8
+#define FLIGHT_VERSION 1
+#define FLIGHT_DEFAULT_MB 64
+#define FLIGHT_SYNC_S 5.0
+
+struct flight_hdr {
+	char magic[FLIGHT_MAGIC_LEN];
+	uint32_t version;
+	uint32_t hdr_size;
+	uint32_t sample_size;		// sizeof(struct sample)
+	uint32_t slot_size;
+	uint32_t cores;
+	uint32_t pad;
+	uint64_t nslots;
+	_Atomic uint64_t seq;		// records written, ever
+	struct sample_meta meta;	// of the run that created the file
+};
+
+struct flight_rec {
+	_Atomic uint64_t seq;
+	double wall;			// CLOCK_REALTIME seconds
+	int state_change;
+	struct sample s;		// core_pct is stored after the struct
+};
+
+struct flight {
+	struct flight_hdr *hdr;
+	uint8_t *map;
+	size_t len;
+	double last_sync;
+};
+
+// size_mb of file, created or reused. -1 with a message on failure.
+int flight_open(struct flight *f, const char *path, unsigned size_mb,
+		const struct sample_meta *meta);
+// Writer side: one sample into the next slot.
+void flight_put(struct flight *f, const struct sample *s, int state_change);
+void flight_close(struct flight *f);
+
+// Re-emits the samples of the last `last_s` seconds (all of them when
+// <= 0) through `out`, oldest first, with ts in Unix time. Returns 0,
+// or -1 if the image is not a flight file this build can read.
+int flight_dump(const uint8_t *buf, size_t len, double last_s, struct out_buf *out);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef FORECAST_H
+#define FORECAST_H
+
+#include "sample.h"
+#include "state.h"
+
+// --predict S[/T]: where memory and CPU are heading, so a state can be
+// acted on before its threshold is crossed. Both forecasters weight the
+// past by exp(-age / T), so they follow the last T seconds at any
+// sampling rate (--adaptive included); each is a handful of decayed
+// sums updated in O(1) per sample, with no sample buffer.
+//
+// Memory: a weighted least-squares line through mem_avail. Its slope
+// gives mem_eta_s, the time until mem_avail falls to the danger ratio
+// of the mem_avail_pct rule. MEM_PREDICTED is the level (warn or
+// danger ratio) mem_avail is projected to reach within S seconds; a
+// predicted_state event fires when it changes.
+//
+// CPU: the z-score of each cpu reading against an exponentially
+// weighted mean and variance, exposed to the rules as cpu_z.
+
+#define FORECAST_FIT_S 60.0
+#define FORECAST_MIN_SAMPLES 5	// and T/4 seconds, before anything is reported
+#define FORECAST_WARN_PCT 10.0	// mem_avail_pct ratios without such a rule
+#define FORECAST_DANGER_PCT 5.0
+#define FORECAST_HYST 1.25	// a predicted level holds until its ETA is 25% past S
+#define FORECAST_Z_SD_MIN 1.0	// percent points: an idle CPU is not all outliers
+
+struct forecaster {
+	double horizon_s;
+	double fit_s;
+	double warn_pct;	// NaN: no such level
+	double danger_pct;
+	// decayed sums of w, w*u, w*u^2, w*y, w*u*y with u = t - last_t and
+	// y = mem_avail_kb - y0, shifted to the newest sample on every update
+	double w, wu, wuu, wy, wuy;
+	double y0;
+	double last_t;
+	double t0;
+	unsigned long n;
+	double cpu_mean;
+	double cpu_var;
+	sys_state level;
+};
+
+void forecast_init(struct forecaster *f, double horizon_s, double fit_s,
+		double warn_pct, double danger_pct);
+// Fills s->mem_slope_mb_s, mem_eta_s, cpu_z and mem_predicted from the
+// sample's cpu_pct and mem_avail_gb; returns 1 (and sets
+// s->mem_predicted_change) when the predicted level moved.
+int forecast_update(struct forecaster *f, struct sample *s);
+
+#endif
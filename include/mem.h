@@ -1,6 +1,9 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stddef.h>
+#include "probe.h"
+
 typedef struct {
 	long mem_total_kb;
 	long mem_avail_kb;
@@ -8,6 +11,15 @@ typedef struct {
 	long swap_free_kb;
 } mem_stat;
 
-int read_mem_stat(mem_stat *out);
+#define MEM_F_TOTAL      (1u << 0)
+#define MEM_F_AVAIL      (1u << 1)
+#define MEM_F_SWAP_TOTAL (1u << 2)
+#define MEM_F_SWAP_FREE  (1u << 3)
+#define MEM_F_ALL        (MEM_F_TOTAL | MEM_F_AVAIL | MEM_F_SWAP_TOTAL | MEM_F_SWAP_FREE)
+
+// Single pass over a /proc/meminfo image. Stops as soon as every field
+// in `want` has been seen; returns the mask of fields actually filled.
+unsigned parse_meminfo(const char *buf, size_t len, unsigned want, mem_stat *out);
+int read_mem_stat(struct probe_ctx *ctx, mem_stat *out);
 
 #endif
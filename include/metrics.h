@@ -0,0 +1,48 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "output.h"
+#include "sample.h"
+
+// --listen [HOST]:PORT: the latest sample in OpenMetrics text format
+// over HTTP, for Prometheus to scrape.
+//
+// The writer thread renders the whole response, headers included, once
+// per sample into whichever of two pages is not published, then
+// publishes it with an atomic index store. The server thread answers a
+// scrape with one write() of the published page: no lock against the
+// sampler or writer and no formatting per scrape. A page still being
+// sent to a slow scraper is never rendered over; that sample is skipped
+// for the endpoint and the next one is tried.
+
+#define METRICS_PAGE_SIZE (64 * 1024)
+#define METRICS_HDR_RESERVE 256	// the headers go in front of the body
+#define METRICS_IO_TIMEOUT_S 2	// per scrape, for recv and send
+
+struct metrics_page {
+	struct out_buf buf;	// fd -1: an overflow sets buf.error
+	size_t start;		// the response is buf.buf[start, buf.len)
+	_Atomic int readers;
+};
+
+struct metrics_server {
+	int fd;
+	pthread_t thread;
+	_Atomic int stop;
+	int started;
+	struct sample_meta meta;
+	struct metrics_page page[2];
+	_Atomic int current;	// published page, -1 before the first sample
+	unsigned long long skipped;	// renders skipped for a busy page
+};
+
+// Binds and starts the server thread. -1 with a message on failure.
+int metrics_open(struct metrics_server *m, const char *spec,
+		const struct sample_meta *meta);
+// Writer thread: renders s into the spare page and publishes it.
+void metrics_publish(struct metrics_server *m, const struct sample *s);
+void metrics_close(struct metrics_server *m);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stddef.h>
+#include "collector.h"
+
+#define NET_MAX 64
+#define NET_NAME 16	// IFNAMSIZ
+#define NET_BUF (16 * 1024)
+
+// Interface kinds, from /sys/class/net/<if>.
+#define NET_DEV		1	// backed by hardware: has device/
+#define NET_MEMBER	2	// enslaved to a bond or bridge: has master
+
+// /proc/net/dev counters, one array slot per interface, loopback
+// skipped. A packet crosses several interfaces on a container host (veth,
+// bridge, NIC; bond and its slaves), so only `counted` ones go into the
+// totals: the NET_DEV interfaces, or in a namespace with none of those
+// (inside a container) the ones that are not a bond or bridge member.
+struct net_counters {
+	int n;
+	char name[NET_MAX][NET_NAME];
+	unsigned char kind[NET_MAX];
+	unsigned char counted[NET_MAX];
+	unsigned long long rx_bytes[NET_MAX];
+	unsigned long long rx_packets[NET_MAX];
+	unsigned long long rx_errs[NET_MAX];	// errs + drop
+	unsigned long long tx_bytes[NET_MAX];
+	unsigned long long tx_packets[NET_MAX];
+	unsigned long long tx_errs[NET_MAX];	// errs + drop
+};
+
+struct net_rates {
+	double rx_mbit_s;
+	double tx_mbit_s;
+	double rx_pps;
+	double tx_pps;
+	double errs_s;		// errors and drops, both directions
+};
+
+// Fills names and counters; `kind` and `counted` are left to the caller.
+int parse_net_dev(const char *buf, size_t len, struct net_counters *out);
+// Pairs the snapshots by interface name; an interface missing from
+// `prev` is new and has no rate yet.
+void net_rates(const struct net_counters *prev, const struct net_counters *curr,
+		double dt_s, struct net_rates *out);
+
+extern const struct collector_ops net_collector;
+
+#endif
@@ -1,11 +1,88 @@
 #ifndef OUTPUT_H
 #define OUTPUT_H
 
-void print_json(
-    double t,
-    double cpu,
-    double mem_used_gb,
-    double mem_avail_gb
-);
+#include <stddef.h>
+#include "cgroup.h"
+#include "sample.h"
+#include "sketch.h"
+#include "trace.h"
+#include "procs.h"
+#include "selfstat.h"
+
+#define OUT_BUF_SIZE (64 * 1024)
+
+enum out_format {
+	FORMAT_JSONL = 0,
+	FORMAT_BIN,		// see trace.h
+};
+
+enum flush_policy {
+	FLUSH_RECORD = 0,	// after every record
+	FLUSH_COUNT,		// every N records
+	FLUSH_TIME,		// when T ms passed since the last flush
+	FLUSH_FULL,		// only when the buffer fills up
+};
+
+// JSONL writer: records are serialized straight into a preallocated
+// buffer and handed to write(2) according to the flush policy.
+struct out_buf {
+	int fd;
+	enum out_format format;
+	struct trace_enc trace;
+	char *buf;
+	size_t cap;
+	size_t len;
+	enum flush_policy policy;
+	unsigned every_n;
+	unsigned pending;
+	double every_ms;
+	double last_flush_ms;
+	unsigned long long bytes_written;
+	int error;
+};
+
+int out_init(struct out_buf *o, int fd, size_t cap, enum out_format format,
+		enum flush_policy policy, unsigned every_n, double every_ms);
+int out_flush(struct out_buf *o);
+void out_close(struct out_buf *o);
+
+// "record" | "full" | "<N>" | "<T>ms"
+int out_parse_policy(const char *s, enum flush_policy *policy,
+		unsigned *every_n, double *every_ms);
+
+void out_putc(struct out_buf *o, char c);
+void out_write(struct out_buf *o, const char *s, size_t n);
+void out_puts(struct out_buf *o, const char *s);
+void out_u64(struct out_buf *o, unsigned long long v);
+void out_long(struct out_buf *o, long v);
+// fixed-point decimal with `prec` (0..9) digits; NaN/inf become null
+void out_fixed(struct out_buf *o, double v, int prec);
+// quoted and escaped
+void out_json_string(struct out_buf *o, const char *s);
+// ends a record: newline (JSONL only) plus whatever the flush policy
+// asks for
+void out_end_record(struct out_buf *o);
+// flushes when a FLUSH_TIME deadline passed with no record to trigger it
+void out_poll(struct out_buf *o);
+
+void emit_meta(struct out_buf *o, const struct sample_meta *m);
+void emit_sample(struct out_buf *o, const struct sample *s);
+void emit_state_change(struct out_buf *o, const struct sample *s);
+// --predict: s->mem_predicted changed on this sample
+void emit_predicted_state(struct out_buf *o, const struct sample *s);
+// quantiles only; missed/dropped are left at zero for the caller
+void sample_summary_fill(struct sample_summary *m, double t,
+		const struct qsketch *cpu, const struct qsketch *mem_used);
+// type is "summary" or "end"
+void emit_summary(struct out_buf *o, const char *type,
+		const struct sample_summary *m);
+void emit_top(struct out_buf *o, const struct proc_top *top);
+const char *top_reason_str(enum top_reason r);
+void emit_cgroups(struct out_buf *o, const struct cgroup_report *rep);
+void emit_self(struct out_buf *o, const struct self_stat *m);
+void emit_block(struct out_buf *o, const struct trace_block *b);
+// Closes the blocks of --index: how many the trace has, where the last
+// one ends, and whether indexing stopped before the trace did.
+void emit_index(struct out_buf *o, size_t nblocks, int64_t t_last_us, int truncated);
 
 #endif
@@ -0,0 +1,39 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Scanning helpers shared by the /proc parsers. They work on a raw
+// [p, end) byte range, never allocate and never touch the locale.
+
+static inline const char *parse_skip_blank(const char *p, const char *end){
+	while(p < end && (*p == ' ' || *p == '\t')) p++;
+	return p;
+}
+
+static inline const char *parse_next_line(const char *p, const char *end){
+	const char *nl = memchr(p, '\n', (size_t)(end - p));
+	return nl ? nl + 1 : end;
+}
+
+// Non-negative decimal after optional blanks. NULL if there is no digit.
+static inline const char *parse_long(const char *p, const char *end, long *out){
+	p = parse_skip_blank(p, end);
+	if(p >= end || (unsigned)(*p - '0') > 9) return NULL;
+	long v = 0;
+	while(p < end && (unsigned)(*p - '0') <= 9)
+		v = v * 10 + (*p++ - '0');
+	*out = v;
+	return p;
+}
+
+// First 8 bytes of a key as one integer, so a key compare is a single
+// 64-bit compare. The caller guarantees 8 readable bytes.
+static inline uint64_t parse_key8(const char *p){
+	uint64_t k;
+	memcpy(&k, p, sizeof(k));
+	return k;
+}
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "arena.h"
+
+// --cpu, --nice, --sched and --numa: where the probe runs and at what
+// priority, so it stays off the CPUs and sockets of the workload it is
+// watching.
+//
+// Everything but a realtime policy is applied by placement_apply() on
+// the main thread before the writer and metrics threads exist, which
+// inherit it. --numa binds the arena (arena.h) to the node of the probe's
+// CPUs before any of its pages are touched, so the per-core arrays,
+// rings and buffers are node-local, and without --cpu keeps the probe on
+// the CPUs of the node it started on. SCHED_FIFO/RR is only for the
+// sampler, which takes the timestamps and sleeps between ticks; the
+// writer, blocked on stdout, stays where it was.
+
+enum probe_sched {
+	PROBE_SCHED_DEFAULT = 0,	// leave the policy alone
+	PROBE_SCHED_OTHER,
+	PROBE_SCHED_BATCH,
+	PROBE_SCHED_IDLE,
+	PROBE_SCHED_FIFO,
+	PROBE_SCHED_RR,
+};
+
+#define PLACEMENT_RT_PRIO 10	// fifo/rr without :PRIO
+
+// "0-3,8,10-11": 0, -1 if malformed or past CPU_SETSIZE
+int placement_parse_cpus(const char *list);
+// idle, batch, other, fifo[:PRIO] or rr[:PRIO]
+int placement_parse_sched(const char *spec, enum probe_sched *policy, int *prio);
+
+struct probe_config;
+
+// -1 with a message if any of it is refused.
+int placement_apply(const struct probe_config *cfg, struct arena *a);
+// On the sampler thread, once the other threads are started.
+int placement_apply_rt(const struct probe_config *cfg);
+
+#endif
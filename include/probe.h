@@ -0,0 +1,36 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+#include <stddef.h>
+
+#define PROBE_MEMINFO_BUF 8192
+// aggregate line plus one cpuN line per core; the tail of /proc/stat
+// (intr, ctxt, ...) is allowed to be cut off
+#define PROBE_STAT_LINE 160
+
+// A /proc file kept open across ticks and re-read with a single pread()
+// into a buffer owned by the struct, or by the caller.
+struct proc_file {
+	const char *path;
+	int fd;
+	char *buf;
+	size_t cap;
+	size_t len;
+	int own_buf;
+};
+
+int proc_file_open(struct proc_file *pf, const char *path, size_t cap);
+// Reads into buf[cap], which outlives the file and is not freed on close.
+int proc_file_open_buf(struct proc_file *pf, const char *path, char *buf, size_t cap);
+int proc_file_read(struct proc_file *pf);
+void proc_file_close(struct proc_file *pf);
+
+struct probe_ctx {
+	struct proc_file stat;
+	struct proc_file meminfo;
+};
+
+int probe_open(struct probe_ctx *ctx, int cores);
+void probe_close(struct probe_ctx *ctx);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef PROCS_H
+#define PROCS_H
+
+#include "probe.h"
+
+#define PROCS_TOP_MAX 10
+#define PROCS_COMM 16	// TASK_COMM_LEN
+#define PROCS_TOP_DEFAULT 5
+#define PROCS_RESCAN_DEFAULT 10
+
+struct proc_top_entry {
+	int pid;
+	char comm[PROCS_COMM];
+	double cpu_pct;		// percent of one core
+	long rss_kb;
+};
+
+enum top_reason {
+	TOP_STATE_CHANGE = 0,
+	TOP_SUMMARY,
+};
+
+struct proc_top {
+	double t;
+	enum top_reason reason;
+	int n_cpu;
+	int n_rss;
+	struct proc_top_entry cpu[PROCS_TOP_MAX];
+	struct proc_top_entry rss[PROCS_TOP_MAX];
+};
+
+struct proc_entry {
+	int pid;			// 0: empty slot
+	unsigned gen;			// last full scan that saw the pid
+	unsigned long long start;	// starttime, tells a reused pid apart
+	unsigned long long ticks;	// utime + stime at read_t
+	double read_t;
+	double cpu_pct;			// between the last two reads
+	long rss_kb;
+	char comm[PROCS_COMM];
+};
+
+// A hot pid keeps its stat/statm open and is re-read every tick. The
+// read buffers belong to the slot, not to the pid: allocated once with
+// the table, so churn in the top set allocates nothing.
+struct proc_hot {
+	int pid;
+	char stat_path[32];
+	char statm_path[32];
+	struct proc_file stat;
+	struct proc_file statm;
+	char *stat_buf;
+	char *statm_buf;
+};
+
+// Per-process collector. Every pid seen lives in an open-addressing
+// table keyed by pid. Each full scan of /proc bumps `gen`; entries a
+// scan did not see are evicted. Between full scans only the hot set
+// (the current top by CPU with some margin, plus the top by RSS) is
+// re-read, so the cost of a tick does not grow with the number of
+// processes on the host.
+struct proc_table {
+	struct proc_entry *slots;
+	unsigned cap;			// power of two
+	unsigned count;
+	unsigned gen;
+	int top_n;
+	int rescan;			// full scan every `rescan` ticks
+	unsigned long tick;
+	struct proc_hot *hot;
+	char *hot_bufs;
+	int nhot;
+	int hot_cap;
+	double hz;
+	long page_kb;
+};
+
+int procs_init(struct proc_table *pt, int top_n, int rescan);
+void procs_free(struct proc_table *pt);
+// Updates the table at time t (seconds, monotonic). Returns -1 only if
+// a full scan could not open /proc.
+int procs_sample(struct proc_table *pt, double t);
+void procs_top(const struct proc_table *pt, struct proc_top *top);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef PSI_H
+#define PSI_H
+
+#include <poll.h>
+#include "probe.h"
+
+// Pressure Stall Information: /proc/pressure/{cpu,memory,io}, or the
+// *.pressure files of a cgroup v2 directory.
+
+enum psi_res {
+	PSI_CPU = 0,
+	PSI_MEM,
+	PSI_IO,
+	PSI_NR
+};
+
+struct psi_line {
+	double avg10;
+	double avg60;
+	double avg300;
+	unsigned long long total;	// stall time in us
+};
+
+struct psi_stat {
+	struct psi_line some;
+	struct psi_line full;
+	int have_full;
+};
+
+// 0 if the "some" line was found
+int parse_psi(const char *buf, size_t len, struct psi_stat *out);
+
+#define PSI_MAX_TRIGGERS 8
+#define PSI_BUF 256
+
+// Wake up when `stall_us` of stall accumulate within `window_us`.
+// The kernel accepts windows of 500ms..10s; unprivileged users only
+// whole multiples of 2s.
+struct psi_trigger {
+	enum psi_res res;
+	int full;
+	unsigned stall_us;
+	unsigned window_us;
+};
+
+// "memory:some:150/1000" (stall and window in ms)
+int psi_parse_trigger(const char *s, struct psi_trigger *t);
+
+struct psi_source {
+	char path[PSI_NR][PSI_BUF];
+	struct proc_file file[PSI_NR];
+	int have[PSI_NR];
+	struct psi_stat prev[PSI_NR];
+	double prev_t;
+	int primed;
+	// share of the last interval spent stalled, from the totals; NaN
+	// for a resource that is not available
+	double some_pct[PSI_NR];
+	double full_pct[PSI_NR];
+	// armed trigger fds, handed to the ticker's poll
+	struct pollfd trig[PSI_MAX_TRIGGERS];
+	int ntrig;
+};
+
+// cgroup_dir NULL reads the system-wide files. Returns the number of
+// resources found; a missing PSI (CONFIG_PSI=n, psi=0) is not an error.
+int psi_open(struct psi_source *ps, const char *cgroup_dir);
+int psi_add_trigger(struct psi_source *ps, const struct psi_trigger *t);
+void psi_read(struct psi_source *ps, double t);
+// Number of triggers that fired since the last poll; clears them.
+int psi_fired(struct psi_source *ps);
+void psi_close(struct psi_source *ps);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef PUSH_H
+#define PUSH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "sample.h"
+
+// --push: samples streamed to sysprobe-agg as datagrams over UDP or a
+// Unix datagram socket. Samples are packed into frames and a batch of
+// frames goes out with one sendmmsg().
+//
+// frame, integers little-endian / LEB128 varints:
+//   char   magic[4]	"SPPU"
+//   u8     version
+//   u8     host_len, host bytes (gethostname)
+//   varint seq		frame number, gaps are frames lost on the way
+//   u8     n, then n entries:
+//     varint t_ms	sender's sample time (ms since its start)
+//     u16    cpu, cpu_avg, mem_used_pct	(hundredths of a percent)
+//     u8     states	bits 0-1 CPU, 2-3 MEM, 4-5 IO, 6-7 NET
+
+#define PUSH_MAGIC "SPPU"
+#define PUSH_MAGIC_LEN 4
+#define PUSH_VERSION 1
+#define PUSH_HOST_MAX 64
+#define PUSH_DGRAM 1400		// fits a 1500 MTU with IP/UDP headers
+#define PUSH_BATCH 16		// frames per sendmmsg
+#define PUSH_ENTRY_MAX 16	// bytes per entry at most
+#define PUSH_FRAME_ENTRIES 64
+#define PUSH_FLUSH_S 1.0	// a partial batch waits at most this long
+
+struct push_entry {
+	double t;
+	double cpu_pct;
+	double cpu_avg;
+	double mem_used_pct;
+	sys_state state[4];	// cpu, mem, io, net
+};
+
+struct push_frame {
+	char host[PUSH_HOST_MAX];
+	uint64_t seq;
+	int n;
+	struct push_entry e[PUSH_FRAME_ENTRIES];
+};
+
+// 0, or -1 if buf is not a frame
+int push_decode(const uint8_t *buf, size_t len, struct push_frame *f);
+
+// "udp:HOST:PORT" or "unix:PATH" -> address. bind_side picks the
+// passive (receiver) lookup for udp.
+int push_parse_addr(const char *spec, int bind_side, struct sockaddr_storage *addr,
+		socklen_t *len);
+
+struct pusher {
+	int fd;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	char host[PUSH_HOST_MAX];
+	size_t host_len;
+	uint64_t seq;
+	uint8_t frame[PUSH_BATCH][PUSH_DGRAM];
+	size_t len[PUSH_BATCH];
+	int nent[PUSH_BATCH];	// entries in each frame
+	size_t count_at[PUSH_BATCH];	// offset of the frame's u8 n
+	int nframes;		// frames in the batch, the last one open
+	double first_mono;	// when the oldest unsent sample was added
+	unsigned long long sent;
+	unsigned long long errors;	// frames sendmmsg did not take
+};
+
+int pusher_open(struct pusher *p, const char *spec);
+void pusher_add(struct pusher *p, const struct sample *s);
+// Sends a partial batch once its oldest sample is PUSH_FLUSH_S old.
+void pusher_poll(struct pusher *p);
+void pusher_flush(struct pusher *p);
+void pusher_close(struct pusher *p);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include "output.h"
+
+struct probe_config;
+
+// Recorded /proc snapshots, written with --capture DIR and fed back
+// with --replay DIR. A capture directory holds one file per source,
+// DIR/stat and DIR/meminfo, each a sequence of frames
+//
+//   "@<t> <len>\n" followed by len raw bytes of the file
+//
+// with t in seconds since the start of the capture. Both files get a
+// frame on every tick, so frame n of each belongs to the same sample;
+// --capture therefore refuses a cpu or mem --period other than the tick.
+
+enum snap_src {
+	SNAP_STAT = 0,
+	SNAP_MEMINFO,
+	SNAP_NR
+};
+
+struct snap_frame {
+	const char *buf;
+	size_t len;
+};
+
+struct snap_writer {
+	FILE *f[SNAP_NR];
+};
+
+int snap_create(struct snap_writer *w, const char *dir);
+int snap_write(struct snap_writer *w, enum snap_src src, double t,
+		const char *buf, size_t len);
+void snap_close(struct snap_writer *w);
+
+struct snap_reader {
+	const char *map[SNAP_NR];
+	size_t len[SNAP_NR];
+	size_t off[SNAP_NR];
+	unsigned long long frames;
+};
+
+int snap_open(struct snap_reader *r, const char *dir);
+// Next frame of every source: 0, 1 at the end of the capture, -1 on a
+// malformed frame.
+int snap_next(struct snap_reader *r, double *t, struct snap_frame frame[SNAP_NR]);
+void snap_free(struct snap_reader *r);
+// Sampling period the capture was taken at: the median gap between its
+// first frames, so a missed deadline or PSI wakeup does not skew it.
+// 0 with fewer than two frames.
+double snap_interval(const struct snap_reader *r);
+
+// cpuN lines in a /proc/stat image
+int snap_stat_cores(const struct snap_frame *f);
+
+// --replay of a binary trace: every sample goes through the rules of
+// `cfg` again and is re-emitted with the states they give; the other
+// records pass through as recorded. Returns 0, or -1 on a bad trace.
+int replay_trace(const char *path, const struct probe_config *cfg, struct out_buf *out);
+
+// "replayed N samples in S s (R samples/s)" on stderr
+void replay_report(unsigned long long samples, double elapsed_s);
+
+#endif
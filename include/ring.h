@@ -0,0 +1,72 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include "sample.h"
+#include "cgroup.h"
+#include "procs.h"
+#include "selfstat.h"
+
+enum rec_kind {
+	REC_SAMPLE = 0,
+	REC_SUMMARY,
+	REC_END,
+	REC_TOP,
+	REC_SELF,
+	REC_CGROUP,
+};
+
+struct ring_rec {
+	enum rec_kind kind;
+	int state_change;	// REC_SAMPLE: emit a state_change event first
+	struct sample s;	// s.core_pct points into ring-owned storage
+	union {
+		struct sample_summary sum;	// REC_SUMMARY, REC_END
+		struct proc_top top;		// REC_TOP
+		struct self_stat self;		// REC_SELF
+		struct cgroup_report cg;	// REC_CGROUP
+	};
+};
+
+#define RING_CACHELINE 64
+
+// Lock-free single-producer/single-consumer ring of sample records.
+// The producer (sampler) never blocks: when the ring is full the record
+// is dropped and counted. The consumer (writer) sleeps on a futex when
+// the ring is empty; the producer only pays for the wake syscall while
+// the consumer is actually asleep.
+struct spsc_ring {
+	struct ring_rec *slots;
+	double *core_store;	// cores doubles per slot
+	unsigned cap;		// power of two
+	int cores;
+
+	_Alignas(RING_CACHELINE) _Atomic unsigned long head;	// producer
+	_Atomic uint32_t pub_seq;
+	_Atomic unsigned long long dropped;
+
+	_Alignas(RING_CACHELINE) _Atomic unsigned long tail;	// consumer
+	_Atomic int waiting;
+};
+
+// cap is rounded up to a power of two
+int ring_init(struct spsc_ring *r, unsigned cap, int cores);
+void ring_free(struct spsc_ring *r);
+
+// Producer. Copies rec (and its per-core array) into the next slot;
+// returns -1 and bumps the drop counter when the ring is full.
+int ring_push(struct spsc_ring *r, const struct ring_rec *rec);
+// Like ring_push, but a full ring is not counted: for a caller that
+// waits and retries until the record is in.
+int ring_try_push(struct spsc_ring *r, const struct ring_rec *rec);
+unsigned long long ring_dropped(const struct spsc_ring *r);
+
+// Consumer. ring_peek returns the oldest record or NULL; the slot stays
+// valid until ring_release.
+struct ring_rec *ring_peek(struct spsc_ring *r);
+void ring_release(struct spsc_ring *r);
+// Blocks until a record may be available or timeout_ms passed.
+void ring_wait(struct spsc_ring *r, int timeout_ms);
+
+#endif
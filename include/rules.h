@@ -0,0 +1,87 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include "sample.h"
+#include "sketch.h"
+#include "state.h"
+#include "window.h"
+
+// Threshold rules deciding CPU_STATE, MEM_STATE, IO_STATE and
+// NET_STATE. A rule, on the command line (--rule) or one per line of a
+// rules file (--rules, '#' starts a comment):
+//
+//   METRIC[:STAT[/N]] [below] warn=X danger=Y [hyst=H] [dwell=S] [state=G]
+//
+//   METRIC  see rules_usage(); each has a default state group G
+//   STAT    last (default), avg, min, max or p95 over the last N readings
+//           of the metric's collector (N defaults to --window)
+//   below   trouble is a *low* value (e.g. mem_avail_pct)
+//   hyst    a level is only left once the value is H back past its
+//           threshold
+//   dwell   a new level must hold S seconds before it is reported
+//
+// A group's state is its worst rule. Any rule given replaces the whole
+// built-in set.
+
+enum state_group {
+	GROUP_CPU = 0,
+	GROUP_MEM,
+	GROUP_IO,
+	GROUP_NET,
+	GROUP_NR
+};
+
+enum rule_stat {
+	STAT_LAST = 0,
+	STAT_AVG,
+	STAT_MIN,
+	STAT_MAX,
+	STAT_P95,
+};
+
+struct rule {
+	int metric;
+	enum rule_stat stat;
+	enum state_group group;
+	// thresholds pre-multiplied by sign (-1 for below), so every rule
+	// tests "x > threshold"; an unset danger is +inf
+	double sign;
+	double warn;
+	double danger;
+	double hyst;
+	double dwell_s;
+	cpu_window *win;	// avg/min/max/p95
+	struct qsketch *q;	// p95: the window's values, with removal
+	sys_state level;
+	sys_state pending;
+	double pending_since;
+	double x;		// last statistic, sign applied
+};
+
+struct rule_engine {
+	struct rule *rules;	// flat, evaluated in order every tick
+	int n;
+	int cap;
+};
+
+void rules_init(struct rule_engine *e);
+void rules_free(struct rule_engine *e);
+// Compiles one rule; -1 with a message on stderr if it does not parse.
+int rules_add(struct rule_engine *e, const char *spec, int window);
+int rules_load(struct rule_engine *e, const char *path, int window);
+// The built-in set: what state.c used to hardcode.
+int rules_defaults(struct rule_engine *e, int window);
+// Rules from `file` (may be NULL) and then `specs`; the built-in set
+// when there are neither.
+int rules_compile(struct rule_engine *e, const char *file, const char *const *specs,
+		int n, int window);
+
+void rules_eval(struct rule_engine *e, const struct sample *s, sys_state out[GROUP_NR]);
+// Warn and danger ratio of the first "mem_avail_pct below" rule, for
+// --predict; danger is NaN if unset. -1 if there is no such rule.
+int rules_mem_avail_levels(const struct rule_engine *e, double *warn_pct, double *danger_pct);
+// True when any rule's statistic is past `frac` of its warn threshold.
+int rules_near_warn(const struct rule_engine *e, double frac);
+void rules_usage(void);
+
+#endif
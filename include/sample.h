@@ -1,11 +1,110 @@
 #ifndef SAMPLE_H
 #define SAMPLE_H
 
+#include "state.h"
+
+// Run-constant fields of the meta record / trace header.
+struct sample_meta {
+	double interval_s;	// adaptive: the slow rate
+	double fast_interval_s;	// adaptive fast rate, 0 for a fixed rate
+	int cores;
+	int window;
+	double max_freq_ghz;
+	double mem_total_gb;
+	double mem_avail_gb;
+	double swap_total_gb;
+	double swap_free_gb;
+	double heartbeat_s;	// --deadband: longest gap between samples, 0 = none
+	// arena.h: its fixed size, the part startup took, and whether it is
+	// mlock'ed; 0 when the run had no arena
+	unsigned arena_kb;
+	unsigned arena_startup_kb;
+	int arena_locked;
+	double predict_s;	// --predict horizon, 0 = off
+};
+
+// Sources behind the sample fields. A collector on a longer --period
+// emits its last values on the ticks in between; sample.fresh has the
+// bits of those that read on this one.
+enum sample_src {
+	SRC_CPU = 1 << 0,	// cpu*, cores, --bpf fields, cpu_z
+	SRC_MEM = 1 << 1,	// mem*, swap*, mem_slope/eta
+	SRC_PSI = 1 << 2,
+	SRC_DISK = 1 << 3,
+	SRC_NET = 1 << 4,
+	SRC_CGROUP = 1 << 5,
+};
+#define SRC_ALL 0x3fu
+
 struct sample {
 	double t;
+	double interval;	// seconds since the previous sample
 	double cpu_pct;
+	double cpu_avg;
+	double cpu_min;
+	double cpu_max;
+	double cpu_ewma;
+	double cpu_hot_avg;
 	double mem_used_gb;
 	double mem_avail_gb;
+	double swap_used_gb;
+	double swap_avail_gb;
+	sys_state cpu_state;
+	sys_state mem_state;
+	sys_state io_state;
+	sys_state net_state;
+	// PSI stall share of the last interval in percent, NaN if unavailable
+	double psi_cpu_some;
+	double psi_mem_some;
+	double psi_mem_full;
+	double psi_io_some;
+	double psi_io_full;
+	int psi_wakeup;		// taken early because a PSI trigger fired
+	unsigned fresh;		// SRC_* read on this tick
+	// whole disks: summed rates, worst await and busiest device
+	double disk_rd_iops;
+	double disk_wr_iops;
+	double disk_rd_mb_s;
+	double disk_wr_mb_s;
+	double disk_await_ms;
+	double disk_util_pct;
+	// physical interfaces (net.h: counted)
+	double net_rx_mbit_s;
+	double net_tx_mbit_s;
+	double net_rx_pps;
+	double net_tx_pps;
+	double net_errs_s;
+	// --cgroup-root: the highest share of its memory.max / cpu.max
+	// quota among the cgroups, NaN if none has that limit
+	double cgroup_mem_pct;
+	double cgroup_cpu_pct;
+	// --bpf, NaN without it: scheduler and mm tracepoints
+	double runq_avg_us;	// wakeup or preemption to on-CPU
+	double runq_p99_us;
+	double pgfault_s;	// user page faults
+	double reclaim_ms_s;	// time in direct reclaim per second
+	// --predict (forecast.h), NaN without it or while the fit warms up
+	double mem_slope_mb_s;	// trend of mem_avail
+	double mem_eta_s;	// until mem_avail is at the danger ratio, NaN if not falling
+	double cpu_z;		// cpu against its recent mean, in standard deviations
+	sys_state mem_predicted;	// level mem_avail is heading for within S
+	int mem_predicted_change;	// emit a predicted_state event first
+	unsigned long long missed;	// deadlines skipped so far
+	unsigned long long dropped;	// records lost to a full writer ring
+	unsigned long long skipped;	// --deadband: samples left out before this one
+	int ncores;
+	const double *core_pct;	// by CPU id, NaN while offline
+};
+
+#define SUMMARY_NQ 3	// p50, p95, p99
+
+struct sample_summary {
+	double t;
+	unsigned long long samples;
+	unsigned long long missed;
+	unsigned long long dropped;
+	double cpu_q[SUMMARY_NQ];
+	double mem_used_q[SUMMARY_NQ];
 };
 
 #endif
@@ -0,0 +1,121 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <time.h>
+#include "cgroup.h"
+#include "collector.h"
+#include "ebpf.h"
+#include "forecast.h"
+#include "config.h"
+#include "probe.h"
+#include "procs.h"
+#include "psi.h"
+#include "replay.h"
+#include "rules.h"
+#include "selfstat.h"
+#include "cpu.h"
+#include "mem.h"
+#include "sample.h"
+#include "sketch.h"
+#include "state.h"
+#include "window.h"
+
+// Everything the sampling side owns: /proc readers, counter snapshots,
+// windows, sketches and the previous state for change detection. The
+// sources are collectors (collector.h), each run at its own period.
+struct sampler {
+	const struct probe_config *cfg;
+	struct cpu_capacity cap;
+	struct probe_ctx probe;
+	struct ebpf_source ebpf;	// --bpf: cpu reads come from here
+	int bpf_on;
+
+	struct cpu_stat prev_cpu;
+	struct cpu_stat curr_cpu;
+	struct cpu_cores prev_cores;
+	struct cpu_cores curr_cores;
+	double *core_pct;
+	double cpu_pct;
+	double cpu_hot_avg;
+	int ncores;
+	cpu_window cpu_win;
+	cpu_window *core_win;
+	mem_stat mem;
+	struct proc_table procs;
+	struct psi_source psi;
+	struct cgroup_set *cgroups;	// --cgroup-root, owned by its collector
+
+	struct collector coll[COLLECTOR_MAX];
+	int ncoll;
+	struct timing_wheel wheel;
+	double tick_s;		// current sampling period
+
+	struct rule_engine rules;
+	struct forecaster forecast;	// --predict
+	int predict_on;
+
+	// whole-run sketches feed the end record, period sketches the
+	// summary records; both are fixed-size
+	struct qsketch cpu_run, mem_run, cpu_period, mem_period;
+	double last_summary;
+
+	// --replay DIR: cpu and mem parse the current frame instead of /proc
+	struct snap_reader replay;
+	struct snap_frame frame[SNAP_NR];
+	double replay_t0;
+	int replaying;
+	struct snap_writer capture;
+	int capturing;
+
+	// --self: own cost, collector sample() latencies live in coll[]
+	struct self_probe self;
+	int self_on;
+	double last_self;
+
+	sys_state prev_cpu_state;
+	sys_state prev_mem_state;
+	sys_state prev_io_state;
+	sys_state prev_net_state;
+	int have_prev_state;
+
+	// adaptive rate
+	int fast;
+	double calm_since;
+	double prev_t;
+
+	struct timespec start;
+};
+
+int sampler_init(struct sampler *sp, const struct probe_config *cfg);
+// For config validation: is there a collector with this name?
+int sampler_collector_known(const char *name);
+void sampler_free(struct sampler *sp);
+void sampler_meta(const struct sampler *sp, struct sample_meta *m);
+double sampler_now(const struct sampler *sp);
+
+// Runs the collectors due on this tick (all of them on a PSI wakeup)
+// and fills `s` with the latest value of every source (s->core_pct
+// points into the sampler). *state_change is set when a state moved.
+// Returns 1 once a replay is over.
+int sampler_sample(struct sampler *sp, struct sample *s, int *state_change);
+
+// Period to wait before the next sample. Fixed unless cfg->adaptive:
+// then the fast rate from the first non-OK (or predicted non-OK) state,
+// near-WARN reading, state change or PSI wakeup, and the slow rate again
+// only after cfg->calm_s without any of those.
+double sampler_interval(struct sampler *sp, const struct sample *s, int state_change);
+
+// Current top processes, for the writer to emit next to an event or
+// summary at time t.
+void sampler_top(const struct sampler *sp, double t, enum top_reason reason,
+		struct proc_top *top);
+
+// Periodic summary: fills `m` and starts a new period when one is due.
+int sampler_summary_due(struct sampler *sp, double t, struct sample_summary *m);
+// Self record: like sampler_summary_due, with the writer-side fields
+// (writer_cpu_s, bytes_written) left for the writer.
+int sampler_self_due(struct sampler *sp, double t, unsigned long long missed,
+		struct self_stat *m);
+void sampler_end(struct sampler *sp, double t, struct sample_summary *m);
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef SELFSTAT_H
+#define SELFSTAT_H
+
+#include <stdatomic.h>
+#include "probe.h"
+
+// sysprobe's own cost, for the periodic "self" record (--self S).
+
+// Log2-bucketed latency histogram: bucket b counts values in
+// [2^b, 2^(b+1)) ns, the last one everything above. Updates are
+// relaxed atomic adds, so any thread may record or take a snapshot
+// without a lock.
+#define LAT_BUCKETS 32
+
+struct lat_hist {
+	_Atomic unsigned long long bucket[LAT_BUCKETS];
+	_Atomic unsigned long long max_ns;
+};
+
+// Quantiles are the upper bound of their bucket, capped at the maximum.
+struct lat_summary {
+	unsigned long long n;
+	double p50_us;
+	double p99_us;
+	double max_us;
+};
+
+void lat_hist_add(struct lat_hist *h, long long ns);
+// Summarizes and resets: every record covers one period.
+void lat_hist_take(struct lat_hist *h, struct lat_summary *out);
+
+#define SELF_NAME 16
+
+struct self_coll {
+	char name[SELF_NAME];
+	struct lat_summary lat;		// time spent in ops->sample()
+};
+
+#define SELF_COLL_MAX 16
+
+struct self_stat {
+	double t;
+	double cpu_pct;			// whole process over the period, % of one core
+	double utime_s;			// whole process since start
+	double stime_s;
+	double sampler_cpu_s;		// CPU time of the sampler thread
+	double writer_cpu_s;		// filled in by the writer thread
+	long rss_kb;
+	long maxrss_kb;
+	unsigned long long bytes_written;	// filled in by the writer thread
+	unsigned long long ticks;	// since start
+	unsigned long long missed;
+	struct lat_summary late;	// wakeup past the tick deadline
+	struct lat_summary loop;	// wakeup to records pushed
+	int ncoll;
+	struct self_coll coll[SELF_COLL_MAX];
+};
+
+struct self_probe {
+	struct proc_file statm;
+	long page_kb;
+	double prev_t;
+	double prev_cpu_s;
+	unsigned long long ticks;
+	struct lat_hist late;
+	struct lat_hist loop;
+};
+
+int self_open(struct self_probe *p);
+void self_close(struct self_probe *p);
+// One pass of the main loop: how late its wakeup was (-1: woken by an
+// fd, not a deadline) and how long its work took.
+void self_tick(struct self_probe *p, long long late_ns, long long loop_ns);
+// Process-wide part of the record; collectors are added by the caller.
+void self_fill(struct self_probe *p, double t, struct self_stat *out);
+
+// CPU time of the calling thread in seconds.
+double self_thread_cpu_s(void);
+
+#endif
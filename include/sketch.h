@@ -0,0 +1,41 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+#include <stdint.h>
+
+#define SKETCH_BINS 2048
+#define SKETCH_REL_ACC 0.01
+#define SKETCH_MIN_VALUE 0.01
+
+// Fixed-memory streaming quantile sketch (DDSketch): values land in
+// logarithmic bins of ratio gamma = (1+a)/(1-a), so any quantile comes
+// back within relative error a. Values at or below min_value share one
+// zero bin, values beyond the last bin clamp to it.
+struct qsketch {
+	double gamma;
+	double inv_log_gamma;
+	double min_value;
+	int offset;		// bin index of bins[0]
+	uint64_t zero;
+	uint64_t count;
+	double min;
+	double max;
+	double sum;
+	uint32_t bins[SKETCH_BINS];
+};
+
+void qsketch_init(struct qsketch *s, double rel_acc, double min_value);
+void qsketch_reset(struct qsketch *s);
+void qsketch_add(struct qsketch *s, double v);
+// Takes back one earlier qsketch_add(v), for sliding windows. Removing
+// the min or max narrows it to the edge of the outermost bin still in
+// use, so the bounds follow the window to within one bin.
+void qsketch_remove(struct qsketch *s, double v);
+// Adds every value of src to dst, exactly as if they had been added to
+// dst; -1 if the sketches were set up with other parameters.
+int qsketch_merge(struct qsketch *dst, const struct qsketch *src);
+// q in [0, 1]; NaN when empty
+double qsketch_quantile(const struct qsketch *s, double q);
+double qsketch_mean(const struct qsketch *s);
+
+#endif
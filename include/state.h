@@ -1,6 +1,5 @@
 #ifndef STATE_H
 #define STATE_H
-#include "mem.h"
 
 typedef enum {
 	SYS_OK = 0,
@@ -10,8 +9,11 @@ typedef enum {
 
 const char *sys_state_str(sys_state s);
 
-sys_state cpu_state_from_avg(double avg);       
-sys_state mem_state_from_capacity(const mem_stat *cap);
+// The thresholds deciding a state are rules (rules.h).
+
+static inline sys_state sys_state_worst(sys_state a, sys_state b){
+	return a > b ? a : b;
+}
 
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef TICKER_H
+#define TICKER_H
+
+#include <poll.h>
+#include <time.h>
+
+// Fixed-rate ticker on absolute CLOCK_MONOTONIC deadlines: deadline n
+// is start + n * period no matter how long each tick's work took, so
+// the sample clock never drifts. When the work overruns one or more
+// whole periods those deadlines are skipped and counted, not queued.
+struct tick_sched {
+	struct timespec next;
+	long long period_ns;
+	unsigned long long ticks;
+	unsigned long long missed;
+	long long late_ns;	// how late the last wakeup was
+};
+
+void tick_sched_init(struct tick_sched *s, double interval_s);
+void tick_sched_set_interval(struct tick_sched *s, double interval_s);
+// Sleeps until the next deadline. Returns 0 on a tick, -1 when a signal
+// interrupted the sleep (the deadline is kept for the next call).
+int tick_sched_wait(struct tick_sched *s);
+// Same, but also returns 1 as soon as one of `fds` reports an event.
+// An early wakeup keeps the deadline and is not a tick.
+int tick_sched_wait_fds(struct tick_sched *s, struct pollfd *fds, int nfds);
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary trace (--format=bin), all integers little-endian.
+//
+// header:
+//   char   magic[8]	"SPTRACE\0"
+//   u16    version
+//   u16    header_len	bytes of header fields that follow
+//   f64    interval_s, u32 cores, u32 window, f64 max_freq_ghz,
+//   f64    mem_total_gb, mem_avail_gb, swap_total_gb, swap_free_gb
+//   f64    fast_interval_s	(0: fixed rate)
+//   f64    heartbeat_s	(--deadband, 0: every sample is written)
+//   u32    arena_kb, arena_startup_kb, arena_locked	(0: no arena)
+//   f64    predict_s	(--predict horizon, 0: off)
+//
+// then records:  u8 tag, varint payload_len, payload
+//
+// TRACE_SAMPLE payload:
+//   u8     flags	bits 0-1 CPU_STATE, 2-3 MEM_STATE, 4-5 IO_STATE,
+//			TRACE_F_STATE_CHANGE: a state_change event fired here
+//   varint dt_us	microseconds since the previous record
+//   u16    cpu, cpu_avg, cpu_min, cpu_max, cpu_ewma, cpu_hot_avg
+//			(hundredths of a percent)
+//   svarint mem_used_kb, mem_avail_kb, swap_used_kb, swap_avail_kb
+//			(zigzag deltas against the previous sample)
+//   varint ncores, then u16 per CPU id (hundredths of a percent,
+//			TRACE_NONE while offline)
+//   varint missed	deadlines skipped so far
+//   varint dropped	records lost to a full writer ring so far
+//   u8     psi_flags	TRACE_PSI_WAKEUP: sample taken on a PSI trigger
+//   u16    psi cpu_some, mem_some, mem_full, io_some, io_full
+//			(hundredths of a percent, TRACE_NONE if unavailable)
+//   varint interval_us	time covered by the sample
+//   u8     NET_STATE
+//   varint disk rd_iops, wr_iops, rd_mb_s, wr_mb_s, await_ms, util,
+//          net rx_mbit_s, tx_mbit_s, rx_pps, tx_pps, errs_s
+//			(hundredths)
+//   varint skipped	--deadband: samples left out before this one
+//   u16    cgroup_mem_pct, cgroup_cpu_pct	(hundredths, TRACE_NONE if
+//			unavailable)
+//   u8     TRACE_EBPF if these follow (--bpf):
+//   varint runq_avg_us, runq_p99_us, reclaim_ms_s	(hundredths)
+//   u16    pgfault_s / 10	(TRACE_NONE if unavailable)
+//   u8     TRACE_PRED if these follow (--predict), bits 1-2 MEM_PREDICTED,
+//			TRACE_PRED_CHANGE: a predicted_state event fired here
+//   svarint mem_slope_kb_s
+//   varint mem_eta_s in tenths + 1	(0: not falling)
+//   svarint cpu_z	(hundredths)
+//   varint fresh	SRC_* bits of the sources read on this tick (sample.h)
+//
+// TRACE_SUMMARY / TRACE_END payload:
+//   varint dt_us, varint samples,
+//   f32    cpu p50/p95/p99, mem_used p50/p95/p99
+//   varint missed, varint dropped
+//
+// TRACE_TOP payload:
+//   varint dt_us, u8 reason (enum top_reason),
+//   varint n_cpu, n_cpu entries, varint n_rss, n_rss entries
+//   entry: varint pid, u8 comm_len, comm bytes,
+//          varint cpu (hundredths of a percent of one core), varint rss_kb
+//
+// TRACE_SELF payload (--self):
+//   varint dt_us, varint cpu_pct (hundredths),
+//   varint utime_us, stime_us, sampler_cpu_us, writer_cpu_us,
+//   varint rss_kb, maxrss_kb, bytes_written, ticks, missed,
+//   lat late, lat loop, varint ncoll, ncoll x (u8 name_len, name, lat)
+//   lat: varint n, p50_ns, p99_ns, max_ns
+//
+// TRACE_CGROUP payload (--cgroup-root):
+//   varint dt_us, u8 reason (enum top_reason),
+//   varint count, warn, danger, varint n, n entries
+//   entry: u8 name_len, name bytes,
+//          u8 flags	bits 0-1 state, TRACE_CG_MEM: mem_kb follows
+//          varint cpu (hundredths of a percent of one core),
+//          u16 cpu_limit_pct, throttled_pct	(TRACE_NONE if no quota),
+//          [varint mem_kb], u16 mem_limit_pct	(TRACE_NONE if unlimited)
+//
+// TRACE_INDEX payload, written once after TRACE_END:
+//   varint nblocks, then per block:
+//     varint offset	byte offset of the block's first sample record
+//     varint samples, t_first_us, t_last_us
+//     svarint ts_us, mem_used_kb, mem_avail_kb, swap_used_kb, swap_avail_kb
+//			delta base in force at offset, so decoding can start there
+//     u16    cpu_min, cpu_max, varint cpu_sum	(hundredths of a percent)
+//     varint mem_used_min_kb, mem_used_max_kb, mem_used_sum_kb
+//     u8     worst states (CPU, MEM, IO, NET, 2 bits each)
+//     varint state changes
+//   [u8    flags]	TRACE_INDEX_TRUNCATED: indexing stopped early
+//   u64    offset of this record, char "SPIX"	(the last 12 bytes
+//			of the file, so a reader finds the index from the end)
+//
+// A block closes after TRACE_BLOCK_S of trace time or TRACE_BLOCK_MAX
+// samples. A trace cut short has no index and is read from the start.
+// When the encoder runs out of memory for the index it stops indexing
+// and flags it: the blocks then cover only the start of the trace, and
+// the rest is decoded on from the last block.
+//
+// Unknown tags are skipped by length and decoders ignore payload bytes
+// past the fields they know, so records and trailing fields can be added
+// without breaking older decoders.
+
+#define TRACE_MAGIC "SPTRACE"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_VERSION 1
+
+enum trace_tag {
+	TRACE_SAMPLE = 1,
+	TRACE_SUMMARY = 2,
+	TRACE_END = 3,
+	TRACE_TOP = 4,
+	TRACE_SELF = 5,
+	TRACE_INDEX = 6,
+	TRACE_CGROUP = 7,
+};
+
+#define TRACE_F_STATE_CHANGE 0x80
+#define TRACE_PSI_WAKEUP 0x01
+#define TRACE_NONE 0xffff
+#define TRACE_CG_MEM 0x04
+#define TRACE_EBPF 0x01
+#define TRACE_PRED 0x01
+#define TRACE_PRED_CHANGE 0x08
+
+#define TRACE_INDEX_MAGIC "SPIX"
+#define TRACE_INDEX_TRAILER 12
+#define TRACE_INDEX_TRUNCATED 0x01
+#define TRACE_BLOCK_S 10.0
+#define TRACE_BLOCK_MAX 65536
+
+// Delta base of the encoder, also of a decoder starting mid-trace.
+struct trace_base {
+	int64_t ts_us;
+	int64_t mem_used_kb;
+	int64_t mem_avail_kb;
+	int64_t swap_used_kb;
+	int64_t swap_avail_kb;
+};
+
+struct trace_block {
+	uint64_t offset;
+	uint64_t samples;
+	int64_t t_first_us;
+	int64_t t_last_us;
+	struct trace_base base;
+	uint16_t cpu_min;
+	uint16_t cpu_max;
+	uint64_t cpu_sum;
+	int64_t mem_used_min_kb;
+	int64_t mem_used_max_kb;
+	int64_t mem_used_sum_kb;
+	uint8_t states;
+	uint64_t changes;
+};
+
+struct trace_enc {
+	struct trace_base base;
+	int pending_change;
+	// index of the blocks written so far, the last one open
+	struct trace_block *blocks;
+	size_t nblocks;
+	size_t cap;
+	int open;
+	int truncated;		// out of memory for the index, no more blocks
+	uint8_t *scratch;	// samples too big for the stack buffer
+	size_t scratch_cap;
+};
+
+struct out_buf;
+struct sample;
+struct sample_meta;
+struct sample_summary;
+struct proc_top;
+struct self_stat;
+struct cgroup_report;
+
+void trace_meta(struct out_buf *o, const struct sample_meta *m);
+void trace_sample(struct out_buf *o, const struct sample *s);
+void trace_state_change(struct out_buf *o, const struct sample *s);
+void trace_summary(struct out_buf *o, int end, const struct sample_summary *m);
+void trace_top(struct out_buf *o, const struct proc_top *top);
+void trace_self(struct out_buf *o, const struct self_stat *m);
+void trace_cgroups(struct out_buf *o, const struct cgroup_report *rep);
+
+// Called on every decoded sample before it is emitted; may rewrite the
+// sample and decide whether a state_change event goes with it.
+typedef void (*trace_sample_hook)(void *arg, struct sample *s, int *state_change);
+
+// Decodes a whole trace image and re-emits every record through `out`.
+// Returns 0, or -1 on a bad header / truncated record. hook may be NULL.
+int trace_decode(const uint8_t *buf, size_t len, struct out_buf *out,
+		trace_sample_hook hook, void *arg);
+// Only the records with from <= ts <= to (trace seconds); with an index
+// the decoding starts at the first block that reaches `from`.
+int trace_decode_range(const uint8_t *buf, size_t len, double from, double to,
+		struct out_buf *out);
+// Emits meta, one "block" record per index block overlapping [from, to]
+// and an "index" record, without decoding any sample. -1 without an
+// index.
+int trace_index(const uint8_t *buf, size_t len, double from, double to,
+		struct out_buf *out);
+void trace_enc_free(struct trace_enc *e);
+
+#endif
@@ -1,18 +1,40 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
+// default number of slots, overridable with --window
 #define CPU_WINDOW 10
 
+// Sliding window over the last `size` samples. Every statistic is O(1)
+// (amortized for min/max): a running sum that is re-summed exactly once
+// per `size` insertions to cancel floating-point drift, two monotonic
+// deques of sample sequence numbers for min/max, and an EWMA.
 typedef struct {
-	double samples[CPU_WINDOW];
+	double *samples;
+	int size;
 	int index;
 	int count;
+
+	double sum;
+	int since_resum;
+
+	unsigned long seq;	// samples added so far
+	unsigned long *min_q;	// increasing values, oldest first
+	unsigned long *max_q;	// decreasing values, oldest first
+	int min_head, min_len;
+	int max_head, max_len;
+
+	double alpha;
+	double ewma;
 } cpu_window;
 
 
-void cpu_window_init(cpu_window *w);
+// alpha <= 0 picks the usual 2 / (size + 1)
+int cpu_window_init(cpu_window *w, int size, double alpha);
+void cpu_window_free(cpu_window *w);
 void cpu_window_add(cpu_window *w, double value);
 double cpu_window_avg(const cpu_window *w);
+double cpu_window_min(const cpu_window *w);
+double cpu_window_max(const cpu_window *w);
+double cpu_window_ewma(const cpu_window *w);
 
 #endif
-
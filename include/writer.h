@@ -0,0 +1,35 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "output.h"
+#include "ring.h"
+#include "flight.h"
+#include "push.h"
+#include "metrics.h"
+#include "deadband.h"
+
+// Writer thread: drains the ring, serializes and does all output I/O,
+// so a slow consumer of stdout can only cost dropped records, never a
+// late sample.
+struct writer {
+	struct spsc_ring *ring;
+	struct out_buf *out;
+	struct flight *flight;	// NULL without --flight
+	struct pusher *push;	// NULL without --push
+	struct metrics_server *metrics;	// NULL without --listen
+	struct deadband *deadband;	// NULL without --deadband; the sinks above get every sample
+	pthread_t thread;
+	_Atomic int stop;
+	_Atomic int failed;	// output error (EPIPE, ...), sampling should stop
+	int started;
+};
+
+int writer_start(struct writer *w, struct spsc_ring *ring, struct out_buf *out,
+		struct flight *flight, struct pusher *push, struct metrics_server *metrics,
+		struct deadband *deadband);
+// Returns after the ring has been drained and the output flushed.
+void writer_stop(struct writer *w);
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "arena.h"
+
+static struct arena *active;
+
+static size_t round_up(size_t n, size_t to){
+	return (n + to - 1) / to * to;
+}
+
+int arena_init(struct arena *a, unsigned size_mb){
+	memset(a, 0, sizeof(*a));
+	size_t mb = size_mb > ARENA_RESERVE_MB ? size_mb : ARENA_RESERVE_MB;
+	a->reserved = mb << 20;
+	void *m = mmap(NULL, a->reserved, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(m == MAP_FAILED){
+		perror("arena: mmap");
+		return -1;
+	}
+	a->base = m;
+	a->limit = a->reserved;
+	atomic_init(&a->used, 0);
+	atomic_init(&a->refused, 0);
+	active = a;
+	return 0;
+}
+
+// The soft limit is often 64 KB or 8 MB; take what the hard one allows.
+static void memlock_budget(size_t want){
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_MEMLOCK, &rl) != 0 || rl.rlim_cur == RLIM_INFINITY ||
+			rl.rlim_cur >= want)
+		return;
+	rl.rlim_cur = rl.rlim_max == RLIM_INFINITY || rl.rlim_max > want ? want : rl.rlim_max;
+	setrlimit(RLIMIT_MEMLOCK, &rl);
+}
+
+int arena_seal(struct arena *a, unsigned size_mb, int lock){
+	long page = sysconf(_SC_PAGESIZE);
+	size_t pg = page > 0 ? (size_t)page : 4096;
+	a->startup = atomic_load(&a->used);
+	size_t limit = size_mb ? (size_t)size_mb << 20 :
+			round_up(a->startup, pg) + ((size_t)ARENA_HEADROOM_MB << 20);
+	// the mapping is all there is: headroom past it would be handed out
+	// beyond its end
+	if(limit > a->reserved) limit = a->reserved;
+	if(!size_mb && a->startup + ((size_t)ARENA_HEADROOM_MB << 20) > limit){
+		fprintf(stderr, "arena: startup needs %zu KB, leaving less than %d MB of the"
+				" %zu MB reserved; give a larger --arena\n",
+				a->startup >> 10, ARENA_HEADROOM_MB, a->reserved >> 20);
+		return -1;
+	}
+	if(a->startup > limit){
+		fprintf(stderr, "arena: startup needs %zu KB, more than --arena %u MB\n",
+				a->startup >> 10, size_mb);
+		return -1;
+	}
+	// the rest of the reservation goes back: the size is fixed from here
+	if(limit < a->reserved){
+		munmap(a->base + limit, a->reserved - limit);
+		a->reserved = limit;
+	}
+	a->limit = limit;
+	if(lock){
+		memlock_budget(limit);
+		if(mlock(a->base, limit) != 0){
+			int err = errno;
+			fprintf(stderr, "arena: mlock %zu KB: %s%s\n", limit >> 10, strerror(err),
+					err == EPERM || err == ENOMEM ?
+					" (needs CAP_IPC_LOCK or a higher ulimit -l)" : "");
+			return -1;
+		}
+		a->locked = 1;
+	}
+	return 0;
+}
+
+int arena_bind_node(struct arena *a, int node){
+	unsigned long mask[16] = { 0 };
+	size_t bits = 8 * sizeof(mask);
+	if(node < 0 || (size_t)node >= bits - 1) return -1;
+	mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+	// preferred, not bound: a full node must not OOM the probe
+	if(syscall(SYS_mbind, a->base, a->reserved, MPOL_PREFERRED, mask, bits, 0) != 0){
+		perror("--numa: mbind");
+		return -1;
+	}
+	return 0;
+}
+
+void arena_destroy(struct arena *a){
+	if(active == a) active = NULL;
+	if(a->base) munmap(a->base, a->reserved);
+	a->base = NULL;
+}
+
+static int in_arena(const struct arena *a, const void *p){
+	const unsigned char *c = p;
+	return a && c >= a->base && c < a->base + a->reserved;
+}
+
+// The sampler and the writer thread both allocate, hence the CAS.
+static void *bump(struct arena *a, size_t size){
+	size_t n = round_up(size ? size : 1, ARENA_ALIGN);
+	size_t used = atomic_load_explicit(&a->used, memory_order_relaxed);
+	do {
+		if(n > a->limit - used){
+			if(atomic_fetch_add(&a->refused, 1) == 0)
+				fprintf(stderr, "arena: full at %zu KB, allocations now fail%s\n",
+						a->limit >> 10, a->startup ? "" :
+						" (startup: give a larger --arena)");
+			errno = ENOMEM;
+			return NULL;
+		}
+	} while(!atomic_compare_exchange_weak(&a->used, &used, used + n));
+	return a->base + used;
+}
+
+void *arena_calloc(size_t n, size_t size){
+	if(!active) return calloc(n, size);
+	if(size && n > (size_t)-1 / size) return NULL;
+	return bump(active, n * size);
+}
+
+void *arena_realloc(void *p, size_t old, size_t size){
+	struct arena *a = active;
+	if(a && !p) return bump(a, size);
+	if(!in_arena(a, p)) return realloc(p, size);
+	// the latest allocation grows where it is
+	size_t start = (size_t)((unsigned char *)p - a->base);
+	size_t end = start + round_up(old ? old : 1, ARENA_ALIGN);
+	size_t want = start + round_up(size ? size : 1, ARENA_ALIGN);
+	size_t used = end;
+	if(size <= old) return p;
+	if(want <= a->limit && atomic_compare_exchange_strong(&a->used, &used, want))
+		return p;
+	void *np = bump(a, size);
+	if(np) memcpy(np, p, old);
+	return np;
+}
+
+void arena_free(void *p){
+	if(!in_arena(active, p)) free(p);
+}
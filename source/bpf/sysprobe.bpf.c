@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-2.0
+// BPF side of --bpf (built only when the Makefile finds libbpf, clang
+// and bpftool). It keeps per-CPU busy time, run-queue latency and
+// page-fault/reclaim counts in the per-CPU cpu_acct map; sysprobe reads
+// the whole map with one lookup per sample. Nothing is sent per event.
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+#include "ebpf_maps.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+#define TASK_RUNNING 0
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, 1);
+	__type(key, __u32);
+	__type(value, struct ebpf_cpu);
+} cpu_acct SEC(".maps");
+
+// pid -> time it became runnable
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, EBPF_MAX_TASKS);
+	__type(key, __u32);
+	__type(value, __u64);
+} enqueued SEC(".maps");
+
+// pid -> start of its direct reclaim
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, EBPF_MAX_TASKS);
+	__type(key, __u32);
+	__type(value, __u64);
+} reclaiming SEC(".maps");
+
+// task_struct::state became __state in 5.14; either may be missing
+// from the vmlinux.h of the build host
+struct task_struct___o {
+	volatile long int state;
+} __attribute__((preserve_access_index));
+
+struct task_struct___x {
+	unsigned int __state;
+} __attribute__((preserve_access_index));
+
+static __always_inline long task_state(void *t){
+	struct task_struct___x *x = t;
+	if(bpf_core_field_exists(x->__state)) return BPF_CORE_READ(x, __state);
+	return BPF_CORE_READ((struct task_struct___o *)t, state);
+}
+
+static __always_inline struct ebpf_cpu *acct(void){
+	__u32 key = 0;
+	return bpf_map_lookup_elem(&cpu_acct, &key);
+}
+
+static __always_inline void enqueue(__u32 pid){
+	if(pid == 0) return;	// the idle task
+	__u64 ts = bpf_ktime_get_ns();
+	bpf_map_update_elem(&enqueued, &pid, &ts, BPF_ANY);
+}
+
+static __always_inline __u32 log2_slot(__u64 v){
+	__u32 slot = 0;
+	for(int i = 0; i < EBPF_RUNQ_SLOTS - 1 && v > 1; i++){
+		v >>= 1;
+		slot++;
+	}
+	return slot;
+}
+
+SEC("tp_btf/sched_wakeup")
+int BPF_PROG(handle_wakeup, struct task_struct *p){
+	enqueue(p->pid);
+	return 0;
+}
+
+SEC("tp_btf/sched_wakeup_new")
+int BPF_PROG(handle_wakeup_new, struct task_struct *p){
+	enqueue(p->pid);
+	return 0;
+}
+
+SEC("tp_btf/sched_switch")
+int BPF_PROG(handle_switch, bool preempt, struct task_struct *prev, struct task_struct *next){
+	struct ebpf_cpu *c = acct();
+	if(!c) return 0;
+	__u64 now = bpf_ktime_get_ns();
+	if(c->running && c->last_ns) c->busy_ns += now - c->last_ns;
+	c->last_ns = now;
+	c->running = next->pid != 0;
+	c->switches++;
+	// preempted, not sleeping: it waits on the run queue from now
+	if(task_state(prev) == TASK_RUNNING) enqueue(prev->pid);
+
+	__u32 pid = next->pid;
+	__u64 *ts = bpf_map_lookup_elem(&enqueued, &pid);
+	if(!ts) return 0;
+	__u64 d = now > *ts ? now - *ts : 0;
+	bpf_map_delete_elem(&enqueued, &pid);
+	c->runq_count++;
+	c->runq_ns += d;
+	__u32 slot = log2_slot(d / 1000);
+	if(slot < EBPF_RUNQ_SLOTS) c->runq_slot[slot]++;
+	return 0;
+}
+
+// x86 only; the loader leaves it out where the tracepoint is missing
+SEC("tracepoint/exceptions/page_fault_user")
+int handle_fault(void *ctx){
+	struct ebpf_cpu *c = acct();
+	if(c) c->faults++;
+	return 0;
+}
+
+SEC("tracepoint/vmscan/mm_vmscan_direct_reclaim_begin")
+int handle_reclaim_begin(void *ctx){
+	__u32 pid = (__u32)bpf_get_current_pid_tgid();
+	__u64 ts = bpf_ktime_get_ns();
+	bpf_map_update_elem(&reclaiming, &pid, &ts, BPF_ANY);
+	return 0;
+}
+
+SEC("tracepoint/vmscan/mm_vmscan_direct_reclaim_end")
+int handle_reclaim_end(void *ctx){
+	__u32 pid = (__u32)bpf_get_current_pid_tgid();
+	__u64 *ts = bpf_map_lookup_elem(&reclaiming, &pid);
+	struct ebpf_cpu *c = acct();
+	if(!ts || !c) return 0;
+	__u64 now = bpf_ktime_get_ns();
+	c->reclaims++;
+	c->reclaim_ns += now > *ts ? now - *ts : 0;
+	bpf_map_delete_elem(&reclaiming, &pid);
+	return 0;
+}
+
+SEC("tracepoint/vmscan/mm_vmscan_wakeup_kswapd")
+int handle_kswapd(void *ctx){
+	struct ebpf_cpu *c = acct();
+	if(c) c->kswapd_wakeups++;
+	return 0;
+}
@@ -0,0 +1,461 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "cgroup.h"
+#include "parse.h"
+#include "sample.h"
+#include "sampler.h"
+
+#define CGROUP_WATCH (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+// fds left to everything else when sizing the table to RLIMIT_NOFILE
+#define CGROUP_FD_SPARE 64
+
+// ---- parsing ----
+
+long long parse_cgroup_stat_key(const char *buf, size_t len, const char *key){
+	const char *p = buf, *end = buf + len;
+	size_t kl = strlen(key);
+	for(; p < end; p = parse_next_line(p, end)){
+		if((size_t)(end - p) <= kl || memcmp(p, key, kl) != 0 || p[kl] != ' ') continue;
+		long v;
+		return parse_long(p + kl, end, &v) ? v : -1;
+	}
+	return -1;
+}
+
+int parse_cgroup_cpu_stat(const char *buf, size_t len, unsigned long long *usage_usec,
+		unsigned long long *nr_periods, unsigned long long *nr_throttled){
+	long long usage = parse_cgroup_stat_key(buf, len, "usage_usec");
+	if(usage < 0) return -1;
+	// no cpu controller: no periods
+	long long periods = parse_cgroup_stat_key(buf, len, "nr_periods");
+	long long throttled = parse_cgroup_stat_key(buf, len, "nr_throttled");
+	*usage_usec = (unsigned long long)usage;
+	*nr_periods = periods > 0 ? (unsigned long long)periods : 0;
+	*nr_throttled = throttled > 0 ? (unsigned long long)throttled : 0;
+	return 0;
+}
+
+double parse_cgroup_mem_max(const char *buf, size_t len){
+	long v;
+	if(len >= 3 && memcmp(buf, "max", 3) == 0) return INFINITY;
+	return parse_long(buf, buf + len, &v) && v > 0 ? (double)v : INFINITY;
+}
+
+// "QUOTA PERIOD" in microseconds, QUOTA "max" without a limit
+double parse_cgroup_cpu_max(const char *buf, size_t len){
+	const char *end = buf + len, *p;
+	long quota, period;
+	if(len >= 3 && memcmp(buf, "max", 3) == 0) return INFINITY;
+	if(!(p = parse_long(buf, end, &quota)) || !parse_long(p, end, &period) ||
+			quota <= 0 || period <= 0)
+		return INFINITY;
+	return (double)quota / (double)period;
+}
+
+// ---- table ----
+
+static int cg_full_path(const struct cgroup_set *cs, const char *rel, const char *file,
+		char *out, size_t size){
+	int n = snprintf(out, size, "%s%s%s%s%s", cs->root, *rel ? "/" : "", rel,
+			file ? "/" : "", file ? file : "");
+	return n > 0 && (size_t)n < size ? 0 : -1;
+}
+
+static int cg_open(const struct cgroup_set *cs, const char *rel, const char *file){
+	char path[2 * CGROUP_PATH + 32];
+	if(cg_full_path(cs, rel, file, path, sizeof(path)) != 0) return -1;
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+// into the shared buffer, NUL-terminated
+static ssize_t cg_pread(struct cgroup_set *cs, int fd){
+	ssize_t n;
+	do {
+		n = pread(fd, cs->buf, CGROUP_BUF - 1, 0);
+	} while(n < 0 && errno == EINTR);
+	if(n >= 0) cs->buf[n] = '\0';
+	return n;
+}
+
+// limits change rarely: opened and closed on each read
+static double cg_read_limit(struct cgroup_set *cs, const struct cgroup *cg, const char *file,
+		double (*parse)(const char *, size_t)){
+	int fd = cg_open(cs, cg->path, file);
+	if(fd < 0) return INFINITY;
+	ssize_t n = cg_pread(cs, fd);
+	close(fd);
+	return n > 0 ? parse(cs->buf, (size_t)n) : INFINITY;
+}
+
+static void cg_read_limits(struct cgroup_set *cs, struct cgroup *cg){
+	cg->mem_max = cg->mem_fd >= 0 ? cg_read_limit(cs, cg, "memory.max", parse_cgroup_mem_max) :
+		INFINITY;
+	cg->cpu_quota = cg_read_limit(cs, cg, "cpu.max", parse_cgroup_cpu_max);
+}
+
+static int cg_find(const struct cgroup_set *cs, const char *rel){
+	for(int i = 0; i < cs->n; i++)
+		if(strcmp(cs->cg[i].path, rel) == 0) return i;
+	return -1;
+}
+
+static int cg_find_wd(const struct cgroup_set *cs, int wd){
+	for(int i = 0; i < cs->n; i++)
+		if(cs->cg[i].wd == wd) return i;
+	return -1;
+}
+
+static void cg_remove(struct cgroup_set *cs, int i){
+	struct cgroup *cg = &cs->cg[i];
+	close(cg->cpu_fd);
+	if(cg->mem_fd >= 0) close(cg->mem_fd);
+	if(cg->stat_fd >= 0) close(cg->stat_fd);
+	// the kernel already dropped the watch of a removed directory
+	if(cg->wd >= 0) inotify_rm_watch(cs->ifd, cg->wd);
+	cs->cg[i] = cs->cg[--cs->n];
+}
+
+// rel and everything below it
+static void cg_remove_tree(struct cgroup_set *cs, const char *rel){
+	size_t len = strlen(rel);
+	for(int i = cs->n - 1; i >= 0; i--){
+		const char *p = cs->cg[i].path;
+		if(strncmp(p, rel, len) == 0 && (p[len] == '\0' || p[len] == '/'))
+			cg_remove(cs, i);
+	}
+}
+
+static int cg_add(struct cgroup_set *cs, const char *rel){
+	if(cs->n == cs->max){
+		if(!cs->overflow)
+			fprintf(stderr, "cgroups: more than %d under %s, the rest is not tracked\n",
+					cs->max, cs->root);
+		cs->overflow = 1;
+		return -1;
+	}
+	struct cgroup *cg = &cs->cg[cs->n];
+	memset(cg, 0, sizeof(*cg));
+	// gone again already, or not a cgroup
+	cg->cpu_fd = cg_open(cs, rel, "cpu.stat");
+	if(cg->cpu_fd < 0) return -1;
+	snprintf(cg->path, sizeof(cg->path), "%s", rel);
+	cg->mem_fd = cg_open(cs, rel, "memory.current");
+	cg->stat_fd = cg->mem_fd >= 0 ? cg_open(cs, rel, "memory.stat") : -1;
+	char dir[CGROUP_PATH * 2];
+	cg->wd = -1;
+	if(cg_full_path(cs, rel, NULL, dir, sizeof(dir)) == 0)
+		cg->wd = inotify_add_watch(cs->ifd, dir, CGROUP_WATCH);
+	if(cg->wd < 0 && errno == ENOSPC && !cs->unwatched){
+		fprintf(stderr, "cgroups: out of inotify watches (fs.inotify.max_user_watches),"
+				" new cgroups below %s are missed\n", dir);
+		cs->unwatched = 1;
+	}
+	cg->read_t = -1.0;
+	cg->cpu_limit_pct = NAN;
+	cg->throttled_pct = NAN;
+	cg->mem_bytes = NAN;
+	cg->mem_limit_pct = NAN;
+	cg_read_limits(cs, cg);
+	cs->n++;
+	return 0;
+}
+
+// Adds rel and every directory below it. The watch goes on before the
+// directory is listed: a child created in between shows up twice and is
+// only added once.
+static void cg_scan(struct cgroup_set *cs, const char *rel){
+	if(cg_find(cs, rel) < 0 && cg_add(cs, rel) != 0) return;
+	char dir[CGROUP_PATH * 2];
+	if(cg_full_path(cs, rel, NULL, dir, sizeof(dir)) != 0) return;
+	DIR *d = opendir(dir);
+	if(!d) return;
+	struct dirent *e;
+	while((e = readdir(d)) != NULL){
+		if(e->d_name[0] == '.') continue;
+		if(e->d_type != DT_DIR){
+			struct stat st;
+			if(e->d_type != DT_UNKNOWN || fstatat(dirfd(d), e->d_name, &st, 0) != 0 ||
+					!S_ISDIR(st.st_mode))
+				continue;
+		}
+		char child[CGROUP_PATH];
+		int n = snprintf(child, sizeof(child), "%s%s%s", rel, *rel ? "/" : "", e->d_name);
+		if(n > 0 && (size_t)n < sizeof(child)) cg_scan(cs, child);
+	}
+	closedir(d);
+}
+
+// Never blocks: the inotify fd is non-blocking.
+static void cg_events(struct cgroup_set *cs){
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int rescan = 0;
+	ssize_t n;
+	while((n = read(cs->ifd, buf, sizeof(buf))) > 0){
+		for(char *p = buf; p < buf + n; ){
+			const struct inotify_event *e = (const struct inotify_event *)p;
+			p += sizeof(*e) + e->len;
+			if(e->mask & IN_Q_OVERFLOW) rescan = 1;
+			if(!(e->mask & IN_ISDIR) || e->len == 0) continue;
+			int i = cg_find_wd(cs, e->wd);
+			if(i < 0) continue;
+			char rel[CGROUP_PATH];
+			const char *parent = cs->cg[i].path;
+			int len = snprintf(rel, sizeof(rel), "%s%s%s", parent, *parent ? "/" : "", e->name);
+			if(len <= 0 || (size_t)len >= sizeof(rel)) continue;
+			if(e->mask & (IN_CREATE | IN_MOVED_TO)) cg_scan(cs, rel);
+			else cg_remove_tree(cs, rel);
+		}
+	}
+	// lost events: whatever is new gets added, whatever is gone fails
+	// its next read
+	if(rescan) cg_scan(cs, "");
+}
+
+// ---- sampling ----
+
+static double worst(double a, double b){
+	return isnan(a) || b > a ? b : a;
+}
+
+static sys_state level_of(double x, double lower){
+	if(x >= CGROUP_DANGER_PCT - lower) return SYS_DANGER;
+	if(x >= CGROUP_WARN_PCT - lower) return SYS_WARN;
+	return SYS_OK;
+}
+
+static sys_state cg_level(sys_state cur, double x){
+	if(isnan(x)) return SYS_OK;
+	sys_state up = level_of(x, 0.0);
+	if(up >= cur) return up;
+	sys_state held = level_of(x, CGROUP_HYST_PCT);
+	return held < cur ? held : cur;
+}
+
+static inline unsigned long long delta(unsigned long long prev, unsigned long long curr){
+	return curr >= prev ? curr - prev : 0;
+}
+
+// -1 once the cgroup is gone
+static int cg_read(struct cgroup_set *cs, struct cgroup *cg, double t, int limits){
+	ssize_t n = cg_pread(cs, cg->cpu_fd);
+	unsigned long long usage, periods, throttled;
+	if(n <= 0 || parse_cgroup_cpu_stat(cs->buf, (size_t)n, &usage, &periods, &throttled) != 0)
+		return -1;
+	if(limits) cg_read_limits(cs, cg);
+	if(cg->read_t >= 0.0 && t > cg->read_t){
+		double dt = t - cg->read_t;
+		cg->cpu_pct = (double)delta(cg->usage_usec, usage) / 1e6 / dt * 100.0;
+		cg->cpu_limit_pct = isinf(cg->cpu_quota) ? NAN : cg->cpu_pct / cg->cpu_quota;
+		unsigned long long dp = delta(cg->nr_periods, periods);
+		cg->throttled_pct = isinf(cg->cpu_quota) ? NAN :
+			dp ? (double)delta(cg->nr_throttled, throttled) / (double)dp * 100.0 : 0.0;
+	}
+	cg->usage_usec = usage;
+	cg->nr_periods = periods;
+	cg->nr_throttled = throttled;
+	cg->read_t = t;
+
+	long current;
+	if(cg->mem_fd >= 0 && (n = cg_pread(cs, cg->mem_fd)) > 0 &&
+			parse_long(cs->buf, cs->buf + n, &current)){
+		// page cache the kernel can drop at once is not pressure
+		long long inactive = -1;
+		if(cg->stat_fd >= 0 && (n = cg_pread(cs, cg->stat_fd)) > 0)
+			inactive = parse_cgroup_stat_key(cs->buf, (size_t)n, "inactive_file");
+		double ws = (double)current - (inactive > 0 ? (double)inactive : 0.0);
+		cg->mem_bytes = ws > 0.0 ? ws : 0.0;
+		cg->mem_limit_pct = isinf(cg->mem_max) ? NAN : cg->mem_bytes / cg->mem_max * 100.0;
+	}
+
+	sys_state st = cg_level(cg->state, worst(cg->mem_limit_pct, cg->cpu_limit_pct));
+	if(st != cg->state){
+		cg->state = st;
+		cg->changed = 1;
+	}
+	return 0;
+}
+
+static void cg_sample_all(struct cgroup_set *cs, double t){
+	int limits = cs->tick++ % CGROUP_LIMIT_EVERY == 0;
+	cs->worst_mem_pct = NAN;
+	cs->worst_cpu_pct = NAN;
+	for(int i = 0; i < cs->n; ){
+		struct cgroup *cg = &cs->cg[i];
+		if(cg_read(cs, cg, t, limits) != 0){
+			cg_remove(cs, i);
+			continue;
+		}
+		cs->worst_mem_pct = worst(cs->worst_mem_pct, cg->mem_limit_pct);
+		cs->worst_cpu_pct = worst(cs->worst_cpu_pct, cg->cpu_limit_pct);
+		i++;
+	}
+}
+
+// ---- reports ----
+
+static double cg_score(const struct cgroup *cg){
+	double s = worst(cg->mem_limit_pct, cg->cpu_limit_pct);
+	return isnan(s) ? -1.0 : s;
+}
+
+static int cg_worse(const struct cgroup *a, const struct cgroup *b){
+	if(a->state != b->state) return a->state > b->state;
+	double sa = cg_score(a), sb = cg_score(b);
+	if(sa != sb) return sa > sb;
+	return a->cpu_pct > b->cpu_pct;
+}
+
+// the end of a long path, cut at a '/' where possible
+static void cg_name(const char *path, char out[CGROUP_NAME]){
+	size_t len = strlen(path);
+	if(len == 0){
+		path = "/";
+		len = 1;
+	} else if(len >= CGROUP_NAME){
+		const char *tail = path + len - (CGROUP_NAME - 1);
+		const char *slash = strchr(tail, '/');
+		path = slash && slash[1] ? slash + 1 : tail;
+		len = strlen(path);
+	}
+	memcpy(out, path, len);
+	out[len] = '\0';
+}
+
+int cgroup_report(struct cgroup_set *cs, double t, enum top_reason reason,
+		struct cgroup_report *rep){
+	const struct cgroup *sel[CGROUP_REPORT_MAX];
+	int n = 0, changes = 0;
+	rep->t = t;
+	rep->reason = reason;
+	rep->count = cs->n;
+	rep->warn = 0;
+	rep->danger = 0;
+	for(int i = 0; i < cs->n; i++){
+		struct cgroup *cg = &cs->cg[i];
+		if(cg->state == SYS_WARN) rep->warn++;
+		if(cg->state == SYS_DANGER) rep->danger++;
+		if(reason == TOP_STATE_CHANGE){
+			if(!cg->changed) continue;
+			cg->changed = 0;
+			changes++;
+		}
+		// insertion into the worst few
+		int k = n < CGROUP_REPORT_MAX ? n++ : CGROUP_REPORT_MAX;
+		if(k == CGROUP_REPORT_MAX && !cg_worse(cg, sel[k - 1])) continue;
+		if(k == CGROUP_REPORT_MAX) k--;
+		while(k > 0 && cg_worse(cg, sel[k - 1])){
+			sel[k] = sel[k - 1];
+			k--;
+		}
+		sel[k] = cg;
+	}
+	rep->n = n;
+	for(int i = 0; i < n; i++){
+		struct cgroup_report_entry *e = &rep->e[i];
+		cg_name(sel[i]->path, e->name);
+		e->state = sel[i]->state;
+		e->cpu_pct = sel[i]->cpu_pct;
+		e->cpu_limit_pct = sel[i]->cpu_limit_pct;
+		e->throttled_pct = sel[i]->throttled_pct;
+		e->mem_mb = sel[i]->mem_bytes / 1048576.0;
+		e->mem_limit_pct = sel[i]->mem_limit_pct;
+	}
+	return reason == TOP_STATE_CHANGE ? changes > 0 : n > 0;
+}
+
+// ---- collector ----
+
+// Raises the soft fd limit to the hard one and leaves room for
+// CGROUP_FDS per cgroup; the table is capped to what fits.
+static int cg_fd_budget(void){
+	struct rlimit rl;
+	if(getrlimit(RLIMIT_NOFILE, &rl) != 0) return CGROUP_MAX;
+	if(rl.rlim_cur < rl.rlim_max){
+		rl.rlim_cur = rl.rlim_max;
+		if(setrlimit(RLIMIT_NOFILE, &rl) != 0) getrlimit(RLIMIT_NOFILE, &rl);
+	}
+	if(rl.rlim_cur == RLIM_INFINITY ||
+			rl.rlim_cur >= (rlim_t)CGROUP_MAX * CGROUP_FDS + CGROUP_FD_SPARE)
+		return CGROUP_MAX;
+	long budget = ((long)rl.rlim_cur - CGROUP_FD_SPARE) / CGROUP_FDS;
+	return budget > 1 ? (int)budget : 1;
+}
+
+static void cgroup_teardown(struct collector *c, struct sampler *sp){
+	struct cgroup_set *cs = c->priv;
+	if(!cs) return;
+	while(cs->n > 0) cg_remove(cs, cs->n - 1);
+	if(cs->ifd >= 0) close(cs->ifd);
+	arena_free(cs->cg);
+	arena_free(cs->buf);
+	arena_free(cs);
+	c->priv = NULL;
+	sp->cgroups = NULL;
+}
+
+static int cgroup_init(struct collector *c, struct sampler *sp){
+	const char *root = sp->cfg->cgroup_root;
+	if(!root) return 1;
+	struct cgroup_set *cs = arena_calloc(1, sizeof(*cs));
+	if(!cs) return -1;
+	c->priv = cs;
+	cs->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	cs->buf = arena_calloc(1, CGROUP_BUF);
+	if(cs->ifd < 0 || !cs->buf){
+		perror("cgroups");
+		return -1;
+	}
+	size_t len = strlen(root);
+	while(len > 1 && root[len - 1] == '/') len--;
+	if(len >= sizeof(cs->root)){
+		fprintf(stderr, "--cgroup-root: path too long\n");
+		return -1;
+	}
+	memcpy(cs->root, root, len);
+	cs->root[len] = '\0';
+	cs->max = cg_fd_budget();
+	// the whole table up front: it may not grow once the arena is sealed
+	cs->cg = arena_calloc((size_t)cs->max, sizeof(*cs->cg));
+	if(!cs->cg){
+		perror("cgroups");
+		return -1;
+	}
+	cg_scan(cs, "");
+	if(cs->n == 0){
+		fprintf(stderr, "%s: not a cgroup v2 directory (no cpu.stat)\n", cs->root);
+		return -1;
+	}
+	// primes the counters
+	cg_sample_all(cs, 0.0);
+	sp->cgroups = cs;
+	return 0;
+}
+
+static int cgroup_sample(struct collector *c, struct sampler *sp, double t){
+	(void)sp;
+	struct cgroup_set *cs = c->priv;
+	cg_events(cs);
+	cg_sample_all(cs, t);
+	return 0;
+}
+
+static void cgroup_emit(const struct collector *c, const struct sampler *sp, struct sample *s){
+	(void)sp;
+	const struct cgroup_set *cs = c->priv;
+	s->cgroup_mem_pct = cs->worst_mem_pct;
+	s->cgroup_cpu_pct = cs->worst_cpu_pct;
+}
+
+const struct collector_ops cgroup_collector = {
+	"cgroup", cgroup_init, cgroup_sample, cgroup_emit, cgroup_teardown, SRC_CGROUP
+};
@@ -0,0 +1,54 @@
+#include <math.h>
+#include <string.h>
+#include "collector.h"
+
+void wheel_init(struct timing_wheel *w){
+	memset(w, 0, sizeof(*w));
+}
+
+void wheel_schedule(struct timing_wheel *w, struct collector *c, unsigned long ticks){
+	c->due = w->now + ticks;
+	c->ready = 0;
+	struct collector **head = &w->slot[c->due & (WHEEL_SLOTS - 1)];
+	c->next = *head;
+	*head = c;
+}
+
+void wheel_advance(struct timing_wheel *w){
+	w->now++;
+	struct collector **pp = &w->slot[w->now & (WHEEL_SLOTS - 1)];
+	while(*pp){
+		struct collector *c = *pp;
+		if(c->due <= w->now){
+			*pp = c->next;
+			c->next = NULL;
+			c->ready = 1;
+		} else {
+			pp = &c->next;
+		}
+	}
+}
+
+unsigned long wheel_ticks(double period_s, double tick_s){
+	if(!(period_s > 0.0) || !(tick_s > 0.0)) return 1;
+	double n = floor(period_s / tick_s + 0.5);
+	return n < 1.0 ? 1 : (unsigned long)n;
+}
+
+void wheel_rescale(struct timing_wheel *w, double old_tick_s, double new_tick_s){
+	struct collector *all = NULL;
+	for(int i = 0; i < WHEEL_SLOTS; i++){
+		while(w->slot[i]){
+			struct collector *c = w->slot[i];
+			w->slot[i] = c->next;
+			c->next = all;
+			all = c;
+		}
+	}
+	while(all){
+		struct collector *c = all;
+		all = c->next;
+		double left_s = (double)(c->due > w->now ? c->due - w->now : 1) * old_tick_s;
+		wheel_schedule(w, c, wheel_ticks(left_s, new_tick_s));
+	}
+}
@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "config.h"
+#include "window.h"
+#include "procs.h"
+#include "sampler.h"
+#include "flight.h"
+#include "deadband.h"
+#include "arena.h"
+#include "forecast.h"
+
+void config_defaults(struct probe_config *cfg){
+	cfg->interval_s = 1.0;
+	cfg->adaptive = 0;
+	cfg->slow_s = 10.0;
+	cfg->fast_s = 0.05;
+	cfg->calm_s = 30.0;
+	cfg->window = CPU_WINDOW;
+	cfg->ewma_alpha = 0.0;
+	cfg->summary_s = 60.0;
+	cfg->self_s = 0.0;
+	cfg->deadband = 0.0;
+	cfg->heartbeat_s = 0.0;
+	cfg->queue = 4096;
+	cfg->top_n = PROCS_TOP_DEFAULT;
+	cfg->proc_rescan = PROCS_RESCAN_DEFAULT;
+	cfg->psi_cgroup = NULL;
+	cfg->bpf = 0;
+	cfg->cgroup_root = NULL;
+	cfg->psi_ntrig = 0;
+	cfg->nperiods = 0;
+	cfg->rules_file = NULL;
+	cfg->nrules = 0;
+	cfg->replay = NULL;
+	cfg->capture = NULL;
+	cfg->flight = NULL;
+	cfg->flight_mb = FLIGHT_DEFAULT_MB;
+	cfg->push = NULL;
+	cfg->listen = NULL;
+	cfg->arena_mb = 0;
+	cfg->mlock = 0;
+	cfg->cpu_list = NULL;
+	cfg->nice = 0;
+	cfg->have_nice = 0;
+	cfg->sched = PROBE_SCHED_DEFAULT;
+	cfg->sched_prio = 0;
+	cfg->numa = 0;
+	cfg->predict_s = 0.0;
+	cfg->predict_fit_s = FORECAST_FIT_S;
+	cfg->format = FORMAT_JSONL;
+	cfg->flush = FLUSH_RECORD;
+	cfg->flush_every_n = 1;
+	cfg->flush_every_ms = 0.0;
+}
+
+void config_usage(const char *prog){
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -i, --interval S     sampling period in seconds, down to 0.0001\n"
+		"                       (default 1)\n"
+		"      --adaptive       sample every --slow S while all is well and every\n"
+		"                       --fast S from the first sign of trouble until\n"
+		"                       --calm S passed without any (defaults 10, 0.05,\n"
+		"                       30)\n"
+		"      --period NAME=S  run collector NAME (cpu, mem, psi, procs, disk,\n"
+		"                       net, cgroup) every S seconds instead of every tick\n"
+		"                       (repeatable)\n"
+		"  -w, --window N       cpu window length in samples (default %d)\n"
+		"      --ewma-alpha A   EWMA smoothing factor in (0,1] (default 2/(N+1))\n"
+		"      --summary S      emit a quantile summary every S seconds, 0 = off\n"
+		"                       (default 60)\n"
+		"      --self S         emit sysprobe's own CPU, RSS, latencies and bytes\n"
+		"                       written every S seconds (default off)\n"
+		"      --deadband D     write a sample only when a percent metric (cpu,\n"
+		"                       cpu_avg, cpu_hot, mem, swap, PSI some, disk\n"
+		"                       util, cgroup) moved more than D points since the\n"
+		"                       last one written, a state changed, or\n"
+		"                       --heartbeat S passed (default 60)\n"
+		"      --queue N        records buffered between sampler and writer\n"
+		"                       (default 4096)\n"
+		"      --top N          processes listed by CPU and by RSS on state\n"
+		"                       changes and summaries, 0 = off (default %d,\n"
+		"                       max %d)\n"
+		"      --proc-rescan K  full /proc scan every K ticks, only the top\n"
+		"                       processes are re-read in between (default %d)\n"
+		"      --psi-cgroup DIR read PSI from a cgroup v2 directory instead of\n"
+		"                       /proc/pressure\n"
+		"      --bpf            CPU time from sched_switch instead of /proc/stat,\n"
+		"                       plus run-queue latency, page faults and direct\n"
+		"                       reclaim (builds with libbpf only, needs\n"
+		"                       CAP_BPF and CAP_PERFMON)\n"
+		"      --cgroup-root DIR\n"
+		"                       track every cgroup v2 group under DIR (e.g.\n"
+		"                       /sys/fs/cgroup/kubepods.slice): CPU and working\n"
+		"                       set against cpu.max and memory.max, and a state\n"
+		"                       each, reported when it changes and on summaries\n"
+		"      --psi-trigger R:some|full:STALL/WINDOW\n"
+		"                       sample at once when R (cpu, memory, io) stalls\n"
+		"                       STALL ms within WINDOW ms, e.g.\n"
+		"                       memory:some:150/2000 (repeatable, up to %d)\n"
+		"      --rules FILE     threshold rules, one per line, replacing the\n"
+		"                       built-in ones\n"
+		"      --rule SPEC      one more rule (repeatable, up to %d):\n"
+		"                       METRIC[:avg|min|max|p95[/N]] [below] warn=X\n"
+		"                       [danger=Y] [hyst=H] [dwell=S] [state=cpu|mem|io|net]\n"
+		"                       e.g. \"cpu:p95/30 warn=80 danger=95 hyst=5 dwell=3\"\n"
+		"      --predict S[/T]  fit where mem_avail and cpu are heading over the\n"
+		"                       last T seconds (default %.0f) and emit a\n"
+		"                       predicted_state event when mem_avail is\n"
+		"                       projected to reach the warn or danger ratio\n"
+		"                       of the mem_avail_pct rule within S seconds;\n"
+		"                       adds mem_eta_s and cpu_z for the rules\n"
+		"      --capture DIR    record the /proc/stat and /proc/meminfo read on\n"
+		"                       every tick into DIR\n"
+		"      --replay PATH    run from a --capture DIR, or re-apply the rules\n"
+		"                       to a binary trace, as fast as possible\n"
+		"      --flight FILE    also keep the latest samples in FILE, a fixed-size\n"
+		"                       mmap'd ring that outlives sysprobe; read it with\n"
+		"                       sysprobe-decode [--last 10m] FILE\n"
+		"      --flight-size MB size of the --flight file (default %u)\n"
+		"      --push ADDR      also stream samples to sysprobe-agg at\n"
+		"                       udp:HOST:PORT or unix:PATH\n"
+		"      --listen [HOST]:PORT\n"
+		"                       serve the latest sample in OpenMetrics format\n"
+		"                       over HTTP, e.g. --listen :9161\n"
+		"      --arena MB       hold all of sysprobe's state in a fixed MB arena\n"
+		"                       set up at startup; a table that would outgrow\n"
+		"                       it stops growing (default: what startup used\n"
+		"                       plus %d MB)\n"
+		"      --mlock          lock the arena in memory, so the probe is not\n"
+		"                       swapped out under the pressure it reports\n"
+		"                       (needs CAP_IPC_LOCK or ulimit -l)\n"
+		"      --cpu LIST       keep the sampler and writer on CPUs LIST, e.g.\n"
+		"                       a housekeeping core: 3 or 0-1,8\n"
+		"      --nice N         run at nice N (-20..19)\n"
+		"      --sched P        idle or batch for low-impact profiling, fifo[:PRIO]\n"
+		"                       or rr[:PRIO] (default %d) for the sampler's\n"
+		"                       timestamps during incidents, or other\n"
+		"      --numa           allocate the per-core arrays, rings and buffers\n"
+		"                       on the node of the first --cpu (without --cpu,\n"
+		"                       stay on the node sysprobe starts on)\n"
+		"      --format F       output format: jsonl or bin (default jsonl)\n"
+		"      --flush P        output flush policy: record, full, N (records)\n"
+		"                       or Tms (default record)\n"
+		"  -h, --help           show this help\n",
+		prog, CPU_WINDOW, PROCS_TOP_DEFAULT, PROCS_TOP_MAX,
+		PROCS_RESCAN_DEFAULT, PSI_MAX_TRIGGERS, CONFIG_MAX_RULES, FORECAST_FIT_S,
+		FLIGHT_DEFAULT_MB,
+		ARENA_HEADROOM_MB, PLACEMENT_RT_PRIO);
+}
+
+static int parse_int(const char *s, int *out){
+	char *end;
+	long v = strtol(s, &end, 10);
+	if(*s == '\0' || *end != '\0' || v < 1 || v > 1000000000L) return -1;
+	*out = (int)v;
+	return 0;
+}
+
+static int parse_double(const char *s, double *out){
+	char *end;
+	double v = strtod(s, &end);
+	if(*s == '\0' || *end != '\0') return -1;
+	*out = v;
+	return 0;
+}
+
+enum {
+	OPT_EWMA_ALPHA = 256,
+	OPT_ADAPTIVE,
+	OPT_SLOW,
+	OPT_FAST,
+	OPT_CALM,
+	OPT_SUMMARY,
+	OPT_FLUSH,
+	OPT_FORMAT,
+	OPT_QUEUE,
+	OPT_TOP,
+	OPT_PROC_RESCAN,
+	OPT_PSI_CGROUP,
+	OPT_PSI_TRIGGER,
+	OPT_CGROUP_ROOT,
+	OPT_BPF,
+	OPT_PERIOD,
+	OPT_RULES,
+	OPT_RULE,
+	OPT_SELF,
+	OPT_DEADBAND,
+	OPT_HEARTBEAT,
+	OPT_REPLAY,
+	OPT_CAPTURE,
+	OPT_FLIGHT,
+	OPT_FLIGHT_SIZE,
+	OPT_PUSH,
+	OPT_LISTEN,
+	OPT_ARENA,
+	OPT_MLOCK,
+	OPT_CPU,
+	OPT_NICE,
+	OPT_SCHED,
+	OPT_NUMA,
+	OPT_PREDICT,
+};
+
+int config_parse_args(struct probe_config *cfg, int argc, char *argv[]){
+	static const struct option opts[] = {
+		{ "interval",   required_argument, NULL, 'i' },
+		{ "window",     required_argument, NULL, 'w' },
+		{ "adaptive",   no_argument,       NULL, OPT_ADAPTIVE },
+		{ "slow",       required_argument, NULL, OPT_SLOW },
+		{ "fast",       required_argument, NULL, OPT_FAST },
+		{ "calm",       required_argument, NULL, OPT_CALM },
+		{ "ewma-alpha", required_argument, NULL, OPT_EWMA_ALPHA },
+		{ "summary",    required_argument, NULL, OPT_SUMMARY },
+		{ "self",       required_argument, NULL, OPT_SELF },
+		{ "deadband",   required_argument, NULL, OPT_DEADBAND },
+		{ "heartbeat",  required_argument, NULL, OPT_HEARTBEAT },
+		{ "flush",      required_argument, NULL, OPT_FLUSH },
+		{ "format",     required_argument, NULL, OPT_FORMAT },
+		{ "queue",      required_argument, NULL, OPT_QUEUE },
+		{ "top",        required_argument, NULL, OPT_TOP },
+		{ "proc-rescan", required_argument, NULL, OPT_PROC_RESCAN },
+		{ "psi-cgroup", required_argument, NULL, OPT_PSI_CGROUP },
+		{ "psi-trigger", required_argument, NULL, OPT_PSI_TRIGGER },
+		{ "cgroup-root", required_argument, NULL, OPT_CGROUP_ROOT },
+		{ "bpf",        no_argument,       NULL, OPT_BPF },
+		{ "period",     required_argument, NULL, OPT_PERIOD },
+		{ "rules",      required_argument, NULL, OPT_RULES },
+		{ "rule",       required_argument, NULL, OPT_RULE },
+		{ "replay",     required_argument, NULL, OPT_REPLAY },
+		{ "capture",    required_argument, NULL, OPT_CAPTURE },
+		{ "flight",     required_argument, NULL, OPT_FLIGHT },
+		{ "flight-size", required_argument, NULL, OPT_FLIGHT_SIZE },
+		{ "push",       required_argument, NULL, OPT_PUSH },
+		{ "listen",     required_argument, NULL, OPT_LISTEN },
+		{ "arena",      required_argument, NULL, OPT_ARENA },
+		{ "mlock",      no_argument,       NULL, OPT_MLOCK },
+		{ "cpu",        required_argument, NULL, OPT_CPU },
+		{ "nice",       required_argument, NULL, OPT_NICE },
+		{ "sched",      required_argument, NULL, OPT_SCHED },
+		{ "numa",       no_argument,       NULL, OPT_NUMA },
+		{ "predict",    required_argument, NULL, OPT_PREDICT },
+		{ "help",       no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	config_defaults(cfg);
+	int c;
+	while((c = getopt_long(argc, argv, "i:w:h", opts, NULL)) != -1){
+		switch(c){
+		case 'i':
+			if(parse_double(optarg, &cfg->interval_s) != 0 ||
+					cfg->interval_s < 0.0001){
+				fprintf(stderr, "bad --interval: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_ADAPTIVE:
+			cfg->adaptive = 1;
+			break;
+		case OPT_SLOW:
+		case OPT_FAST: {
+			double *v = c == OPT_SLOW ? &cfg->slow_s : &cfg->fast_s;
+			if(parse_double(optarg, v) != 0 || *v < 0.0001){
+				fprintf(stderr, "bad --%s: %s\n", c == OPT_SLOW ? "slow" : "fast", optarg);
+				return -1;
+			}
+			cfg->adaptive = 1;
+			break;
+		}
+		case OPT_CALM:
+			if(parse_double(optarg, &cfg->calm_s) != 0 || cfg->calm_s < 0.0){
+				fprintf(stderr, "bad --calm: %s\n", optarg);
+				return -1;
+			}
+			cfg->adaptive = 1;
+			break;
+		case 'w':
+			if(parse_int(optarg, &cfg->window) != 0){
+				fprintf(stderr, "bad --window: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_EWMA_ALPHA:
+			if(parse_double(optarg, &cfg->ewma_alpha) != 0 ||
+					cfg->ewma_alpha <= 0.0 || cfg->ewma_alpha > 1.0){
+				fprintf(stderr, "bad --ewma-alpha: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_SUMMARY:
+			if(parse_double(optarg, &cfg->summary_s) != 0 ||
+					cfg->summary_s < 0.0){
+				fprintf(stderr, "bad --summary: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_REPLAY:
+			cfg->replay = optarg;
+			break;
+		case OPT_CAPTURE:
+			cfg->capture = optarg;
+			break;
+		case OPT_PUSH:
+			cfg->push = optarg;
+			break;
+		case OPT_LISTEN:
+			cfg->listen = optarg;
+			break;
+		case OPT_FLIGHT:
+			cfg->flight = optarg;
+			break;
+		case OPT_FLIGHT_SIZE: {
+			int mb;
+			if(parse_int(optarg, &mb) != 0 || mb > 65536){
+				fprintf(stderr, "bad --flight-size: %s\n", optarg);
+				return -1;
+			}
+			cfg->flight_mb = (unsigned)mb;
+			break;
+		}
+		case OPT_ARENA: {
+			int mb;
+			if(parse_int(optarg, &mb) != 0 || mb > 65536){
+				fprintf(stderr, "bad --arena: %s\n", optarg);
+				return -1;
+			}
+			cfg->arena_mb = (unsigned)mb;
+			break;
+		}
+		case OPT_MLOCK:
+			cfg->mlock = 1;
+			break;
+		case OPT_CPU:
+			if(placement_parse_cpus(optarg) != 0){
+				fprintf(stderr, "bad --cpu: %s\n", optarg);
+				return -1;
+			}
+			cfg->cpu_list = optarg;
+			break;
+		case OPT_NICE: {
+			char *end;
+			long v = strtol(optarg, &end, 10);
+			if(*optarg == '\0' || *end != '\0' || v < -20 || v > 19){
+				fprintf(stderr, "bad --nice: %s\n", optarg);
+				return -1;
+			}
+			cfg->nice = (int)v;
+			cfg->have_nice = 1;
+			break;
+		}
+		case OPT_SCHED:
+			if(placement_parse_sched(optarg, &cfg->sched, &cfg->sched_prio) != 0){
+				fprintf(stderr, "bad --sched: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_NUMA:
+			cfg->numa = 1;
+			break;
+		case OPT_PREDICT: {
+			char *fit = strchr(optarg, '/');
+			if(fit) *fit = '\0';
+			int bad = parse_double(optarg, &cfg->predict_s) != 0 || !(cfg->predict_s > 0.0) ||
+				(fit && (parse_double(fit + 1, &cfg->predict_fit_s) != 0 ||
+					 !(cfg->predict_fit_s > 0.0)));
+			if(fit) *fit = '/';
+			if(bad){
+				fprintf(stderr, "bad --predict: %s\n", optarg);
+				return -1;
+			}
+			break;
+		}
+		case OPT_DEADBAND:
+			if(parse_double(optarg, &cfg->deadband) != 0 || cfg->deadband <= 0.0){
+				fprintf(stderr, "bad --deadband: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_HEARTBEAT:
+			if(parse_double(optarg, &cfg->heartbeat_s) != 0 || cfg->heartbeat_s <= 0.0){
+				fprintf(stderr, "bad --heartbeat: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_SELF:
+			if(parse_double(optarg, &cfg->self_s) != 0 || cfg->self_s < 0.0){
+				fprintf(stderr, "bad --self: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_FLUSH:
+			if(out_parse_policy(optarg, &cfg->flush, &cfg->flush_every_n,
+						&cfg->flush_every_ms) != 0){
+				fprintf(stderr, "bad --flush: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_QUEUE: {
+			int q;
+			if(parse_int(optarg, &q) != 0 || q > (1 << 24)){
+				fprintf(stderr, "bad --queue: %s\n", optarg);
+				return -1;
+			}
+			cfg->queue = (unsigned)q;
+			break;
+		}
+		case OPT_TOP:
+			if(strcmp(optarg, "0") == 0){
+				cfg->top_n = 0;
+			} else if(parse_int(optarg, &cfg->top_n) != 0 ||
+					cfg->top_n > PROCS_TOP_MAX){
+				fprintf(stderr, "bad --top: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_PROC_RESCAN:
+			if(parse_int(optarg, &cfg->proc_rescan) != 0){
+				fprintf(stderr, "bad --proc-rescan: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case OPT_PSI_CGROUP:
+			cfg->psi_cgroup = optarg;
+			break;
+		case OPT_BPF:
+			cfg->bpf = 1;
+			break;
+		case OPT_CGROUP_ROOT:
+			cfg->cgroup_root = optarg;
+			break;
+		case OPT_PSI_TRIGGER:
+			if(cfg->psi_ntrig >= PSI_MAX_TRIGGERS ||
+					psi_parse_trigger(optarg, &cfg->psi_trig[cfg->psi_ntrig]) != 0){
+				fprintf(stderr, "bad --psi-trigger: %s\n", optarg);
+				return -1;
+			}
+			cfg->psi_ntrig++;
+			break;
+		case OPT_PERIOD: {
+			char *eq = strchr(optarg, '=');
+			struct collector_period *p = &cfg->periods[cfg->nperiods];
+			if(!eq || cfg->nperiods >= CONFIG_MAX_PERIODS ||
+					parse_double(eq + 1, &p->period_s) != 0 || p->period_s < 0.0){
+				fprintf(stderr, "bad --period: %s\n", optarg);
+				return -1;
+			}
+			*eq = '\0';
+			if(!sampler_collector_known(optarg)){
+				fprintf(stderr, "unknown collector: %s\n", optarg);
+				return -1;
+			}
+			p->name = optarg;
+			cfg->nperiods++;
+			break;
+		}
+		case OPT_RULES:
+			cfg->rules_file = optarg;
+			break;
+		case OPT_RULE:
+			if(cfg->nrules >= CONFIG_MAX_RULES){
+				fprintf(stderr, "too many --rule options (max %d)\n", CONFIG_MAX_RULES);
+				return -1;
+			}
+			cfg->rules[cfg->nrules++] = optarg;
+			break;
+		case OPT_FORMAT:
+			if(strcmp(optarg, "jsonl") == 0) cfg->format = FORMAT_JSONL;
+			else if(strcmp(optarg, "bin") == 0) cfg->format = FORMAT_BIN;
+			else {
+				fprintf(stderr, "bad --format: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'h':
+			config_usage(argv[0]);
+			return 1;
+		default:
+			config_usage(argv[0]);
+			return -1;
+		}
+	}
+	if(cfg->adaptive){
+		if(cfg->fast_s > cfg->slow_s){
+			fprintf(stderr, "--fast must not be slower than --slow\n");
+			return -1;
+		}
+		cfg->interval_s = cfg->slow_s;
+	}
+	if(cfg->heartbeat_s > 0.0 && cfg->deadband <= 0.0){
+		fprintf(stderr, "--heartbeat only goes with --deadband\n");
+		return -1;
+	}
+	if(cfg->deadband > 0.0 && cfg->heartbeat_s <= 0.0) cfg->heartbeat_s = DEADBAND_HEARTBEAT_S;
+	if(cfg->replay && (cfg->capture || cfg->adaptive || cfg->psi_ntrig)){
+		fprintf(stderr, "--replay does not go with --capture, --adaptive or --psi-trigger\n");
+		return -1;
+	}
+	// every capture frame is a fresh read: cpu and mem on a longer
+	// --period would stamp stale /proc images with the current time
+	for(int i = 0; cfg->capture && i < cfg->nperiods; i++){
+		const struct collector_period *p = &cfg->periods[i];
+		if(strcmp(p->name, "cpu") != 0 && strcmp(p->name, "mem") != 0) continue;
+		int later = 0;	// the last --period for a collector is the one used
+		for(int j = i + 1; j < cfg->nperiods; j++)
+			later |= strcmp(cfg->periods[j].name, p->name) == 0;
+		if(!later && p->period_s > 0.0 && (cfg->adaptive || p->period_s != cfg->interval_s)){
+			fprintf(stderr, "--capture needs cpu and mem read on every tick, not --period %s=%g\n",
+					p->name, p->period_s);
+			return -1;
+		}
+	}
+	// a capture holds /proc/stat, which --bpf no longer reads
+	if(cfg->bpf && (cfg->replay || cfg->capture)){
+		fprintf(stderr, "--bpf does not go with --replay or --capture\n");
+		return -1;
+	}
+	// a replay never sleeps: a realtime one would own its CPU
+	if(cfg->replay && (cfg->sched == PROBE_SCHED_FIFO || cfg->sched == PROBE_SCHED_RR)){
+		fprintf(stderr, "--replay does not go with --sched fifo or rr\n");
+		return -1;
+	}
+	if(optind < argc){
+		fprintf(stderr, "unexpected argument: %s\n", argv[optind]);
+		config_usage(argv[0]);
+		return -1;
+	}
+	return 0;
+}
@@ -1,39 +1,104 @@
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include "arena.h"
 #include "cpu.h"
+#include "parse.h"
 
 
 
+// Highest id in /sys/devices/system/cpu/present ("0-7", "0,2,4-6"),
+// plus one: with sparse ids that is more than the configured count.
+static long cpu_present_slots(void){
+	char buf[256];
+	FILE *f = fopen("/sys/devices/system/cpu/present", "r");
+	if(!f) return 0;
+	size_t n = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	long id, last = -1;
+	for(const char *p = buf, *end = buf + n; (p = parse_long(p, end, &id)) != NULL; ){
+		last = id;
+		while(p < end && (*p == ',' || *p == '-')) p++;
+	}
+	return last + 1;
+}
+
 int read_cpu_capacity(struct cpu_capacity *cap){
 	if(!cap) return -1;
-	long cores = sysconf(_SC_NPROCESSORS_ONLN);
-       	if(cores < 1) cores = 1;
+	// slots for every CPU that can come online, so a hotplugged one
+	// keeps its id
+	long cores = sysconf(_SC_NPROCESSORS_CONF);
+	long present = cpu_present_slots();
+	if(present > cores) cores = present;
+	if(cores < 1) cores = 1;
 	cap->cores = (int)cores;
 	cap->max_freq_khz = -1;	
 	FILE *f = fopen("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq", "r");
 	if (!f) {
-		printf("Frequency info is not exposed.");
+		fprintf(stderr, "Frequency info is not exposed.\n");
 	} else {
-		fscanf(f,"%ld",&cap->max_freq_khz);
+		if(fscanf(f,"%ld",&cap->max_freq_khz) != 1)
+			cap->max_freq_khz = -1;
+		fclose(f);
 	}
 
-	fclose(f);
 	return 0;
 }
 
+int cpu_cores_init(struct cpu_cores *c, int cores){
+	if(!c) return -1;
+	if(cores < 1) cores = 1;
+	long *block = arena_calloc((size_t)cores * 8, sizeof(long));
+	unsigned char *online = arena_calloc((size_t)cores, 1);
+	if(!block || !online){
+		arena_free(block);
+		arena_free(online);
+		return -1;
+	}
+	c->cap = cores;
+	c->n = 0;
+	c->user    = block;
+	c->nice    = block + 1 * cores;
+	c->system  = block + 2 * cores;
+	c->idle    = block + 3 * cores;
+	c->iowait  = block + 4 * cores;
+	c->irq     = block + 5 * cores;
+	c->softirq = block + 6 * cores;
+	c->steal   = block + 7 * cores;
+	c->online  = online;
+	return 0;
+}
+
+void cpu_cores_free(struct cpu_cores *c){
+	if(!c) return;
+	arena_free(c->user);
+	arena_free(c->online);
+	memset(c, 0, sizeof(*c));
+}
+
+// iowait counts as idle; steal is time the hypervisor took from us and
+// counts as busy, otherwise a starved VM looks idle.
 double cpu_usage(const struct cpu_stat *prev,
 		const struct cpu_stat *curr){
-	long prev_idle = prev->idle;
-	long curr_idle = curr->idle;
+	long prev_idle = prev->idle + prev->iowait;
+	long curr_idle = curr->idle + curr->iowait;
 
 	long prev_total = prev->user +
 		prev->nice + 
 		prev->system +
-		prev->idle;
+		prev->irq +
+		prev->softirq +
+		prev->steal +
+		prev_idle;
 	long curr_total = curr->user +
 		curr->nice +
-		curr->system+
-		curr->idle;
+		curr->system +
+		curr->irq +
+		curr->softirq +
+		curr->steal +
+		curr_idle;
 	long total_delta = curr_total - prev_total;
 	long idle_delta = curr_idle - prev_idle;
 
@@ -43,18 +108,137 @@ double cpu_usage(const struct cpu_stat *prev,
 	
 }
 
+#define CPU_KERNEL_LANES 8
 
-int read_cpu_stat(struct cpu_stat *out) {
-    FILE *f = fopen("/proc/stat", "r");
-    if (!f)
-        return -1;
+// Per-core deltas over one tick are far below 2^31 jiffies, so they are
+// narrowed to int before the int->double conversion: that conversion
+// has a vector form on every SIMD ISA, the 64-bit one does not.
+static inline double cpu_usage_lane(int i,
+		const long *restrict p_user, const long *restrict p_nice,
+		const long *restrict p_system, const long *restrict p_idle,
+		const long *restrict p_iowait, const long *restrict p_irq,
+		const long *restrict p_softirq, const long *restrict p_steal,
+		const long *restrict c_user, const long *restrict c_nice,
+		const long *restrict c_system, const long *restrict c_idle,
+		const long *restrict c_iowait, const long *restrict c_irq,
+		const long *restrict c_softirq, const long *restrict c_steal){
+	int didle = (int)((c_idle[i] - p_idle[i]) + (c_iowait[i] - p_iowait[i]));
+	int dbusy = (int)((c_user[i] - p_user[i]) + (c_nice[i] - p_nice[i])
+		+ (c_system[i] - p_system[i]) + (c_irq[i] - p_irq[i])
+		+ (c_softirq[i] - p_softirq[i]) + (c_steal[i] - p_steal[i]));
+	int dtotal = dbusy + didle;
+	int ok = dtotal > 0;
+	double busy = (double)(dbusy * ok);
+	double total = (double)(dtotal * ok + (1 - ok));
+	return 100.0 * busy / total;
+}
+
+#define CPU_USAGE_LANE(i) cpu_usage_lane((i), \
+		p_user, p_nice, p_system, p_idle, p_iowait, p_irq, p_softirq, p_steal, \
+		c_user, c_nice, c_system, c_idle, c_iowait, c_irq, c_softirq, c_steal)
+
+// Batched per-core kernel. The body is straight-line arithmetic over
+// restrict-qualified arrays with no data-dependent branches (the
+// dtotal == 0 case is a select and the divisor is forced to 1), and it
+// runs in fixed blocks of CPU_KERNEL_LANES so even -O2's cheap cost
+// model vectorizes it without having to prove anything about n. The
+// remaining n % CPU_KERNEL_LANES cores go through the same lane scalar.
+void cpu_usage_kernel(int n,
+		const long *restrict p_user, const long *restrict p_nice,
+		const long *restrict p_system, const long *restrict p_idle,
+		const long *restrict p_iowait, const long *restrict p_irq,
+		const long *restrict p_softirq, const long *restrict p_steal,
+		const long *restrict c_user, const long *restrict c_nice,
+		const long *restrict c_system, const long *restrict c_idle,
+		const long *restrict c_iowait, const long *restrict c_irq,
+		const long *restrict c_softirq, const long *restrict c_steal,
+		double *restrict out){
+	int i = 0;
+	for(; i + CPU_KERNEL_LANES <= n; i += CPU_KERNEL_LANES){
+		for(int l = 0; l < CPU_KERNEL_LANES; l++)
+			out[i + l] = CPU_USAGE_LANE(i + l);
+	}
+	for(; i < n; i++)
+		out[i] = CPU_USAGE_LANE(i);
+}
+
+void cpu_cores_usage(const struct cpu_cores *prev,
+		const struct cpu_cores *curr, double *out){
+	int n = curr->n > prev->n ? curr->n : prev->n;
+	cpu_usage_kernel(n,
+			prev->user, prev->nice, prev->system, prev->idle,
+			prev->iowait, prev->irq, prev->softirq, prev->steal,
+			curr->user, curr->nice, curr->system, curr->idle,
+			curr->iowait, curr->irq, curr->softirq, curr->steal,
+			out);
+	// kept out of the kernel so it stays branch-free
+	for(int i = 0; i < n; i++)
+		if(!(prev->online[i] & curr->online[i])) out[i] = NAN;
+}
+
+
+// user nice system idle are mandatory; iowait onwards only exist on
+// newer kernels and default to zero.
+static const char *parse_cpu_fields(const char *p, const char *end, long v[8]){
+	for(int i = 0; i < 8; i++){
+		const char *q = parse_long(p, end, &v[i]);
+		if(!q){
+			if(i < 4) return NULL;
+			v[i] = 0;
+			continue;
+		}
+		p = q;
+	}
+	return p;
+}
 
-    int n = fscanf(f, "cpu %ld %ld %ld %ld",
-                    &out->user,
-                    &out->nice,
-                    &out->system,
-                    &out->idle);
+int parse_cpu_stat(const char *buf, size_t len, struct cpu_stat *out,
+		struct cpu_cores *cores){
+	const char *p = buf;
+	const char *end = buf + len;
+	long v[8];
+	if(len < 4 || memcmp(p, "cpu ", 4) != 0) return -1;
+	if(!parse_cpu_fields(p + 4, end, v)) return -1;
+	out->user = v[0];
+	out->nice = v[1];
+	out->system = v[2];
+	out->idle = v[3];
+	out->iowait = v[4];
+	out->irq = v[5];
+	out->softirq = v[6];
+	out->steal = v[7];
+	if(!cores) return 0;
+
+	int n = 0;
+	memset(cores->online, 0, (size_t)cores->cap);
+	p = parse_next_line(p, end);
+	while(p + 4 <= end && memcmp(p, "cpu", 3) == 0 && (unsigned)(p[3] - '0') <= 9){
+		long id;
+		if(!(p = parse_long(p + 3, end, &id)) || !parse_cpu_fields(p, end, v)) break;
+		p = parse_next_line(p, end);
+		// a CPU beyond the slots sized at startup is left out
+		if(id >= cores->cap) continue;
+		cores->user[id] = v[0];
+		cores->nice[id] = v[1];
+		cores->system[id] = v[2];
+		cores->idle[id] = v[3];
+		cores->iowait[id] = v[4];
+		cores->irq[id] = v[5];
+		cores->softirq[id] = v[6];
+		cores->steal[id] = v[7];
+		cores->online[id] = 1;
+		if(id >= n) n = (int)id + 1;
+	}
+	cores->n = n;
+	return 0;
+}
+
+int read_cpu_stat(struct probe_ctx *ctx, struct cpu_stat *out,
+		struct cpu_cores *cores) {
+    if (!ctx || !out)
+        return -1;
+    if (proc_file_read(&ctx->stat) < 0)
+        return -1;
 
-    fclose(f);
-    return (n == 4) ? 0 : -1;
+    return parse_cpu_stat(ctx->stat.buf, ctx->stat.len, out, cores);
 }
@@ -0,0 +1,42 @@
+#include <math.h>
+#include <string.h>
+#include "deadband.h"
+
+void deadband_init(struct deadband *d, double delta, double heartbeat_s,
+		const struct sample_meta *meta){
+	memset(d, 0, sizeof(*d));
+	d->delta = delta;
+	d->heartbeat_s = heartbeat_s > 0.0 ? heartbeat_s : DEADBAND_HEARTBEAT_S;
+	d->mem_total_gb = meta->mem_total_gb;
+	d->swap_total_gb = meta->swap_total_gb;
+}
+
+static double pct_of(double v, double total){
+	return total > 0.0 ? v / total * 100.0 : 0.0;
+}
+
+static int moved(double last, double v, double delta){
+	// a metric appearing or going away (NaN) counts as a move
+	if(isnan(last) || isnan(v)) return isnan(last) != isnan(v);
+	return fabs(v - last) > delta;
+}
+
+int deadband_pass(struct deadband *d, const struct sample *s, int state_change){
+	double v[DEADBAND_NVAL] = {
+		s->cpu_pct, s->cpu_avg,
+		pct_of(s->mem_used_gb, d->mem_total_gb), pct_of(s->swap_used_gb, d->swap_total_gb),
+		s->psi_cpu_some, s->psi_mem_some, s->psi_io_some,
+		s->disk_util_pct, s->cpu_hot_avg, s->cgroup_mem_pct, s->cgroup_cpu_pct,
+	};
+	int out = !d->have || state_change || s->t - d->last_t >= d->heartbeat_s;
+	for(int i = 0; !out && i < DEADBAND_NVAL; i++)
+		out = moved(d->last[i], v[i], d->delta);
+	if(!out){
+		d->skipped++;
+		return 0;
+	}
+	memcpy(d->last, v, sizeof(v));
+	d->last_t = s->t;
+	d->have = 1;
+	return 1;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "arena.h"
+#include "disk.h"
+#include "parse.h"
+#include "probe.h"
+#include "sample.h"
+
+#define SECTOR_BYTES 512.0
+
+static int skip_dev(const char *name, size_t n){
+	return (n > 4 && memcmp(name, "loop", 4) == 0) ||
+		(n > 3 && memcmp(name, "ram", 3) == 0);
+}
+
+// "major minor name rd_ios rd_merges rd_sect rd_ms wr_ios wr_merges
+//  wr_sect wr_ms in_flight io_ms weighted_ms [discard/flush ...]"
+int parse_diskstats(const char *buf, size_t len, struct disk_counters *out){
+	const char *p = buf, *end = buf + len;
+	int n = 0;
+	for(; p < end && n < DISK_MAX; p = parse_next_line(p, end)){
+		const char *next = parse_next_line(p, end);
+		long major, minor, v[10];
+		const char *q = parse_long(p, next, &major);
+		if(!q || !(q = parse_long(q, next, &minor))) continue;
+		const char *nm = parse_skip_blank(q, next);
+		q = nm;
+		while(q < next && *q != ' ' && *q != '\n') q++;
+		size_t nl = (size_t)(q - nm);
+		if(nl == 0 || nl >= DISK_NAME || skip_dev(nm, nl)) continue;
+		int i;
+		for(i = 0; i < 10 && (q = parse_long(q, next, &v[i])) != NULL; i++)
+			;
+		if(i < 10) continue;
+		memcpy(out->name[n], nm, nl);
+		out->name[n][nl] = '\0';
+		out->rd_ios[n] = (unsigned long long)v[0];
+		out->rd_sect[n] = (unsigned long long)v[2];
+		out->rd_ms[n] = (unsigned long long)v[3];
+		out->wr_ios[n] = (unsigned long long)v[4];
+		out->wr_sect[n] = (unsigned long long)v[6];
+		out->wr_ms[n] = (unsigned long long)v[7];
+		out->io_ms[n] = (unsigned long long)v[9];
+		n++;
+	}
+	out->n = n;
+	return 0;
+}
+
+static inline double delta(unsigned long long prev, unsigned long long curr){
+	return curr >= prev ? (double)(curr - prev) : 0.0;
+}
+
+// Slot of `name` in `c`: `hint` (the same slot) first, as the list
+// rarely changes between reads, then the rest.
+static int find_dev(const struct disk_counters *c, const char *name, int hint){
+	if(hint < c->n && strcmp(c->name[hint], name) == 0) return hint;
+	for(int i = 0; i < c->n; i++)
+		if(strcmp(c->name[i], name) == 0) return i;
+	return -1;
+}
+
+void disk_rates(const struct disk_counters *prev, const struct disk_counters *curr,
+		double dt_s, struct disk_rates *out){
+	memset(out, 0, sizeof(*out));
+	if(!(dt_s > 0.0)) return;
+	for(int i = 0; i < curr->n; i++){
+		if(!curr->whole[i]) continue;
+		int j = find_dev(prev, curr->name[i], i);
+		if(j < 0) continue;
+		double rd = delta(prev->rd_ios[j], curr->rd_ios[i]);
+		double wr = delta(prev->wr_ios[j], curr->wr_ios[i]);
+		out->rd_iops += rd / dt_s;
+		out->wr_iops += wr / dt_s;
+		out->rd_mb_s += delta(prev->rd_sect[j], curr->rd_sect[i]) * SECTOR_BYTES / 1048576.0 / dt_s;
+		out->wr_mb_s += delta(prev->wr_sect[j], curr->wr_sect[i]) * SECTOR_BYTES / 1048576.0 / dt_s;
+		if(rd + wr > 0.0){
+			double await = (delta(prev->rd_ms[j], curr->rd_ms[i]) +
+					delta(prev->wr_ms[j], curr->wr_ms[i])) / (rd + wr);
+			if(await > out->await_ms) out->await_ms = await;
+		}
+		double util = delta(prev->io_ms[j], curr->io_ms[i]) / (dt_s * 1000.0) * 100.0;
+		if(util > 100.0) util = 100.0;
+		if(util > out->util_pct) out->util_pct = util;
+	}
+}
+
+// ---- collector ----
+
+struct disk_source {
+	struct proc_file file;
+	struct disk_counters snap[2];
+	int cur;
+	double prev_t;
+	struct disk_rates rates;
+};
+
+// Any device under /sys/block/X/slaves: dm-*, md*, bcache*, ...
+static int stacked(const char *path){
+	char slaves[80 + DISK_NAME];
+	snprintf(slaves, sizeof(slaves), "%s/slaves", path);
+	DIR *d = opendir(slaves);
+	if(!d) return 0;
+	int n = 0;
+	struct dirent *de;
+	while(!n && (de = readdir(d))) n = de->d_name[0] != '.';
+	closedir(d);
+	return n;
+}
+
+// Partitions have no /sys/block entry, and stacked devices pass their
+// I/O on to the leaves, where it is already counted. Only checked for a
+// name the previous read did not have, so a stable device list costs no
+// extra syscalls.
+static void mark_whole(const struct disk_counters *prev, struct disk_counters *curr){
+	char path[64 + DISK_NAME];
+	for(int i = 0; i < curr->n; i++){
+		int j = find_dev(prev, curr->name[i], i);
+		if(j >= 0){
+			curr->whole[i] = prev->whole[j];
+			continue;
+		}
+		int n = snprintf(path, sizeof(path), "/sys/block/%s", curr->name[i]);
+		// "cciss/c0d0" is "cciss!c0d0" in sysfs
+		for(int k = (int)sizeof("/sys/block/") - 1; k < n; k++)
+			if(path[k] == '/') path[k] = '!';
+		curr->whole[i] = access(path, F_OK) == 0 && !stacked(path);
+	}
+}
+
+static int disk_read(struct disk_source *d){
+	if(proc_file_read(&d->file) < 0) return -1;
+	struct disk_counters *curr = &d->snap[d->cur];
+	parse_diskstats(d->file.buf, d->file.len, curr);
+	mark_whole(&d->snap[!d->cur], curr);
+	return 0;
+}
+
+static int disk_init(struct collector *c, struct sampler *sp){
+	(void)sp;
+	struct disk_source *d = arena_calloc(1, sizeof(*d));
+	if(!d) return -1;
+	// no /proc/diskstats (some containers): leave the collector out
+	if(proc_file_open(&d->file, "/proc/diskstats", DISK_BUF) != 0){
+		arena_free(d);
+		return 1;
+	}
+	disk_read(d);
+	d->cur = 1;
+	c->priv = d;
+	return 0;
+}
+
+static int disk_sample(struct collector *c, struct sampler *sp, double t){
+	(void)sp;
+	struct disk_source *d = c->priv;
+	if(disk_read(d) != 0) return -1;
+	disk_rates(&d->snap[!d->cur], &d->snap[d->cur], t - d->prev_t, &d->rates);
+	d->prev_t = t;
+	d->cur = !d->cur;
+	return 0;
+}
+
+static void disk_emit(const struct collector *c, const struct sampler *sp, struct sample *s){
+	(void)sp;
+	const struct disk_source *d = c->priv;
+	s->disk_rd_iops = d->rates.rd_iops;
+	s->disk_wr_iops = d->rates.wr_iops;
+	s->disk_rd_mb_s = d->rates.rd_mb_s;
+	s->disk_wr_mb_s = d->rates.wr_mb_s;
+	s->disk_await_ms = d->rates.await_ms;
+	s->disk_util_pct = d->rates.util_pct;
+}
+
+static void disk_teardown(struct collector *c, struct sampler *sp){
+	(void)sp;
+	struct disk_source *d = c->priv;
+	if(!d) return;
+	proc_file_close(&d->file);
+	arena_free(d);
+	c->priv = NULL;
+}
+
+const struct collector_ops disk_collector = {
+	"disk", disk_init, disk_sample, disk_emit, disk_teardown, SRC_DISK
+};
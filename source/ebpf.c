@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arena.h"
+#include "ebpf.h"
+
+#ifdef SYSPROBE_BPF
+
+#include <errno.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include "sysprobe.skel.h"
+
+static int warn_only(enum libbpf_print_level level, const char *fmt, va_list ap){
+	return level == LIBBPF_WARN ? vfprintf(stderr, fmt, ap) : 0;
+}
+
+// the clock of bpf_ktime_get_ns()
+static unsigned long long mono_ns(void){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static int tracepoint_exists(const char *name){
+	static const char *const roots[] = { "/sys/kernel/tracing", "/sys/kernel/debug/tracing" };
+	char path[160];
+	for(int i = 0; i < 2; i++){
+		snprintf(path, sizeof(path), "%s/events/%s", roots[i], name);
+		if(access(path, F_OK) == 0) return 1;
+	}
+	return 0;
+}
+
+int ebpf_open(struct ebpf_source *e){
+	memset(e, 0, sizeof(*e));
+	e->map_fd = -1;
+	e->read_t = -1.0;
+	e->runq_avg_us = NAN;
+	e->runq_p99_us = NAN;
+	e->pgfault_s = NAN;
+	e->reclaim_ms_s = NAN;
+	libbpf_set_print(warn_only);
+	struct sysprobe_bpf *skel = sysprobe_bpf__open();
+	if(!skel){
+		fprintf(stderr, "--bpf: cannot open the BPF object: %s\n", strerror(errno));
+		return -1;
+	}
+	e->skel = skel;
+	// the mm tracepoints are optional: what a kernel lacks is left out
+	const struct { struct bpf_program *prog; const char *tp; } opt[] = {
+		{ skel->progs.handle_fault, "exceptions/page_fault_user" },
+		{ skel->progs.handle_reclaim_begin, "vmscan/mm_vmscan_direct_reclaim_begin" },
+		{ skel->progs.handle_reclaim_end, "vmscan/mm_vmscan_direct_reclaim_end" },
+		{ skel->progs.handle_kswapd, "vmscan/mm_vmscan_wakeup_kswapd" },
+	};
+	for(size_t i = 0; i < sizeof(opt) / sizeof(opt[0]); i++)
+		if(!tracepoint_exists(opt[i].tp)) bpf_program__set_autoload(opt[i].prog, false);
+	e->faults_on = bpf_program__autoload(skel->progs.handle_fault);
+	int err = sysprobe_bpf__load(skel);
+	if(!err) err = sysprobe_bpf__attach(skel);
+	if(err){
+		fprintf(stderr, "--bpf: cannot load the BPF program (needs CAP_BPF and"
+				" CAP_PERFMON, and kernel BTF): %s\n", strerror(-err));
+		ebpf_close(e);
+		return -1;
+	}
+	e->map_fd = bpf_map__fd(skel->maps.cpu_acct);
+	e->ncpus = libbpf_num_possible_cpus();
+	e->vals = e->ncpus > 0 ? arena_calloc((size_t)e->ncpus, sizeof(*e->vals)) : NULL;
+	if(!e->vals){
+		perror("--bpf");
+		ebpf_close(e);
+		return -1;
+	}
+	e->open_ns = mono_ns();
+	return 0;
+}
+
+// upper edge of the bucket holding the 99th percentile of the deltas
+static double runq_p99(const unsigned long long *prev, const unsigned long long *curr,
+		unsigned long long n){
+	unsigned long long want = n - n / 100, seen = 0;
+	for(int i = 0; i < EBPF_RUNQ_SLOTS; i++){
+		seen += curr[i] - prev[i];
+		if(seen >= want) return (double)(1ULL << (i + 1));
+	}
+	return (double)(1ULL << EBPF_RUNQ_SLOTS);
+}
+
+int ebpf_read(struct ebpf_source *e, double t, struct cpu_stat *st, struct cpu_cores *cores){
+	__u32 key = 0;
+	if(bpf_map_lookup_elem(e->map_fd, &key, e->vals) != 0) return -1;
+	unsigned long long now = mono_ns();
+	long elapsed_us = (long)((now - e->open_ns) / 1000);
+	unsigned long long runq_count = 0, runq_ns = 0, faults = 0, reclaim_ns = 0;
+	unsigned long long slot[EBPF_RUNQ_SLOTS] = {0};
+	memset(st, 0, sizeof(*st));
+	if(cores) cores->n = cores->cap < e->ncpus ? cores->cap : e->ncpus;
+	for(int i = 0; i < e->ncpus; i++){
+		const struct ebpf_cpu *c = &e->vals[i];
+		unsigned long long busy = c->busy_ns;
+		// the task on the CPU since the last switch counts up to now
+		if(c->running && c->last_ns && now > c->last_ns) busy += now - c->last_ns;
+		long busy_us = (long)(busy / 1000);
+		if(busy_us > elapsed_us) busy_us = elapsed_us;
+		if(cores && i < cores->n){
+			cores->online[i] = c->last_ns != 0;
+			cores->user[i] = busy_us;
+			cores->idle[i] = elapsed_us - busy_us;
+			cores->nice[i] = cores->system[i] = cores->iowait[i] = 0;
+			cores->irq[i] = cores->softirq[i] = cores->steal[i] = 0;
+		}
+		// a possible CPU that never switched is offline
+		if(c->last_ns){
+			st->user += busy_us;
+			st->idle += elapsed_us - busy_us;
+		}
+		runq_count += c->runq_count;
+		runq_ns += c->runq_ns;
+		for(int k = 0; k < EBPF_RUNQ_SLOTS; k++) slot[k] += c->runq_slot[k];
+		faults += c->faults;
+		reclaim_ns += c->reclaim_ns;
+	}
+	if(e->read_t >= 0.0 && t > e->read_t){
+		double dt = t - e->read_t;
+		unsigned long long n = runq_count - e->runq_count;
+		e->runq_avg_us = n ? (double)(runq_ns - e->runq_ns) / 1e3 / (double)n : 0.0;
+		e->runq_p99_us = n ? runq_p99(e->runq_slot, slot, n) : 0.0;
+		e->pgfault_s = e->faults_on ? (double)(faults - e->faults) / dt : NAN;
+		e->reclaim_ms_s = (double)(reclaim_ns - e->reclaim_ns) / 1e6 / dt;
+	}
+	e->runq_count = runq_count;
+	e->runq_ns = runq_ns;
+	memcpy(e->runq_slot, slot, sizeof(slot));
+	e->faults = faults;
+	e->reclaim_ns = reclaim_ns;
+	e->read_t = t;
+	return 0;
+}
+
+void ebpf_close(struct ebpf_source *e){
+	if(e->skel) sysprobe_bpf__destroy(e->skel);
+	e->skel = NULL;
+	arena_free(e->vals);
+	e->vals = NULL;
+}
+
+#else
+
+int ebpf_open(struct ebpf_source *e){
+	memset(e, 0, sizeof(*e));
+	fprintf(stderr, "--bpf: this sysprobe was built without libbpf\n");
+	return -1;
+}
+
+int ebpf_read(struct ebpf_source *e, double t, struct cpu_stat *st, struct cpu_cores *cores){
+	(void)e;
+	(void)t;
+	(void)st;
+	(void)cores;
+	return -1;
+}
+
+void ebpf_close(struct ebpf_source *e){
+	(void)e;
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flight.h"
+
+#define FLIGHT_HDR_SIZE 4096
+#define FLIGHT_ALIGN 64
+
+static size_t slot_size_for(int cores){
+	size_t n = sizeof(struct flight_rec) + (size_t)cores * sizeof(double);
+	return (n + FLIGHT_ALIGN - 1) & ~(size_t)(FLIGHT_ALIGN - 1);
+}
+
+static double wall_now(void){
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// Same build, same geometry: keep the history.
+static int flight_reusable(const struct flight_hdr *h, size_t len, uint32_t slot_size,
+		uint32_t cores){
+	return memcmp(h->magic, FLIGHT_MAGIC, FLIGHT_MAGIC_LEN) == 0 &&
+		h->version == FLIGHT_VERSION && h->hdr_size == FLIGHT_HDR_SIZE &&
+		h->sample_size == sizeof(struct sample) && h->slot_size == slot_size &&
+		h->cores == cores && h->nslots == (len - FLIGHT_HDR_SIZE) / slot_size;
+}
+
+int flight_open(struct flight *f, const char *path, unsigned size_mb,
+		const struct sample_meta *meta){
+	memset(f, 0, sizeof(*f));
+	uint32_t cores = (uint32_t)(meta->cores > 0 ? meta->cores : 1);
+	size_t slot = slot_size_for((int)cores);
+	size_t len = (size_t)size_mb << 20;
+	if(len < FLIGHT_HDR_SIZE + 2 * slot){
+		fprintf(stderr, "%s: --flight-size too small for %u cores\n", path, cores);
+		return -1;
+	}
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0){
+		perror(path);
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || ((size_t)st.st_size != len && ftruncate(fd, (off_t)len) != 0)){
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	void *m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(m == MAP_FAILED){
+		perror(path);
+		return -1;
+	}
+	f->map = m;
+	f->len = len;
+	f->hdr = m;
+	if(!flight_reusable(f->hdr, len, (uint32_t)slot, cores)){
+		memset(f->hdr, 0, FLIGHT_HDR_SIZE);
+		memset(f->map + FLIGHT_HDR_SIZE, 0, 2 * slot);
+		f->hdr->version = FLIGHT_VERSION;
+		f->hdr->hdr_size = FLIGHT_HDR_SIZE;
+		f->hdr->sample_size = sizeof(struct sample);
+		f->hdr->slot_size = (uint32_t)slot;
+		f->hdr->cores = cores;
+		f->hdr->nslots = (len - FLIGHT_HDR_SIZE) / slot;
+		atomic_init(&f->hdr->seq, 0);
+		f->hdr->meta = *meta;
+		// the magic last: a half-initialized header is not a flight file
+		atomic_thread_fence(memory_order_release);
+		memcpy(f->hdr->magic, FLIGHT_MAGIC, FLIGHT_MAGIC_LEN);
+	}
+	f->last_sync = wall_now();
+	return 0;
+}
+
+void flight_put(struct flight *f, const struct sample *s, int state_change){
+	struct flight_hdr *h = f->hdr;
+	uint64_t seq = atomic_load_explicit(&h->seq, memory_order_relaxed) + 1;
+	struct flight_rec *r = (struct flight_rec *)(f->map + h->hdr_size +
+			((seq - 1) % h->nslots) * h->slot_size);
+	atomic_store_explicit(&r->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	double wall = wall_now();
+	r->wall = wall;
+	r->state_change = state_change;
+	r->s = *s;
+	r->s.core_pct = NULL;
+	int n = s->ncores < (int)h->cores ? s->ncores : (int)h->cores;
+	r->s.ncores = n;
+	if(n > 0 && s->core_pct) memcpy(r + 1, s->core_pct, (size_t)n * sizeof(double));
+	atomic_store_explicit(&r->seq, seq, memory_order_release);
+	atomic_store_explicit(&h->seq, seq, memory_order_release);
+	if(wall - f->last_sync >= FLIGHT_SYNC_S){
+		// only the dirty pages go out; this is the writer thread, not the sampler
+		msync(f->map, f->len, MS_SYNC);
+		f->last_sync = wall;
+	}
+}
+
+void flight_close(struct flight *f){
+	if(!f->map) return;
+	msync(f->map, f->len, MS_SYNC);
+	munmap(f->map, f->len);
+	f->map = NULL;
+	f->hdr = NULL;
+}
+
+// Copies slot `seq` out; 0 if it was overwritten or torn meanwhile.
+static int flight_read(const struct flight_hdr *h, const uint8_t *buf, uint64_t seq,
+		struct flight_rec *out, double *cores){
+	const struct flight_rec *r = (const struct flight_rec *)(buf + h->hdr_size +
+			((seq - 1) % h->nslots) * h->slot_size);
+	if(atomic_load_explicit(&r->seq, memory_order_acquire) != seq) return 0;
+	memcpy((void *)((char *)out + sizeof(out->seq)), (const char *)r + sizeof(r->seq),
+			sizeof(*out) - sizeof(out->seq));
+	int n = out->s.ncores;
+	if(n < 0 || (uint32_t)n > h->cores) return 0;
+	memcpy(cores, r + 1, (size_t)n * sizeof(double));
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&r->seq, memory_order_relaxed) == seq;
+}
+
+int flight_dump(const uint8_t *buf, size_t len, double last_s, struct out_buf *out){
+	const struct flight_hdr *h = (const struct flight_hdr *)buf;
+	// nothing in the header is trusted before it is checked against the
+	// file: a slot must hold its cores, the slots must fit in len (a
+	// division, so a huge nslots cannot wrap the product)
+	if(len < FLIGHT_HDR_SIZE || memcmp(h->magic, FLIGHT_MAGIC, FLIGHT_MAGIC_LEN) != 0 ||
+			h->version != FLIGHT_VERSION || h->sample_size != sizeof(struct sample) ||
+			h->hdr_size != FLIGHT_HDR_SIZE ||
+			h->slot_size < sizeof(struct flight_rec) + (uint64_t)h->cores * sizeof(double) ||
+			h->nslots == 0 || h->nslots > (len - h->hdr_size) / h->slot_size)
+		return -1;
+	double *cores = calloc(h->cores ? h->cores : 1, sizeof(double));
+	if(!cores) return -1;
+	emit_meta(out, &h->meta);
+
+	uint64_t newest = atomic_load_explicit(&h->seq, memory_order_acquire);
+	uint64_t oldest = newest > h->nslots ? newest - h->nslots + 1 : 1;
+	struct flight_rec r;
+	// the window is measured back from the newest record, not from now:
+	// a dump is usually taken after the fact
+	if(last_s > 0.0 && newest >= oldest){
+		double end = 0.0;
+		for(uint64_t q = newest; q >= oldest && q > 0; q--)
+			if(flight_read(h, buf, q, &r, cores)){
+				end = r.wall;
+				break;
+			}
+		// binary search for the first record inside the window; a
+		// record lost to a tear just falls on the side of its neighbour
+		uint64_t lo = oldest, hi = newest;
+		while(lo < hi){
+			uint64_t mid = lo + (hi - lo) / 2;
+			if(flight_read(h, buf, mid, &r, cores) && r.wall < end - last_s) lo = mid + 1;
+			else hi = mid;
+		}
+		oldest = lo;
+	}
+	for(uint64_t q = oldest; q <= newest && q > 0 && !out->error; q++){
+		if(!flight_read(h, buf, q, &r, cores)) continue;
+		r.s.t = r.wall;
+		r.s.core_pct = cores;
+		if(r.state_change) emit_state_change(out, &r.s);
+		if(r.s.mem_predicted_change) emit_predicted_state(out, &r.s);
+		emit_sample(out, &r.s);
+	}
+	free(cores);
+	return 0;
+}
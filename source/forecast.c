@@ -0,0 +1,84 @@
+#include <math.h>
+#include <string.h>
+#include "forecast.h"
+
+void forecast_init(struct forecaster *f, double horizon_s, double fit_s,
+		double warn_pct, double danger_pct){
+	memset(f, 0, sizeof(*f));
+	f->horizon_s = horizon_s;
+	f->fit_s = fit_s > 0.0 ? fit_s : FORECAST_FIT_S;
+	f->warn_pct = warn_pct;
+	f->danger_pct = danger_pct;
+	f->level = SYS_OK;
+}
+
+// Seconds until avail_kb falls to pct of total at slope kb/s: 0 once
+// there, INFINITY when not falling or there is no such level.
+static double eta_to(double pct, double avail_kb, double total_kb, double slope){
+	if(isnan(pct)) return INFINITY;
+	double floor_kb = total_kb * pct / 100.0;
+	if(avail_kb <= floor_kb) return 0.0;
+	return slope < 0.0 ? (avail_kb - floor_kb) / -slope : INFINITY;
+}
+
+int forecast_update(struct forecaster *f, struct sample *s){
+	double t = s->t;
+	double avail_kb = s->mem_avail_gb * 1048576.0;
+	double total_kb = (s->mem_used_gb + s->mem_avail_gb) * 1048576.0;
+	double cpu = s->cpu_pct;
+	s->mem_slope_mb_s = NAN;
+	s->mem_eta_s = NAN;
+	s->cpu_z = NAN;
+	s->mem_predicted = f->level;
+	s->mem_predicted_change = 0;
+
+	double decay = 1.0;
+	if(f->n == 0){
+		f->y0 = avail_kb;
+		f->t0 = t;
+		f->cpu_mean = cpu;
+	} else {
+		double dt = t > f->last_t ? t - f->last_t : 0.0;
+		decay = exp(-dt / f->fit_s);
+		// move the origin to this sample, then age every weight by dt
+		f->wuu = (f->wuu - 2.0 * dt * f->wu + dt * dt * f->w) * decay;
+		f->wu = (f->wu - dt * f->w) * decay;
+		f->wuy = (f->wuy - dt * f->wy) * decay;
+		f->w *= decay;
+		f->wy *= decay;
+	}
+	// at u = 0 the new point only adds to w and wy
+	double y = avail_kb - f->y0;
+	f->w += 1.0;
+	f->wy += y;
+	f->last_t = t;
+	f->n++;
+
+	// scored against what came before it, then folded in
+	int ready = f->n > FORECAST_MIN_SAMPLES && t - f->t0 >= f->fit_s / 4.0;
+	double d = cpu - f->cpu_mean;
+	if(ready) s->cpu_z = d / fmax(sqrt(f->cpu_var), FORECAST_Z_SD_MIN);
+	double alpha = 1.0 - decay;
+	f->cpu_mean += alpha * d;
+	f->cpu_var = (1.0 - alpha) * (f->cpu_var + alpha * d * d);
+
+	double suu = f->wuu - f->wu * f->wu / f->w;
+	if(!ready || !(suu > 0.0)) return 0;
+	double slope = (f->wuy - f->wu * f->wy / f->w) / suu;	// kb/s
+	s->mem_slope_mb_s = slope / 1024.0;
+	double eta_danger = eta_to(f->danger_pct, avail_kb, total_kb, slope);
+	double eta_warn = eta_to(f->warn_pct, avail_kb, total_kb, slope);
+	if(isfinite(eta_danger)) s->mem_eta_s = eta_danger;
+
+	// a level already predicted is kept a little longer, so an ETA
+	// hovering around S does not flap
+	double h = f->horizon_s;
+	sys_state next = SYS_OK;
+	if(eta_danger <= h * (f->level >= SYS_DANGER ? FORECAST_HYST : 1.0)) next = SYS_DANGER;
+	else if(eta_warn <= h * (f->level >= SYS_WARN ? FORECAST_HYST : 1.0)) next = SYS_WARN;
+	s->mem_predicted = next;
+	if(next == f->level) return 0;
+	f->level = next;
+	s->mem_predicted_change = 1;
+	return 1;
+}
@@ -4,12 +4,17 @@
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
-#include "cpu.h"
-#include "mem.h"
+#include <sys/stat.h>
+#include "arena.h"
 #include "sample.h"
 #include "output.h"
-#include "state.h"
-#include "window.h"
+#include "config.h"
+#include "sampler.h"
+#include "ticker.h"
+#include "ring.h"
+#include "writer.h"
+#include "replay.h"
+#include "placement.h"
 
 volatile sig_atomic_t running = 1;
 
@@ -18,173 +23,168 @@ void handle_sigint(int sig){
 	running = 0;
 }
 
-double now_sec(struct timespec *start){
-	struct timespec t;
-	clock_gettime(CLOCK_MONOTONIC,&t);
-	return(t.tv_sec - start->tv_sec)
-		+ (t.tv_nsec - start->tv_nsec)/1e9;
+// Waits for the writer to make room: for the end record, and for every
+// record of a replay, which has no clock to fall behind. Nothing is
+// lost while it waits, so nothing is counted as dropped.
+static void push_wait(struct spsc_ring *ring, struct writer *w, const struct ring_rec *rec){
+	struct timespec pause = { 0, 1000000 };
+	while(ring_try_push(ring, rec) != 0 && !atomic_load(&w->failed))
+		nanosleep(&pause, NULL);
 }
 
+static void push(struct spsc_ring *ring, struct writer *w, const struct ring_rec *rec,
+		int wait){
+	if(wait) push_wait(ring, w, rec);
+	else ring_push(ring, rec);
+}
 
+static int open_out(struct out_buf *out, const struct probe_config *cfg){
+	if(out_init(out, STDOUT_FILENO, OUT_BUF_SIZE, cfg->format, cfg->flush,
+				cfg->flush_every_n, cfg->flush_every_ms) != 0){
+		perror("out_init");
+		return -1;
+	}
+	return 0;
+}
 
 int main(int argc, char *argv[]){
-	struct cpu_capacity cap;
-	read_cpu_capacity(&cap);
-	mem_stat mem;
-	read_mem_stat(&mem);
-	printf("{"
-    		"\"type\":\"meta\","
-    		"\"schema\":1,"
-    		"\"interval_s\":%.3f,"
-    		"\"cores\":%d,"
-    		"\"max_freq_ghz\":%.3f,"
-    		"\"mem_total_gb\":%.2f,"
-		"\"mem_avail_gb\":%.2f,"
-    		"\"swap_total_gb\":%.2f,"
-		"\"swap_free_gb\":%.2f,"
-    		"\"units\":{\"mem\":\"GB\",\"swap\":\"GB\",\"ts\":\"s\"}"
-    		"}\n",
-		1.0, //--interval to be replaced
-		cap.cores,
-		(cap.max_freq_khz > 0 ? cap.max_freq_khz / 1000000.0:-1),
-		mem.mem_total_kb/1024.0/1024.0, 
-		mem.mem_avail_kb/1024.0/1024.0, 
-		mem.swap_total_kb/1024.0/1024.0, 
-		mem.swap_free_kb/1024.0/1024.0
-		);
-
-	signal(SIGINT, handle_sigint);
-	
-	struct cpu_stat prev_cpu = {0};
-	struct cpu_stat curr_cpu = {0};
-
-
-	cpu_window cpu_win;
-	cpu_window_init(&cpu_win);
-
-	read_cpu_stat(&prev_cpu);
-
-	struct timespec start;
-	clock_gettime(CLOCK_MONOTONIC, &start);
-	sys_state prev_cpu_state = SYS_OK;
-	sys_state prev_mem_state = SYS_OK;
-	int have_prev_state = 0;
-
-	while (running) {
-		sleep(1);
-
-		if(read_cpu_stat(&curr_cpu) != 0) continue;
-
-		double usage = cpu_usage(&prev_cpu, &curr_cpu);
-		cpu_window_add(&cpu_win, usage);
-
-		read_mem_stat(&mem);
-
-		double avg_cpu = cpu_window_avg(&cpu_win);
-		sys_state cpu_state = cpu_state_from_avg(avg_cpu);
-        	sys_state mem_state = mem_state_from_capacity(&mem);
-		double t = now_sec(&start);
-		if(!have_prev_state){
-			prev_cpu_state = cpu_state;
-			prev_mem_state = mem_state;
-			have_prev_state = 1;
-			
-		} else if (cpu_state != prev_cpu_state || mem_state != prev_mem_state){
-			printf(
-            			"{"
-				"\"type\":\"event\","
-				"\"event\":\"state_change\","
-            			"\"ts\":%.3f,"
-            			"\"cpu\":%.2f,"
-            			"\"cpu_avg\":%.2f,"
-				"\"mem_used\":%.2f,"
-				"\"mem_avail\":%.2f,"
-				"\"mem_swap_used\":%.2f,"
-				"\"mem_swap_avail\":%.2f,"
-            			"\"CPU_STATE\":\"%s\","
-            			"\"MEM_STATE\":\"%s\""
-            			"}\n",
-            			t,
-            			usage,
-            			avg_cpu,
-				(mem.mem_total_kb - mem.mem_avail_kb)/1024.0/1024.0,
-				mem.mem_avail_kb/1024.0/1024.0,
-				(mem.swap_total_kb - mem.swap_free_kb)/1024.0/1024.0,
-				mem.swap_free_kb/1024.0/1024.0,
-            			sys_state_str(cpu_state),
-            			sys_state_str(mem_state)
-        			);
-
-			prev_cpu_state = cpu_state;
-			prev_mem_state = mem_state;
-		}
-
-			printf(
-				"{"
-				"\"type\":\"sample\","
-            			"\"ts\":%.3f,"
-            			"\"cpu\":%.2f,"
-            			"\"cpu_avg\":%.2f,"
-				"\"mem_used\":%.2f,"
-				"\"mem_avail\":%.2f,"
-				"\"mem_swap_used\":%.2f,"
-				"\"mem_swap_avail\":%.2f,"
-            			"\"CPU_STATE\":\"%s\","
-            			"\"MEM_STATE\":\"%s\""
-            			"}\n",
-            			t,
-            			usage,
-            			avg_cpu,
-				(mem.mem_total_kb - mem.mem_avail_kb)/1024.0/1024.0,
-				mem.mem_avail_kb/1024.0/1024.0,
-				(mem.swap_total_kb - mem.swap_free_kb)/1024.0/1024.0,
-				mem.swap_free_kb/1024.0/1024.0,
-            			sys_state_str(cpu_state),
-            			sys_state_str(mem_state)
-        			);
-
-
-        	fflush(stdout);
-
-        	prev_cpu = curr_cpu;
+	struct probe_config cfg;
+	int rc = config_parse_args(&cfg, argc, argv);
+	if(rc != 0) return rc > 0 ? 0 : 2;
+
+	struct out_buf out;
+	struct stat st;
+	// a trace is replayed without a sampler: only the rules run again
+	if(cfg.replay && stat(cfg.replay, &st) == 0 && !S_ISDIR(st.st_mode)){
+		if(open_out(&out, &cfg) != 0) return 1;
+		rc = replay_trace(cfg.replay, &cfg, &out);
+		out_close(&out);
+		return rc == 0 ? 0 : 1;
 	}
 
+	// everything allocated from here to arena_seal() is startup state
+	static struct arena arena;
+	if(arena_init(&arena, cfg.arena_mb) != 0) return 1;
+	if(placement_apply(&cfg, &arena) != 0) return 1;
+	static struct sampler sp;
+	if(sampler_init(&sp, &cfg) != 0) return 1;
+	if(open_out(&out, &cfg) != 0) return 1;
+	struct spsc_ring ring;
+	if(ring_init(&ring, cfg.queue, sp.cap.cores) != 0){
+		perror("ring_init");
+		return 1;
+	}
 
-
-	//struct timespec start;
-	//clock_gettime(CLOCK_MONOTONIC, &start);
-
-	//struct cpu_stat cpu_prev, cpu_curr;
-	//struct mem_stat mem;
-
-	//if(read_cpu_stat(&cpu_prev) != 0){
-	//	perror("cpu");
-	//	return 2;
-	//}
-	//sleep(1);
-
-	/*while(running){
-		struct sample s = {0};
-
-		if (read_cpu_stat(&cpu_curr) == 0){
-			s.cpu_pct = cpu_usage(&cpu_prev, &cpu_curr);
-			cpu_prev = cpu_curr;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_sigint;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	// a dead reader shows up as EPIPE from write() instead of killing us
+	signal(SIGPIPE, SIG_IGN);
+
+	struct sample_meta meta;
+	sampler_meta(&sp, &meta);
+	static struct metrics_server metrics;
+	if(cfg.listen && metrics_open(&metrics, cfg.listen, &meta) != 0) return 1;
+	if(arena_seal(&arena, cfg.arena_mb, cfg.mlock) != 0) return 1;
+	meta.arena_kb = (unsigned)(arena.limit >> 10);
+	meta.arena_startup_kb = (unsigned)(arena.startup >> 10);
+	meta.arena_locked = arena.locked;
+	emit_meta(&out, &meta);
+
+	static struct flight flight;
+	if(cfg.flight && flight_open(&flight, cfg.flight, cfg.flight_mb, &meta) != 0) return 1;
+
+	static struct pusher pusher;
+	if(cfg.push && pusher_open(&pusher, cfg.push) != 0) return 1;
+
+	static struct deadband deadband;
+	if(cfg.deadband > 0.0) deadband_init(&deadband, cfg.deadband, cfg.heartbeat_s, &meta);
+
+	struct writer writer;
+	if(writer_start(&writer, &ring, &out, cfg.flight ? &flight : NULL,
+				cfg.push ? &pusher : NULL, cfg.listen ? &metrics : NULL,
+				cfg.deadband > 0.0 ? &deadband : NULL) != 0)
+		return 1;
+	if(placement_apply_rt(&cfg) != 0) return 1;
+
+	struct tick_sched ticker;
+	tick_sched_init(&ticker, cfg.interval_s);
+	struct ring_rec rec;
+	double t = 0.0;
+	int replay = sp.replaying;
+	unsigned long long samples = 0;
+	double replay_start = sampler_now(&sp);
+
+	// this thread is the sampler: it never touches stdout
+	while (running && !atomic_load(&writer.failed)) {
+		// a fired PSI trigger takes a sample right away, off the grid;
+		// a replay does not wait at all
+		int woke = replay ? 0 : tick_sched_wait_fds(&ticker, sp.psi.trig, sp.psi.ntrig);
+		if(woke < 0) continue;
+		double t_wake = sampler_now(&sp);
+
+		memset(&rec, 0, sizeof(rec));
+		rec.kind = REC_SAMPLE;
+		if(sampler_sample(&sp, &rec.s, &rec.state_change) != 0) break;
+		rec.s.missed = ticker.missed;
+		t = rec.s.t;
+		samples++;
+		if(!replay)
+			tick_sched_set_interval(&ticker, sampler_interval(&sp, &rec.s, rec.state_change));
+		push(&ring, &writer, &rec, replay);
+		// who is behind the change goes right after the event
+		if(rec.state_change && sp.procs.top_n > 0){
+			rec.kind = REC_TOP;
+			sampler_top(&sp, t, TOP_STATE_CHANGE, &rec.top);
+			push(&ring, &writer, &rec, replay);
 		}
-
-		if (read_mem_stat(&mem) == 0){
-			s.mem_used_gb = (mem.total_kb - mem.avail_kb) / 1024.0 / 1024.0;
-		       	s.mem_avail_gb = mem.avail_kb / 1024.0 / 1024.0;
+		// a cgroup changing state need not move the host's
+		if(sp.cgroups && cgroup_report(sp.cgroups, t, TOP_STATE_CHANGE, &rec.cg)){
+			rec.kind = REC_CGROUP;
+			push(&ring, &writer, &rec, replay);
 		}
 
-		s.t = now_sec(&start);
+		if(sampler_summary_due(&sp, t, &rec.sum)){
+			rec.kind = REC_SUMMARY;
+			rec.sum.missed = ticker.missed;
+			push(&ring, &writer, &rec, replay);
+			if(sp.procs.top_n > 0){
+				rec.kind = REC_TOP;
+				sampler_top(&sp, t, TOP_SUMMARY, &rec.top);
+				push(&ring, &writer, &rec, replay);
+			}
+			if(sp.cgroups && cgroup_report(sp.cgroups, t, TOP_SUMMARY, &rec.cg)){
+				rec.kind = REC_CGROUP;
+				push(&ring, &writer, &rec, replay);
+			}
+		}
 
-		print_json(s.t, s.cpu_pct, s.mem_used_gb, s.mem_avail_gb);
+		if(sp.self_on){
+			self_tick(&sp.self, woke == 0 && !replay ? ticker.late_ns : -1,
+					(long long)((sampler_now(&sp) - t_wake) * 1e9));
+			if(sampler_self_due(&sp, t, ticker.missed, &rec.self)){
+				rec.kind = REC_SELF;
+				push(&ring, &writer, &rec, replay);
+			}
+		}
+	}
 
-		sleep(1);
-	}*/
-	
+	memset(&rec, 0, sizeof(rec));
+	rec.kind = REC_END;
+	sampler_end(&sp, t, &rec.sum);
+	rec.sum.missed = ticker.missed;
+	push_wait(&ring, &writer, &rec);
+	writer_stop(&writer);
+	out_close(&out);
+	if(cfg.flight) flight_close(&flight);
+	if(cfg.push) pusher_close(&pusher);
+	if(cfg.listen) metrics_close(&metrics);
+	if(replay) replay_report(samples, sampler_now(&sp) - replay_start);
+
+	ring_free(&ring);
+	sampler_free(&sp);
+	arena_destroy(&arena);
 	return 0;
 }
-
-
-
@@ -3,39 +3,50 @@
 #include <unistd.h>
 #include <string.h>
 #include "mem.h"
+#include "parse.h"
 
 
-int read_mem_stat(mem_stat *cap){
-	if(!cap) return -1;
+unsigned parse_meminfo(const char *buf, size_t len, unsigned want, mem_stat *out){
+	const uint64_t k_total = parse_key8("MemTotal");
+	const uint64_t k_avail = parse_key8("MemAvail");
+	const uint64_t k_swap_total = parse_key8("SwapTota");
+	const uint64_t k_swap_free = parse_key8("SwapFree");
+	const char *p = buf;
+	const char *end = buf + len;
+	unsigned got = 0;
+
+	while(p + 8 <= end && (got & want) != want){
+		uint64_t k = parse_key8(p);
+		long *dst = NULL;
+		unsigned bit = 0;
+		if(k == k_total){
+			dst = &out->mem_total_kb; bit = MEM_F_TOTAL;
+		} else if(k == k_avail){
+			dst = &out->mem_avail_kb; bit = MEM_F_AVAIL;
+		} else if(k == k_swap_total){
+			dst = &out->swap_total_kb; bit = MEM_F_SWAP_TOTAL;
+		} else if(k == k_swap_free){
+			dst = &out->swap_free_kb; bit = MEM_F_SWAP_FREE;
+		}
+		if(dst){
+			const char *colon = memchr(p, ':', (size_t)(end - p));
+			if(colon && parse_long(colon + 1, end, dst)) got |= bit;
+		}
+		p = parse_next_line(p, end);
+	}
+	return got;
+}
+
+int read_mem_stat(struct probe_ctx *ctx, mem_stat *cap){
+	if(!ctx || !cap) return -1;
 	cap->mem_total_kb = 0;
 	cap->mem_avail_kb = 0;
 	cap->swap_total_kb = 0;
 	cap->swap_free_kb = 0;
-	FILE *f = fopen("/proc/meminfo", "r");
-	if(!f){
-		perror("fopen /proc/meminfo");
+	if(proc_file_read(&ctx->meminfo) < 0){
+		perror("read /proc/meminfo");
 		return -1;
 	}
-	char key[32];
-	long value;
-	char unit[16];
-	
-	int cnt = 0;
-	while(fscanf(f, "%31s %ld %15s", key, &value, unit) == 3){
-		if(strcmp(key, "MemTotal:") == 0){
-			cap->mem_total_kb = value;cnt++;
-		} else if (strcmp(key, "MemAvailable:") == 0){
-			cap->mem_avail_kb = value;cnt++;
-		} else if (strcmp(key, "SwapTotal:") == 0){
-			cap->swap_total_kb = value;cnt++;
-		} else if (strcmp(key, "SwapFree:") == 0){
-			cap->swap_free_kb = value;cnt++;
-		}
-		if(cnt==4) break;
-
-	}
-	fclose(f);
+	parse_meminfo(ctx->meminfo.buf, ctx->meminfo.len, MEM_F_ALL, cap);
 	return 0;
 }
-
-
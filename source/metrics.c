@@ -0,0 +1,345 @@
+#define _GNU_SOURCE	// accept4
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "metrics.h"
+
+#define GIB (1024.0 * 1024.0 * 1024.0)
+#define METRICS_ACCEPT_BACKOFF_MS 100
+
+static const char resp_404[] =
+	"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+static const char resp_503[] =
+	"HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+// [HOST]:PORT, HOST may be [v6] or empty for all addresses
+static int listen_on(const char *spec){
+	char host[256];
+	const char *colon = strrchr(spec, ':');
+	if(!colon || !colon[1] || (size_t)(colon - spec) >= sizeof(host)) return -1;
+	memcpy(host, spec, (size_t)(colon - spec));
+	host[colon - spec] = '\0';
+	char *hp = host;
+	size_t hl = strlen(hp);
+	if(hl >= 2 && hp[0] == '[' && hp[hl - 1] == ']'){
+		hp[hl - 1] = '\0';
+		hp++;
+	}
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int rc = getaddrinfo(*hp ? hp : NULL, colon + 1, &hints, &res);
+	if(rc != 0){
+		fprintf(stderr, "%s: %s\n", spec, gai_strerror(rc));
+		return -1;
+	}
+	int fd = socket(res->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int one = 1;
+	if(fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+			bind(fd, res->ai_addr, res->ai_addrlen) != 0 || listen(fd, 16) != 0){
+		perror(spec);
+		if(fd >= 0) close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static void send_all(int fd, const char *p, size_t n){
+	while(n){
+		ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+		if(k < 0){
+			if(errno == EINTR) continue;
+			return;
+		}
+		p += k;
+		n -= (size_t)k;
+	}
+}
+
+static void serve(struct metrics_server *m, int c){
+	struct timeval tv = { .tv_sec = METRICS_IO_TIMEOUT_S };
+	setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	// only the request line matters; the rest of the request is ignored
+	char req[1024];
+	size_t len = 0;
+	while(len < sizeof(req) - 1){
+		ssize_t k = recv(c, req + len, sizeof(req) - 1 - len, 0);
+		if(k < 0 && errno == EINTR) continue;
+		if(k <= 0) break;
+		len += (size_t)k;
+		req[len] = '\0';
+		if(strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+	}
+	req[len] = '\0';
+	if(strncmp(req, "GET /metrics ", 13) != 0 && strncmp(req, "GET / ", 6) != 0){
+		send_all(c, resp_404, sizeof(resp_404) - 1);
+		return;
+	}
+	int i;
+	for(;;){
+		i = atomic_load(&m->current);
+		if(i < 0) break;
+		atomic_fetch_add(&m->page[i].readers, 1);
+		// the writer may have picked this page between the two loads
+		if(atomic_load(&m->current) == i) break;
+		atomic_fetch_sub(&m->page[i].readers, 1);
+	}
+	if(i < 0){
+		send_all(c, resp_503, sizeof(resp_503) - 1);
+		return;
+	}
+	struct metrics_page *p = &m->page[i];
+	send_all(c, p->buf.buf + p->start, p->buf.len - p->start);
+	atomic_fetch_sub(&p->readers, 1);
+}
+
+static void *metrics_main(void *arg){
+	struct metrics_server *m = arg;
+	const struct timespec backoff = { 0, METRICS_ACCEPT_BACKOFF_MS * 1000000L };
+	while(!atomic_load(&m->stop)){
+		int c = accept4(m->fd, NULL, NULL, SOCK_CLOEXEC);
+		if(c < 0){
+			if(errno == EINTR || errno == ECONNABORTED) continue;
+			// shutdown() by metrics_close sets stop first; anything else
+			// (EMFILE, ENFILE, ENOBUFS, ENOMEM) passes, so wait it out
+			// rather than spin on the pending connection
+			if(atomic_load(&m->stop)) break;
+			nanosleep(&backoff, NULL);
+			continue;
+		}
+		serve(m, c);
+		close(c);
+	}
+	return NULL;
+}
+
+int metrics_open(struct metrics_server *m, const char *spec,
+		const struct sample_meta *meta){
+	memset(m, 0, sizeof(*m));
+	m->fd = -1;
+	m->meta = *meta;
+	atomic_init(&m->current, -1);
+	atomic_init(&m->stop, 0);
+	for(int i = 0; i < 2; i++){
+		atomic_init(&m->page[i].readers, 0);
+		if(out_init(&m->page[i].buf, -1, METRICS_PAGE_SIZE, FORMAT_JSONL, FLUSH_FULL, 0, 0) != 0){
+			perror("metrics");
+			return -1;
+		}
+	}
+	m->fd = listen_on(spec);
+	if(m->fd < 0){
+		fprintf(stderr, "bad --listen address: %s\n", spec);
+		return -1;
+	}
+	// like the writer, leave the signals to the sampler thread
+	sigset_t block, old;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	int rc = pthread_create(&m->thread, NULL, metrics_main, m);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(rc != 0){
+		fprintf(stderr, "pthread_create: metrics server failed\n");
+		close(m->fd);
+		return -1;
+	}
+	m->started = 1;
+	return 0;
+}
+
+static void put_value(struct out_buf *o, double v){
+	if(isnan(v)) out_puts(o, "NaN");
+	else if(isinf(v)) out_puts(o, v > 0 ? "+Inf" : "-Inf");
+	else if(v == (double)(long)v) out_long(o, (long)v);
+	else out_fixed(o, v, 4);
+	out_putc(o, '\n');
+}
+
+static void family(struct out_buf *o, const char *name, const char *type, const char *help){
+	out_puts(o, "# TYPE sysprobe_");
+	out_puts(o, name);
+	out_putc(o, ' ');
+	out_puts(o, type);
+	out_puts(o, "\n# HELP sysprobe_");
+	out_puts(o, name);
+	out_putc(o, ' ');
+	out_puts(o, help);
+	out_putc(o, '\n');
+}
+
+// labels is the inside of {...} or NULL
+static void metric(struct out_buf *o, const char *name, const char *labels, double v){
+	out_puts(o, "sysprobe_");
+	out_puts(o, name);
+	if(labels){
+		out_putc(o, '{');
+		out_puts(o, labels);
+		out_putc(o, '}');
+	}
+	out_putc(o, ' ');
+	put_value(o, v);
+}
+
+static void gauge(struct out_buf *o, const char *name, const char *help, double v){
+	family(o, name, "gauge", help);
+	metric(o, name, NULL, v);
+}
+
+static void counter(struct out_buf *o, const char *name, const char *help,
+		unsigned long long v){
+	family(o, name, "counter", help);
+	out_puts(o, "sysprobe_");
+	out_puts(o, name);
+	out_puts(o, "_total ");
+	out_u64(o, v);
+	out_putc(o, '\n');
+}
+
+static void render(struct out_buf *o, const struct sample_meta *mt, const struct sample *s){
+	gauge(o, "cores", "Online CPUs.", mt->cores);
+	gauge(o, "cpu_max_frequency_hertz", "Highest CPU frequency, NaN if unknown.",
+			mt->max_freq_ghz > 0.0 ? mt->max_freq_ghz * 1e9 : NAN);
+	gauge(o, "interval_seconds", "Sampling period (the slow one with --adaptive).",
+			mt->interval_s);
+	gauge(o, "window_samples", "Length of the cpu window.", mt->window);
+	gauge(o, "memory_total_bytes", "Installed memory.", mt->mem_total_gb * GIB);
+	gauge(o, "swap_total_bytes", "Swap space.", mt->swap_total_gb * GIB);
+
+	gauge(o, "sample_interval_seconds", "Time covered by the latest sample.", s->interval);
+	gauge(o, "cpu_percent", "CPU busy over the latest sample.", s->cpu_pct);
+	family(o, "cpu_window_percent", "gauge", "CPU busy over the cpu window.");
+	metric(o, "cpu_window_percent", "stat=\"avg\"", s->cpu_avg);
+	metric(o, "cpu_window_percent", "stat=\"min\"", s->cpu_min);
+	metric(o, "cpu_window_percent", "stat=\"max\"", s->cpu_max);
+	metric(o, "cpu_window_percent", "stat=\"ewma\"", s->cpu_ewma);
+	gauge(o, "cpu_hot_percent", "Mean busy share of the busiest cores.", s->cpu_hot_avg);
+	if(s->core_pct && s->ncores > 0){
+		family(o, "core_cpu_percent", "gauge", "Per-core CPU busy over the latest sample.");
+		for(int i = 0; i < s->ncores; i++){
+			if(isnan(s->core_pct[i])) continue;	// offline
+			out_puts(o, "sysprobe_core_cpu_percent{core=\"");
+			out_u64(o, (unsigned long long)i);
+			out_puts(o, "\"} ");
+			put_value(o, s->core_pct[i]);
+		}
+	}
+
+	gauge(o, "memory_used_bytes", "Memory in use (total - available).", s->mem_used_gb * GIB);
+	gauge(o, "memory_available_bytes", "MemAvailable.", s->mem_avail_gb * GIB);
+	gauge(o, "swap_used_bytes", "Swap in use.", s->swap_used_gb * GIB);
+
+	family(o, "state", "gauge", "Rule state per group: 0 ok, 1 warn, 2 danger.");
+	metric(o, "state", "group=\"cpu\"", s->cpu_state);
+	metric(o, "state", "group=\"mem\"", s->mem_state);
+	metric(o, "state", "group=\"io\"", s->io_state);
+	metric(o, "state", "group=\"net\"", s->net_state);
+
+	family(o, "pressure_percent", "gauge",
+			"PSI stall share of the latest sample, NaN if unavailable.");
+	metric(o, "pressure_percent", "resource=\"cpu\",kind=\"some\"", s->psi_cpu_some);
+	metric(o, "pressure_percent", "resource=\"memory\",kind=\"some\"", s->psi_mem_some);
+	metric(o, "pressure_percent", "resource=\"memory\",kind=\"full\"", s->psi_mem_full);
+	metric(o, "pressure_percent", "resource=\"io\",kind=\"some\"", s->psi_io_some);
+	metric(o, "pressure_percent", "resource=\"io\",kind=\"full\"", s->psi_io_full);
+
+	family(o, "disk_iops", "gauge", "Whole-disk operations per second.");
+	metric(o, "disk_iops", "op=\"read\"", s->disk_rd_iops);
+	metric(o, "disk_iops", "op=\"write\"", s->disk_wr_iops);
+	family(o, "disk_bytes_per_second", "gauge", "Whole-disk throughput.");
+	metric(o, "disk_bytes_per_second", "op=\"read\"", s->disk_rd_mb_s * 1048576.0);
+	metric(o, "disk_bytes_per_second", "op=\"write\"", s->disk_wr_mb_s * 1048576.0);
+	gauge(o, "disk_await_seconds", "Worst disk await.", s->disk_await_ms / 1e3);
+	gauge(o, "disk_util_percent", "Utilization of the busiest disk.", s->disk_util_pct);
+
+	family(o, "net_bits_per_second", "gauge", "Throughput of all interfaces but lo.");
+	metric(o, "net_bits_per_second", "dir=\"rx\"", s->net_rx_mbit_s * 1e6);
+	metric(o, "net_bits_per_second", "dir=\"tx\"", s->net_tx_mbit_s * 1e6);
+	family(o, "net_packets_per_second", "gauge", "Packet rate of all interfaces but lo.");
+	metric(o, "net_packets_per_second", "dir=\"rx\"", s->net_rx_pps);
+	metric(o, "net_packets_per_second", "dir=\"tx\"", s->net_tx_pps);
+	gauge(o, "net_errors_per_second", "Interface errors and drops.", s->net_errs_s);
+
+	family(o, "cgroup_limit_percent", "gauge",
+			"Highest share of its limit among the --cgroup-root cgroups, NaN if none.");
+	metric(o, "cgroup_limit_percent", "resource=\"memory\"", s->cgroup_mem_pct);
+	metric(o, "cgroup_limit_percent", "resource=\"cpu\"", s->cgroup_cpu_pct);
+
+	if(!isnan(s->mem_slope_mb_s)){
+		gauge(o, "memory_available_trend_bytes_per_second",
+				"Slope of MemAvailable over the --predict fit window.",
+				s->mem_slope_mb_s * 1048576.0);
+		gauge(o, "memory_exhaustion_seconds",
+				"Projected time until MemAvailable reaches the danger ratio, NaN if not falling.",
+				s->mem_eta_s);
+		gauge(o, "memory_predicted_state",
+				"Level MemAvailable is heading for: 0 ok, 1 warn, 2 danger.", s->mem_predicted);
+		gauge(o, "cpu_zscore", "CPU against its recent mean, in standard deviations.", s->cpu_z);
+	}
+	if(!isnan(s->runq_avg_us)){
+		family(o, "runqueue_latency_seconds", "gauge",
+				"Wakeup or preemption to on-CPU (--bpf); p99 is a log2 bucket edge.");
+		metric(o, "runqueue_latency_seconds", "stat=\"avg\"", s->runq_avg_us / 1e6);
+		metric(o, "runqueue_latency_seconds", "stat=\"p99\"", s->runq_p99_us / 1e6);
+		gauge(o, "page_faults_per_second", "User page faults (--bpf).", s->pgfault_s);
+		gauge(o, "direct_reclaim_ratio", "Seconds spent in direct reclaim per second (--bpf).",
+				s->reclaim_ms_s / 1e3);
+	}
+
+	counter(o, "missed_deadlines", "Sampling deadlines skipped.", s->missed);
+	counter(o, "dropped_records", "Records lost to a full writer queue.", s->dropped);
+	out_puts(o, "# EOF\n");
+}
+
+void metrics_publish(struct metrics_server *m, const struct sample *s){
+	int b = atomic_load(&m->current) == 0 ? 1 : 0;
+	struct metrics_page *p = &m->page[b];
+	if(atomic_load(&p->readers) != 0){
+		m->skipped++;
+		return;
+	}
+	struct out_buf *o = &p->buf;
+	o->error = 0;
+	o->len = METRICS_HDR_RESERVE;
+	render(o, &m->meta, s);
+	if(o->error) return;	// did not fit; the previous page stays up
+
+	char hdr[METRICS_HDR_RESERVE];
+	int n = snprintf(hdr, sizeof(hdr),
+		"HTTP/1.1 200 OK\r\n"
+		"Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+		"Content-Length: %zu\r\nConnection: close\r\n\r\n",
+		o->len - METRICS_HDR_RESERVE);
+	if(n <= 0 || n >= (int)sizeof(hdr)) return;
+	p->start = METRICS_HDR_RESERVE - (size_t)n;
+	memcpy(o->buf + p->start, hdr, (size_t)n);
+	atomic_store(&m->current, b);
+}
+
+void metrics_close(struct metrics_server *m){
+	if(m->started){
+		atomic_store(&m->stop, 1);
+		// wakes the accept() of the server thread
+		shutdown(m->fd, SHUT_RDWR);
+		pthread_join(m->thread, NULL);
+		m->started = 0;
+	}
+	if(m->fd >= 0) close(m->fd);
+	m->fd = -1;
+	for(int i = 0; i < 2; i++){
+		m->page[i].buf.len = 0;
+		out_close(&m->page[i].buf);
+	}
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "arena.h"
+#include "net.h"
+#include "parse.h"
+#include "probe.h"
+#include "sample.h"
+
+// "  eth0: rx_bytes rx_packets rx_errs rx_drop fifo frame compressed
+//  multicast tx_bytes tx_packets tx_errs tx_drop fifo colls carrier
+//  compressed"; the two header lines have no ':'.
+int parse_net_dev(const char *buf, size_t len, struct net_counters *out){
+	const char *p = buf, *end = buf + len;
+	int n = 0;
+	for(; p < end && n < NET_MAX; p = parse_next_line(p, end)){
+		const char *next = parse_next_line(p, end);
+		const char *colon = memchr(p, ':', (size_t)(next - p));
+		if(!colon) continue;
+		const char *nm = parse_skip_blank(p, colon);
+		size_t nl = (size_t)(colon - nm);
+		if(nl == 0 || nl >= NET_NAME || (nl == 2 && memcmp(nm, "lo", 2) == 0)) continue;
+		long v[12];
+		const char *q = colon + 1;
+		int i;
+		for(i = 0; i < 12 && (q = parse_long(q, next, &v[i])) != NULL; i++)
+			;
+		if(i < 12) continue;
+		memcpy(out->name[n], nm, nl);
+		out->name[n][nl] = '\0';
+		out->rx_bytes[n] = (unsigned long long)v[0];
+		out->rx_packets[n] = (unsigned long long)v[1];
+		out->rx_errs[n] = (unsigned long long)v[2] + (unsigned long long)v[3];
+		out->tx_bytes[n] = (unsigned long long)v[8];
+		out->tx_packets[n] = (unsigned long long)v[9];
+		out->tx_errs[n] = (unsigned long long)v[10] + (unsigned long long)v[11];
+		n++;
+	}
+	out->n = n;
+	return 0;
+}
+
+static inline double delta(unsigned long long prev, unsigned long long curr){
+	return curr >= prev ? (double)(curr - prev) : 0.0;
+}
+
+// Slot of `name` in `c`: `hint` (the same slot) first, as the list
+// rarely changes between reads, then the rest.
+static int find_if(const struct net_counters *c, const char *name, int hint){
+	if(hint < c->n && strcmp(c->name[hint], name) == 0) return hint;
+	for(int i = 0; i < c->n; i++)
+		if(strcmp(c->name[i], name) == 0) return i;
+	return -1;
+}
+
+void net_rates(const struct net_counters *prev, const struct net_counters *curr,
+		double dt_s, struct net_rates *out){
+	memset(out, 0, sizeof(*out));
+	if(!(dt_s > 0.0)) return;
+	for(int i = 0; i < curr->n; i++){
+		if(!curr->counted[i]) continue;
+		int j = find_if(prev, curr->name[i], i);
+		if(j < 0) continue;
+		out->rx_mbit_s += delta(prev->rx_bytes[j], curr->rx_bytes[i]) * 8.0 / 1e6 / dt_s;
+		out->tx_mbit_s += delta(prev->tx_bytes[j], curr->tx_bytes[i]) * 8.0 / 1e6 / dt_s;
+		out->rx_pps += delta(prev->rx_packets[j], curr->rx_packets[i]) / dt_s;
+		out->tx_pps += delta(prev->tx_packets[j], curr->tx_packets[i]) / dt_s;
+		out->errs_s += (delta(prev->rx_errs[j], curr->rx_errs[i]) +
+				delta(prev->tx_errs[j], curr->tx_errs[i])) / dt_s;
+	}
+}
+
+// ---- collector ----
+
+struct net_source {
+	struct proc_file file;
+	struct net_counters snap[2];
+	int cur;
+	double prev_t;
+	struct net_rates rates;
+};
+
+static int if_has(const char *name, const char *what){
+	char path[64 + NET_NAME];
+	snprintf(path, sizeof(path), "/sys/class/net/%s/%s", name, what);
+	return access(path, F_OK) == 0;
+}
+
+// Only looked up for a name the previous read did not have, so a stable
+// interface list costs no extra syscalls.
+static void mark_counted(const struct net_counters *prev, struct net_counters *curr){
+	int any_dev = 0;
+	for(int i = 0; i < curr->n; i++){
+		int j = find_if(prev, curr->name[i], i);
+		if(j >= 0)
+			curr->kind[i] = prev->kind[j];
+		else
+			curr->kind[i] = (if_has(curr->name[i], "device") ? NET_DEV : 0) |
+				(if_has(curr->name[i], "master") ? NET_MEMBER : 0);
+		any_dev |= curr->kind[i] & NET_DEV;
+	}
+	for(int i = 0; i < curr->n; i++)
+		curr->counted[i] = any_dev ? (curr->kind[i] & NET_DEV) != 0 :
+			!(curr->kind[i] & NET_MEMBER);
+}
+
+static int net_read(struct net_source *ns){
+	if(proc_file_read(&ns->file) < 0) return -1;
+	struct net_counters *curr = &ns->snap[ns->cur];
+	parse_net_dev(ns->file.buf, ns->file.len, curr);
+	mark_counted(&ns->snap[!ns->cur], curr);
+	return 0;
+}
+
+static int net_init(struct collector *c, struct sampler *sp){
+	(void)sp;
+	struct net_source *ns = arena_calloc(1, sizeof(*ns));
+	if(!ns) return -1;
+	if(proc_file_open(&ns->file, "/proc/net/dev", NET_BUF) != 0){
+		arena_free(ns);
+		return 1;
+	}
+	net_read(ns);
+	ns->cur = 1;
+	c->priv = ns;
+	return 0;
+}
+
+static int net_sample(struct collector *c, struct sampler *sp, double t){
+	(void)sp;
+	struct net_source *ns = c->priv;
+	if(net_read(ns) != 0) return -1;
+	net_rates(&ns->snap[!ns->cur], &ns->snap[ns->cur], t - ns->prev_t, &ns->rates);
+	ns->prev_t = t;
+	ns->cur = !ns->cur;
+	return 0;
+}
+
+static void net_emit(const struct collector *c, const struct sampler *sp, struct sample *s){
+	(void)sp;
+	const struct net_source *ns = c->priv;
+	s->net_rx_mbit_s = ns->rates.rx_mbit_s;
+	s->net_tx_mbit_s = ns->rates.tx_mbit_s;
+	s->net_rx_pps = ns->rates.rx_pps;
+	s->net_tx_pps = ns->rates.tx_pps;
+	s->net_errs_s = ns->rates.errs_s;
+}
+
+static void net_teardown(struct collector *c, struct sampler *sp){
+	(void)sp;
+	struct net_source *ns = c->priv;
+	if(!ns) return;
+	proc_file_close(&ns->file);
+	arena_free(ns);
+	c->priv = NULL;
+}
+
+const struct collector_ops net_collector = {
+	"net", net_init, net_sample, net_emit, net_teardown, SRC_NET
+};
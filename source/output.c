@@ -1,14 +1,591 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+#include "output.h"
+#include "trace.h"
 
-void print_json(
-		double t,
-		double cpu,
-		double mem_used_gb,
-		double mem_avail_gb
-	       ) {
-	printf(
-        "{\"t\":%.1f,\"cpu\":%.1f,\"mem_used_gb\":%.2f,\"mem_avail_gb\":%.2f}\n",
-        t, cpu, mem_used_gb, mem_avail_gb
-    );
-    fflush(stdout);
+static double mono_ms(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+int out_init(struct out_buf *o, int fd, size_t cap, enum out_format format,
+		enum flush_policy policy, unsigned every_n, double every_ms){
+	if(!o || cap < 64) return -1;
+	memset(o, 0, sizeof(*o));
+	o->buf = arena_calloc(1, cap);
+	if(!o->buf) return -1;
+	o->fd = fd;
+	o->cap = cap;
+	o->format = format;
+	o->policy = policy;
+	o->every_n = every_n ? every_n : 1;
+	o->every_ms = every_ms;
+	o->last_flush_ms = mono_ms();
+	return 0;
+}
+
+// Loops over short writes and EINTR, so a signal arriving mid-flush
+// (SIGINT on shutdown) never loses the tail of the buffer.
+int out_flush(struct out_buf *o){
+	size_t off = 0;
+	while(off < o->len){
+		ssize_t n = write(o->fd, o->buf + off, o->len - off);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			o->error = errno;
+			o->len = 0;
+			return -1;
+		}
+		off += (size_t)n;
+	}
+	o->bytes_written += off;
+	o->len = 0;
+	o->pending = 0;
+	o->last_flush_ms = mono_ms();
+	return 0;
+}
+
+void out_close(struct out_buf *o){
+	if(!o || !o->buf) return;
+	out_flush(o);
+	arena_free(o->buf);
+	o->buf = NULL;
+	trace_enc_free(&o->trace);
+}
+
+int out_parse_policy(const char *s, enum flush_policy *policy,
+		unsigned *every_n, double *every_ms){
+	char *end;
+	if(strcmp(s, "record") == 0){
+		*policy = FLUSH_RECORD;
+		return 0;
+	}
+	if(strcmp(s, "full") == 0){
+		*policy = FLUSH_FULL;
+		return 0;
+	}
+	double v = strtod(s, &end);
+	if(end == s || v <= 0.0) return -1;
+	if(strcmp(end, "ms") == 0){
+		*policy = FLUSH_TIME;
+		*every_ms = v;
+		return 0;
+	}
+	if(*end == '\0' && v == (unsigned)v){
+		*policy = FLUSH_COUNT;
+		*every_n = (unsigned)v;
+		return 0;
+	}
+	return -1;
+}
+
+static inline void out_reserve(struct out_buf *o, size_t n){
+	if(o->len + n > o->cap) out_flush(o);
+}
+
+void out_putc(struct out_buf *o, char c){
+	out_reserve(o, 1);
+	o->buf[o->len++] = c;
+}
+
+void out_write(struct out_buf *o, const char *s, size_t n){
+	while(n){
+		out_reserve(o, 1);
+		size_t room = o->cap - o->len;
+		size_t k = n < room ? n : room;
+		memcpy(o->buf + o->len, s, k);
+		o->len += k;
+		s += k;
+		n -= k;
+	}
+}
+
+void out_puts(struct out_buf *o, const char *s){
+	out_write(o, s, strlen(s));
+}
+
+void out_u64(struct out_buf *o, unsigned long long v){
+	char tmp[20];
+	int n = 0;
+	do {
+		tmp[n++] = (char)('0' + v % 10);
+		v /= 10;
+	} while(v);
+	out_reserve(o, (size_t)n);
+	while(n) o->buf[o->len++] = tmp[--n];
+}
+
+void out_long(struct out_buf *o, long v){
+	if(v < 0){
+		out_putc(o, '-');
+		out_u64(o, 0ULL - (unsigned long long)v);
+	} else {
+		out_u64(o, (unsigned long long)v);
+	}
+}
+
+static const double pow10_tab[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+// Scale, round once, then print integer and fraction as integers. Only
+// values too large for exact 64-bit scaling fall back to snprintf.
+void out_fixed(struct out_buf *o, double v, int prec){
+	if(isnan(v) || isinf(v)){
+		out_write(o, "null", 4);
+		return;
+	}
+	if(prec < 0) prec = 0;
+	if(prec > 9) prec = 9;
+	double scale = pow10_tab[prec];
+	double a = fabs(v) * scale + 0.5;
+	if(a >= 9e15){
+		char tmp[64];
+		int n = snprintf(tmp, sizeof(tmp), "%.*f", prec, v);
+		out_write(o, tmp, (size_t)n);
+		return;
+	}
+	unsigned long long m = (unsigned long long)a;
+	unsigned long long ip = m / (unsigned long long)scale;
+	unsigned long long fp = m % (unsigned long long)scale;
+	if(v < 0 && m) out_putc(o, '-');
+	out_u64(o, ip);
+	if(!prec) return;
+	out_reserve(o, (size_t)prec + 1);
+	o->buf[o->len++] = '.';
+	for(int i = prec - 1; i >= 0; i--){
+		o->buf[o->len + i] = (char)('0' + fp % 10);
+		fp /= 10;
+	}
+	o->len += prec;
+}
+
+void out_end_record(struct out_buf *o){
+	if(o->format == FORMAT_JSONL) out_putc(o, '\n');
+	o->pending++;
+	switch(o->policy){
+	case FLUSH_RECORD:
+		out_flush(o);
+		break;
+	case FLUSH_COUNT:
+		if(o->pending >= o->every_n) out_flush(o);
+		break;
+	case FLUSH_TIME:
+		if(mono_ms() - o->last_flush_ms >= o->every_ms) out_flush(o);
+		break;
+	case FLUSH_FULL:
+		break;
+	}
+}
+
+void out_poll(struct out_buf *o){
+	if(o->policy == FLUSH_TIME && o->len &&
+			mono_ms() - o->last_flush_ms >= o->every_ms)
+		out_flush(o);
+}
+
+#define OUT_LIT(o, s) out_write((o), (s), sizeof(s) - 1)
+
+static void emit_field(struct out_buf *o, const char *key_lit, size_t klen,
+		double v, int prec){
+	out_write(o, key_lit, klen);
+	out_fixed(o, v, prec);
+}
+
+#define EMIT_FIELD(o, k, v, p) emit_field((o), (k), sizeof(k) - 1, (v), (p))
+
+static void json_meta(struct out_buf *o, const struct sample_meta *m){
+	OUT_LIT(o, "{\"type\":\"meta\",\"schema\":1");
+	EMIT_FIELD(o, ",\"interval_s\":", m->interval_s, 6);
+	if(m->fast_interval_s > 0.0){
+		OUT_LIT(o, ",\"adaptive\":true");
+		EMIT_FIELD(o, ",\"fast_interval_s\":", m->fast_interval_s, 6);
+	} else {
+		OUT_LIT(o, ",\"adaptive\":false");
+	}
+	OUT_LIT(o, ",\"cores\":");
+	out_long(o, m->cores);
+	OUT_LIT(o, ",\"window\":");
+	out_long(o, m->window);
+	EMIT_FIELD(o, ",\"max_freq_ghz\":", m->max_freq_ghz, 3);
+	EMIT_FIELD(o, ",\"mem_total_gb\":", m->mem_total_gb, 2);
+	EMIT_FIELD(o, ",\"mem_avail_gb\":", m->mem_avail_gb, 2);
+	EMIT_FIELD(o, ",\"swap_total_gb\":", m->swap_total_gb, 2);
+	EMIT_FIELD(o, ",\"swap_free_gb\":", m->swap_free_gb, 2);
+	if(m->heartbeat_s > 0.0) EMIT_FIELD(o, ",\"heartbeat_s\":", m->heartbeat_s, 3);
+	if(m->predict_s > 0.0) EMIT_FIELD(o, ",\"predict_s\":", m->predict_s, 3);
+	if(m->arena_kb > 0){
+		OUT_LIT(o, ",\"arena_kb\":");
+		out_long(o, m->arena_kb);
+		OUT_LIT(o, ",\"arena_startup_kb\":");
+		out_long(o, m->arena_startup_kb);
+		if(m->arena_locked) OUT_LIT(o, ",\"arena_locked\":true");
+		else OUT_LIT(o, ",\"arena_locked\":false");
+	}
+	OUT_LIT(o, ",\"units\":{\"mem\":\"GB\",\"swap\":\"GB\",\"ts\":\"s\"}}");
+	out_end_record(o);
+}
+
+// Fields shared by sample and state_change records.
+static void emit_common(struct out_buf *o, const struct sample *s){
+	EMIT_FIELD(o, ",\"ts\":", s->t, 3);
+	EMIT_FIELD(o, ",\"cpu\":", s->cpu_pct, 2);
+	EMIT_FIELD(o, ",\"cpu_avg\":", s->cpu_avg, 2);
+	EMIT_FIELD(o, ",\"mem_used\":", s->mem_used_gb, 2);
+	EMIT_FIELD(o, ",\"mem_avail\":", s->mem_avail_gb, 2);
+	EMIT_FIELD(o, ",\"mem_swap_used\":", s->swap_used_gb, 2);
+	EMIT_FIELD(o, ",\"mem_swap_avail\":", s->swap_avail_gb, 2);
+	OUT_LIT(o, ",\"CPU_STATE\":\"");
+	out_puts(o, sys_state_str(s->cpu_state));
+	OUT_LIT(o, "\",\"MEM_STATE\":\"");
+	out_puts(o, sys_state_str(s->mem_state));
+	OUT_LIT(o, "\",\"IO_STATE\":\"");
+	out_puts(o, sys_state_str(s->io_state));
+	OUT_LIT(o, "\",\"NET_STATE\":\"");
+	out_puts(o, sys_state_str(s->net_state));
+	out_putc(o, '"');
+}
+
+static void json_sample(struct out_buf *o, const struct sample *s){
+	OUT_LIT(o, "{\"type\":\"sample\"");
+	emit_common(o, s);
+	EMIT_FIELD(o, ",\"cpu_min\":", s->cpu_min, 2);
+	EMIT_FIELD(o, ",\"cpu_max\":", s->cpu_max, 2);
+	EMIT_FIELD(o, ",\"cpu_ewma\":", s->cpu_ewma, 2);
+	EMIT_FIELD(o, ",\"cpu_hot_avg\":", s->cpu_hot_avg, 2);
+	OUT_LIT(o, ",\"missed\":");
+	out_u64(o, s->missed);
+	OUT_LIT(o, ",\"dropped\":");
+	out_u64(o, s->dropped);
+	EMIT_FIELD(o, ",\"interval\":", s->interval, 6);
+	EMIT_FIELD(o, ",\"psi_cpu_some\":", s->psi_cpu_some, 2);
+	EMIT_FIELD(o, ",\"psi_mem_some\":", s->psi_mem_some, 2);
+	EMIT_FIELD(o, ",\"psi_mem_full\":", s->psi_mem_full, 2);
+	EMIT_FIELD(o, ",\"psi_io_some\":", s->psi_io_some, 2);
+	EMIT_FIELD(o, ",\"psi_io_full\":", s->psi_io_full, 2);
+	if(s->psi_wakeup) OUT_LIT(o, ",\"psi_wakeup\":true");
+	else OUT_LIT(o, ",\"psi_wakeup\":false");
+	EMIT_FIELD(o, ",\"disk_read_iops\":", s->disk_rd_iops, 2);
+	EMIT_FIELD(o, ",\"disk_write_iops\":", s->disk_wr_iops, 2);
+	EMIT_FIELD(o, ",\"disk_read_mb_s\":", s->disk_rd_mb_s, 3);
+	EMIT_FIELD(o, ",\"disk_write_mb_s\":", s->disk_wr_mb_s, 3);
+	EMIT_FIELD(o, ",\"disk_await_ms\":", s->disk_await_ms, 2);
+	EMIT_FIELD(o, ",\"disk_util\":", s->disk_util_pct, 2);
+	EMIT_FIELD(o, ",\"net_rx_mbit_s\":", s->net_rx_mbit_s, 3);
+	EMIT_FIELD(o, ",\"net_tx_mbit_s\":", s->net_tx_mbit_s, 3);
+	EMIT_FIELD(o, ",\"net_rx_pps\":", s->net_rx_pps, 1);
+	EMIT_FIELD(o, ",\"net_tx_pps\":", s->net_tx_pps, 1);
+	EMIT_FIELD(o, ",\"net_errs_s\":", s->net_errs_s, 2);
+	if(!isnan(s->cgroup_mem_pct)) EMIT_FIELD(o, ",\"cgroup_mem_pct\":", s->cgroup_mem_pct, 2);
+	if(!isnan(s->cgroup_cpu_pct)) EMIT_FIELD(o, ",\"cgroup_cpu_pct\":", s->cgroup_cpu_pct, 2);
+	if(!isnan(s->mem_slope_mb_s)){
+		EMIT_FIELD(o, ",\"mem_slope_mb_s\":", s->mem_slope_mb_s, 3);
+		if(!isnan(s->mem_eta_s)) EMIT_FIELD(o, ",\"mem_eta_s\":", s->mem_eta_s, 1);
+		EMIT_FIELD(o, ",\"cpu_z\":", s->cpu_z, 2);
+		OUT_LIT(o, ",\"MEM_PREDICTED\":\"");
+		out_puts(o, sys_state_str(s->mem_predicted));
+		out_putc(o, '"');
+	}
+	if(!isnan(s->runq_avg_us)){
+		EMIT_FIELD(o, ",\"runq_avg_us\":", s->runq_avg_us, 2);
+		EMIT_FIELD(o, ",\"runq_p99_us\":", s->runq_p99_us, 0);
+		EMIT_FIELD(o, ",\"pgfault_s\":", s->pgfault_s, 1);
+		EMIT_FIELD(o, ",\"reclaim_ms_s\":", s->reclaim_ms_s, 3);
+	}
+	if(s->skipped){
+		OUT_LIT(o, ",\"skipped\":");
+		out_u64(o, s->skipped);
+	}
+	OUT_LIT(o, ",\"cpu_cores\":[");
+	for(int i = 0; i < s->ncores; i++){
+		if(i) out_putc(o, ',');
+		out_fixed(o, s->core_pct[i], 2);
+	}
+	OUT_LIT(o, "]}");
+	out_end_record(o);
+}
+
+static void json_state_change(struct out_buf *o, const struct sample *s){
+	OUT_LIT(o, "{\"type\":\"event\",\"event\":\"state_change\"");
+	emit_common(o, s);
+	out_putc(o, '}');
+	out_end_record(o);
+}
+
+// The level is what mem_avail is heading for within --predict S; eta
+// and slope are left out while the fit has nothing to say.
+static void json_predicted_state(struct out_buf *o, const struct sample *s){
+	OUT_LIT(o, "{\"type\":\"event\",\"event\":\"predicted_state\"");
+	emit_common(o, s);
+	OUT_LIT(o, ",\"MEM_PREDICTED\":\"");
+	out_puts(o, sys_state_str(s->mem_predicted));
+	out_putc(o, '"');
+	if(!isnan(s->mem_eta_s)) EMIT_FIELD(o, ",\"mem_eta_s\":", s->mem_eta_s, 1);
+	if(!isnan(s->mem_slope_mb_s)) EMIT_FIELD(o, ",\"mem_slope_mb_s\":", s->mem_slope_mb_s, 3);
+	out_putc(o, '}');
+	out_end_record(o);
+}
+
+static void emit_quantiles(struct out_buf *o, const char *name,
+		const double q[SUMMARY_NQ]){
+	static const char *tags[] = { "_p50\":", "_p95\":", "_p99\":" };
+	for(int i = 0; i < SUMMARY_NQ; i++){
+		OUT_LIT(o, ",\"");
+		out_puts(o, name);
+		out_puts(o, tags[i]);
+		out_fixed(o, q[i], 2);
+	}
+}
+
+static void json_summary(struct out_buf *o, const char *type,
+		const struct sample_summary *m){
+	OUT_LIT(o, "{\"type\":\"");
+	out_puts(o, type);
+	out_putc(o, '"');
+	EMIT_FIELD(o, ",\"ts\":", m->t, 3);
+	OUT_LIT(o, ",\"samples\":");
+	out_u64(o, m->samples);
+	OUT_LIT(o, ",\"missed\":");
+	out_u64(o, m->missed);
+	OUT_LIT(o, ",\"dropped\":");
+	out_u64(o, m->dropped);
+	emit_quantiles(o, "cpu", m->cpu_q);
+	emit_quantiles(o, "mem_used", m->mem_used_q);
+	out_putc(o, '}');
+	out_end_record(o);
+}
+
+// comm is whatever the process set with prctl(PR_SET_NAME)
+void out_json_string(struct out_buf *o, const char *s){
+	static const char hex[] = "0123456789abcdef";
+	out_putc(o, '"');
+	for(; *s; s++){
+		unsigned char c = (unsigned char)*s;
+		if(c == '"' || c == '\\'){
+			out_putc(o, '\\');
+			out_putc(o, (char)c);
+		} else if(c < 0x20){
+			OUT_LIT(o, "\\u00");
+			out_putc(o, hex[c >> 4]);
+			out_putc(o, hex[c & 15]);
+		} else {
+			out_putc(o, (char)c);
+		}
+	}
+	out_putc(o, '"');
+}
+
+const char *top_reason_str(enum top_reason r){
+	return r == TOP_SUMMARY ? "summary" : "state_change";
+}
+
+static void json_top_list(struct out_buf *o, const struct proc_top_entry *e, int n){
+	out_putc(o, '[');
+	for(int i = 0; i < n; i++){
+		if(i) out_putc(o, ',');
+		OUT_LIT(o, "{\"pid\":");
+		out_long(o, e[i].pid);
+		OUT_LIT(o, ",\"comm\":");
+		out_json_string(o, e[i].comm);
+		EMIT_FIELD(o, ",\"cpu\":", e[i].cpu_pct, 2);
+		OUT_LIT(o, ",\"rss_kb\":");
+		out_long(o, e[i].rss_kb);
+		out_putc(o, '}');
+	}
+	out_putc(o, ']');
+}
+
+static void json_top(struct out_buf *o, const struct proc_top *top){
+	OUT_LIT(o, "{\"type\":\"top\"");
+	EMIT_FIELD(o, ",\"ts\":", top->t, 3);
+	OUT_LIT(o, ",\"reason\":\"");
+	out_puts(o, top_reason_str(top->reason));
+	OUT_LIT(o, "\",\"by_cpu\":");
+	json_top_list(o, top->cpu, top->n_cpu);
+	OUT_LIT(o, ",\"by_rss\":");
+	json_top_list(o, top->rss, top->n_rss);
+	out_putc(o, '}');
+	out_end_record(o);
+}
+
+static void json_cgroups(struct out_buf *o, const struct cgroup_report *rep){
+	OUT_LIT(o, "{\"type\":\"cgroups\"");
+	EMIT_FIELD(o, ",\"ts\":", rep->t, 3);
+	OUT_LIT(o, ",\"reason\":\"");
+	out_puts(o, top_reason_str(rep->reason));
+	OUT_LIT(o, "\",\"count\":");
+	out_long(o, rep->count);
+	OUT_LIT(o, ",\"warn\":");
+	out_long(o, rep->warn);
+	OUT_LIT(o, ",\"danger\":");
+	out_long(o, rep->danger);
+	OUT_LIT(o, ",\"cgroups\":[");
+	for(int i = 0; i < rep->n; i++){
+		const struct cgroup_report_entry *e = &rep->e[i];
+		if(i) out_putc(o, ',');
+		OUT_LIT(o, "{\"name\":");
+		out_json_string(o, e->name);
+		OUT_LIT(o, ",\"state\":\"");
+		out_puts(o, sys_state_str(e->state));
+		out_putc(o, '"');
+		EMIT_FIELD(o, ",\"cpu\":", e->cpu_pct, 2);
+		EMIT_FIELD(o, ",\"cpu_limit_pct\":", e->cpu_limit_pct, 2);
+		EMIT_FIELD(o, ",\"throttled_pct\":", e->throttled_pct, 2);
+		EMIT_FIELD(o, ",\"mem_mb\":", e->mem_mb, 1);
+		EMIT_FIELD(o, ",\"mem_limit_pct\":", e->mem_limit_pct, 2);
+		out_putc(o, '}');
+	}
+	OUT_LIT(o, "]}");
+	out_end_record(o);
+}
+
+static void json_lat(struct out_buf *o, const struct lat_summary *l){
+	OUT_LIT(o, "{\"n\":");
+	out_u64(o, l->n);
+	EMIT_FIELD(o, ",\"p50\":", l->p50_us, 3);
+	EMIT_FIELD(o, ",\"p99\":", l->p99_us, 3);
+	EMIT_FIELD(o, ",\"max\":", l->max_us, 3);
+	out_putc(o, '}');
+}
+
+static void json_self(struct out_buf *o, const struct self_stat *m){
+	OUT_LIT(o, "{\"type\":\"self\"");
+	EMIT_FIELD(o, ",\"ts\":", m->t, 3);
+	EMIT_FIELD(o, ",\"cpu_pct\":", m->cpu_pct, 3);
+	EMIT_FIELD(o, ",\"utime_s\":", m->utime_s, 3);
+	EMIT_FIELD(o, ",\"stime_s\":", m->stime_s, 3);
+	EMIT_FIELD(o, ",\"sampler_cpu_s\":", m->sampler_cpu_s, 3);
+	EMIT_FIELD(o, ",\"writer_cpu_s\":", m->writer_cpu_s, 3);
+	OUT_LIT(o, ",\"rss_kb\":");
+	out_long(o, m->rss_kb);
+	OUT_LIT(o, ",\"maxrss_kb\":");
+	out_long(o, m->maxrss_kb);
+	OUT_LIT(o, ",\"bytes_written\":");
+	out_u64(o, m->bytes_written);
+	OUT_LIT(o, ",\"ticks\":");
+	out_u64(o, m->ticks);
+	OUT_LIT(o, ",\"missed\":");
+	out_u64(o, m->missed);
+	OUT_LIT(o, ",\"late_us\":");
+	json_lat(o, &m->late);
+	OUT_LIT(o, ",\"loop_us\":");
+	json_lat(o, &m->loop);
+	OUT_LIT(o, ",\"collectors_us\":{");
+	for(int i = 0; i < m->ncoll; i++){
+		if(i) out_putc(o, ',');
+		out_json_string(o, m->coll[i].name);
+		out_putc(o, ':');
+		json_lat(o, &m->coll[i].lat);
+	}
+	OUT_LIT(o, "}}");
+	out_end_record(o);
+}
+
+void sample_summary_fill(struct sample_summary *m, double t,
+		const struct qsketch *cpu, const struct qsketch *mem_used){
+	static const double qs[SUMMARY_NQ] = { 0.50, 0.95, 0.99 };
+	m->t = t;
+	m->samples = cpu->count;
+	m->missed = 0;
+	m->dropped = 0;
+	for(int i = 0; i < SUMMARY_NQ; i++){
+		m->cpu_q[i] = qsketch_quantile(cpu, qs[i]);
+		m->mem_used_q[i] = qsketch_quantile(mem_used, qs[i]);
+	}
+}
+
+static void json_block(struct out_buf *o, const struct trace_block *b){
+	static const char *keys[] = {
+		",\"CPU_STATE\":\"", ",\"MEM_STATE\":\"", ",\"IO_STATE\":\"", ",\"NET_STATE\":\""
+	};
+	double n = b->samples ? (double)b->samples : 1.0;
+	OUT_LIT(o, "{\"type\":\"block\"");
+	EMIT_FIELD(o, ",\"ts_first\":", b->t_first_us / 1e6, 3);
+	EMIT_FIELD(o, ",\"ts_last\":", b->t_last_us / 1e6, 3);
+	OUT_LIT(o, ",\"offset\":");
+	out_u64(o, b->offset);
+	OUT_LIT(o, ",\"samples\":");
+	out_u64(o, b->samples);
+	EMIT_FIELD(o, ",\"cpu_min\":", b->cpu_min / 100.0, 2);
+	EMIT_FIELD(o, ",\"cpu_max\":", b->cpu_max / 100.0, 2);
+	EMIT_FIELD(o, ",\"cpu_mean\":", (double)b->cpu_sum / 100.0 / n, 2);
+	EMIT_FIELD(o, ",\"mem_used_min\":", b->mem_used_min_kb / 1024.0 / 1024.0, 2);
+	EMIT_FIELD(o, ",\"mem_used_max\":", b->mem_used_max_kb / 1024.0 / 1024.0, 2);
+	EMIT_FIELD(o, ",\"mem_used_mean\":", (double)b->mem_used_sum_kb / 1024.0 / 1024.0 / n, 2);
+	for(int g = 0; g < 4; g++){
+		out_puts(o, keys[g]);
+		out_puts(o, sys_state_str((sys_state)((b->states >> (2 * g)) & 3)));
+		out_putc(o, '"');
+	}
+	OUT_LIT(o, ",\"state_changes\":");
+	out_u64(o, b->changes);
+	out_putc(o, '}');
+	out_end_record(o);
+}
+
+static void json_index(struct out_buf *o, size_t nblocks, int64_t t_last_us, int truncated){
+	OUT_LIT(o, "{\"type\":\"index\",\"blocks\":");
+	out_u64(o, nblocks);
+	EMIT_FIELD(o, ",\"ts_last\":", t_last_us / 1e6, 3);
+	if(truncated) OUT_LIT(o, ",\"truncated\":true");
+	else OUT_LIT(o, ",\"truncated\":false");
+	out_putc(o, '}');
+	out_end_record(o);
+}
+
+void emit_meta(struct out_buf *o, const struct sample_meta *m){
+	if(o->format == FORMAT_BIN) trace_meta(o, m);
+	else json_meta(o, m);
+}
+
+void emit_sample(struct out_buf *o, const struct sample *s){
+	if(o->format == FORMAT_BIN) trace_sample(o, s);
+	else json_sample(o, s);
+}
+
+void emit_state_change(struct out_buf *o, const struct sample *s){
+	if(o->format == FORMAT_BIN) trace_state_change(o, s);
+	else json_state_change(o, s);
+}
+
+void emit_predicted_state(struct out_buf *o, const struct sample *s){
+	// folded into the forecast fields of the sample that follows
+	if(o->format != FORMAT_BIN) json_predicted_state(o, s);
+}
+
+void emit_summary(struct out_buf *o, const char *type,
+		const struct sample_summary *m){
+	if(o->format == FORMAT_BIN) trace_summary(o, strcmp(type, "end") == 0, m);
+	else json_summary(o, type, m);
+}
+
+void emit_top(struct out_buf *o, const struct proc_top *top){
+	if(o->format == FORMAT_BIN) trace_top(o, top);
+	else json_top(o, top);
+}
+
+void emit_cgroups(struct out_buf *o, const struct cgroup_report *rep){
+	if(o->format == FORMAT_BIN) trace_cgroups(o, rep);
+	else json_cgroups(o, rep);
+}
+
+void emit_self(struct out_buf *o, const struct self_stat *m){
+	if(o->format == FORMAT_BIN) trace_self(o, m);
+	else json_self(o, m);
+}
+
+void emit_block(struct out_buf *o, const struct trace_block *b){
+	// the index is read back from a trace, never written through here
+	if(o->format != FORMAT_BIN) json_block(o, b);
+}
+
+void emit_index(struct out_buf *o, size_t nblocks, int64_t t_last_us, int truncated){
+	if(o->format != FORMAT_BIN) json_index(o, nblocks, t_last_us, truncated);
 }
@@ -0,0 +1,163 @@
+#define _GNU_SOURCE	// cpu_set_t, sched_getcpu
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include "placement.h"
+#include "config.h"
+
+static int parse_list(const char *s, cpu_set_t *set){
+	CPU_ZERO(set);
+	if(*s == '\0') return -1;
+	while(*s){
+		char *end;
+		long lo = strtol(s, &end, 10), hi = lo;
+		if(end == s || lo < 0) return -1;
+		if(*end == '-'){
+			s = end + 1;
+			hi = strtol(s, &end, 10);
+			if(end == s || hi < lo) return -1;
+		}
+		if(hi >= CPU_SETSIZE) return -1;
+		for(long c = lo; c <= hi; c++) CPU_SET((int)c, set);
+		s = end;
+		if(*s == ',') s++;
+		else if(*s != '\0' && *s != '\n') return -1;
+		else break;
+	}
+	return 0;
+}
+
+int placement_parse_cpus(const char *list){
+	cpu_set_t set;
+	return parse_list(list, &set);
+}
+
+int placement_parse_sched(const char *spec, enum probe_sched *policy, int *prio){
+	static const struct { const char *name; enum probe_sched p; } names[] = {
+		{ "other", PROBE_SCHED_OTHER }, { "batch", PROBE_SCHED_BATCH },
+		{ "idle", PROBE_SCHED_IDLE }, { "fifo", PROBE_SCHED_FIFO },
+		{ "rr", PROBE_SCHED_RR },
+	};
+	const char *c = strchr(spec, ':');
+	size_t n = c ? (size_t)(c - spec) : strlen(spec);
+	for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++){
+		if(strlen(names[i].name) != n || memcmp(spec, names[i].name, n) != 0) continue;
+		int rt = names[i].p == PROBE_SCHED_FIFO || names[i].p == PROBE_SCHED_RR;
+		*policy = names[i].p;
+		*prio = rt ? PLACEMENT_RT_PRIO : 0;
+		if(!c) return 0;
+		char *end;
+		long v = strtol(c + 1, &end, 10);
+		if(!rt || c[1] == '\0' || *end != '\0' || v < 1 || v > 99) return -1;
+		*prio = (int)v;
+		return 0;
+	}
+	return -1;
+}
+
+static int read_list(const char *path, cpu_set_t *set){
+	char buf[4096];
+	FILE *f = fopen(path, "r");
+	if(!f) return -1;
+	int ok = fgets(buf, sizeof(buf), f) != NULL;
+	fclose(f);
+	return ok ? parse_list(buf, set) : -1;
+}
+
+// -1: no NUMA in this kernel, or the CPU is not there
+static int cpu_node(int cpu){
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	DIR *d = opendir(path);
+	if(!d) return -1;
+	int node = -1;
+	struct dirent *de;
+	while(node < 0 && (de = readdir(d)))
+		if(strncmp(de->d_name, "node", 4) == 0) sscanf(de->d_name + 4, "%d", &node);
+	closedir(d);
+	return node;
+}
+
+static int first_cpu(const cpu_set_t *set){
+	for(int c = 0; c < CPU_SETSIZE; c++)
+		if(CPU_ISSET(c, set)) return c;
+	return -1;
+}
+
+// Node of the probe's CPUs; without --cpu, the probe is kept on the
+// node it is running on now.
+static int numa_place(const struct probe_config *cfg, cpu_set_t *set, int *pin){
+	cpu_set_t nodes;
+	if(read_list("/sys/devices/system/node/online", &nodes) != 0 || CPU_COUNT(&nodes) < 2)
+		return -1;
+	int cpu = *pin ? first_cpu(set) : sched_getcpu();
+	int node = cpu >= 0 ? cpu_node(cpu) : -1;
+	if(node < 0) return -1;
+	if(!cfg->cpu_list){
+		char path[80];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		if(read_list(path, set) != 0) return -1;
+		*pin = 1;
+	}
+	return node;
+}
+
+static const char *sched_name(int policy){
+	switch(policy){
+	case SCHED_BATCH: return "batch";
+	case SCHED_IDLE: return "idle";
+	case SCHED_FIFO: return "fifo";
+	case SCHED_RR: return "rr";
+	default: return "other";
+	}
+}
+
+static int set_sched(int policy, int prio){
+	struct sched_param sp = { .sched_priority = prio };
+	// tid 0: this thread only; threads started after inherit it
+	if(sched_setscheduler(0, policy, &sp) != 0){
+		int err = errno;
+		fprintf(stderr, "--sched %s: %s%s\n", sched_name(policy), strerror(err),
+				err == EPERM ? " (needs CAP_SYS_NICE or an RLIMIT_RTPRIO)" : "");
+		return -1;
+	}
+	return 0;
+}
+
+int placement_apply(const struct probe_config *cfg, struct arena *a){
+	cpu_set_t set;
+	int pin = 0;
+	if(cfg->cpu_list){
+		if(parse_list(cfg->cpu_list, &set) != 0) return -1;
+		pin = 1;
+	}
+	if(cfg->numa){
+		int node = numa_place(cfg, &set, &pin);
+		// one node: nothing to be local to
+		if(node >= 0 && arena_bind_node(a, node) != 0) return -1;
+	}
+	if(pin && sched_setaffinity(0, sizeof(set), &set) != 0){
+		perror("--cpu");
+		return -1;
+	}
+	if(cfg->have_nice && setpriority(PRIO_PROCESS, 0, cfg->nice) != 0){
+		perror("--nice");
+		return -1;
+	}
+	switch(cfg->sched){
+	case PROBE_SCHED_OTHER: return set_sched(SCHED_OTHER, 0);
+	case PROBE_SCHED_BATCH: return set_sched(SCHED_BATCH, 0);
+	case PROBE_SCHED_IDLE: return set_sched(SCHED_IDLE, 0);
+	default: return 0;
+	}
+}
+
+int placement_apply_rt(const struct probe_config *cfg){
+	if(cfg->sched == PROBE_SCHED_FIFO) return set_sched(SCHED_FIFO, cfg->sched_prio);
+	if(cfg->sched == PROBE_SCHED_RR) return set_sched(SCHED_RR, cfg->sched_prio);
+	return 0;
+}
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "arena.h"
+#include "probe.h"
+
+
+static int proc_file_reopen(struct proc_file *pf){
+	if(pf->fd >= 0) close(pf->fd);
+	pf->fd = open(pf->path, O_RDONLY | O_CLOEXEC);
+	return pf->fd >= 0 ? 0 : -1;
+}
+
+int proc_file_open_buf(struct proc_file *pf, const char *path, char *buf, size_t cap){
+	if(!pf || !path || !buf || cap < 2) return -1;
+	pf->path = path;
+	pf->fd = -1;
+	pf->len = 0;
+	pf->cap = cap;
+	pf->buf = buf;
+	pf->own_buf = 0;
+	pf->buf[0] = '\0';
+	if(proc_file_reopen(pf) != 0){
+		pf->buf = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+int proc_file_open(struct proc_file *pf, const char *path, size_t cap){
+	if(!pf || cap < 2) return -1;
+	char *buf = arena_calloc(1, cap);
+	if(!buf) return -1;
+	if(proc_file_open_buf(pf, path, buf, cap) != 0){
+		arena_free(buf);
+		return -1;
+	}
+	pf->own_buf = 1;
+	return 0;
+}
+
+static ssize_t proc_file_pread(struct proc_file *pf){
+	ssize_t n;
+	do {
+		n = pread(pf->fd, pf->buf, pf->cap - 1, 0);
+	} while(n < 0 && errno == EINTR);
+	return n;
+}
+
+// One syscall per tick in the common case. A failed read (fd closed
+// under us, procfs remounted, ...) reopens the file and retries once.
+int proc_file_read(struct proc_file *pf){
+	ssize_t n = pf->fd >= 0 ? proc_file_pread(pf) : -1;
+	if(n < 0){
+		if(proc_file_reopen(pf) != 0) return -1;
+		n = proc_file_pread(pf);
+		if(n < 0) return -1;
+	}
+	pf->len = (size_t)n;
+	pf->buf[n] = '\0';
+	return (int)n;
+}
+
+void proc_file_close(struct proc_file *pf){
+	if(!pf) return;
+	if(pf->fd >= 0) close(pf->fd);
+	pf->fd = -1;
+	if(pf->own_buf) arena_free(pf->buf);
+	pf->buf = NULL;
+	pf->len = 0;
+}
+
+int probe_open(struct probe_ctx *ctx, int cores){
+	if(!ctx) return -1;
+	if(cores < 1) cores = 1;
+	if(proc_file_open(&ctx->stat, "/proc/stat",
+				(size_t)(cores + 1) * PROBE_STAT_LINE) != 0){
+		perror("open /proc/stat");
+		return -1;
+	}
+	if(proc_file_open(&ctx->meminfo, "/proc/meminfo", PROBE_MEMINFO_BUF) != 0){
+		perror("open /proc/meminfo");
+		proc_file_close(&ctx->stat);
+		return -1;
+	}
+	return 0;
+}
+
+void probe_close(struct probe_ctx *ctx){
+	if(!ctx) return;
+	proc_file_close(&ctx->stat);
+	proc_file_close(&ctx->meminfo);
+}
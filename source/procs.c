@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "arena.h"
+#include "procs.h"
+#include "parse.h"
+
+#define PROCS_INIT_CAP 1024
+#define PROCS_START_MAX (1u << 20)	// slots procs_init() starts with at most
+#define PROCS_STAT_BUF 1024
+#define PROCS_STATM_BUF 128
+
+static inline unsigned pid_hash(int pid){
+	unsigned h = (unsigned)pid * 0x9e3779b1u;
+	return h ^ (h >> 16);
+}
+
+// Processes running now; /proc entries are pids or names.
+static unsigned procs_running(void){
+	DIR *d = opendir("/proc");
+	if(!d) return 0;
+	unsigned n = 0;
+	struct dirent *de;
+	while((de = readdir(d)))
+		n += de->d_name[0] >= '1' && de->d_name[0] <= '9';
+	closedir(d);
+	return n;
+}
+
+int procs_init(struct proc_table *pt, int top_n, int rescan){
+	memset(pt, 0, sizeof(*pt));
+	if(top_n > PROCS_TOP_MAX) top_n = PROCS_TOP_MAX;
+	pt->top_n = top_n;
+	pt->rescan = rescan > 0 ? rescan : PROCS_RESCAN_DEFAULT;
+	// room for 2N by CPU, so a process climbing into the top N is
+	// already tracked, plus N by RSS
+	pt->hot_cap = 3 * top_n;
+	// sized so the host can double its processes before the table has
+	// to: each growth leaves the old copy behind in the arena
+	pt->cap = PROCS_INIT_CAP;
+	for(unsigned want = procs_running(); pt->cap < 4 * want && pt->cap < PROCS_START_MAX;)
+		pt->cap *= 2;
+	pt->slots = arena_calloc(pt->cap, sizeof(*pt->slots));
+	size_t nhot = (size_t)(pt->hot_cap > 0 ? pt->hot_cap : 1);
+	pt->hot = arena_calloc(nhot, sizeof(*pt->hot));
+	pt->hot_bufs = arena_calloc(nhot, PROCS_STAT_BUF + PROCS_STATM_BUF);
+	if(!pt->slots || !pt->hot || !pt->hot_bufs){
+		procs_free(pt);
+		return -1;
+	}
+	for(size_t i = 0; i < nhot; i++){
+		pt->hot[i].stat_buf = pt->hot_bufs + i * (PROCS_STAT_BUF + PROCS_STATM_BUF);
+		pt->hot[i].statm_buf = pt->hot[i].stat_buf + PROCS_STAT_BUF;
+	}
+	long hz = sysconf(_SC_CLK_TCK);
+	long page = sysconf(_SC_PAGESIZE);
+	pt->hz = hz > 0 ? (double)hz : 100.0;
+	pt->page_kb = page > 0 ? page / 1024 : 4;
+	return 0;
+}
+
+static void hot_close(struct proc_hot *h){
+	proc_file_close(&h->stat);
+	proc_file_close(&h->statm);
+	h->pid = 0;
+}
+
+void procs_free(struct proc_table *pt){
+	if(pt->hot){
+		for(int i = 0; i < pt->hot_cap; i++)
+			if(pt->hot[i].pid) hot_close(&pt->hot[i]);
+		arena_free(pt->hot);
+	}
+	arena_free(pt->hot_bufs);
+	arena_free(pt->slots);
+	pt->hot = NULL;
+	pt->hot_bufs = NULL;
+	pt->slots = NULL;
+	pt->count = 0;
+}
+
+// ---- pid table ----
+
+static struct proc_entry *procs_find(const struct proc_table *pt, int pid){
+	unsigned m = pt->cap - 1;
+	for(unsigned i = pid_hash(pid) & m;; i = (i + 1) & m){
+		if(pt->slots[i].pid == pid) return &pt->slots[i];
+		if(pt->slots[i].pid == 0) return NULL;
+	}
+}
+
+static void procs_place(struct proc_entry *slots, unsigned cap, const struct proc_entry *e){
+	unsigned m = cap - 1;
+	unsigned i = pid_hash(e->pid) & m;
+	while(slots[i].pid) i = (i + 1) & m;
+	slots[i] = *e;
+}
+
+// Kept at most half full so probe sequences stay short.
+static int procs_grow(struct proc_table *pt){
+	unsigned cap = pt->cap * 2;
+	struct proc_entry *slots = arena_calloc(cap, sizeof(*slots));
+	if(!slots) return -1;
+	for(unsigned i = 0; i < pt->cap; i++)
+		if(pt->slots[i].pid) procs_place(slots, cap, &pt->slots[i]);
+	arena_free(pt->slots);
+	pt->slots = slots;
+	pt->cap = cap;
+	return 0;
+}
+
+static struct proc_entry *procs_insert(struct proc_table *pt, int pid){
+	struct proc_entry *e = procs_find(pt, pid);
+	if(e) return e;
+	if((pt->count + 1) * 2 > pt->cap && procs_grow(pt) != 0) return NULL;
+	struct proc_entry fresh;
+	memset(&fresh, 0, sizeof(fresh));
+	fresh.pid = pid;
+	procs_place(pt->slots, pt->cap, &fresh);
+	pt->count++;
+	return procs_find(pt, pid);
+}
+
+// Backward-shift delete: no tombstones, lookups never slow down.
+static void procs_remove_at(struct proc_table *pt, unsigned i){
+	unsigned m = pt->cap - 1;
+	unsigned j = i;
+	for(;;){
+		j = (j + 1) & m;
+		if(pt->slots[j].pid == 0) break;
+		unsigned home = pid_hash(pt->slots[j].pid) & m;
+		// j may fill the hole if its home is not inside (i, j]
+		if(((j - home) & m) >= ((j - i) & m)){
+			pt->slots[i] = pt->slots[j];
+			i = j;
+		}
+	}
+	pt->slots[i].pid = 0;
+	pt->count--;
+}
+
+static void procs_remove(struct proc_table *pt, int pid){
+	struct proc_entry *e = procs_find(pt, pid);
+	if(e) procs_remove_at(pt, (unsigned)(e - pt->slots));
+}
+
+// Drops every pid the last full scan did not see. A delete can pull a
+// later entry into slot i, so i is only advanced past a live entry.
+static void procs_evict(struct proc_table *pt){
+	for(unsigned i = 0; i < pt->cap;){
+		struct proc_entry *e = &pt->slots[i];
+		if(e->pid && e->gen != pt->gen) procs_remove_at(pt, i);
+		else i++;
+	}
+}
+
+// ---- /proc/[pid] parsing ----
+
+struct pid_stat {
+	char comm[PROCS_COMM];
+	unsigned long long ticks;
+	unsigned long long start;
+	long rss_kb;
+};
+
+static const char *skip_field(const char *p, const char *end){
+	p = parse_skip_blank(p, end);
+	while(p < end && *p != ' ') p++;
+	return p;
+}
+
+// "pid (comm) S ppid ... utime(14) stime(15) ... starttime(22) ..."
+// comm may itself contain spaces and parentheses: it ends at the last ')'.
+static int parse_pid_stat(const char *buf, size_t len, struct pid_stat *ps){
+	const char *end = buf + len;
+	const char *lp = memchr(buf, '(', len);
+	const char *rp = end;
+	while(rp > buf && rp[-1] != ')') rp--;
+	if(!lp || rp <= lp + 1) return -1;
+	rp--;
+	size_t n = (size_t)(rp - lp - 1);
+	if(n >= PROCS_COMM) n = PROCS_COMM - 1;
+	memcpy(ps->comm, lp + 1, n);
+	ps->comm[n] = '\0';
+
+	const char *p = rp + 1;
+	long ut, st, start;
+	for(int f = 3; f < 14 && p; f++) p = skip_field(p, end);
+	if(!p || !(p = parse_long(p, end, &ut)) || !(p = parse_long(p, end, &st)))
+		return -1;
+	for(int f = 16; f < 22; f++) p = skip_field(p, end);
+	if(!parse_long(p, end, &start)) return -1;
+	ps->ticks = (unsigned long long)ut + (unsigned long long)st;
+	ps->start = (unsigned long long)start;
+	return 0;
+}
+
+// "size resident shared ..." in pages
+static int parse_pid_statm(const char *buf, size_t len, long page_kb, long *rss_kb){
+	const char *end = buf + len;
+	long size, res;
+	const char *p = parse_long(buf, end, &size);
+	if(!p || !parse_long(p, end, &res)) return -1;
+	*rss_kb = res * page_kb;
+	return 0;
+}
+
+static void procs_update(struct proc_table *pt, struct proc_entry *e,
+		const struct pid_stat *ps, double t){
+	if(e->read_t > 0.0 && e->start == ps->start && t > e->read_t &&
+			ps->ticks >= e->ticks){
+		e->cpu_pct = (double)(ps->ticks - e->ticks) / pt->hz / (t - e->read_t) * 100.0;
+	} else {
+		// new pid, or the pid was reused: no baseline yet
+		e->cpu_pct = 0.0;
+	}
+	e->start = ps->start;
+	e->ticks = ps->ticks;
+	e->read_t = t;
+	e->rss_kb = ps->rss_kb;
+	memcpy(e->comm, ps->comm, PROCS_COMM);
+}
+
+static ssize_t read_at(int dfd, const char *name, char *buf, size_t cap){
+	int fd = openat(dfd, name, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) return -1;
+	ssize_t n;
+	do {
+		n = read(fd, buf, cap - 1);
+	} while(n < 0 && errno == EINTR);
+	close(fd);
+	if(n >= 0) buf[n] = '\0';
+	return n;
+}
+
+static int procs_scan(struct proc_table *pt, double t){
+	DIR *d = opendir("/proc");
+	if(!d){
+		perror("opendir /proc");
+		return -1;
+	}
+	int dfd = dirfd(d);
+	char path[64];
+	char buf[PROCS_STAT_BUF];
+	struct pid_stat ps;
+	struct dirent *de;
+	pt->gen++;
+	while((de = readdir(d)) != NULL){
+		const char *name = de->d_name;
+		if(de->d_type != DT_DIR && de->d_type != DT_UNKNOWN) continue;
+		long pid;
+		const char *e = parse_long(name, name + strlen(name), &pid);
+		if(!e || *e || pid <= 0) continue;
+
+		snprintf(path, sizeof(path), "%ld/stat", pid);
+		ssize_t n = read_at(dfd, path, buf, sizeof(buf));
+		if(n <= 0 || parse_pid_stat(buf, (size_t)n, &ps) != 0) continue;
+		snprintf(path, sizeof(path), "%ld/statm", pid);
+		n = read_at(dfd, path, buf, sizeof(buf));
+		if(n <= 0 || parse_pid_statm(buf, (size_t)n, pt->page_kb, &ps.rss_kb) != 0)
+			continue;
+
+		struct proc_entry *pe = procs_insert(pt, (int)pid);
+		if(!pe) continue;
+		procs_update(pt, pe, &ps, t);
+		pe->gen = pt->gen;
+	}
+	closedir(d);
+	procs_evict(pt);
+	return 0;
+}
+
+// ---- hot set ----
+
+static void procs_read_hot(struct proc_table *pt, double t){
+	struct pid_stat ps;
+	for(int i = 0; i < pt->hot_cap; i++){
+		struct proc_hot *h = &pt->hot[i];
+		if(!h->pid) continue;
+		struct proc_entry *e = procs_find(pt, h->pid);
+		// a failed read means the process is gone: evict it now rather
+		// than keep reporting it until the next full scan
+		if(!e || proc_file_read(&h->stat) <= 0 ||
+				parse_pid_stat(h->stat.buf, h->stat.len, &ps) != 0 ||
+				proc_file_read(&h->statm) <= 0 ||
+				parse_pid_statm(h->statm.buf, h->statm.len, pt->page_kb, &ps.rss_kb) != 0){
+			procs_remove(pt, h->pid);
+			hot_close(h);
+			continue;
+		}
+		procs_update(pt, e, &ps, t);
+	}
+}
+
+// The k largest entries by CPU or RSS, descending. Entries at zero are
+// never listed.
+static int top_select(const struct proc_table *pt, int by_rss,
+		const struct proc_entry **out, int k){
+	int n = 0;
+	for(unsigned i = 0; i < pt->cap && k > 0; i++){
+		const struct proc_entry *e = &pt->slots[i];
+		if(!e->pid) continue;
+		double v = by_rss ? (double)e->rss_kb : e->cpu_pct;
+		if(v <= 0.0) continue;
+		if(n == k && v <= (by_rss ? (double)out[n - 1]->rss_kb : out[n - 1]->cpu_pct))
+			continue;
+		int j = n < k ? n++ : n - 1;
+		while(j > 0 && (by_rss ? (double)out[j - 1]->rss_kb : out[j - 1]->cpu_pct) < v){
+			out[j] = out[j - 1];
+			j--;
+		}
+		out[j] = e;
+	}
+	return n;
+}
+
+static int hot_open(struct proc_hot *h, int pid){
+	snprintf(h->stat_path, sizeof(h->stat_path), "/proc/%d/stat", pid);
+	snprintf(h->statm_path, sizeof(h->statm_path), "/proc/%d/statm", pid);
+	if(proc_file_open_buf(&h->stat, h->stat_path, h->stat_buf, PROCS_STAT_BUF) != 0)
+		return -1;
+	if(proc_file_open_buf(&h->statm, h->statm_path, h->statm_buf, PROCS_STATM_BUF) != 0){
+		proc_file_close(&h->stat);
+		return -1;
+	}
+	h->pid = pid;
+	return 0;
+}
+
+static void procs_pick_hot(struct proc_table *pt){
+	const struct proc_entry *sel[3 * PROCS_TOP_MAX];
+	int want[3 * PROCS_TOP_MAX];
+	int nwant = 0;
+	int n = top_select(pt, 0, sel, 2 * pt->top_n);
+	n += top_select(pt, 1, sel + n, pt->top_n);
+	for(int i = 0; i < n; i++){
+		int dup = 0;
+		for(int j = 0; j < nwant; j++) dup |= want[j] == sel[i]->pid;
+		if(!dup) want[nwant++] = sel[i]->pid;
+	}
+
+	// keep files that stay hot open, close the rest
+	for(int i = 0; i < pt->hot_cap; i++){
+		struct proc_hot *h = &pt->hot[i];
+		if(!h->pid) continue;
+		int keep = 0;
+		for(int j = 0; j < nwant; j++){
+			if(want[j] == h->pid){
+				keep = 1;
+				want[j] = 0;
+			}
+		}
+		if(!keep) hot_close(h);
+	}
+	int slot = 0;
+	for(int j = 0; j < nwant; j++){
+		if(!want[j]) continue;
+		while(slot < pt->hot_cap && pt->hot[slot].pid) slot++;
+		if(slot == pt->hot_cap) break;
+		hot_open(&pt->hot[slot], want[j]);
+	}
+	pt->nhot = 0;
+	for(int i = 0; i < pt->hot_cap; i++) pt->nhot += pt->hot[i].pid != 0;
+}
+
+int procs_sample(struct proc_table *pt, double t){
+	if(pt->top_n <= 0) return 0;
+	int rc = 0;
+	if(pt->tick++ % (unsigned long)pt->rescan == 0) rc = procs_scan(pt, t);
+	else procs_read_hot(pt, t);
+	procs_pick_hot(pt);
+	return rc;
+}
+
+static void top_copy(struct proc_top_entry *dst, const struct proc_entry *e){
+	dst->pid = e->pid;
+	memcpy(dst->comm, e->comm, PROCS_COMM);
+	dst->cpu_pct = e->cpu_pct;
+	dst->rss_kb = e->rss_kb;
+}
+
+void procs_top(const struct proc_table *pt, struct proc_top *top){
+	const struct proc_entry *sel[PROCS_TOP_MAX];
+	top->n_cpu = top_select(pt, 0, sel, pt->top_n);
+	for(int i = 0; i < top->n_cpu; i++) top_copy(&top->cpu[i], sel[i]);
+	top->n_rss = top_select(pt, 1, sel, pt->top_n);
+	for(int i = 0; i < top->n_rss; i++) top_copy(&top->rss[i], sel[i]);
+}
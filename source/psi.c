@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "psi.h"
+#include "parse.h"
+
+static const char *psi_names[PSI_NR] = { "cpu", "memory", "io" };
+
+// "avg10=0.87" -> 0.87; the fraction is always two digits
+static const char *parse_avg(const char *p, const char *end, double *out){
+	long ip, fp = 0;
+	p = memchr(p, '=', (size_t)(end - p));
+	if(!p || !(p = parse_long(p + 1, end, &ip))) return NULL;
+	const char *f = p;
+	if(p < end && *p == '.' && !(p = parse_long(p + 1, end, &fp))) return NULL;
+	double scale = 1.0;
+	for(const char *q = f + 1; q < p; q++) scale *= 10.0;
+	*out = ip + fp / scale;
+	return p;
+}
+
+static int parse_psi_line(const char *p, const char *end, struct psi_line *l){
+	long total;
+	if(!(p = parse_avg(p, end, &l->avg10)) || !(p = parse_avg(p, end, &l->avg60)) ||
+			!(p = parse_avg(p, end, &l->avg300)))
+		return -1;
+	p = memchr(p, '=', (size_t)(end - p));
+	if(!p || !parse_long(p + 1, end, &total)) return -1;
+	l->total = (unsigned long long)total;
+	return 0;
+}
+
+int parse_psi(const char *buf, size_t len, struct psi_stat *out){
+	const char *p = buf, *end = buf + len;
+	int have_some = 0;
+	out->have_full = 0;
+	while(p < end){
+		const char *next = parse_next_line(p, end);
+		if(next - p > 5 && memcmp(p, "some ", 5) == 0)
+			have_some = parse_psi_line(p + 5, next, &out->some) == 0;
+		else if(next - p > 5 && memcmp(p, "full ", 5) == 0)
+			out->have_full = parse_psi_line(p + 5, next, &out->full) == 0;
+		p = next;
+	}
+	return have_some ? 0 : -1;
+}
+
+int psi_parse_trigger(const char *s, struct psi_trigger *t){
+	const char *c = strchr(s, ':');
+	if(!c) return -1;
+	size_t n = (size_t)(c - s);
+	int res = -1;
+	for(int i = 0; i < PSI_NR; i++)
+		if(strlen(psi_names[i]) == n && memcmp(s, psi_names[i], n) == 0) res = i;
+	if(res < 0) return -1;
+	s = c + 1;
+	if(strncmp(s, "some:", 5) == 0) t->full = 0;
+	else if(strncmp(s, "full:", 5) == 0) t->full = 1;
+	else return -1;
+	char *end;
+	double stall = strtod(s + 5, &end);
+	if(*end != '/') return -1;
+	double window = strtod(end + 1, &end);
+	if(*end != '\0' || !(stall > 0.0) || !(window >= stall)) return -1;
+	t->res = (enum psi_res)res;
+	t->stall_us = (unsigned)(stall * 1000.0);
+	t->window_us = (unsigned)(window * 1000.0);
+	return 0;
+}
+
+int psi_open(struct psi_source *ps, const char *cgroup_dir){
+	memset(ps, 0, sizeof(*ps));
+	int found = 0;
+	for(int i = 0; i < PSI_NR; i++){
+		ps->file[i].fd = -1;
+		ps->some_pct[i] = NAN;
+		ps->full_pct[i] = NAN;
+		if(cgroup_dir)
+			snprintf(ps->path[i], PSI_BUF, "%s/%s.pressure", cgroup_dir, psi_names[i]);
+		else
+			snprintf(ps->path[i], PSI_BUF, "/proc/pressure/%s", psi_names[i]);
+		if(proc_file_open(&ps->file[i], ps->path[i], PSI_BUF) == 0){
+			ps->have[i] = 1;
+			found++;
+		}
+	}
+	return found;
+}
+
+// The kernel arms a trigger per open file description on write(); the
+// fd then reports POLLPRI each time the threshold is crossed, at most
+// once per window.
+int psi_add_trigger(struct psi_source *ps, const struct psi_trigger *t){
+	if(ps->ntrig >= PSI_MAX_TRIGGERS) return -1;
+	int fd = open(ps->path[t->res], O_RDWR | O_NONBLOCK | O_CLOEXEC);
+	if(fd < 0){
+		perror(ps->path[t->res]);
+		return -1;
+	}
+	char cmd[64];
+	int n = snprintf(cmd, sizeof(cmd), "%s %u %u",
+			t->full ? "full" : "some", t->stall_us, t->window_us);
+	// the terminating NUL is part of what the kernel parses
+	if(write(fd, cmd, (size_t)n + 1) < 0){
+		fprintf(stderr, "%s: trigger \"%s\": %s\n", ps->path[t->res], cmd, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	ps->trig[ps->ntrig].fd = fd;
+	ps->trig[ps->ntrig].events = POLLPRI;
+	ps->trig[ps->ntrig].revents = 0;
+	ps->ntrig++;
+	return 0;
+}
+
+static double stall_pct(unsigned long long prev, unsigned long long curr, double dt_us){
+	if(curr < prev || dt_us <= 0.0) return 0.0;
+	double v = (double)(curr - prev) / dt_us * 100.0;
+	return v > 100.0 ? 100.0 : v;
+}
+
+void psi_read(struct psi_source *ps, double t){
+	double dt_us = (t - ps->prev_t) * 1e6;
+	for(int i = 0; i < PSI_NR; i++){
+		struct psi_stat cur;
+		if(!ps->have[i]) continue;
+		if(proc_file_read(&ps->file[i]) <= 0 ||
+				parse_psi(ps->file[i].buf, ps->file[i].len, &cur) != 0){
+			ps->some_pct[i] = NAN;
+			ps->full_pct[i] = NAN;
+			continue;
+		}
+		if(ps->primed){
+			ps->some_pct[i] = stall_pct(ps->prev[i].some.total, cur.some.total, dt_us);
+			ps->full_pct[i] = cur.have_full ?
+				stall_pct(ps->prev[i].full.total, cur.full.total, dt_us) : NAN;
+		} else {
+			// no interval yet: fall back to the kernel's 10s average
+			ps->some_pct[i] = cur.some.avg10;
+			ps->full_pct[i] = cur.have_full ? cur.full.avg10 : NAN;
+		}
+		ps->prev[i] = cur;
+	}
+	ps->prev_t = t;
+	ps->primed = 1;
+}
+
+int psi_fired(struct psi_source *ps){
+	int n = 0;
+	for(int i = 0; i < ps->ntrig; i++){
+		struct pollfd *p = &ps->trig[i];
+		if(p->revents & POLLERR){
+			// the file went away (cgroup removed): stop polling it
+			close(p->fd);
+			p->fd = -1;
+		} else if(p->revents & POLLPRI){
+			n++;
+		}
+		p->revents = 0;
+	}
+	return n;
+}
+
+void psi_close(struct psi_source *ps){
+	for(int i = 0; i < PSI_NR; i++)
+		if(ps->have[i]) proc_file_close(&ps->file[i]);
+	for(int i = 0; i < ps->ntrig; i++)
+		if(ps->trig[i].fd >= 0) close(ps->trig[i].fd);
+	ps->ntrig = 0;
+}
@@ -0,0 +1,222 @@
+#define _GNU_SOURCE	// sendmmsg
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "push.h"
+
+static double mono_s(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v){
+	size_t n = 0;
+	while(v >= 0x80){
+		p[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (uint8_t)v;
+	return n;
+}
+
+static const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *out){
+	uint64_t v = 0;
+	for(int shift = 0; p < end && shift < 64; shift += 7){
+		uint8_t b = *p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80)){
+			*out = v;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+static size_t put_u16(uint8_t *p, double v){
+	uint16_t x = !(v > 0.0) ? 0 : v >= 655.35 ? 65535 : (uint16_t)(v * 100.0 + 0.5);
+	p[0] = (uint8_t)x;
+	p[1] = (uint8_t)(x >> 8);
+	return 2;
+}
+
+int push_parse_addr(const char *spec, int bind_side, struct sockaddr_storage *addr,
+		socklen_t *len){
+	memset(addr, 0, sizeof(*addr));
+	if(strncmp(spec, "unix:", 5) == 0){
+		struct sockaddr_un *un = (struct sockaddr_un *)addr;
+		if(strlen(spec + 5) == 0 || strlen(spec + 5) >= sizeof(un->sun_path)) return -1;
+		un->sun_family = AF_UNIX;
+		strcpy(un->sun_path, spec + 5);
+		*len = sizeof(*un);
+		return 0;
+	}
+	if(strncmp(spec, "udp:", 4) != 0) return -1;
+	// udp:HOST:PORT, HOST may be [v6]
+	char host[256];
+	const char *h = spec + 4, *colon = strrchr(h, ':');
+	if(!colon || (size_t)(colon - h) >= sizeof(host)) return -1;
+	memcpy(host, h, (size_t)(colon - h));
+	host[colon - h] = '\0';
+	char *hp = host;
+	size_t hl = strlen(hp);
+	if(hl >= 2 && hp[0] == '[' && hp[hl - 1] == ']'){
+		hp[hl - 1] = '\0';
+		hp++;
+	}
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if(bind_side) hints.ai_flags = AI_PASSIVE;
+	int rc = getaddrinfo(*hp ? hp : NULL, colon + 1, &hints, &res);
+	if(rc != 0){
+		fprintf(stderr, "%s: %s\n", spec, gai_strerror(rc));
+		return -1;
+	}
+	memcpy(addr, res->ai_addr, res->ai_addrlen);
+	*len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+static void frame_start(struct pusher *p, int i){
+	uint8_t *f = p->frame[i];
+	size_t n = 0;
+	memcpy(f, PUSH_MAGIC, PUSH_MAGIC_LEN);
+	n += PUSH_MAGIC_LEN;
+	f[n++] = PUSH_VERSION;
+	f[n++] = (uint8_t)p->host_len;
+	memcpy(f + n, p->host, p->host_len);
+	n += p->host_len;
+	n += put_varint(f + n, ++p->seq);
+	p->count_at[i] = n;
+	f[n++] = 0;
+	p->len[i] = n;
+	p->nent[i] = 0;
+}
+
+int pusher_open(struct pusher *p, const char *spec){
+	memset(p, 0, sizeof(*p));
+	p->fd = -1;
+	if(push_parse_addr(spec, 0, &p->addr, &p->addr_len) != 0){
+		fprintf(stderr, "bad --push address: %s\n", spec);
+		return -1;
+	}
+	p->fd = socket(p->addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if(p->fd < 0){
+		perror("socket");
+		return -1;
+	}
+	if(gethostname(p->host, sizeof(p->host)) != 0) strcpy(p->host, "unknown");
+	p->host[sizeof(p->host) - 1] = '\0';
+	p->host_len = strlen(p->host);
+	return 0;
+}
+
+void pusher_flush(struct pusher *p){
+	int n = p->nframes;
+	if(n > 0 && p->nent[n - 1] == 0) n--;	// the open frame is still empty
+	if(n == 0) return;
+	struct mmsghdr msg[PUSH_BATCH];
+	struct iovec iov[PUSH_BATCH];
+	memset(msg, 0, sizeof(msg));
+	for(int i = 0; i < n; i++){
+		iov[i].iov_base = p->frame[i];
+		iov[i].iov_len = p->len[i];
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+		msg[i].msg_hdr.msg_name = &p->addr;
+		msg[i].msg_hdr.msg_namelen = p->addr_len;
+	}
+	int done = 0;
+	while(done < n){
+		int rc = sendmmsg(p->fd, msg + done, (unsigned)(n - done), 0);
+		if(rc < 0 && errno == EINTR) continue;
+		// no receiver, full socket buffer: the frames are lost, the
+		// receiver sees the seq gap
+		if(rc <= 0){
+			p->errors += (unsigned long long)(n - done);
+			break;
+		}
+		done += rc;
+	}
+	p->sent += (unsigned long long)done;
+	p->nframes = 0;
+}
+
+void pusher_add(struct pusher *p, const struct sample *s){
+	if(p->nframes == 0){
+		frame_start(p, 0);
+		p->nframes = 1;
+		p->first_mono = mono_s();
+	}
+	int i = p->nframes - 1;
+	if(p->len[i] + PUSH_ENTRY_MAX > PUSH_DGRAM || p->nent[i] == PUSH_FRAME_ENTRIES){
+		if(p->nframes == PUSH_BATCH){
+			pusher_flush(p);
+			pusher_add(p, s);
+			return;
+		}
+		i = p->nframes++;
+		frame_start(p, i);
+	}
+	uint8_t *f = p->frame[i] + p->len[i];
+	size_t n = 0;
+	double total = s->mem_used_gb + s->mem_avail_gb;
+	n += put_varint(f + n, s->t > 0.0 ? (uint64_t)(s->t * 1000.0 + 0.5) : 0);
+	n += put_u16(f + n, s->cpu_pct);
+	n += put_u16(f + n, s->cpu_avg);
+	n += put_u16(f + n, total > 0.0 ? s->mem_used_gb / total * 100.0 : 0.0);
+	f[n++] = (uint8_t)((s->cpu_state & 3) | (s->mem_state & 3) << 2 |
+			(s->io_state & 3) << 4 | (s->net_state & 3) << 6);
+	p->len[i] += n;
+	p->frame[i][p->count_at[i]] = (uint8_t)++p->nent[i];
+}
+
+void pusher_poll(struct pusher *p){
+	if(p->nframes > 0 && mono_s() - p->first_mono >= PUSH_FLUSH_S) pusher_flush(p);
+}
+
+void pusher_close(struct pusher *p){
+	if(p->fd < 0) return;
+	pusher_flush(p);
+	close(p->fd);
+	p->fd = -1;
+}
+
+// ---- receiver side ----
+
+int push_decode(const uint8_t *buf, size_t len, struct push_frame *f){
+	const uint8_t *p = buf, *end = buf + len;
+	if(len < PUSH_MAGIC_LEN + 3 || memcmp(p, PUSH_MAGIC, PUSH_MAGIC_LEN) != 0 ||
+			p[PUSH_MAGIC_LEN] != PUSH_VERSION)
+		return -1;
+	p += PUSH_MAGIC_LEN + 1;
+	size_t hl = *p++;
+	if(hl == 0 || hl >= PUSH_HOST_MAX || (size_t)(end - p) < hl) return -1;
+	memcpy(f->host, p, hl);
+	f->host[hl] = '\0';
+	p += hl;
+	if(!(p = get_varint(p, end, &f->seq)) || p >= end) return -1;
+	f->n = *p++;
+	if(f->n > PUSH_FRAME_ENTRIES) return -1;
+	for(int i = 0; i < f->n; i++){
+		struct push_entry *e = &f->e[i];
+		uint64_t t_ms;
+		if(!(p = get_varint(p, end, &t_ms)) || end - p < 7) return -1;
+		e->t = t_ms / 1000.0;
+		e->cpu_pct = (p[0] | p[1] << 8) / 100.0;
+		e->cpu_avg = (p[2] | p[3] << 8) / 100.0;
+		e->mem_used_pct = (p[4] | p[5] << 8) / 100.0;
+		for(int g = 0; g < 4; g++) e->state[g] = (sys_state)((p[6] >> (2 * g)) & 3);
+		p += 7;
+	}
+	return 0;
+}
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "replay.h"
+#include "config.h"
+#include "forecast.h"
+#include "parse.h"
+#include "rules.h"
+#include "trace.h"
+
+static const char *snap_names[SNAP_NR] = { "stat", "meminfo" };
+
+#define SNAP_PATH 4096
+#define SNAP_HDR 64
+
+int snap_create(struct snap_writer *w, const char *dir){
+	memset(w, 0, sizeof(*w));
+	if(mkdir(dir, 0755) != 0 && errno != EEXIST){
+		perror(dir);
+		return -1;
+	}
+	for(int i = 0; i < SNAP_NR; i++){
+		char path[SNAP_PATH];
+		snprintf(path, sizeof(path), "%s/%s", dir, snap_names[i]);
+		w->f[i] = fopen(path, "w");
+		if(!w->f[i]){
+			perror(path);
+			snap_close(w);
+			return -1;
+		}
+		// frames are a few KB: batch them into large writes
+		setvbuf(w->f[i], NULL, _IOFBF, 1 << 20);
+	}
+	return 0;
+}
+
+int snap_write(struct snap_writer *w, enum snap_src src, double t,
+		const char *buf, size_t len){
+	FILE *f = w->f[src];
+	if(fprintf(f, "@%.6f %zu\n", t, len) < 0 || fwrite(buf, 1, len, f) != len)
+		return -1;
+	return 0;
+}
+
+void snap_close(struct snap_writer *w){
+	for(int i = 0; i < SNAP_NR; i++){
+		if(w->f[i] && fclose(w->f[i]) != 0) perror("capture");
+		w->f[i] = NULL;
+	}
+}
+
+int snap_open(struct snap_reader *r, const char *dir){
+	memset(r, 0, sizeof(*r));
+	for(int i = 0; i < SNAP_NR; i++){
+		char path[SNAP_PATH];
+		snprintf(path, sizeof(path), "%s/%s", dir, snap_names[i]);
+		int fd = open(path, O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0){
+			fprintf(stderr, "%s: missing or empty\n", path);
+			if(fd >= 0) close(fd);
+			snap_free(r);
+			return -1;
+		}
+		void *m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(m == MAP_FAILED){
+			perror(path);
+			snap_free(r);
+			return -1;
+		}
+		madvise(m, (size_t)st.st_size, MADV_SEQUENTIAL);
+		r->map[i] = m;
+		r->len[i] = (size_t)st.st_size;
+	}
+	return 0;
+}
+
+static int snap_frame_next(struct snap_reader *r, int i, double *t, struct snap_frame *f){
+	size_t left = r->len[i] - r->off[i];
+	if(left == 0) return 1;
+	const char *p = r->map[i] + r->off[i];
+	const char *nl = memchr(p, '\n', left < SNAP_HDR ? left : SNAP_HDR);
+	char hdr[SNAP_HDR];
+	size_t len;
+	if(!nl || p[0] != '@') return -1;
+	memcpy(hdr, p + 1, (size_t)(nl - p - 1));
+	hdr[nl - p - 1] = '\0';
+	if(sscanf(hdr, "%lf %zu", t, &len) != 2) return -1;
+	size_t body = (size_t)(nl + 1 - p);
+	if(len > left - body) return -1;
+	f->buf = nl + 1;
+	f->len = len;
+	r->off[i] += body + len;
+	return 0;
+}
+
+int snap_next(struct snap_reader *r, double *t, struct snap_frame frame[SNAP_NR]){
+	for(int i = 0; i < SNAP_NR; i++){
+		double ti;
+		int ri = snap_frame_next(r, i, &ti, &frame[i]);
+		if(ri != 0){
+			if(ri < 0) fprintf(stderr, "replay: bad frame in %s at byte %zu\n",
+					snap_names[i], r->off[i]);
+			return ri;
+		}
+		// the stat frame carries the sample's time
+		if(i == SNAP_STAT) *t = ti;
+	}
+	r->frames++;
+	return 0;
+}
+
+#define SNAP_RATE_GAPS 31
+
+static int cmp_double(const void *a, const void *b){
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+double snap_interval(const struct snap_reader *r){
+	// a copy from the start, so the reader's position is left alone
+	struct snap_reader c = *r;
+	c.off[SNAP_STAT] = 0;
+	struct snap_frame f;
+	double gap[SNAP_RATE_GAPS], prev, t;
+	int n = 0;
+	if(snap_frame_next(&c, SNAP_STAT, &prev, &f) != 0) return 0.0;
+	while(n < SNAP_RATE_GAPS && snap_frame_next(&c, SNAP_STAT, &t, &f) == 0){
+		gap[n++] = t - prev;
+		prev = t;
+	}
+	if(n == 0) return 0.0;
+	qsort(gap, (size_t)n, sizeof(gap[0]), cmp_double);
+	return gap[n / 2];
+}
+
+void snap_free(struct snap_reader *r){
+	for(int i = 0; i < SNAP_NR; i++)
+		if(r->map[i]) munmap((void *)r->map[i], r->len[i]);
+	memset(r, 0, sizeof(*r));
+}
+
+int snap_stat_cores(const struct snap_frame *f){
+	int n = 0;
+	for(const char *p = f->buf, *end = f->buf + f->len; p + 4 <= end; ){
+		long id;
+		if(memcmp(p, "cpu", 3) == 0 && (unsigned)(p[3] - '0') <= 9 &&
+				parse_long(p + 3, end, &id) && id >= n)
+			n = (int)id + 1;
+		const char *nl = memchr(p, '\n', (size_t)(end - p));
+		if(!nl) break;
+		p = nl + 1;
+	}
+	return n;
+}
+
+void replay_report(unsigned long long samples, double elapsed_s){
+	fprintf(stderr, "replayed %llu samples in %.3f s (%.0f samples/s)\n", samples,
+			elapsed_s, elapsed_s > 0.0 ? samples / elapsed_s : 0.0);
+}
+
+// ---- trace replay ----
+
+struct trace_replay {
+	struct rule_engine rules;
+	struct forecaster forecast;	// --predict: fitted again, as the rules
+	int predict_on;
+	sys_state prev[GROUP_NR];
+	int have_prev;
+	unsigned long long samples;
+};
+
+static void replay_sample(void *arg, struct sample *s, int *state_change){
+	struct trace_replay *tr = arg;
+	sys_state st[GROUP_NR];
+	if(tr->predict_on) forecast_update(&tr->forecast, s);
+	rules_eval(&tr->rules, s, st);
+	s->cpu_state = st[GROUP_CPU];
+	s->mem_state = st[GROUP_MEM];
+	s->io_state = st[GROUP_IO];
+	s->net_state = st[GROUP_NET];
+	*state_change = tr->have_prev && memcmp(st, tr->prev, sizeof(st)) != 0;
+	memcpy(tr->prev, st, sizeof(st));
+	tr->have_prev = 1;
+	tr->samples++;
+}
+
+static double mono_s(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int replay_trace(const char *path, const struct probe_config *cfg, struct out_buf *out){
+	struct trace_replay tr;
+	memset(&tr, 0, sizeof(tr));
+	if(rules_compile(&tr.rules, cfg->rules_file, cfg->rules, cfg->nrules, cfg->window) != 0)
+		return -1;
+	if(cfg->predict_s > 0.0){
+		double warn = FORECAST_WARN_PCT, danger = FORECAST_DANGER_PCT;
+		rules_mem_avail_levels(&tr.rules, &warn, &danger);
+		forecast_init(&tr.forecast, cfg->predict_s, cfg->predict_fit_s, warn, danger);
+		tr.predict_on = 1;
+	}
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0){
+		fprintf(stderr, "%s: empty or unreadable\n", path);
+		if(fd >= 0) close(fd);
+		rules_free(&tr.rules);
+		return -1;
+	}
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		perror(path);
+		rules_free(&tr.rules);
+		return -1;
+	}
+	madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+	double t0 = mono_s();
+	int rc = trace_decode(map, (size_t)st.st_size, out, replay_sample, &tr);
+	out_flush(out);
+	replay_report(tr.samples, mono_s() - t0);
+	if(rc != 0) fprintf(stderr, "%s: not a sysprobe trace or truncated\n", path);
+	munmap(map, (size_t)st.st_size);
+	rules_free(&tr.rules);
+	return rc;
+}
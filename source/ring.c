@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "arena.h"
+#include "ring.h"
+
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val,
+		const struct timespec *timeout){
+	return syscall(SYS_futex, (uint32_t *)addr, op, val, timeout, NULL, 0);
+}
+
+int ring_init(struct spsc_ring *r, unsigned cap, int cores){
+	memset(r, 0, sizeof(*r));
+	unsigned c = 2;
+	while(c < cap) c <<= 1;
+	if(cores < 1) cores = 1;
+	r->slots = arena_calloc(c, sizeof(*r->slots));
+	r->core_store = arena_calloc((size_t)c * (size_t)cores, sizeof(double));
+	if(!r->slots || !r->core_store){
+		ring_free(r);
+		return -1;
+	}
+	r->cap = c;
+	r->cores = cores;
+	atomic_init(&r->head, 0);
+	atomic_init(&r->tail, 0);
+	atomic_init(&r->pub_seq, 0);
+	atomic_init(&r->dropped, 0);
+	atomic_init(&r->waiting, 0);
+	return 0;
+}
+
+void ring_free(struct spsc_ring *r){
+	arena_free(r->slots);
+	arena_free(r->core_store);
+	r->slots = NULL;
+	r->core_store = NULL;
+}
+
+int ring_try_push(struct spsc_ring *r, const struct ring_rec *rec){
+	unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	unsigned long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	if(head - tail >= r->cap) return -1;
+	unsigned idx = (unsigned)(head & (r->cap - 1));
+	struct ring_rec *slot = &r->slots[idx];
+	double *store = r->core_store + (size_t)idx * (size_t)r->cores;
+	*slot = *rec;
+	int n = rec->s.ncores < r->cores ? rec->s.ncores : r->cores;
+	if(n > 0 && rec->s.core_pct) memcpy(store, rec->s.core_pct, (size_t)n * sizeof(double));
+	slot->s.ncores = n > 0 ? n : 0;
+	slot->s.core_pct = store;
+	slot->s.dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+	if(rec->kind == REC_SUMMARY || rec->kind == REC_END)
+		slot->sum.dropped = slot->s.dropped;
+
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	atomic_fetch_add(&r->pub_seq, 1);
+	if(atomic_load(&r->waiting))
+		futex(&r->pub_seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+	return 0;
+}
+
+int ring_push(struct spsc_ring *r, const struct ring_rec *rec){
+	if(ring_try_push(r, rec) == 0) return 0;
+	atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+	return -1;
+}
+
+unsigned long long ring_dropped(const struct spsc_ring *r){
+	return atomic_load_explicit(&r->dropped, memory_order_relaxed);
+}
+
+struct ring_rec *ring_peek(struct spsc_ring *r){
+	unsigned long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	unsigned long head = atomic_load_explicit(&r->head, memory_order_acquire);
+	if(tail == head) return NULL;
+	return &r->slots[tail & (r->cap - 1)];
+}
+
+void ring_release(struct spsc_ring *r){
+	unsigned long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+void ring_wait(struct spsc_ring *r, int timeout_ms){
+	uint32_t seq = atomic_load(&r->pub_seq);
+	atomic_store(&r->waiting, 1);
+	if(atomic_load(&r->head) == atomic_load_explicit(&r->tail, memory_order_relaxed)){
+		struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+		// returns early (EAGAIN) if a push bumped pub_seq since we looked
+		futex(&r->pub_seq, FUTEX_WAIT_PRIVATE, seq, &ts);
+	}
+	atomic_store(&r->waiting, 0);
+}
@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <math.h>
+#include "arena.h"
+#include "rules.h"
+
+#define RULE_LINE 512
+#define METRIC_DERIVED ((size_t)-1)
+
+struct metric_def {
+	const char *name;
+	size_t off;		// double in struct sample, or METRIC_DERIVED
+	enum state_group group;
+	unsigned src;		// SRC_* it comes from
+};
+
+enum {
+	M_MEM_AVAIL_PCT = 0,
+	M_SWAP_USED_PCT,
+};
+
+static const struct metric_def metrics[] = {
+	{ "mem_avail_pct",  METRIC_DERIVED,                          GROUP_MEM, SRC_MEM },
+	{ "swap_used_pct",  METRIC_DERIVED,                          GROUP_MEM, SRC_MEM },
+	{ "cpu",            offsetof(struct sample, cpu_pct),        GROUP_CPU, SRC_CPU },
+	{ "cpu_avg",        offsetof(struct sample, cpu_avg),        GROUP_CPU, SRC_CPU },
+	{ "cpu_hot",        offsetof(struct sample, cpu_hot_avg),    GROUP_CPU, SRC_CPU },
+	{ "mem_used_gb",    offsetof(struct sample, mem_used_gb),    GROUP_MEM, SRC_MEM },
+	{ "mem_avail_gb",   offsetof(struct sample, mem_avail_gb),   GROUP_MEM, SRC_MEM },
+	{ "psi_cpu_some",   offsetof(struct sample, psi_cpu_some),   GROUP_CPU, SRC_PSI },
+	{ "psi_mem_some",   offsetof(struct sample, psi_mem_some),   GROUP_MEM, SRC_PSI },
+	{ "psi_mem_full",   offsetof(struct sample, psi_mem_full),   GROUP_MEM, SRC_PSI },
+	{ "psi_io_some",    offsetof(struct sample, psi_io_some),    GROUP_IO,  SRC_PSI },
+	{ "psi_io_full",    offsetof(struct sample, psi_io_full),    GROUP_IO,  SRC_PSI },
+	{ "disk_util",      offsetof(struct sample, disk_util_pct),  GROUP_IO,  SRC_DISK },
+	{ "disk_await_ms",  offsetof(struct sample, disk_await_ms),  GROUP_IO,  SRC_DISK },
+	{ "net_errs_s",     offsetof(struct sample, net_errs_s),     GROUP_NET, SRC_NET },
+	{ "cgroup_mem_pct", offsetof(struct sample, cgroup_mem_pct), GROUP_MEM, SRC_CGROUP },
+	{ "cgroup_cpu_pct", offsetof(struct sample, cgroup_cpu_pct), GROUP_CPU, SRC_CGROUP },
+	{ "runq_p99_us",    offsetof(struct sample, runq_p99_us),    GROUP_CPU, SRC_CPU },
+	{ "reclaim_ms_s",   offsetof(struct sample, reclaim_ms_s),   GROUP_MEM, SRC_CPU },
+	{ "cpu_z",          offsetof(struct sample, cpu_z),          GROUP_CPU, SRC_CPU },
+	{ "mem_eta_s",      offsetof(struct sample, mem_eta_s),      GROUP_MEM, SRC_MEM },
+};
+
+#define METRIC_NR (int)(sizeof(metrics) / sizeof(metrics[0]))
+
+static const char *group_names[GROUP_NR] = { "cpu", "mem", "io", "net" };
+static const char *stat_names[] = { "last", "avg", "min", "max", "p95" };
+
+// What state.c used to hardcode. swap_used_pct is a percentage now:
+// the old "swap_used > 80" compared a 0..1 ratio and never fired.
+static const char *default_rules[] = {
+	"cpu_avg warn=85 danger=95",
+	"psi_cpu_some warn=20 danger=50",
+	"mem_avail_pct below warn=10 danger=5",
+	"swap_used_pct warn=80",
+	"psi_mem_some warn=10 danger=40",
+	"psi_mem_full warn=2 danger=10",
+	"psi_io_some warn=20 danger=50",
+	"psi_io_full warn=5 danger=20",
+	"disk_util warn=80 danger=95",
+	"disk_await_ms warn=100 danger=500",
+	"net_errs_s warn=10 danger=100",
+};
+
+void rules_init(struct rule_engine *e){
+	memset(e, 0, sizeof(*e));
+}
+
+static void rule_release(struct rule *r){
+	if(r->win){
+		cpu_window_free(r->win);
+		arena_free(r->win);
+	}
+	arena_free(r->q);
+	r->win = NULL;
+	r->q = NULL;
+}
+
+void rules_free(struct rule_engine *e){
+	for(int i = 0; i < e->n; i++) rule_release(&e->rules[i]);
+	arena_free(e->rules);
+	rules_init(e);
+}
+
+void rules_usage(void){
+	fprintf(stderr, "metrics (default state group):");
+	for(int i = 0; i < METRIC_NR; i++)
+		fprintf(stderr, "%s %s(%s)", i % 4 ? "" : "\n ", metrics[i].name,
+				group_names[metrics[i].group]);
+	fprintf(stderr, "\n");
+}
+
+static int find_name(const char *const *names, int n, const char *s, size_t len){
+	for(int i = 0; i < n; i++)
+		if(strlen(names[i]) == len && memcmp(names[i], s, len) == 0) return i;
+	return -1;
+}
+
+static int parse_num(const char *s, double *out){
+	char *end;
+	double v = strtod(s, &end);
+	if(end == s || *end != '\0' || isnan(v)) return -1;
+	*out = v;
+	return 0;
+}
+
+// Parses `spec` into `r` (runtime state untouched). Returns NULL or what
+// is wrong with it.
+static const char err_metric[] = "unknown metric";
+
+static const char *rule_parse(char *spec, struct rule *r, int window, int *win_out){
+	const char *metric_names[METRIC_NR];
+	for(int i = 0; i < METRIC_NR; i++) metric_names[i] = metrics[i].name;
+
+	char *save = NULL;
+	char *tok = strtok_r(spec, " \t", &save);
+	if(!tok) return "empty rule";
+
+	char *colon = strchr(tok, ':');
+	size_t mlen = colon ? (size_t)(colon - tok) : strlen(tok);
+	r->metric = find_name(metric_names, METRIC_NR, tok, mlen);
+	if(r->metric < 0) return err_metric;
+	r->group = metrics[r->metric].group;
+	r->stat = STAT_LAST;
+	*win_out = window;
+	if(colon){
+		char *slash = strchr(colon + 1, '/');
+		size_t slen = slash ? (size_t)(slash - colon - 1) : strlen(colon + 1);
+		int st = find_name(stat_names, (int)(sizeof(stat_names) / sizeof(stat_names[0])),
+				colon + 1, slen);
+		if(st < 0) return "unknown statistic";
+		r->stat = (enum rule_stat)st;
+		if(slash){
+			char *end;
+			long n = strtol(slash + 1, &end, 10);
+			if(*end != '\0' || n < 1 || n > 1000000) return "bad window length";
+			*win_out = (int)n;
+		}
+	}
+
+	double warn = NAN, danger = NAN;
+	r->sign = 1.0;
+	r->hyst = 0.0;
+	r->dwell_s = 0.0;
+	while((tok = strtok_r(NULL, " \t", &save)) != NULL){
+		char *eq = strchr(tok, '=');
+		if(!eq){
+			if(strcmp(tok, "below") == 0) r->sign = -1.0;
+			else if(strcmp(tok, "above") == 0) r->sign = 1.0;
+			else return "unknown keyword";
+			continue;
+		}
+		*eq = '\0';
+		const char *val = eq + 1;
+		double v;
+		if(strcmp(tok, "state") == 0){
+			int g = find_name(group_names, GROUP_NR, val, strlen(val));
+			if(g < 0) return "unknown state group";
+			r->group = (enum state_group)g;
+			continue;
+		}
+		if(parse_num(val, &v) != 0) return "bad number";
+		if(strcmp(tok, "warn") == 0) warn = v;
+		else if(strcmp(tok, "danger") == 0) danger = v;
+		else if(strcmp(tok, "hyst") == 0 && v >= 0.0) r->hyst = v;
+		else if(strcmp(tok, "dwell") == 0 && v >= 0.0) r->dwell_s = v;
+		else return "unknown or negative setting";
+	}
+	if(isnan(warn) && isnan(danger)) return "needs warn= or danger=";
+	// only danger given: there is no separate warn level
+	if(isnan(warn)) warn = danger;
+	if(!isnan(danger) && r->sign * danger < r->sign * warn)
+		return "danger is less severe than warn";
+	r->warn = r->sign * warn;
+	r->danger = isnan(danger) ? INFINITY : r->sign * danger;
+	return NULL;
+}
+
+int rules_add(struct rule_engine *e, const char *spec, int window){
+	char buf[RULE_LINE];
+	if(strlen(spec) >= sizeof(buf)){
+		fprintf(stderr, "rule too long: %s\n", spec);
+		return -1;
+	}
+	strcpy(buf, spec);
+	struct rule r;
+	memset(&r, 0, sizeof(r));
+	int win = window;
+	const char *err = rule_parse(buf, &r, window, &win);
+	if(err){
+		fprintf(stderr, "bad rule \"%s\": %s\n", spec, err);
+		if(err == err_metric) rules_usage();
+		return -1;
+	}
+	if(r.stat != STAT_LAST){
+		r.win = arena_calloc(1, sizeof(*r.win));
+		if(!r.win || cpu_window_init(r.win, win, 0.0) != 0){
+			arena_free(r.win);
+			perror("rules_add");
+			return -1;
+		}
+	}
+	if(r.stat == STAT_P95){
+		r.q = arena_calloc(1, sizeof(*r.q));
+		if(!r.q){
+			rule_release(&r);
+			perror("rules_add");
+			return -1;
+		}
+		qsketch_init(r.q, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	}
+	// grown on the heap while compiling, see rules_pack()
+	if(e->n == e->cap){
+		int cap = e->cap ? e->cap * 2 : 16;
+		struct rule *nr = e->cap ? arena_realloc(e->rules, (size_t)e->cap * sizeof(*nr),
+				(size_t)cap * sizeof(*nr)) : malloc((size_t)cap * sizeof(*nr));
+		if(!nr){
+			rule_release(&r);
+			perror("rules_add");
+			return -1;
+		}
+		e->rules = nr;
+		e->cap = cap;
+	}
+	e->rules[e->n++] = r;
+	return 0;
+}
+
+int rules_load(struct rule_engine *e, const char *path, int window){
+	FILE *f = fopen(path, "r");
+	if(!f){
+		perror(path);
+		return -1;
+	}
+	char line[RULE_LINE];
+	int rc = 0, lineno = 0;
+	while(fgets(line, sizeof(line), f)){
+		lineno++;
+		char *hash = strchr(line, '#');
+		if(hash) *hash = '\0';
+		line[strcspn(line, "\r\n")] = '\0';
+		char *p = line + strspn(line, " \t");
+		if(!*p) continue;
+		if(rules_add(e, p, window) != 0){
+			fprintf(stderr, "%s:%d: rule rejected\n", path, lineno);
+			rc = -1;
+			break;
+		}
+	}
+	fclose(f);
+	return rc;
+}
+
+int rules_defaults(struct rule_engine *e, int window){
+	for(size_t i = 0; i < sizeof(default_rules) / sizeof(default_rules[0]); i++)
+		if(rules_add(e, default_rules[i], window) != 0) return -1;
+	return 0;
+}
+
+// The table moves into the arena once, at its final size, so the copies
+// it outgrew while compiling are not left behind there.
+static int rules_pack(struct rule_engine *e){
+	if(e->n == 0) return 0;
+	struct rule *nr = arena_calloc((size_t)e->n, sizeof(*nr));
+	if(!nr){
+		perror("rules_compile");
+		return -1;
+	}
+	memcpy(nr, e->rules, (size_t)e->n * sizeof(*nr));
+	arena_free(e->rules);
+	e->rules = nr;
+	e->cap = e->n;
+	return 0;
+}
+
+int rules_compile(struct rule_engine *e, const char *file, const char *const *specs,
+		int n, int window){
+	rules_init(e);
+	if(!file && n == 0){
+		if(rules_defaults(e, window) != 0) return -1;
+		return rules_pack(e);
+	}
+	if(file && rules_load(e, file, window) != 0) return -1;
+	for(int i = 0; i < n; i++)
+		if(rules_add(e, specs[i], window) != 0) return -1;
+	return rules_pack(e);
+}
+
+// Every metric as one flat array: table offsets for the plain fields,
+// then the two derived ratios.
+static void metrics_fill(const struct sample *s, double m[METRIC_NR]){
+	for(int i = 0; i < METRIC_NR; i++){
+		if(metrics[i].off == METRIC_DERIVED) continue;
+		memcpy(&m[i], (const char *)s + metrics[i].off, sizeof(double));
+	}
+	double mem_total = s->mem_used_gb + s->mem_avail_gb;
+	double swap_total = s->swap_used_gb + s->swap_avail_gb;
+	m[M_MEM_AVAIL_PCT] = mem_total > 0.0 ? s->mem_avail_gb / mem_total * 100.0 : NAN;
+	m[M_SWAP_USED_PCT] = swap_total > 0.0 ? s->swap_used_gb / swap_total * 100.0 : 0.0;
+}
+
+// The window only takes a reading its source made on this tick, so a
+// collector on a longer --period is not averaged over copies of one
+// value. A NaN (source absent, nothing to say yet) never enters it: the
+// statistic is NaN, i.e. OK, until the source has a value again.
+static double rule_stat(struct rule *r, double v, unsigned fresh){
+	if(r->stat == STAT_LAST || isnan(v)) return v;
+	cpu_window *w = r->win;
+	if(fresh & metrics[r->metric].src){
+		if(r->q){
+			if(w->count == w->size) qsketch_remove(r->q, w->samples[w->index]);
+			qsketch_add(r->q, v);
+		}
+		cpu_window_add(w, v);
+	}
+	if(w->count == 0) return NAN;
+	switch(r->stat){
+	case STAT_AVG: return cpu_window_avg(w);
+	case STAT_MIN: return cpu_window_min(w);
+	case STAT_MAX: return cpu_window_max(w);
+	case STAT_P95: return qsketch_quantile(r->q, 0.95);
+	default: return v;
+	}
+}
+
+void rules_eval(struct rule_engine *e, const struct sample *s, sys_state out[GROUP_NR]){
+	double m[METRIC_NR];
+	metrics_fill(s, m);
+	for(int g = 0; g < GROUP_NR; g++) out[g] = SYS_OK;
+	double t = s->t;
+	for(int i = 0; i < e->n; i++){
+		struct rule *r = &e->rules[i];
+		double x = r->sign * rule_stat(r, m[r->metric], s->fresh);
+		r->x = x;
+		// NaN compares false: a missing source reads as OK
+		int up = (x > r->warn) + (x > r->danger);
+		int down = (x > r->warn - r->hyst) + (x > r->danger - r->hyst);
+		int cur = (int)r->level;
+		// rising takes the raw level, falling has to clear the band
+		int cand = up > cur ? up : (down < cur ? down : cur);
+		r->pending_since = cand == (int)r->pending ? r->pending_since : t;
+		r->pending = (sys_state)cand;
+		r->level = (cand == cur || t - r->pending_since >= r->dwell_s) ?
+			(sys_state)cand : r->level;
+		out[r->group] = sys_state_worst(out[r->group], r->level);
+	}
+}
+
+int rules_mem_avail_levels(const struct rule_engine *e, double *warn_pct, double *danger_pct){
+	for(int i = 0; i < e->n; i++){
+		const struct rule *r = &e->rules[i];
+		if(r->metric != M_MEM_AVAIL_PCT || r->sign > 0.0) continue;
+		*warn_pct = -r->warn;
+		*danger_pct = isinf(r->danger) ? NAN : -r->danger;
+		return 0;
+	}
+	return -1;
+}
+
+int rules_near_warn(const struct rule_engine *e, double frac){
+	for(int i = 0; i < e->n; i++){
+		const struct rule *r = &e->rules[i];
+		// sign space: warn is positive for "above" rules, negative for below
+		double thr = r->warn >= 0.0 ? r->warn * frac : r->warn / frac;
+		if(r->x > thr) return 1;
+	}
+	return 0;
+}
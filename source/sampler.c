@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arena.h"
+#include "sampler.h"
+#include "output.h"
+#include "cgroup.h"
+#include "disk.h"
+#include "net.h"
+
+#define KB_TO_GB(kb) ((kb) / 1024.0 / 1024.0)
+
+// ---- built-in collectors ----
+
+// live /proc, the BPF map, or the current replay frame
+static int cpu_read(struct sampler *sp, double t, struct cpu_stat *st, struct cpu_cores *cores){
+	if(sp->bpf_on) return ebpf_read(&sp->ebpf, t, st, cores);
+	if(!sp->replaying) return read_cpu_stat(&sp->probe, st, cores);
+	const struct snap_frame *f = &sp->frame[SNAP_STAT];
+	return parse_cpu_stat(f->buf, f->len, st, cores);
+}
+
+static int mem_read(struct sampler *sp){
+	if(!sp->replaying) return read_mem_stat(&sp->probe, &sp->mem);
+	const struct snap_frame *f = &sp->frame[SNAP_MEMINFO];
+	memset(&sp->mem, 0, sizeof(sp->mem));
+	parse_meminfo(f->buf, f->len, MEM_F_ALL, &sp->mem);
+	return 0;
+}
+
+static int cpu_init(struct collector *c, struct sampler *sp){
+	(void)c;
+	const struct probe_config *cfg = sp->cfg;
+	int cores = sp->cap.cores;
+	if(cpu_cores_init(&sp->prev_cores, cores) != 0 ||
+			cpu_cores_init(&sp->curr_cores, cores) != 0){
+		perror("cpu_cores_init");
+		return -1;
+	}
+	sp->core_pct = arena_calloc((size_t)cores, sizeof(double));
+	sp->core_win = arena_calloc((size_t)cores, sizeof(cpu_window));
+	if(!sp->core_pct || !sp->core_win){
+		perror("calloc");
+		return -1;
+	}
+	if(cpu_window_init(&sp->cpu_win, cfg->window, cfg->ewma_alpha) != 0){
+		perror("cpu_window_init");
+		return -1;
+	}
+	for(int i = 0; i < cores; i++){
+		if(cpu_window_init(&sp->core_win[i], cfg->window, cfg->ewma_alpha) != 0){
+			perror("cpu_window_init");
+			return -1;
+		}
+	}
+	cpu_read(sp, 0.0, &sp->prev_cpu, &sp->prev_cores);
+	return 0;
+}
+
+static int cpu_sample(struct collector *c, struct sampler *sp, double t){
+	(void)c;
+	if(cpu_read(sp, t, &sp->curr_cpu, &sp->curr_cores) != 0) return -1;
+	sp->cpu_pct = cpu_usage(&sp->prev_cpu, &sp->curr_cpu);
+	cpu_cores_usage(&sp->prev_cores, &sp->curr_cores, sp->core_pct);
+	sp->ncores = sp->curr_cores.n > sp->prev_cores.n ? sp->curr_cores.n : sp->prev_cores.n;
+	cpu_window_add(&sp->cpu_win, sp->cpu_pct);
+	// hottest core by window average: a single saturated core
+	// disappears in the aggregate on wide machines
+	sp->cpu_hot_avg = 0.0;
+	for(int i = 0; i < sp->ncores; i++){
+		if(isnan(sp->core_pct[i])) continue;	// offline
+		cpu_window_add(&sp->core_win[i], sp->core_pct[i]);
+		double a = cpu_window_avg(&sp->core_win[i]);
+		if(a > sp->cpu_hot_avg) sp->cpu_hot_avg = a;
+	}
+	qsketch_add(&sp->cpu_run, sp->cpu_pct);
+	qsketch_add(&sp->cpu_period, sp->cpu_pct);
+
+	sp->prev_cpu = sp->curr_cpu;
+	struct cpu_cores tmp = sp->prev_cores;
+	sp->prev_cores = sp->curr_cores;
+	sp->curr_cores = tmp;
+	return 0;
+}
+
+static void cpu_emit(const struct collector *c, const struct sampler *sp, struct sample *s){
+	(void)c;
+	s->cpu_pct = sp->cpu_pct;
+	s->ncores = sp->ncores;
+	s->core_pct = sp->core_pct;
+	s->cpu_hot_avg = sp->cpu_hot_avg;
+	s->cpu_avg = cpu_window_avg(&sp->cpu_win);
+	s->cpu_min = cpu_window_min(&sp->cpu_win);
+	s->cpu_max = cpu_window_max(&sp->cpu_win);
+	s->cpu_ewma = cpu_window_ewma(&sp->cpu_win);
+	if(sp->bpf_on){
+		s->runq_avg_us = sp->ebpf.runq_avg_us;
+		s->runq_p99_us = sp->ebpf.runq_p99_us;
+		s->pgfault_s = sp->ebpf.pgfault_s;
+		s->reclaim_ms_s = sp->ebpf.reclaim_ms_s;
+	}
+}
+
+static void cpu_teardown(struct collector *c, struct sampler *sp){
+	(void)c;
+	arena_free(sp->core_pct);
+	cpu_window_free(&sp->cpu_win);
+	if(sp->core_win){
+		for(int i = 0; i < sp->cap.cores; i++) cpu_window_free(&sp->core_win[i]);
+		arena_free(sp->core_win);
+	}
+	cpu_cores_free(&sp->prev_cores);
+	cpu_cores_free(&sp->curr_cores);
+}
+
+static int mem_sample(struct collector *c, struct sampler *sp, double t){
+	(void)c;
+	(void)t;
+	if(mem_read(sp) != 0) return -1;
+	double used = KB_TO_GB(sp->mem.mem_total_kb - sp->mem.mem_avail_kb);
+	qsketch_add(&sp->mem_run, used);
+	qsketch_add(&sp->mem_period, used);
+	return 0;
+}
+
+static void mem_emit(const struct collector *c, const struct sampler *sp, struct sample *s){
+	(void)c;
+	const mem_stat *mem = &sp->mem;
+	s->mem_used_gb = KB_TO_GB(mem->mem_total_kb - mem->mem_avail_kb);
+	s->mem_avail_gb = KB_TO_GB(mem->mem_avail_kb);
+	s->swap_used_gb = KB_TO_GB(mem->swap_total_kb - mem->swap_free_kb);
+	s->swap_avail_gb = KB_TO_GB(mem->swap_free_kb);
+}
+
+static int psi_init(struct collector *c, struct sampler *sp){
+	(void)c;
+	const struct probe_config *cfg = sp->cfg;
+	if(psi_open(&sp->psi, cfg->psi_cgroup) == 0 && (cfg->psi_cgroup || cfg->psi_ntrig)){
+		fprintf(stderr, "no PSI files under %s\n",
+				cfg->psi_cgroup ? cfg->psi_cgroup : "/proc/pressure");
+		return -1;
+	}
+	for(int i = 0; i < cfg->psi_ntrig; i++)
+		if(psi_add_trigger(&sp->psi, &cfg->psi_trig[i]) != 0) return -1;
+	psi_read(&sp->psi, 0.0);
+	return 0;
+}
+
+static int psi_sample(struct collector *c, struct sampler *sp, double t){
+	(void)c;
+	psi_read(&sp->psi, t);
+	return 0;
+}
+
+static void psi_emit(const struct collector *c, const struct sampler *sp, struct sample *s){
+	(void)c;
+	const struct psi_source *psi = &sp->psi;
+	s->psi_cpu_some = psi->some_pct[PSI_CPU];
+	s->psi_mem_some = psi->some_pct[PSI_MEM];
+	s->psi_mem_full = psi->full_pct[PSI_MEM];
+	s->psi_io_some = psi->some_pct[PSI_IO];
+	s->psi_io_full = psi->full_pct[PSI_IO];
+}
+
+static void psi_teardown(struct collector *c, struct sampler *sp){
+	(void)c;
+	psi_close(&sp->psi);
+}
+
+static int procs_cinit(struct collector *c, struct sampler *sp){
+	(void)c;
+	if(sp->cfg->top_n <= 0) return 1;
+	if(procs_init(&sp->procs, sp->cfg->top_n, sp->cfg->proc_rescan) != 0){
+		perror("procs_init");
+		return -1;
+	}
+	return 0;
+}
+
+static int procs_csample(struct collector *c, struct sampler *sp, double t){
+	(void)c;
+	return procs_sample(&sp->procs, t);
+}
+
+static void procs_teardown(struct collector *c, struct sampler *sp){
+	(void)c;
+	procs_free(&sp->procs);
+}
+
+static const struct collector_ops cpu_collector = {
+	"cpu", cpu_init, cpu_sample, cpu_emit, cpu_teardown, SRC_CPU
+};
+static const struct collector_ops mem_collector = {
+	"mem", NULL, mem_sample, mem_emit, NULL, SRC_MEM
+};
+static const struct collector_ops psi_collector = {
+	"psi", psi_init, psi_sample, psi_emit, psi_teardown, SRC_PSI
+};
+static const struct collector_ops procs_collector = {
+	"procs", procs_cinit, procs_csample, NULL, procs_teardown, 0
+};
+
+// Emit order is registry order.
+static const struct collector_ops *const registry[] = {
+	&cpu_collector,
+	&mem_collector,
+	&psi_collector,
+	&procs_collector,
+	&disk_collector,
+	&net_collector,
+	&cgroup_collector,
+};
+
+#define NREGISTRY (int)(sizeof(registry) / sizeof(registry[0]))
+
+// ---- sampler ----
+
+int sampler_collector_known(const char *name){
+	for(int i = 0; i < NREGISTRY; i++)
+		if(strcmp(registry[i]->name, name) == 0) return 1;
+	return 0;
+}
+
+static double collector_period(const struct probe_config *cfg, const char *name){
+	double p = 0.0;
+	for(int i = 0; i < cfg->nperiods; i++)
+		if(strcmp(cfg->periods[i].name, name) == 0) p = cfg->periods[i].period_s;
+	return p;
+}
+
+// The buffers hold whatever cpu and mem read last.
+static void sampler_capture(struct sampler *sp, double t){
+	if(snap_write(&sp->capture, SNAP_STAT, t, sp->probe.stat.buf, sp->probe.stat.len) != 0 ||
+			snap_write(&sp->capture, SNAP_MEMINFO, t, sp->probe.meminfo.buf,
+				sp->probe.meminfo.len) != 0){
+		perror("capture");
+		snap_close(&sp->capture);
+		sp->capturing = 0;
+	}
+}
+
+int sampler_init(struct sampler *sp, const struct probe_config *cfg){
+	memset(sp, 0, sizeof(*sp));
+	sp->cfg = cfg;
+	sp->tick_s = cfg->interval_s;
+	if(cfg->replay){
+		// the first frame only primes the counters, as the first read does live
+		if(snap_open(&sp->replay, cfg->replay) != 0) return -1;
+		sp->replaying = 1;
+		// the capture's period, not -i: collector periods and the meta
+		// record go by it
+		double dt = snap_interval(&sp->replay);
+		if(dt > 0.0) sp->tick_s = dt;
+		if(snap_next(&sp->replay, &sp->replay_t0, sp->frame) != 0){
+			fprintf(stderr, "%s: no frames\n", cfg->replay);
+			return -1;
+		}
+		int cores = snap_stat_cores(&sp->frame[SNAP_STAT]);
+		sp->cap.cores = cores > 0 ? cores : 1;
+		sp->cap.max_freq_khz = -1;
+		mem_read(sp);
+	} else {
+		read_cpu_capacity(&sp->cap);
+		if(probe_open(&sp->probe, sp->cap.cores) != 0) return -1;
+		if(cfg->bpf){
+			if(ebpf_open(&sp->ebpf) != 0) return -1;
+			sp->bpf_on = 1;
+		}
+		read_mem_stat(&sp->probe, &sp->mem);
+	}
+	if(rules_compile(&sp->rules, cfg->rules_file, cfg->rules, cfg->nrules, cfg->window) != 0)
+		return -1;
+	if(cfg->predict_s > 0.0){
+		// the ratios the mem rules act on, or the built-in ones
+		double warn = FORECAST_WARN_PCT, danger = FORECAST_DANGER_PCT;
+		rules_mem_avail_levels(&sp->rules, &warn, &danger);
+		forecast_init(&sp->forecast, cfg->predict_s, cfg->predict_fit_s, warn, danger);
+		sp->predict_on = 1;
+	}
+	if(cfg->self_s > 0.0){
+		if(self_open(&sp->self) != 0) return -1;
+		sp->self_on = 1;
+	}
+
+	qsketch_init(&sp->cpu_run, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	qsketch_init(&sp->mem_run, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	qsketch_init(&sp->cpu_period, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	qsketch_init(&sp->mem_period, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+
+	wheel_init(&sp->wheel);
+	for(int i = 0; i < NREGISTRY && sp->ncoll < COLLECTOR_MAX; i++){
+		struct collector *c = &sp->coll[sp->ncoll];
+		memset(c, 0, sizeof(*c));
+		c->ops = registry[i];
+		c->period_s = collector_period(cfg, c->ops->name);
+		// only /proc/stat and /proc/meminfo are captured
+		if(sp->replaying && c->ops != &cpu_collector && c->ops != &mem_collector) continue;
+		int rc = c->ops->init ? c->ops->init(c, sp) : 0;
+		if(rc < 0){
+			// undo what the failed init managed to set up
+			if(c->ops->teardown) c->ops->teardown(c, sp);
+			return -1;
+		}
+		if(rc > 0) continue;	// disabled by configuration
+		c->initialized = 1;
+		// everything runs on the first tick
+		wheel_schedule(&sp->wheel, c, 1);
+		sp->ncoll++;
+	}
+	if(cfg->capture){
+		if(snap_create(&sp->capture, cfg->capture) != 0) return -1;
+		sp->capturing = 1;
+		sampler_capture(sp, 0.0);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &sp->start);
+	return 0;
+}
+
+void sampler_free(struct sampler *sp){
+	for(int i = sp->ncoll - 1; i >= 0; i--){
+		struct collector *c = &sp->coll[i];
+		if(c->initialized && c->ops->teardown) c->ops->teardown(c, sp);
+		c->initialized = 0;
+	}
+	sp->ncoll = 0;
+	rules_free(&sp->rules);
+	if(sp->capturing) snap_close(&sp->capture);
+	sp->capturing = 0;
+	if(sp->self_on) self_close(&sp->self);
+	sp->self_on = 0;
+	// a replay never opened /proc
+	if(sp->replaying) snap_free(&sp->replay);
+	else probe_close(&sp->probe);
+	sp->replaying = 0;
+	if(sp->bpf_on) ebpf_close(&sp->ebpf);
+	sp->bpf_on = 0;
+}
+
+void sampler_meta(const struct sampler *sp, struct sample_meta *m){
+	const mem_stat *mem = &sp->mem;
+	// a replay runs at the rate it was captured at
+	m->interval_s = sp->replaying ? sp->tick_s : sp->cfg->interval_s;
+	m->fast_interval_s = sp->cfg->adaptive && !sp->replaying ? sp->cfg->fast_s : 0.0;
+	m->cores = sp->cap.cores;
+	m->window = sp->cfg->window;
+	m->max_freq_ghz = sp->cap.max_freq_khz > 0 ? sp->cap.max_freq_khz / 1000000.0 : -1;
+	m->mem_total_gb = KB_TO_GB(mem->mem_total_kb);
+	m->mem_avail_gb = KB_TO_GB(mem->mem_avail_kb);
+	m->swap_total_gb = KB_TO_GB(mem->swap_total_kb);
+	m->swap_free_gb = KB_TO_GB(mem->swap_free_kb);
+	m->heartbeat_s = sp->cfg->deadband > 0.0 ? sp->cfg->heartbeat_s : 0.0;
+	// filled in by whoever owns the arena, once it is sealed
+	m->arena_kb = 0;
+	m->arena_startup_kb = 0;
+	m->arena_locked = 0;
+	m->predict_s = sp->cfg->predict_s;
+}
+
+double sampler_now(const struct sampler *sp){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec - sp->start.tv_sec)
+		+ (t.tv_nsec - sp->start.tv_nsec) / 1e9;
+}
+
+int sampler_sample(struct sampler *sp, struct sample *s, int *state_change){
+	*state_change = 0;
+	double t;
+	if(sp->replaying){
+		if(snap_next(&sp->replay, &t, sp->frame) != 0) return 1;
+		t -= sp->replay_t0;
+	} else {
+		t = sampler_now(sp);
+	}
+	// a PSI wakeup is off the grid: everything is read now and the
+	// wheel keeps its schedule
+	int wakeup = psi_fired(&sp->psi) > 0;
+	if(!wakeup) wheel_advance(&sp->wheel);
+	unsigned fresh = 0;
+	for(int i = 0; i < sp->ncoll; i++){
+		struct collector *c = &sp->coll[i];
+		if(!wakeup && !c->ready) continue;
+		fresh |= c->ops->src;
+		// a failed read keeps the previous values
+		if(sp->self_on){
+			double t0 = sampler_now(sp);
+			c->ops->sample(c, sp, t);
+			lat_hist_add(&c->lat, (long long)((sampler_now(sp) - t0) * 1e9));
+		} else {
+			c->ops->sample(c, sp, t);
+		}
+		if(c->ready) wheel_schedule(&sp->wheel, c, wheel_ticks(c->period_s, sp->tick_s));
+	}
+
+	memset(s, 0, sizeof(*s));
+	s->t = t;
+	s->interval = t - sp->prev_t;
+	sp->prev_t = t;
+	s->psi_wakeup = wakeup;
+	s->fresh = fresh;
+	// set only with --cgroup-root, --bpf and --predict
+	s->cgroup_mem_pct = NAN;
+	s->cgroup_cpu_pct = NAN;
+	s->runq_avg_us = NAN;
+	s->runq_p99_us = NAN;
+	s->pgfault_s = NAN;
+	s->reclaim_ms_s = NAN;
+	s->mem_slope_mb_s = NAN;
+	s->mem_eta_s = NAN;
+	s->cpu_z = NAN;
+	for(int i = 0; i < sp->ncoll; i++){
+		const struct collector *c = &sp->coll[i];
+		if(c->ops->emit) c->ops->emit(c, sp, s);
+	}
+	// before the rules, which may act on cpu_z and mem_eta_s
+	if(sp->predict_on) forecast_update(&sp->forecast, s);
+
+	sys_state st[GROUP_NR];
+	rules_eval(&sp->rules, s, st);
+	s->cpu_state = st[GROUP_CPU];
+	s->mem_state = st[GROUP_MEM];
+	s->io_state = st[GROUP_IO];
+	s->net_state = st[GROUP_NET];
+
+	if(!sp->have_prev_state){
+		sp->have_prev_state = 1;
+	} else if(s->cpu_state != sp->prev_cpu_state || s->mem_state != sp->prev_mem_state ||
+			s->io_state != sp->prev_io_state || s->net_state != sp->prev_net_state){
+		*state_change = 1;
+	}
+	sp->prev_cpu_state = s->cpu_state;
+	sp->prev_mem_state = s->mem_state;
+	sp->prev_io_state = s->io_state;
+	sp->prev_net_state = s->net_state;
+	if(sp->capturing) sampler_capture(sp, t);
+	return 0;
+}
+
+// Speeding up happens at 80% of a WARN threshold, calm needs 70%:
+// a reading hovering at the edge does not flap the rate.
+#define ADAPT_NEAR 0.8
+#define ADAPT_CALM 0.7
+// A single saturated core speeds sampling up without being a state.
+#define ADAPT_HOT_PCT 85.0
+
+double sampler_interval(struct sampler *sp, const struct sample *s, int state_change){
+	const struct probe_config *cfg = sp->cfg;
+	if(!cfg->adaptive) return sp->tick_s;
+	double frac = sp->fast ? ADAPT_CALM : ADAPT_NEAR;
+	int trouble = state_change || s->psi_wakeup ||
+		s->cpu_state != SYS_OK || s->mem_state != SYS_OK || s->io_state != SYS_OK ||
+		s->net_state != SYS_OK || s->mem_predicted != SYS_OK ||
+		s->cpu_hot_avg > ADAPT_HOT_PCT * frac ||
+		rules_near_warn(&sp->rules, frac);
+	if(trouble){
+		sp->fast = 1;
+		sp->calm_since = s->t;
+	} else if(sp->fast && s->t - sp->calm_since >= cfg->calm_s){
+		sp->fast = 0;
+	}
+	double tick_s = sp->fast ? cfg->fast_s : cfg->slow_s;
+	if(tick_s != sp->tick_s) wheel_rescale(&sp->wheel, sp->tick_s, tick_s);
+	sp->tick_s = tick_s;
+	return sp->tick_s;
+}
+
+void sampler_top(const struct sampler *sp, double t, enum top_reason reason,
+		struct proc_top *top){
+	top->t = t;
+	top->reason = reason;
+	procs_top(&sp->procs, top);
+}
+
+// Periods run on a fixed grid: a tick landing a hair before its due time
+// still counts (half a tick of slack), and the next one is due a whole
+// period after the last due time, not after the tick that met it. Only a
+// stall of more than a period resyncs the grid to t.
+static int period_due(double *last, double period_s, double tick_s, double t){
+	double due = *last + period_s;
+	if(t < due - tick_s / 2.0) return 0;
+	*last = t - due > period_s ? t : due;
+	return 1;
+}
+
+int sampler_summary_due(struct sampler *sp, double t, struct sample_summary *m){
+	if(sp->cfg->summary_s <= 0.0 ||
+			!period_due(&sp->last_summary, sp->cfg->summary_s, sp->tick_s, t))
+		return 0;
+	sample_summary_fill(m, t, &sp->cpu_period, &sp->mem_period);
+	qsketch_reset(&sp->cpu_period);
+	qsketch_reset(&sp->mem_period);
+	return 1;
+}
+
+int sampler_self_due(struct sampler *sp, double t, unsigned long long missed,
+		struct self_stat *m){
+	if(!sp->self_on || !period_due(&sp->last_self, sp->cfg->self_s, sp->tick_s, t))
+		return 0;
+	self_fill(&sp->self, t, m);
+	m->missed = missed;
+	for(int i = 0; i < sp->ncoll && m->ncoll < SELF_COLL_MAX; i++){
+		struct self_coll *sc = &m->coll[m->ncoll++];
+		snprintf(sc->name, sizeof(sc->name), "%s", sp->coll[i].ops->name);
+		lat_hist_take(&sp->coll[i].lat, &sc->lat);
+	}
+	return 1;
+}
+
+void sampler_end(struct sampler *sp, double t, struct sample_summary *m){
+	sample_summary_fill(m, t, &sp->cpu_run, &sp->mem_run);
+}
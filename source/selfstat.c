@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "selfstat.h"
+#include "parse.h"
+
+#define SELF_STATM_BUF 128
+
+static int lat_bucket(unsigned long long ns){
+	int b = ns ? 63 - __builtin_clzll(ns) : 0;
+	return b < LAT_BUCKETS ? b : LAT_BUCKETS - 1;
+}
+
+void lat_hist_add(struct lat_hist *h, long long ns){
+	unsigned long long v = ns > 0 ? (unsigned long long)ns : 0;
+	atomic_fetch_add_explicit(&h->bucket[lat_bucket(v)], 1, memory_order_relaxed);
+	unsigned long long m = atomic_load_explicit(&h->max_ns, memory_order_relaxed);
+	while(v > m && !atomic_compare_exchange_weak_explicit(&h->max_ns, &m, v,
+				memory_order_relaxed, memory_order_relaxed))
+		;
+}
+
+static double bucket_top_us(int b, unsigned long long max_ns){
+	double top = (double)(1ULL << (b + 1));
+	return (top < (double)max_ns ? top : (double)max_ns) / 1000.0;
+}
+
+void lat_hist_take(struct lat_hist *h, struct lat_summary *out){
+	unsigned long long cnt[LAT_BUCKETS], n = 0;
+	for(int b = 0; b < LAT_BUCKETS; b++){
+		cnt[b] = atomic_exchange_explicit(&h->bucket[b], 0, memory_order_relaxed);
+		n += cnt[b];
+	}
+	unsigned long long max_ns = atomic_exchange_explicit(&h->max_ns, 0, memory_order_relaxed);
+	out->n = n;
+	out->p50_us = out->p99_us = 0.0;
+	out->max_us = max_ns / 1000.0;
+	if(n == 0) return;
+	// ranks of the 50th and 99th percentile, 1-based
+	unsigned long long r50 = (n + 1) / 2, r99 = n - n / 100, seen = 0;
+	int have50 = 0;
+	for(int b = 0; b < LAT_BUCKETS; b++){
+		seen += cnt[b];
+		if(!have50 && seen >= r50){
+			out->p50_us = bucket_top_us(b, max_ns);
+			have50 = 1;
+		}
+		if(seen >= r99){
+			out->p99_us = bucket_top_us(b, max_ns);
+			break;
+		}
+	}
+}
+
+static double tv_s(struct timeval tv){
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+double self_thread_cpu_s(void){
+	struct timespec ts;
+	if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0.0;
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int self_open(struct self_probe *p){
+	memset(p, 0, sizeof(*p));
+	long page = sysconf(_SC_PAGESIZE);
+	p->page_kb = page > 0 ? page / 1024 : 4;
+	if(proc_file_open(&p->statm, "/proc/self/statm", SELF_STATM_BUF) != 0){
+		perror("open /proc/self/statm");
+		return -1;
+	}
+	return 0;
+}
+
+void self_close(struct self_probe *p){
+	proc_file_close(&p->statm);
+}
+
+void self_tick(struct self_probe *p, long long late_ns, long long loop_ns){
+	p->ticks++;
+	if(late_ns >= 0) lat_hist_add(&p->late, late_ns);
+	lat_hist_add(&p->loop, loop_ns);
+}
+
+void self_fill(struct self_probe *p, double t, struct self_stat *out){
+	struct rusage ru;
+	memset(out, 0, sizeof(*out));
+	out->t = t;
+	if(getrusage(RUSAGE_SELF, &ru) == 0){
+		out->utime_s = tv_s(ru.ru_utime);
+		out->stime_s = tv_s(ru.ru_stime);
+		out->maxrss_kb = ru.ru_maxrss;
+	}
+	double cpu_s = out->utime_s + out->stime_s;
+	out->cpu_pct = t > p->prev_t ? (cpu_s - p->prev_cpu_s) / (t - p->prev_t) * 100.0 : 0.0;
+	p->prev_t = t;
+	p->prev_cpu_s = cpu_s;
+	out->sampler_cpu_s = self_thread_cpu_s();
+
+	// statm: size resident shared ... in pages
+	long size, resident;
+	const char *b = p->statm.buf, *end;
+	if(proc_file_read(&p->statm) > 0){
+		end = b + p->statm.len;
+		if((b = parse_long(b, end, &size)) && parse_long(b, end, &resident))
+			out->rss_kb = resident * p->page_kb;
+	}
+	out->ticks = p->ticks;
+	lat_hist_take(&p->late, &out->late);
+	lat_hist_take(&p->loop, &out->loop);
+}
@@ -0,0 +1,114 @@
+#include <math.h>
+#include <string.h>
+#include "sketch.h"
+
+void qsketch_init(struct qsketch *s, double rel_acc, double min_value){
+	if(rel_acc <= 0.0 || rel_acc >= 1.0) rel_acc = SKETCH_REL_ACC;
+	if(min_value <= 0.0) min_value = SKETCH_MIN_VALUE;
+	s->gamma = (1.0 + rel_acc) / (1.0 - rel_acc);
+	s->inv_log_gamma = 1.0 / log(s->gamma);
+	s->min_value = min_value;
+	s->offset = (int)ceil(log(min_value) * s->inv_log_gamma);
+	qsketch_reset(s);
+}
+
+void qsketch_reset(struct qsketch *s){
+	s->zero = 0;
+	s->count = 0;
+	s->min = INFINITY;
+	s->max = -INFINITY;
+	s->sum = 0.0;
+	memset(s->bins, 0, sizeof(s->bins));
+}
+
+static inline int qsketch_bin(const struct qsketch *s, double v){
+	int k = (int)ceil(log(v) * s->inv_log_gamma) - s->offset;
+	if(k < 0) k = 0;
+	if(k >= SKETCH_BINS) k = SKETCH_BINS - 1;
+	return k;
+}
+
+void qsketch_add(struct qsketch *s, double v){
+	if(isnan(v)) return;
+	if(v <= s->min_value) s->zero++;
+	else s->bins[qsketch_bin(s, v)]++;
+	s->count++;
+	s->sum += v;
+	if(v < s->min) s->min = v;
+	if(v > s->max) s->max = v;
+}
+
+void qsketch_remove(struct qsketch *s, double v){
+	if(isnan(v) || s->count == 0) return;
+	if(v <= s->min_value){
+		if(!s->zero) return;
+		s->zero--;
+	} else {
+		int k = qsketch_bin(s, v);
+		if(!s->bins[k]) return;
+		s->bins[k]--;
+	}
+	s->count--;
+	s->sum -= v;
+	if(s->count == 0){
+		s->min = INFINITY;
+		s->max = -INFINITY;
+		return;
+	}
+	// what is left is no further out than v, nor than its outermost bin
+	if(v >= s->max){
+		double hi = s->min_value;	// only the zero bin left
+		for(int k = v <= s->min_value ? -1 : qsketch_bin(s, v); k >= 0; k--){
+			if(!s->bins[k]) continue;
+			hi = k == SKETCH_BINS - 1 ? INFINITY : pow(s->gamma, k + s->offset);
+			break;
+		}
+		if(hi < s->max) s->max = hi;
+	}
+	if(v <= s->min && !s->zero){
+		double lo = s->min;
+		for(int k = v <= s->min_value ? 0 : qsketch_bin(s, v); k < SKETCH_BINS; k++){
+			if(!s->bins[k]) continue;
+			lo = k == 0 ? s->min_value : pow(s->gamma, k + s->offset - 1);
+			break;
+		}
+		if(lo > s->min) s->min = lo;
+	}
+}
+
+int qsketch_merge(struct qsketch *dst, const struct qsketch *src){
+	if(dst->gamma != src->gamma || dst->offset != src->offset) return -1;
+	for(int k = 0; k < SKETCH_BINS; k++) dst->bins[k] += src->bins[k];
+	dst->zero += src->zero;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if(src->min < dst->min) dst->min = src->min;
+	if(src->max > dst->max) dst->max = src->max;
+	return 0;
+}
+
+double qsketch_quantile(const struct qsketch *s, double q){
+	if(s->count == 0) return NAN;
+	if(q <= 0.0) return s->min;
+	if(q >= 1.0) return s->max;
+	uint64_t rank = (uint64_t)(q * (double)(s->count - 1));
+	uint64_t seen = s->zero;
+	double v = s->min;
+	if(seen <= rank){
+		for(int k = 0; k < SKETCH_BINS; k++){
+			seen += s->bins[k];
+			if(seen > rank){
+				// midpoint (in relative terms) of (gamma^(i-1), gamma^i]
+				v = 2.0 * pow(s->gamma, k + s->offset) / (s->gamma + 1.0);
+				break;
+			}
+		}
+	}
+	if(v < s->min) v = s->min;
+	if(v > s->max) v = s->max;
+	return v;
+}
+
+double qsketch_mean(const struct qsketch *s){
+	return s->count ? s->sum / (double)s->count : NAN;
+}
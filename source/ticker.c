@@ -0,0 +1,83 @@
+#define _GNU_SOURCE	// ppoll
+#include <errno.h>
+#include "ticker.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+static long long ts_ns(const struct timespec *t){
+	return (long long)t->tv_sec * NSEC_PER_SEC + t->tv_nsec;
+}
+
+static struct timespec ns_ts(long long ns){
+	struct timespec t = { (time_t)(ns / NSEC_PER_SEC), (long)(ns % NSEC_PER_SEC) };
+	return t;
+}
+
+static long long period_from(double interval_s){
+	long long p = (long long)(interval_s * 1e9 + 0.5);
+	return p > 0 ? p : 1;
+}
+
+void tick_sched_init(struct tick_sched *s, double interval_s){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	s->period_ns = period_from(interval_s);
+	s->next = ns_ts(ts_ns(&now) + s->period_ns);
+	s->ticks = 0;
+	s->missed = 0;
+	s->late_ns = 0;
+}
+
+// The new period counts from the last deadline; if that is already in
+// the past the schedule is re-anchored on now rather than reporting
+// the switch itself as a missed deadline.
+void tick_sched_set_interval(struct tick_sched *s, double interval_s){
+	long long p = period_from(interval_s);
+	if(p == s->period_ns) return;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long next = ts_ns(&s->next) - s->period_ns + p;
+	if(next < ts_ns(&now)) next = ts_ns(&now) + p;
+	s->next = ns_ts(next);
+	s->period_ns = p;
+}
+
+static void tick_advance(struct tick_sched *s){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long deadline = ts_ns(&s->next);
+	long long late = ts_ns(&now) - deadline;
+	if(late < 0) late = 0;
+	s->late_ns = late;
+
+	long long skip = late / s->period_ns;
+	s->missed += (unsigned long long)skip;
+	s->next = ns_ts(deadline + (skip + 1) * s->period_ns);
+	s->ticks++;
+}
+
+int tick_sched_wait(struct tick_sched *s){
+	int rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &s->next, NULL);
+	if(rc == EINTR) return -1;
+	tick_advance(s);
+	return 0;
+}
+
+// ppoll only takes a relative timeout; it never returns before it, and
+// the loop absorbs the rare wakeup that lands a hair short.
+int tick_sched_wait_fds(struct tick_sched *s, struct pollfd *fds, int nfds){
+	if(nfds <= 0) return tick_sched_wait(s);
+	for(;;){
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long rem = ts_ns(&s->next) - ts_ns(&now);
+		if(rem <= 0) break;
+		struct timespec ts = ns_ts(rem);
+		int n = ppoll(fds, (nfds_t)nfds, &ts, NULL);
+		if(n > 0) return 1;
+		if(n < 0 && errno == EINTR) return -1;
+		if(n < 0) break;
+	}
+	tick_advance(s);
+	return 0;
+}
@@ -0,0 +1,465 @@
+#define _GNU_SOURCE	// recvmmsg
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include "output.h"
+#include "push.h"
+#include "sketch.h"
+#include "state.h"
+#include "window.h"
+
+// sysprobe-agg: receives the frames of `sysprobe --push` from many
+// hosts and prints one fleet record per period on stdout.
+//
+// Each host keeps a window of its CPU samples and sketches of CPU and
+// memory for the current period; at the end of a period the host
+// sketches are merged into the fleet quantiles. Memory is bounded by
+// --max-hosts: the host table is allocated once, hosts silent for
+// --expire seconds give their slot back, and frames of new hosts past
+// the limit are counted and dropped.
+
+#define AGG_RECV_BATCH 64
+#define AGG_RECV_BUF 2048
+#define AGG_HOT 3
+#define AGG_NGROUP 4
+// a frame further behind than this is a restarted sender, not a late
+// one; also the width of host.seen
+#define AGG_REORDER 64
+
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int sig){
+	(void)sig;
+	running = 0;
+}
+
+struct host {
+	char name[PUSH_HOST_MAX];	// "" while the slot is free
+	uint64_t next_seq;
+	uint64_t seen;			// bit k: frame next_seq - 1 - k arrived
+	double last_seen;
+	sys_state state[AGG_NGROUP];
+	cpu_window cpu;
+	struct qsketch cpu_q;		// this period
+	struct qsketch mem_q;
+};
+
+struct agg {
+	struct host *hosts;
+	int max_hosts;
+	int nhosts;
+	int *free_ids;
+	int nfree;
+	// open addressing over host ids (+1, 0 = empty), linear probing
+	int *index;
+	unsigned mask;
+	int window;
+	double expire_s;
+	struct qsketch fleet_cpu;
+	struct qsketch fleet_mem;
+	// this period
+	unsigned long long frames, samples, lost, bad, rejected, added, expired;
+};
+
+static double mono_s(void){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static double wall_s(void){
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static unsigned name_hash(const char *s){
+	unsigned h = 2166136261u;	// FNV-1a
+	for(; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+static int agg_init(struct agg *a, int max_hosts, int window, double expire_s){
+	memset(a, 0, sizeof(*a));
+	unsigned cap = 2;
+	while(cap < 2u * (unsigned)max_hosts) cap <<= 1;
+	a->hosts = calloc((size_t)max_hosts, sizeof(*a->hosts));
+	a->free_ids = malloc((size_t)max_hosts * sizeof(int));
+	a->index = calloc(cap, sizeof(int));
+	if(!a->hosts || !a->free_ids || !a->index) return -1;
+	a->max_hosts = max_hosts;
+	a->mask = cap - 1;
+	a->window = window;
+	a->expire_s = expire_s;
+	for(int i = 0; i < max_hosts; i++) a->free_ids[i] = max_hosts - 1 - i;
+	a->nfree = max_hosts;
+	qsketch_init(&a->fleet_cpu, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	qsketch_init(&a->fleet_mem, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	return 0;
+}
+
+static void agg_free(struct agg *a){
+	for(int i = 0; i < a->max_hosts; i++)
+		if(a->hosts[i].name[0]) cpu_window_free(&a->hosts[i].cpu);
+	free(a->hosts);
+	free(a->free_ids);
+	free(a->index);
+}
+
+static struct host *agg_host(struct agg *a, const char *name, double now){
+	unsigned i = name_hash(name) & a->mask;
+	for(; a->index[i]; i = (i + 1) & a->mask){
+		struct host *h = &a->hosts[a->index[i] - 1];
+		if(strcmp(h->name, name) == 0) return h;
+	}
+	if(a->nfree == 0){
+		a->rejected++;
+		return NULL;
+	}
+	int id = a->free_ids[--a->nfree];
+	struct host *h = &a->hosts[id];
+	memset(h, 0, sizeof(*h));
+	if(cpu_window_init(&h->cpu, a->window, 0.0) != 0){
+		a->free_ids[a->nfree++] = id;
+		a->rejected++;
+		return NULL;
+	}
+	snprintf(h->name, sizeof(h->name), "%s", name);
+	qsketch_init(&h->cpu_q, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	qsketch_init(&h->mem_q, SKETCH_REL_ACC, SKETCH_MIN_VALUE);
+	h->last_seen = now;
+	a->index[i] = id + 1;
+	a->nhosts++;
+	a->added++;
+	return h;
+}
+
+// backward-shift delete keeps every probe chain unbroken
+static void agg_remove(struct agg *a, unsigned i){
+	int id = a->index[i] - 1;
+	cpu_window_free(&a->hosts[id].cpu);
+	a->hosts[id].name[0] = '\0';
+	a->free_ids[a->nfree++] = id;
+	a->nhosts--;
+	unsigned hole = i;
+	for(unsigned j = (i + 1) & a->mask; a->index[j]; j = (j + 1) & a->mask){
+		unsigned home = name_hash(a->hosts[a->index[j] - 1].name) & a->mask;
+		// j may move to the hole unless its home lies in (hole, j]
+		if(((j - home) & a->mask) >= ((j - hole) & a->mask)){
+			a->index[hole] = a->index[j];
+			hole = j;
+		}
+	}
+	a->index[hole] = 0;
+}
+
+static void agg_frame(struct agg *a, const struct push_frame *f, double now){
+	struct host *h = agg_host(a, f->host, now);
+	if(!h) return;
+	a->frames++;
+	// A late or duplicated datagram leaves next_seq alone, or the next
+	// in-order frame would count the same gap as lost again, and a
+	// duplicate's samples are dropped. A restarted sender starts over at
+	// 1: far below next_seq, or a 1 that was already seen.
+	uint64_t back = h->next_seq - 1 - f->seq;	// frames behind the newest
+	int late = h->next_seq && f->seq < h->next_seq;
+	if(!h->next_seq || f->seq + AGG_REORDER < h->next_seq ||
+			(f->seq == 1 && late && (h->seen >> back & 1))){
+		h->next_seq = f->seq + 1;
+		h->seen = 1;
+		late = 0;
+	} else if(late){
+		h->last_seen = now;
+		if(h->seen >> back & 1) return;
+		h->seen |= 1ULL << back;
+	} else {
+		uint64_t ahead = f->seq - h->next_seq + 1;
+		a->lost += ahead - 1;
+		h->seen = ahead >= AGG_REORDER ? 1 : h->seen << ahead | 1;
+		h->next_seq = f->seq + 1;
+	}
+	h->last_seen = now;
+	for(int i = 0; i < f->n; i++){
+		const struct push_entry *e = &f->e[i];
+		cpu_window_add(&h->cpu, e->cpu_pct);
+		qsketch_add(&h->cpu_q, e->cpu_pct);
+		qsketch_add(&h->mem_q, e->mem_used_pct);
+	}
+	// a late frame's states are older than the ones already kept
+	if(f->n > 0 && !late) memcpy(h->state, f->e[f->n - 1].state, sizeof(h->state));
+	a->samples += (unsigned long long)f->n;
+}
+
+static void emit_quantiles(struct out_buf *o, const char *name, const struct qsketch *q){
+	static const double qs[] = { 0.50, 0.95, 0.99 };
+	static const char *tags[] = { "_p50\":", "_p95\":", "_p99\":" };
+	for(int i = 0; i < 3; i++){
+		out_puts(o, ",\"");
+		out_puts(o, name);
+		out_puts(o, tags[i]);
+		out_fixed(o, qsketch_quantile(q, qs[i]), 2);
+	}
+}
+
+static void emit_count(struct out_buf *o, const char *key, unsigned long long v){
+	out_puts(o, key);
+	out_u64(o, v);
+}
+
+static void agg_emit(struct agg *a, struct out_buf *o, double now){
+	static const char *group_keys[AGG_NGROUP] = {
+		",\"CPU_STATE\":{", ",\"MEM_STATE\":{", ",\"IO_STATE\":{", ",\"NET_STATE\":{"
+	};
+	unsigned long long states[AGG_NGROUP][3];
+	const struct host *hot[AGG_HOT] = { NULL };
+	memset(states, 0, sizeof(states));
+	qsketch_reset(&a->fleet_cpu);
+	qsketch_reset(&a->fleet_mem);
+	// expiry first: a shift may wrap a host around to a slot visited
+	// again, harmless for the check but not for the merge below
+	for(unsigned i = 0; i <= a->mask; i++){
+		if(!a->index[i] || now - a->hosts[a->index[i] - 1].last_seen < a->expire_s)
+			continue;
+		a->expired++;
+		agg_remove(a, i);
+		i--;	// the shift may have moved another host here
+	}
+	for(unsigned i = 0; i <= a->mask; i++){
+		if(!a->index[i]) continue;
+		struct host *h = &a->hosts[a->index[i] - 1];
+		qsketch_merge(&a->fleet_cpu, &h->cpu_q);
+		qsketch_merge(&a->fleet_mem, &h->mem_q);
+		qsketch_reset(&h->cpu_q);
+		qsketch_reset(&h->mem_q);
+		for(int g = 0; g < AGG_NGROUP; g++)
+			if(h->state[g] <= SYS_DANGER) states[g][h->state[g]]++;
+		// insertion into the hottest few by window average
+		double avg = cpu_window_avg(&h->cpu);
+		for(int k = 0; k < AGG_HOT; k++){
+			if(!hot[k] || avg > cpu_window_avg(&hot[k]->cpu)){
+				memmove(&hot[k + 1], &hot[k], (size_t)(AGG_HOT - 1 - k) * sizeof(hot[0]));
+				hot[k] = h;
+				break;
+			}
+		}
+	}
+
+	out_puts(o, "{\"type\":\"fleet\",\"ts\":");
+	out_fixed(o, wall_s(), 3);
+	emit_count(o, ",\"hosts\":", (unsigned long long)a->nhosts);
+	emit_count(o, ",\"new_hosts\":", a->added);
+	emit_count(o, ",\"expired_hosts\":", a->expired);
+	emit_count(o, ",\"rejected_frames\":", a->rejected);
+	emit_count(o, ",\"frames\":", a->frames);
+	emit_count(o, ",\"lost_frames\":", a->lost);
+	emit_count(o, ",\"bad_frames\":", a->bad);
+	emit_count(o, ",\"samples\":", a->samples);
+	emit_quantiles(o, "cpu", &a->fleet_cpu);
+	emit_quantiles(o, "mem_used_pct", &a->fleet_mem);
+	for(int g = 0; g < AGG_NGROUP; g++){
+		out_puts(o, group_keys[g]);
+		emit_count(o, "\"ok\":", states[g][SYS_OK]);
+		emit_count(o, ",\"warn\":", states[g][SYS_WARN]);
+		emit_count(o, ",\"danger\":", states[g][SYS_DANGER]);
+		out_putc(o, '}');
+	}
+	out_puts(o, ",\"hot\":[");
+	for(int k = 0; k < AGG_HOT && hot[k]; k++){
+		if(k) out_putc(o, ',');
+		out_puts(o, "{\"host\":");
+		out_json_string(o, hot[k]->name);
+		out_puts(o, ",\"cpu_avg\":");
+		out_fixed(o, cpu_window_avg(&hot[k]->cpu), 2);
+		out_putc(o, '}');
+	}
+	out_puts(o, "]}");
+	out_end_record(o);
+	a->frames = a->samples = a->lost = a->bad = a->rejected = a->added = a->expired = 0;
+}
+
+static void usage(const char *prog){
+	fprintf(stderr,
+		"usage: %s [options] udp:ADDR:PORT | unix:PATH\n"
+		"  --every S       fleet record period in seconds (default 10)\n"
+		"  --window N      per-host cpu window in samples (default %d)\n"
+		"  --max-hosts N   host table size (default 1024)\n"
+		"  --expire S      forget a host silent for S seconds (default 60)\n",
+		prog, CPU_WINDOW);
+}
+
+static int parse_pos(const char *s, double *out){
+	char *end;
+	double v = strtod(s, &end);
+	if(end == s || *end || !(v > 0.0)) return -1;
+	*out = v;
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	static const struct option opts[] = {
+		{ "every",     required_argument, NULL, 'e' },
+		{ "window",    required_argument, NULL, 'w' },
+		{ "max-hosts", required_argument, NULL, 'm' },
+		{ "expire",    required_argument, NULL, 'x' },
+		{ "help",      no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	double every_s = 10.0, expire_s = 60.0, v;
+	int window = CPU_WINDOW, max_hosts = 1024, c;
+	while((c = getopt_long(argc, argv, "h", opts, NULL)) != -1){
+		switch(c){
+		case 'e':
+			if(parse_pos(optarg, &every_s) != 0) goto bad;
+			break;
+		case 'w':
+			if(parse_pos(optarg, &v) != 0 || v > 1e6) goto bad;
+			window = (int)v;
+			break;
+		case 'm':
+			if(parse_pos(optarg, &v) != 0 || v > 1e7) goto bad;
+			max_hosts = (int)v;
+			break;
+		case 'x':
+			if(parse_pos(optarg, &expire_s) != 0) goto bad;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(optind != argc - 1){
+		usage(argv[0]);
+		return 2;
+	}
+	const char *spec = argv[optind];
+
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	if(push_parse_addr(spec, 1, &addr, &addr_len) != 0){
+		fprintf(stderr, "bad address: %s\n", spec);
+		return 2;
+	}
+	int fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if(fd < 0){
+		perror("socket");
+		return 1;
+	}
+	const char *unix_path = addr.ss_family == AF_UNIX ?
+		((struct sockaddr_un *)&addr)->sun_path : NULL;
+	if(unix_path) unlink(unix_path);
+	// many senders at once: a deep receive queue absorbs their bursts
+	int rcvbuf = 8 << 20;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	if(bind(fd, (struct sockaddr *)&addr, addr_len) != 0){
+		perror(spec);
+		return 1;
+	}
+
+	int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	struct itimerspec its;
+	its.it_interval.tv_sec = (time_t)every_s;
+	its.it_interval.tv_nsec = (long)((every_s - (double)(time_t)every_s) * 1e9);
+	its.it_value = its.it_interval;
+	if(tfd < 0 || timerfd_settime(tfd, 0, &its, NULL) != 0){
+		perror("timerfd");
+		return 1;
+	}
+	int ep = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+	if(ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) != 0){
+		perror("epoll");
+		return 1;
+	}
+	ev.data.fd = tfd;
+	if(epoll_ctl(ep, EPOLL_CTL_ADD, tfd, &ev) != 0){
+		perror("epoll");
+		return 1;
+	}
+
+	static struct agg a;
+	if(agg_init(&a, max_hosts, window, expire_s) != 0){
+		perror("agg_init");
+		return 1;
+	}
+	struct out_buf out;
+	if(out_init(&out, STDOUT_FILENO, OUT_BUF_SIZE, FORMAT_JSONL, FLUSH_RECORD, 1, 0.0) != 0){
+		perror("out_init");
+		return 1;
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	static uint8_t bufs[AGG_RECV_BATCH][AGG_RECV_BUF];
+	struct mmsghdr msgs[AGG_RECV_BATCH];
+	struct iovec iov[AGG_RECV_BATCH];
+	static struct push_frame frame;
+	while(running && !out.error){
+		struct epoll_event evs[2];
+		int n = epoll_wait(ep, evs, 2, -1);
+		if(n < 0){
+			if(errno == EINTR) continue;
+			perror("epoll_wait");
+			break;
+		}
+		for(int i = 0; i < n; i++){
+			if(evs[i].data.fd == tfd){
+				uint64_t expirations;
+				if(read(tfd, &expirations, sizeof(expirations)) > 0)
+					agg_emit(&a, &out, mono_s());
+				continue;
+			}
+			// drain the socket, AGG_RECV_BATCH datagrams per syscall
+			for(;;){
+				memset(msgs, 0, sizeof(msgs));
+				for(int k = 0; k < AGG_RECV_BATCH; k++){
+					iov[k].iov_base = bufs[k];
+					iov[k].iov_len = sizeof(bufs[k]);
+					msgs[k].msg_hdr.msg_iov = &iov[k];
+					msgs[k].msg_hdr.msg_iovlen = 1;
+				}
+				int got = recvmmsg(fd, msgs, AGG_RECV_BATCH, MSG_DONTWAIT, NULL);
+				if(got <= 0) break;
+				double now = mono_s();
+				for(int k = 0; k < got; k++){
+					if((msgs[k].msg_hdr.msg_flags & MSG_TRUNC) ||
+							push_decode(bufs[k], msgs[k].msg_len, &frame) != 0){
+						a.bad++;
+						continue;
+					}
+					agg_frame(&a, &frame, now);
+				}
+				if(got < AGG_RECV_BATCH) break;
+			}
+		}
+	}
+
+	out_close(&out);
+	agg_free(&a);
+	close(ep);
+	close(tfd);
+	close(fd);
+	if(unix_path) unlink(unix_path);
+	return 0;
+
+bad:
+	fprintf(stderr, "bad value: %s\n", optarg);
+	usage(argv[0]);
+	return 2;
+}
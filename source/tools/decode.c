@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "trace.h"
+#include "flight.h"
+
+// sysprobe-decode: binary trace (--format=bin) or flight recorder file
+// (--flight) -> JSONL on stdout.
+
+static void usage(const char *prog){
+	fprintf(stderr, "usage: %s [options] FILE\n"
+		"  --last D   flight recorder only: the D before its newest sample,\n"
+		"             e.g. 90s, 10m, 2h\n"
+		"  --from T   trace only: records from trace time T on (like D)\n"
+		"  --to T     trace only: records up to trace time T\n"
+		"  --index    trace only: the block summaries of its index that\n"
+		"             overlap --from/--to instead of the records\n", prog);
+}
+
+// "90", "90s", "10m", "2h" -> seconds; zero only with allow_zero
+static int parse_time(const char *s, int allow_zero, double *out){
+	char *end;
+	double v = strtod(s, &end);
+	double unit = 1.0;
+	if(*end == 'm') unit = 60.0;
+	else if(*end == 'h') unit = 3600.0;
+	else if(*end != 's' && *end != '\0') return -1;
+	if(*end && end[1]) return -1;
+	if(end == s || !(v > 0.0 || (allow_zero && v == 0.0))) return -1;
+	*out = v * unit;
+	return 0;
+}
+
+int main(int argc, char *argv[]){
+	static const struct option opts[] = {
+		{ "last",  required_argument, NULL, 'l' },
+		{ "from",  required_argument, NULL, 'f' },
+		{ "to",    required_argument, NULL, 't' },
+		{ "index", no_argument,       NULL, 'x' },
+		{ "help",  no_argument,       NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	double last_s = 0.0, from = -INFINITY, to = INFINITY;
+	int index = 0, ranged = 0, c;
+	while((c = getopt_long(argc, argv, "h", opts, NULL)) != -1){
+		switch(c){
+		case 'l':
+			if(parse_time(optarg, 0, &last_s) != 0){
+				fprintf(stderr, "bad --last: %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 'f':
+		case 't':
+			if(parse_time(optarg, 1, c == 'f' ? &from : &to) != 0){
+				fprintf(stderr, "bad --%s: %s\n", c == 'f' ? "from" : "to", optarg);
+				return 2;
+			}
+			ranged = 1;
+			break;
+		case 'x':
+			index = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		default:
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(optind != argc - 1){
+		usage(argv[0]);
+		return 2;
+	}
+	const char *path = argv[optind];
+	int fd = open(path, O_RDONLY);
+	if(fd < 0){
+		perror(path);
+		return 1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0){
+		fprintf(stderr, "%s: empty or unreadable\n", path);
+		close(fd);
+		return 1;
+	}
+	void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED){
+		perror("mmap");
+		return 1;
+	}
+	// a ranged read seeks through the index and touches little of the file
+	madvise(map, (size_t)st.st_size, ranged || index ? MADV_RANDOM : MADV_SEQUENTIAL);
+
+	struct out_buf out;
+	if(out_init(&out, STDOUT_FILENO, OUT_BUF_SIZE, FORMAT_JSONL, FLUSH_FULL, 0, 0) != 0){
+		perror("out_init");
+		return 1;
+	}
+	int flight = (size_t)st.st_size >= FLIGHT_MAGIC_LEN &&
+		memcmp(map, FLIGHT_MAGIC, FLIGHT_MAGIC_LEN) == 0;
+	if(flight && (ranged || index)){
+		fprintf(stderr, "%s: --from, --to and --index are for traces, see --last\n", path);
+		return 2;
+	}
+	int rc;
+	if(flight) rc = flight_dump(map, (size_t)st.st_size, last_s, &out);
+	else if(index) rc = trace_index(map, (size_t)st.st_size, from, to, &out);
+	else if(ranged) rc = trace_decode_range(map, (size_t)st.st_size, from, to, &out);
+	else rc = trace_decode(map, (size_t)st.st_size, &out, NULL, NULL);
+	out_close(&out);
+	munmap(map, (size_t)st.st_size);
+	if(rc != 0 && index){
+		fprintf(stderr, "%s: no index (not a trace, or cut short)\n", path);
+		return 1;
+	}
+	if(rc != 0){
+		fprintf(stderr, flight ? "%s: corrupt flight file, or one of another sysprobe build\n" :
+				"%s: not a sysprobe trace or truncated\n", path);
+		return 1;
+	}
+	return 0;
+}
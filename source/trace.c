@@ -0,0 +1,920 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "arena.h"
+#include "trace.h"
+#include "output.h"
+#include "sample.h"
+#include "procs.h"
+#include "cgroup.h"
+#include "selfstat.h"
+
+#define GB_TO_KB(gb) ((int64_t)llround((gb) * 1024.0 * 1024.0))
+#define KB_TO_GB(kb) ((kb) / 1024.0 / 1024.0)
+
+// fixed part of a sample payload, ncores u16 come on top
+#define TRACE_SAMPLE_MAX 320
+
+// ---- encoding ----
+
+struct wbuf {
+	uint8_t *p;
+	size_t len;
+};
+
+static void put_u8(struct wbuf *w, uint8_t v){
+	w->p[w->len++] = v;
+}
+
+static void put_u16(struct wbuf *w, uint16_t v){
+	w->p[w->len++] = (uint8_t)v;
+	w->p[w->len++] = (uint8_t)(v >> 8);
+}
+
+static void put_u32(struct wbuf *w, uint32_t v){
+	for(int i = 0; i < 4; i++) w->p[w->len++] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64(struct wbuf *w, uint64_t v){
+	for(int i = 0; i < 8; i++) w->p[w->len++] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_f32(struct wbuf *w, float f){
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	put_u32(w, v);
+}
+
+static void put_f64(struct wbuf *w, double f){
+	uint64_t v;
+	memcpy(&v, &f, sizeof(v));
+	put_u64(w, v);
+}
+
+static void put_varint(struct wbuf *w, uint64_t v){
+	while(v >= 0x80){
+		w->p[w->len++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	w->p[w->len++] = (uint8_t)v;
+}
+
+static void put_svarint(struct wbuf *w, int64_t v){
+	put_varint(w, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static uint16_t centi_pct(double v){
+	if(!(v > 0.0)) return 0;
+	if(v >= 655.35) return 65535;
+	return (uint16_t)lround(v * 100.0);
+}
+
+static uint16_t centi_opt(double v){
+	return isnan(v) ? TRACE_NONE : centi_pct(v);
+}
+
+static uint64_t centi(double v){
+	return v > 0.0 ? (uint64_t)llround(v * 100.0) : 0;
+}
+
+static void trace_record(struct out_buf *o, uint8_t tag, const struct wbuf *payload){
+	uint8_t hdr[16];
+	struct wbuf h = { hdr, 0 };
+	put_u8(&h, tag);
+	put_varint(&h, payload->len);
+	out_write(o, (const char *)hdr, h.len);
+	out_write(o, (const char *)payload->p, payload->len);
+	out_end_record(o);
+}
+
+static uint64_t trace_dt(struct trace_enc *e, double t){
+	int64_t ts_us = (int64_t)llround(t * 1e6);
+	int64_t dt = ts_us - e->base.ts_us;
+	e->base.ts_us = ts_us;
+	return dt > 0 ? (uint64_t)dt : 0;
+}
+
+void trace_meta(struct out_buf *o, const struct sample_meta *m){
+	uint8_t buf[128];
+	struct wbuf w = { buf, 0 };
+	memcpy(w.p, TRACE_MAGIC, TRACE_MAGIC_LEN);
+	w.len = TRACE_MAGIC_LEN;
+	put_u16(&w, TRACE_VERSION);
+	put_u16(&w, 0);
+	size_t fields = w.len;
+	put_f64(&w, m->interval_s);
+	put_u32(&w, (uint32_t)m->cores);
+	put_u32(&w, (uint32_t)m->window);
+	put_f64(&w, m->max_freq_ghz);
+	put_f64(&w, m->mem_total_gb);
+	put_f64(&w, m->mem_avail_gb);
+	put_f64(&w, m->swap_total_gb);
+	put_f64(&w, m->swap_free_gb);
+	put_f64(&w, m->fast_interval_s);
+	put_f64(&w, m->heartbeat_s);
+	put_u32(&w, m->arena_kb);
+	put_u32(&w, m->arena_startup_kb);
+	put_u32(&w, (uint32_t)m->arena_locked);
+	put_f64(&w, m->predict_s);
+	uint16_t hlen = (uint16_t)(w.len - fields);
+	buf[fields - 2] = (uint8_t)hlen;
+	buf[fields - 1] = (uint8_t)(hlen >> 8);
+	// a new trace: new delta base and index, same index storage
+	struct trace_enc keep = o->trace;
+	memset(&o->trace, 0, sizeof(o->trace));
+	o->trace.blocks = keep.blocks;
+	o->trace.cap = keep.cap;
+	o->trace.scratch = keep.scratch;
+	o->trace.scratch_cap = keep.scratch_cap;
+	out_write(o, (const char *)buf, w.len);
+	out_end_record(o);
+}
+
+void trace_state_change(struct out_buf *o, const struct sample *s){
+	(void)s;
+	// folded into the flags of the sample that follows
+	o->trace.pending_change = 1;
+}
+
+void trace_enc_free(struct trace_enc *e){
+	free(e->blocks);
+	arena_free(e->scratch);
+	e->blocks = NULL;
+	e->scratch = NULL;
+	e->nblocks = e->cap = e->scratch_cap = 0;
+	e->open = 0;
+}
+
+// Opens a block at the sample about to be written, closing the current
+// one once it is long enough. Without memory the trace just goes on
+// unindexed. The index grows with the trace and is only read when it is
+// closed, so it lives on the heap rather than in the arena.
+static struct trace_block *index_block(struct out_buf *o, int64_t ts_us){
+	struct trace_enc *e = &o->trace;
+	if(e->truncated) return NULL;
+	if(e->open){
+		struct trace_block *b = &e->blocks[e->nblocks - 1];
+		if(ts_us - b->t_first_us < (int64_t)(TRACE_BLOCK_S * 1e6) &&
+				b->samples < TRACE_BLOCK_MAX)
+			return b;
+		e->open = 0;
+	}
+	if(e->nblocks == e->cap){
+		size_t cap = e->cap ? 2 * e->cap : 256;
+		struct trace_block *nb = realloc(e->blocks, cap * sizeof(*nb));
+		// a gap would make the index lie about what lies between blocks
+		if(!nb){
+			e->truncated = 1;
+			return NULL;
+		}
+		e->blocks = nb;
+		e->cap = cap;
+	}
+	struct trace_block *b = &e->blocks[e->nblocks++];
+	memset(b, 0, sizeof(*b));
+	b->offset = o->bytes_written + o->len;
+	b->t_first_us = ts_us;
+	b->base = e->base;
+	b->cpu_min = UINT16_MAX;
+	b->mem_used_min_kb = INT64_MAX;
+	b->mem_used_max_kb = INT64_MIN;
+	e->open = 1;
+	return b;
+}
+
+static void index_add(struct trace_block *b, int64_t ts_us, uint16_t cpu, int64_t mem_used_kb,
+		uint8_t flags, sys_state net){
+	b->samples++;
+	b->t_last_us = ts_us;
+	if(cpu < b->cpu_min) b->cpu_min = cpu;
+	if(cpu > b->cpu_max) b->cpu_max = cpu;
+	b->cpu_sum += cpu;
+	if(mem_used_kb < b->mem_used_min_kb) b->mem_used_min_kb = mem_used_kb;
+	if(mem_used_kb > b->mem_used_max_kb) b->mem_used_max_kb = mem_used_kb;
+	b->mem_used_sum_kb += mem_used_kb;
+	// worst state per 2-bit field
+	uint8_t st = (uint8_t)((flags & 0x3f) | ((net & 3) << 6));
+	for(int k = 0; k < 8; k += 2){
+		uint8_t cur = (b->states >> k) & 3, v = (st >> k) & 3;
+		if(v > cur) b->states = (uint8_t)((b->states & ~(3 << k)) | (v << k));
+	}
+	if(flags & TRACE_F_STATE_CHANGE) b->changes++;
+}
+
+void trace_sample(struct out_buf *o, const struct sample *s){
+	struct trace_enc *e = &o->trace;
+	struct trace_block *blk = index_block(o, (int64_t)llround(s->t * 1e6));
+	size_t cap = TRACE_SAMPLE_MAX + 2 * (size_t)(s->ncores > 0 ? s->ncores : 0);
+	uint8_t stackbuf[TRACE_SAMPLE_MAX + 2 * 1024];
+	uint8_t *buf = stackbuf;
+	// past 1024 cores: a buffer allocated once, the core count is fixed
+	if(cap > sizeof(stackbuf)){
+		if(e->scratch_cap < cap){
+			arena_free(e->scratch);
+			e->scratch = arena_calloc(1, cap);
+			e->scratch_cap = e->scratch ? cap : 0;
+		}
+		buf = e->scratch;
+	}
+	if(!buf) return;
+	struct wbuf w = { buf, 0 };
+
+	uint8_t flags = (uint8_t)((s->cpu_state & 3) | ((s->mem_state & 3) << 2) |
+			((s->io_state & 3) << 4));
+	if(e->pending_change) flags |= TRACE_F_STATE_CHANGE;
+	e->pending_change = 0;
+	put_u8(&w, flags);
+	put_varint(&w, trace_dt(e, s->t));
+	put_u16(&w, centi_pct(s->cpu_pct));
+	put_u16(&w, centi_pct(s->cpu_avg));
+	put_u16(&w, centi_pct(s->cpu_min));
+	put_u16(&w, centi_pct(s->cpu_max));
+	put_u16(&w, centi_pct(s->cpu_ewma));
+	put_u16(&w, centi_pct(s->cpu_hot_avg));
+
+	int64_t v;
+	struct trace_base *d = &e->base;
+	v = GB_TO_KB(s->mem_used_gb);   put_svarint(&w, v - d->mem_used_kb);   d->mem_used_kb = v;
+	v = GB_TO_KB(s->mem_avail_gb);  put_svarint(&w, v - d->mem_avail_kb);  d->mem_avail_kb = v;
+	v = GB_TO_KB(s->swap_used_gb);  put_svarint(&w, v - d->swap_used_kb);  d->swap_used_kb = v;
+	v = GB_TO_KB(s->swap_avail_gb); put_svarint(&w, v - d->swap_avail_kb); d->swap_avail_kb = v;
+
+	put_varint(&w, (uint64_t)(s->ncores > 0 ? s->ncores : 0));
+	for(int i = 0; i < s->ncores; i++) put_u16(&w, centi_opt(s->core_pct[i]));
+	put_varint(&w, s->missed);
+	put_varint(&w, s->dropped);
+	put_u8(&w, s->psi_wakeup ? TRACE_PSI_WAKEUP : 0);
+	put_u16(&w, centi_opt(s->psi_cpu_some));
+	put_u16(&w, centi_opt(s->psi_mem_some));
+	put_u16(&w, centi_opt(s->psi_mem_full));
+	put_u16(&w, centi_opt(s->psi_io_some));
+	put_u16(&w, centi_opt(s->psi_io_full));
+	put_varint(&w, s->interval > 0.0 ? (uint64_t)llround(s->interval * 1e6) : 0);
+	put_u8(&w, (uint8_t)s->net_state);
+	put_varint(&w, centi(s->disk_rd_iops));
+	put_varint(&w, centi(s->disk_wr_iops));
+	put_varint(&w, centi(s->disk_rd_mb_s));
+	put_varint(&w, centi(s->disk_wr_mb_s));
+	put_varint(&w, centi(s->disk_await_ms));
+	put_varint(&w, centi(s->disk_util_pct));
+	put_varint(&w, centi(s->net_rx_mbit_s));
+	put_varint(&w, centi(s->net_tx_mbit_s));
+	put_varint(&w, centi(s->net_rx_pps));
+	put_varint(&w, centi(s->net_tx_pps));
+	put_varint(&w, centi(s->net_errs_s));
+	put_varint(&w, s->skipped);
+	put_u16(&w, centi_opt(s->cgroup_mem_pct));
+	put_u16(&w, centi_opt(s->cgroup_cpu_pct));
+	put_u8(&w, isnan(s->runq_avg_us) ? 0 : TRACE_EBPF);
+	if(!isnan(s->runq_avg_us)){
+		put_varint(&w, centi(s->runq_avg_us));
+		put_varint(&w, centi(s->runq_p99_us));
+		put_varint(&w, centi(s->reclaim_ms_s));
+		put_u16(&w, isnan(s->pgfault_s) ? TRACE_NONE :
+				s->pgfault_s >= 655340.0 ? 65534 : (uint16_t)lround(s->pgfault_s / 10.0));
+	}
+	if(isnan(s->mem_slope_mb_s)){
+		put_u8(&w, 0);
+	} else {
+		put_u8(&w, (uint8_t)(TRACE_PRED | (s->mem_predicted & 3) << 1 |
+				(s->mem_predicted_change ? TRACE_PRED_CHANGE : 0)));
+		put_svarint(&w, llround(s->mem_slope_mb_s * 1024.0));
+		put_varint(&w, isnan(s->mem_eta_s) ? 0 : (uint64_t)llround(s->mem_eta_s * 10.0) + 1);
+		put_svarint(&w, isnan(s->cpu_z) ? 0 : llround(s->cpu_z * 100.0));
+	}
+	put_varint(&w, s->fresh);
+
+	if(blk) index_add(blk, d->ts_us, centi_pct(s->cpu_pct), d->mem_used_kb, flags, s->net_state);
+	else e->open = 0;
+	trace_record(o, TRACE_SAMPLE, &w);
+}
+
+// 13 varints, two u16 and a u8 per block at most
+#define TRACE_BLOCK_ENC (13 * 10 + 5)
+#define TRACE_INDEX_FLAGS 1
+
+static void trace_write_index(struct out_buf *o){
+	struct trace_enc *e = &o->trace;
+	if(e->nblocks == 0) return;
+	size_t cap = 10 + e->nblocks * TRACE_BLOCK_ENC + TRACE_INDEX_FLAGS + TRACE_INDEX_TRAILER;
+	uint8_t *buf = malloc(cap);
+	if(!buf) return;
+	struct wbuf w = { buf, 0 };
+	put_varint(&w, e->nblocks);
+	for(size_t i = 0; i < e->nblocks; i++){
+		const struct trace_block *b = &e->blocks[i];
+		put_varint(&w, b->offset);
+		put_varint(&w, b->samples);
+		put_varint(&w, (uint64_t)b->t_first_us);
+		put_varint(&w, (uint64_t)b->t_last_us);
+		put_svarint(&w, b->base.ts_us);
+		put_svarint(&w, b->base.mem_used_kb);
+		put_svarint(&w, b->base.mem_avail_kb);
+		put_svarint(&w, b->base.swap_used_kb);
+		put_svarint(&w, b->base.swap_avail_kb);
+		put_u16(&w, b->cpu_min);
+		put_u16(&w, b->cpu_max);
+		put_varint(&w, b->cpu_sum);
+		put_varint(&w, (uint64_t)b->mem_used_min_kb);
+		put_varint(&w, (uint64_t)b->mem_used_max_kb);
+		put_varint(&w, (uint64_t)b->mem_used_sum_kb);
+		put_u8(&w, b->states);
+		put_varint(&w, b->changes);
+	}
+	put_u8(&w, e->truncated ? TRACE_INDEX_TRUNCATED : 0);
+	put_u64(&w, o->bytes_written + o->len);
+	memcpy(w.p + w.len, TRACE_INDEX_MAGIC, 4);
+	w.len += 4;
+	trace_record(o, TRACE_INDEX, &w);
+	free(buf);
+	e->nblocks = 0;
+	e->open = 0;
+}
+
+void trace_summary(struct out_buf *o, int end, const struct sample_summary *m){
+	uint8_t buf[64];
+	struct wbuf w = { buf, 0 };
+	put_varint(&w, trace_dt(&o->trace, m->t));
+	put_varint(&w, m->samples);
+	for(int i = 0; i < SUMMARY_NQ; i++) put_f32(&w, (float)m->cpu_q[i]);
+	for(int i = 0; i < SUMMARY_NQ; i++) put_f32(&w, (float)m->mem_used_q[i]);
+	put_varint(&w, m->missed);
+	put_varint(&w, m->dropped);
+	trace_record(o, end ? TRACE_END : TRACE_SUMMARY, &w);
+	if(end) trace_write_index(o);
+}
+
+// per entry: pid, comm, cpu and rss varints
+#define TRACE_TOP_ENTRY (5 + 1 + PROCS_COMM + 10 + 10)
+
+static void put_top_list(struct wbuf *w, const struct proc_top_entry *e, int n){
+	put_varint(w, (uint64_t)n);
+	for(int i = 0; i < n; i++){
+		size_t len = strnlen(e[i].comm, PROCS_COMM - 1);
+		put_varint(w, (uint64_t)(e[i].pid > 0 ? e[i].pid : 0));
+		put_u8(w, (uint8_t)len);
+		memcpy(w->p + w->len, e[i].comm, len);
+		w->len += len;
+		put_varint(w, e[i].cpu_pct > 0.0 ? (uint64_t)llround(e[i].cpu_pct * 100.0) : 0);
+		put_varint(w, (uint64_t)(e[i].rss_kb > 0 ? e[i].rss_kb : 0));
+	}
+}
+
+void trace_top(struct out_buf *o, const struct proc_top *top){
+	uint8_t buf[32 + 2 * PROCS_TOP_MAX * TRACE_TOP_ENTRY];
+	struct wbuf w = { buf, 0 };
+	put_varint(&w, trace_dt(&o->trace, top->t));
+	put_u8(&w, (uint8_t)top->reason);
+	put_top_list(&w, top->cpu, top->n_cpu);
+	put_top_list(&w, top->rss, top->n_rss);
+	trace_record(o, TRACE_TOP, &w);
+}
+
+// non-negative v in units of 1/scale
+static uint64_t scaled(double v, double scale){
+	return v > 0.0 ? (uint64_t)llround(v * scale) : 0;
+}
+
+static uint64_t us(double s){
+	return scaled(s, 1e6);
+}
+
+// per entry: name, flags, cpu and mem varints, three u16
+#define TRACE_CG_ENTRY (1 + CGROUP_NAME + 1 + 10 + 10 + 3 * 2)
+
+void trace_cgroups(struct out_buf *o, const struct cgroup_report *rep){
+	uint8_t buf[64 + CGROUP_REPORT_MAX * TRACE_CG_ENTRY];
+	struct wbuf w = { buf, 0 };
+	put_varint(&w, trace_dt(&o->trace, rep->t));
+	put_u8(&w, (uint8_t)rep->reason);
+	put_varint(&w, (uint64_t)rep->count);
+	put_varint(&w, (uint64_t)rep->warn);
+	put_varint(&w, (uint64_t)rep->danger);
+	put_varint(&w, (uint64_t)rep->n);
+	for(int i = 0; i < rep->n; i++){
+		const struct cgroup_report_entry *e = &rep->e[i];
+		size_t len = strnlen(e->name, CGROUP_NAME - 1);
+		put_u8(&w, (uint8_t)len);
+		memcpy(w.p + w.len, e->name, len);
+		w.len += len;
+		int mem = !isnan(e->mem_mb);
+		put_u8(&w, (uint8_t)((uint8_t)e->state | (mem ? TRACE_CG_MEM : 0)));
+		put_varint(&w, centi(e->cpu_pct));
+		put_u16(&w, centi_opt(e->cpu_limit_pct));
+		put_u16(&w, centi_opt(e->throttled_pct));
+		if(mem) put_varint(&w, scaled(e->mem_mb, 1024.0));
+		put_u16(&w, centi_opt(e->mem_limit_pct));
+	}
+	trace_record(o, TRACE_CGROUP, &w);
+}
+
+static void put_lat(struct wbuf *w, const struct lat_summary *l){
+	put_varint(w, l->n);
+	put_varint(w, scaled(l->p50_us, 1e3));
+	put_varint(w, scaled(l->p99_us, 1e3));
+	put_varint(w, scaled(l->max_us, 1e3));
+}
+
+// per lat: four varints
+#define TRACE_LAT 40
+
+void trace_self(struct out_buf *o, const struct self_stat *m){
+	uint8_t buf[128 + 2 * TRACE_LAT + SELF_COLL_MAX * (1 + SELF_NAME + TRACE_LAT)];
+	struct wbuf w = { buf, 0 };
+	put_varint(&w, trace_dt(&o->trace, m->t));
+	put_varint(&w, centi(m->cpu_pct));
+	put_varint(&w, us(m->utime_s));
+	put_varint(&w, us(m->stime_s));
+	put_varint(&w, us(m->sampler_cpu_s));
+	put_varint(&w, us(m->writer_cpu_s));
+	put_varint(&w, (uint64_t)(m->rss_kb > 0 ? m->rss_kb : 0));
+	put_varint(&w, (uint64_t)(m->maxrss_kb > 0 ? m->maxrss_kb : 0));
+	put_varint(&w, m->bytes_written);
+	put_varint(&w, m->ticks);
+	put_varint(&w, m->missed);
+	put_lat(&w, &m->late);
+	put_lat(&w, &m->loop);
+	put_varint(&w, (uint64_t)m->ncoll);
+	for(int i = 0; i < m->ncoll; i++){
+		size_t len = strnlen(m->coll[i].name, SELF_NAME - 1);
+		put_u8(&w, (uint8_t)len);
+		memcpy(w.p + w.len, m->coll[i].name, len);
+		w.len += len;
+		put_lat(&w, &m->coll[i].lat);
+	}
+	trace_record(o, TRACE_SELF, &w);
+}
+
+// ---- decoding ----
+
+struct rbuf {
+	const uint8_t *p;
+	const uint8_t *end;
+	int bad;
+};
+
+static int need(struct rbuf *r, size_t n){
+	if(r->bad || (size_t)(r->end - r->p) < n){
+		r->bad = 1;
+		return 0;
+	}
+	return 1;
+}
+
+static uint8_t get_u8(struct rbuf *r){
+	return need(r, 1) ? *r->p++ : 0;
+}
+
+static uint16_t get_u16(struct rbuf *r){
+	if(!need(r, 2)) return 0;
+	uint16_t v = (uint16_t)(r->p[0] | (r->p[1] << 8));
+	r->p += 2;
+	return v;
+}
+
+static uint32_t get_u32(struct rbuf *r){
+	if(!need(r, 4)) return 0;
+	uint32_t v = 0;
+	for(int i = 0; i < 4; i++) v |= (uint32_t)r->p[i] << (8 * i);
+	r->p += 4;
+	return v;
+}
+
+static uint64_t get_u64(struct rbuf *r){
+	if(!need(r, 8)) return 0;
+	uint64_t v = 0;
+	for(int i = 0; i < 8; i++) v |= (uint64_t)r->p[i] << (8 * i);
+	r->p += 8;
+	return v;
+}
+
+static float get_f32(struct rbuf *r){
+	uint32_t v = get_u32(r);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static double get_f64(struct rbuf *r){
+	uint64_t v = get_u64(r);
+	double f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+static uint64_t get_varint(struct rbuf *r){
+	uint64_t v = 0;
+	for(int shift = 0; shift < 64; shift += 7){
+		if(!need(r, 1)) return 0;
+		uint8_t b = *r->p++;
+		v |= (uint64_t)(b & 0x7f) << shift;
+		if(!(b & 0x80)) return v;
+	}
+	r->bad = 1;
+	return 0;
+}
+
+// trailing field that older writers did not emit
+static uint64_t opt_varint(struct rbuf *r){
+	return r->p < r->end ? get_varint(r) : 0;
+}
+
+static double opt_centi(struct rbuf *r){
+	if(r->p >= r->end) return NAN;
+	uint16_t v = get_u16(r);
+	return v == TRACE_NONE ? NAN : v / 100.0;
+}
+
+static int64_t get_svarint(struct rbuf *r){
+	uint64_t v = get_varint(r);
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int get_cgroups(struct rbuf *r, struct cgroup_report *rep){
+	rep->reason = get_u8(r) == TOP_SUMMARY ? TOP_SUMMARY : TOP_STATE_CHANGE;
+	rep->count = (int)get_varint(r);
+	rep->warn = (int)get_varint(r);
+	rep->danger = (int)get_varint(r);
+	uint64_t n = get_varint(r);
+	if(n > CGROUP_REPORT_MAX) return -1;
+	rep->n = (int)n;
+	for(int i = 0; i < rep->n; i++){
+		struct cgroup_report_entry *e = &rep->e[i];
+		uint8_t len = get_u8(r);
+		if(len >= CGROUP_NAME || !need(r, len)) return -1;
+		memcpy(e->name, r->p, len);
+		e->name[len] = '\0';
+		r->p += len;
+		uint8_t flags = get_u8(r);
+		e->state = (sys_state)(flags & 3);
+		e->cpu_pct = get_varint(r) / 100.0;
+		e->cpu_limit_pct = opt_centi(r);
+		e->throttled_pct = opt_centi(r);
+		e->mem_mb = flags & TRACE_CG_MEM ? get_varint(r) / 1024.0 : NAN;
+		e->mem_limit_pct = opt_centi(r);
+	}
+	return r->bad ? -1 : 0;
+}
+
+static int get_top_list(struct rbuf *r, struct proc_top_entry *e){
+	uint64_t n = get_varint(r);
+	if(n > PROCS_TOP_MAX){
+		r->bad = 1;
+		return 0;
+	}
+	for(uint64_t i = 0; i < n; i++){
+		e[i].pid = (int)get_varint(r);
+		uint8_t len = get_u8(r);
+		if(len >= PROCS_COMM || !need(r, len)){
+			r->bad = 1;
+			return 0;
+		}
+		memcpy(e[i].comm, r->p, len);
+		e[i].comm[len] = '\0';
+		r->p += len;
+		e[i].cpu_pct = get_varint(r) / 100.0;
+		e[i].rss_kb = (long)get_varint(r);
+	}
+	return (int)n;
+}
+
+static void get_lat(struct rbuf *r, struct lat_summary *l){
+	l->n = get_varint(r);
+	l->p50_us = get_varint(r) / 1e3;
+	l->p99_us = get_varint(r) / 1e3;
+	l->max_us = get_varint(r) / 1e3;
+}
+
+static int get_self(struct rbuf *r, struct self_stat *m){
+	m->cpu_pct = get_varint(r) / 100.0;
+	m->utime_s = get_varint(r) / 1e6;
+	m->stime_s = get_varint(r) / 1e6;
+	m->sampler_cpu_s = get_varint(r) / 1e6;
+	m->writer_cpu_s = get_varint(r) / 1e6;
+	m->rss_kb = (long)get_varint(r);
+	m->maxrss_kb = (long)get_varint(r);
+	m->bytes_written = get_varint(r);
+	m->ticks = get_varint(r);
+	m->missed = get_varint(r);
+	get_lat(r, &m->late);
+	get_lat(r, &m->loop);
+	uint64_t n = get_varint(r);
+	if(n > SELF_COLL_MAX) r->bad = 1;
+	for(uint64_t i = 0; !r->bad && i < n; i++){
+		uint8_t len = get_u8(r);
+		if(len >= SELF_NAME || !need(r, len)){
+			r->bad = 1;
+			break;
+		}
+		memcpy(m->coll[i].name, r->p, len);
+		m->coll[i].name[len] = '\0';
+		r->p += len;
+		get_lat(r, &m->coll[i].lat);
+	}
+	m->ncoll = r->bad ? 0 : (int)n;
+	return r->bad ? -1 : 0;
+}
+
+static int decode_header(struct rbuf *r, struct sample_meta *m){
+	if((size_t)(r->end - r->p) < TRACE_MAGIC_LEN + 4 || memcmp(r->p, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0)
+		return -1;
+	r->p += TRACE_MAGIC_LEN;
+	uint16_t version = get_u16(r);
+	uint16_t hlen = get_u16(r);
+	if(version != TRACE_VERSION || !need(r, hlen)) return -1;
+
+	struct rbuf h = { r->p, r->p + hlen, 0 };
+	m->interval_s = get_f64(&h);
+	m->cores = (int)get_u32(&h);
+	m->window = (int)get_u32(&h);
+	m->max_freq_ghz = get_f64(&h);
+	m->mem_total_gb = get_f64(&h);
+	m->mem_avail_gb = get_f64(&h);
+	m->swap_total_gb = get_f64(&h);
+	m->swap_free_gb = get_f64(&h);
+	m->fast_interval_s = h.p < h.end ? get_f64(&h) : 0.0;
+	m->heartbeat_s = h.p < h.end ? get_f64(&h) : 0.0;
+	m->arena_kb = h.p < h.end ? get_u32(&h) : 0;
+	m->arena_startup_kb = h.p < h.end ? get_u32(&h) : 0;
+	m->arena_locked = h.p < h.end ? (int)get_u32(&h) : 0;
+	m->predict_s = h.p < h.end ? get_f64(&h) : 0.0;
+	if(h.bad) return -1;
+	r->p += hlen;
+	return 0;
+}
+
+struct trace_dec {
+	struct trace_base base;
+	double *cores;
+	int cores_cap;
+	double from, to;	// records outside are not emitted
+	trace_sample_hook hook;
+	void *arg;
+};
+
+// Records from r->p on. Returns 0 at the end of the image or past d->to,
+// -1 on a truncated record.
+static int decode_records(struct rbuf *r, struct trace_dec *d, struct out_buf *out){
+	struct trace_base *b = &d->base;
+	while(r->p < r->end && !out->error){
+		uint8_t tag = get_u8(r);
+		uint64_t plen = get_varint(r);
+		if(r->bad || !need(r, plen)) return -1;
+		struct rbuf p = { r->p, r->p + plen, 0 };
+		r->p += plen;
+
+		if(tag == TRACE_SAMPLE){
+			struct sample s = {0};
+			uint8_t flags = get_u8(&p);
+			s.cpu_state = (sys_state)(flags & 3);
+			s.mem_state = (sys_state)((flags >> 2) & 3);
+			s.io_state = (sys_state)((flags >> 4) & 3);
+			b->ts_us += (int64_t)get_varint(&p);
+			s.t = b->ts_us / 1e6;
+			s.cpu_pct = get_u16(&p) / 100.0;
+			s.cpu_avg = get_u16(&p) / 100.0;
+			s.cpu_min = get_u16(&p) / 100.0;
+			s.cpu_max = get_u16(&p) / 100.0;
+			s.cpu_ewma = get_u16(&p) / 100.0;
+			s.cpu_hot_avg = get_u16(&p) / 100.0;
+			b->mem_used_kb += get_svarint(&p);
+			b->mem_avail_kb += get_svarint(&p);
+			b->swap_used_kb += get_svarint(&p);
+			b->swap_avail_kb += get_svarint(&p);
+			if(s.t > d->to) return 0;
+			s.mem_used_gb = KB_TO_GB(b->mem_used_kb);
+			s.mem_avail_gb = KB_TO_GB(b->mem_avail_kb);
+			s.swap_used_gb = KB_TO_GB(b->swap_used_kb);
+			s.swap_avail_gb = KB_TO_GB(b->swap_avail_kb);
+			if(s.t < d->from) continue;	// the delta base is all it had to give
+			uint64_t n = get_varint(&p);
+			if(n > (uint64_t)(p.end - p.p) / 2) p.bad = 1;
+			if(!p.bad && (int)n > d->cores_cap){
+				double *nc = realloc(d->cores, n * sizeof(double));
+				if(!nc) return -1;
+				d->cores = nc;
+				d->cores_cap = (int)n;
+			}
+			for(uint64_t i = 0; !p.bad && i < n; i++){
+				uint16_t v = get_u16(&p);
+				d->cores[i] = v == TRACE_NONE ? NAN : v / 100.0;
+			}
+			if(p.bad) return -1;
+			s.missed = opt_varint(&p);
+			s.dropped = opt_varint(&p);
+			s.psi_wakeup = p.p < p.end && (get_u8(&p) & TRACE_PSI_WAKEUP);
+			s.psi_cpu_some = opt_centi(&p);
+			s.psi_mem_some = opt_centi(&p);
+			s.psi_mem_full = opt_centi(&p);
+			s.psi_io_some = opt_centi(&p);
+			s.psi_io_full = opt_centi(&p);
+			s.interval = opt_varint(&p) / 1e6;
+			s.net_state = p.p < p.end ? (sys_state)(get_u8(&p) & 3) : SYS_OK;
+			s.disk_rd_iops = opt_varint(&p) / 100.0;
+			s.disk_wr_iops = opt_varint(&p) / 100.0;
+			s.disk_rd_mb_s = opt_varint(&p) / 100.0;
+			s.disk_wr_mb_s = opt_varint(&p) / 100.0;
+			s.disk_await_ms = opt_varint(&p) / 100.0;
+			s.disk_util_pct = opt_varint(&p) / 100.0;
+			s.net_rx_mbit_s = opt_varint(&p) / 100.0;
+			s.net_tx_mbit_s = opt_varint(&p) / 100.0;
+			s.net_rx_pps = opt_varint(&p) / 100.0;
+			s.net_tx_pps = opt_varint(&p) / 100.0;
+			s.net_errs_s = opt_varint(&p) / 100.0;
+			s.skipped = opt_varint(&p);
+			s.cgroup_mem_pct = opt_centi(&p);
+			s.cgroup_cpu_pct = opt_centi(&p);
+			s.runq_avg_us = s.runq_p99_us = s.pgfault_s = s.reclaim_ms_s = NAN;
+			if(p.p < p.end && (get_u8(&p) & TRACE_EBPF)){
+				s.runq_avg_us = get_varint(&p) / 100.0;
+				s.runq_p99_us = get_varint(&p) / 100.0;
+				s.reclaim_ms_s = get_varint(&p) / 100.0;
+				uint16_t f = get_u16(&p);
+				s.pgfault_s = f == TRACE_NONE ? NAN : f * 10.0;
+			}
+			s.mem_slope_mb_s = s.mem_eta_s = s.cpu_z = NAN;
+			s.mem_predicted = SYS_OK;
+			s.mem_predicted_change = 0;
+			uint8_t pf = p.p < p.end ? get_u8(&p) : 0;
+			if(pf & TRACE_PRED){
+				s.mem_predicted = (sys_state)((pf >> 1) & 3);
+				s.mem_predicted_change = (pf & TRACE_PRED_CHANGE) != 0;
+				s.mem_slope_mb_s = get_svarint(&p) / 1024.0;
+				uint64_t eta = get_varint(&p);
+				s.mem_eta_s = eta ? (eta - 1) / 10.0 : NAN;
+				s.cpu_z = get_svarint(&p) / 100.0;
+			}
+			// older traces: take every value as read on its tick
+			s.fresh = p.p < p.end ? (unsigned)get_varint(&p) : SRC_ALL;
+			s.ncores = (int)n;
+			s.core_pct = d->cores;
+			int change = (flags & TRACE_F_STATE_CHANGE) != 0;
+			if(d->hook) d->hook(d->arg, &s, &change);
+			if(change) emit_state_change(out, &s);
+			if(s.mem_predicted_change) emit_predicted_state(out, &s);
+			emit_sample(out, &s);
+		} else if(tag == TRACE_SUMMARY || tag == TRACE_END){
+			struct sample_summary m;
+			b->ts_us += (int64_t)get_varint(&p);
+			m.t = b->ts_us / 1e6;
+			m.samples = get_varint(&p);
+			for(int i = 0; i < SUMMARY_NQ; i++) m.cpu_q[i] = get_f32(&p);
+			for(int i = 0; i < SUMMARY_NQ; i++) m.mem_used_q[i] = get_f32(&p);
+			m.missed = opt_varint(&p);
+			m.dropped = opt_varint(&p);
+			if(p.bad) return -1;
+			// the end record is about the whole run, not a point in time
+			if(tag == TRACE_END) emit_summary(out, "end", &m);
+			else if(m.t >= d->from && m.t <= d->to) emit_summary(out, "summary", &m);
+		} else if(tag == TRACE_TOP){
+			struct proc_top top;
+			b->ts_us += (int64_t)get_varint(&p);
+			top.t = b->ts_us / 1e6;
+			top.reason = get_u8(&p) == TOP_SUMMARY ? TOP_SUMMARY : TOP_STATE_CHANGE;
+			top.n_cpu = get_top_list(&p, top.cpu);
+			top.n_rss = get_top_list(&p, top.rss);
+			if(p.bad) return -1;
+			if(top.t >= d->from && top.t <= d->to) emit_top(out, &top);
+		} else if(tag == TRACE_CGROUP){
+			struct cgroup_report rep;
+			b->ts_us += (int64_t)get_varint(&p);
+			rep.t = b->ts_us / 1e6;
+			if(get_cgroups(&p, &rep) != 0) return -1;
+			if(rep.t >= d->from && rep.t <= d->to) emit_cgroups(out, &rep);
+		} else if(tag == TRACE_SELF){
+			struct self_stat m = {0};
+			b->ts_us += (int64_t)get_varint(&p);
+			m.t = b->ts_us / 1e6;
+			if(get_self(&p, &m) != 0) return -1;
+			if(m.t >= d->from && m.t <= d->to) emit_self(out, &m);
+		}
+		// anything else: newer record type (or the index), already
+		// skipped by length
+	}
+	return 0;
+}
+
+int trace_decode(const uint8_t *buf, size_t len, struct out_buf *out,
+		trace_sample_hook hook, void *arg){
+	struct rbuf r = { buf, buf + len, 0 };
+	struct sample_meta m;
+	if(decode_header(&r, &m) != 0) return -1;
+	emit_meta(out, &m);
+	struct trace_dec d = { .from = -INFINITY, .to = INFINITY, .hook = hook, .arg = arg };
+	int rc = decode_records(&r, &d, out);
+	free(d.cores);
+	return rc;
+}
+
+// The index found through the trailer, decoded; NULL if there is none.
+static struct trace_block *load_index(const uint8_t *buf, size_t len, size_t *nblocks,
+		int *truncated){
+	if(len < TRACE_INDEX_TRAILER ||
+			memcmp(buf + len - 4, TRACE_INDEX_MAGIC, 4) != 0)
+		return NULL;
+	struct rbuf t = { buf + len - TRACE_INDEX_TRAILER, buf + len, 0 };
+	uint64_t off = get_u64(&t);
+	if(off >= len) return NULL;
+	struct rbuf r = { buf + off, buf + len, 0 };
+	if(get_u8(&r) != TRACE_INDEX) return NULL;
+	uint64_t plen = get_varint(&r);
+	if(r.bad || plen != (uint64_t)(r.end - r.p)) return NULL;
+	uint64_t n = get_varint(&r);
+	// a block takes 20 bytes at the very least
+	if(r.bad || n == 0 || n > plen / 20) return NULL;
+	struct trace_block *blocks = calloc(n, sizeof(*blocks));
+	if(!blocks) return NULL;
+	for(uint64_t i = 0; i < n; i++){
+		struct trace_block *b = &blocks[i];
+		b->offset = get_varint(&r);
+		b->samples = get_varint(&r);
+		b->t_first_us = (int64_t)get_varint(&r);
+		b->t_last_us = (int64_t)get_varint(&r);
+		b->base.ts_us = get_svarint(&r);
+		b->base.mem_used_kb = get_svarint(&r);
+		b->base.mem_avail_kb = get_svarint(&r);
+		b->base.swap_used_kb = get_svarint(&r);
+		b->base.swap_avail_kb = get_svarint(&r);
+		b->cpu_min = get_u16(&r);
+		b->cpu_max = get_u16(&r);
+		b->cpu_sum = get_varint(&r);
+		b->mem_used_min_kb = (int64_t)get_varint(&r);
+		b->mem_used_max_kb = (int64_t)get_varint(&r);
+		b->mem_used_sum_kb = (int64_t)get_varint(&r);
+		b->states = get_u8(&r);
+		b->changes = get_varint(&r);
+		if(r.bad || b->offset >= off){
+			free(blocks);
+			return NULL;
+		}
+	}
+	// the flags came later: an index without them is complete
+	*truncated = r.end - r.p > TRACE_INDEX_TRAILER &&
+			(get_u8(&r) & TRACE_INDEX_TRUNCATED);
+	*nblocks = n;
+	return blocks;
+}
+
+// first block whose last sample is at or after t_us
+static size_t first_block(const struct trace_block *b, size_t n, int64_t t_us){
+	size_t lo = 0, hi = n;
+	while(lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if(b[mid].t_last_us < t_us) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+static int64_t to_us(double t){
+	if(t <= -9e12) return INT64_MIN;
+	if(t >= 9e12) return INT64_MAX;
+	return (int64_t)llround(t * 1e6);
+}
+
+int trace_decode_range(const uint8_t *buf, size_t len, double from, double to,
+		struct out_buf *out){
+	struct rbuf r = { buf, buf + len, 0 };
+	struct sample_meta m;
+	if(decode_header(&r, &m) != 0) return -1;
+	emit_meta(out, &m);
+	struct trace_dec d = { .from = from, .to = to };
+	size_t n = 0;
+	int truncated = 0;
+	struct trace_block *blocks = load_index(buf, len, &n, &truncated);
+	if(blocks){
+		// past the last block: whatever the index does not cover (its
+		// open end, or all the rest when truncated) follows that block
+		size_t i = first_block(blocks, n, to_us(from));
+		if(i == n) i = n - 1;
+		if(i > 0){
+			// the blocks of the window come with the delta base to start from
+			r.p = buf + blocks[i].offset;
+			d.base = blocks[i].base;
+		}
+		free(blocks);
+	}
+	int rc = decode_records(&r, &d, out);
+	free(d.cores);
+	return rc;
+}
+
+int trace_index(const uint8_t *buf, size_t len, double from, double to,
+		struct out_buf *out){
+	struct rbuf r = { buf, buf + len, 0 };
+	struct sample_meta m;
+	if(decode_header(&r, &m) != 0) return -1;
+	size_t n = 0;
+	int truncated = 0;
+	struct trace_block *blocks = load_index(buf, len, &n, &truncated);
+	if(!blocks) return -1;
+	emit_meta(out, &m);
+	int64_t to_t = to_us(to);
+	for(size_t i = first_block(blocks, n, to_us(from)); i < n && !out->error; i++){
+		if(blocks[i].t_first_us > to_t) break;
+		emit_block(out, &blocks[i]);
+	}
+	emit_index(out, n, blocks[n - 1].t_last_us, truncated);
+	free(blocks);
+	return 0;
+}
@@ -1,21 +1,95 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
 #include "window.h"
 
-void cpu_window_init(cpu_window *w){
-	w->index=0;
-	w->count=0;
+int cpu_window_init(cpu_window *w, int size, double alpha){
+	if(!w) return -1;
+	memset(w, 0, sizeof(*w));
+	if(size < 1) size = CPU_WINDOW;
+	w->samples = arena_calloc((size_t)size, sizeof(double));
+	w->min_q = arena_calloc((size_t)size, sizeof(unsigned long));
+	w->max_q = arena_calloc((size_t)size, sizeof(unsigned long));
+	if(!w->samples || !w->min_q || !w->max_q){
+		cpu_window_free(w);
+		return -1;
+	}
+	w->size = size;
+	w->alpha = (alpha > 0.0 && alpha <= 1.0) ? alpha : 2.0 / (size + 1);
+	return 0;
+}
+
+void cpu_window_free(cpu_window *w){
+	if(!w) return;
+	arena_free(w->samples);
+	arena_free(w->min_q);
+	arena_free(w->max_q);
+	w->samples = NULL;
+	w->min_q = NULL;
+	w->max_q = NULL;
+	w->size = 0;
+	w->count = 0;
+}
+
+static inline double seq_value(const cpu_window *w, unsigned long s){
+	return w->samples[s % (unsigned long)w->size];
+}
+
+// Deques are rings of `size` slots: they never hold more than the
+// samples currently in the window.
+static void deque_push(cpu_window *w, unsigned long *q, int *head, int *len,
+		unsigned long s, int keep_below){
+	unsigned long oldest = w->seq >= (unsigned long)w->size ?
+		w->seq - (unsigned long)w->size + 1 : 0;
+	while(*len && q[*head] < oldest){
+		*head = (*head + 1) % w->size;
+		(*len)--;
+	}
+	double v = seq_value(w, s);
+	while(*len){
+		int back = (*head + *len - 1) % w->size;
+		double bv = seq_value(w, q[back]);
+		if(keep_below ? bv < v : bv > v) break;
+		(*len)--;
+	}
+	q[(*head + *len) % w->size] = s;
+	(*len)++;
 }
 
 void cpu_window_add(cpu_window *w, double value){
+	double old = w->count == w->size ? w->samples[w->index] : 0.0;
 	w->samples[w->index] = value;
-	w->index = (w->index + 1) % CPU_WINDOW;
-	if(w->count < CPU_WINDOW) w->count++;
+	w->index = (w->index + 1) % w->size;
+	if(w->count < w->size) w->count++;
+
+	w->sum += value - old;
+	if(++w->since_resum >= w->size){
+		double s = 0.0;
+		for(int i = 0; i < w->count; i++) s += w->samples[i];
+		w->sum = s;
+		w->since_resum = 0;
+	}
+
+	unsigned long s = w->seq;
+	deque_push(w, w->min_q, &w->min_head, &w->min_len, s, 1);
+	deque_push(w, w->max_q, &w->max_head, &w->max_len, s, 0);
+	w->seq++;
+
+	w->ewma = s == 0 ? value : w->ewma + w->alpha * (value - w->ewma);
 }
 
 double cpu_window_avg(const cpu_window *w){
-	double sum=0.0;
-	for(int i = 0; i < w->count; i++){
-		sum+=w->samples[i];
-	}
-	return w->count ? sum / w->count: 0.0;
+	return w->count ? w->sum / w->count: 0.0;
 }
 
+double cpu_window_min(const cpu_window *w){
+	return w->min_len ? seq_value(w, w->min_q[w->min_head]) : 0.0;
+}
+
+double cpu_window_max(const cpu_window *w){
+	return w->max_len ? seq_value(w, w->max_q[w->max_head]) : 0.0;
+}
+
+double cpu_window_ewma(const cpu_window *w){
+	return w->ewma;
+}
@@ -0,0 +1,114 @@
+#include <signal.h>
+#include <stdio.h>
+#include "writer.h"
+
+// how long the writer sleeps on an empty ring before re-checking the
+// time-based flush policy and the stop flag
+#define WRITER_IDLE_MS 50
+
+static int writer_emit(struct writer *w, const struct ring_rec *r){
+	struct out_buf *out = w->out;
+	switch(r->kind){
+	case REC_SAMPLE: {
+		if(w->flight) flight_put(w->flight, &r->s, r->state_change);
+		if(w->push) pusher_add(w->push, &r->s);
+		if(w->metrics) metrics_publish(w->metrics, &r->s);
+		if(!w->deadband){
+			if(r->state_change) emit_state_change(out, &r->s);
+			if(r->s.mem_predicted_change) emit_predicted_state(out, &r->s);
+			emit_sample(out, &r->s);
+			return 0;
+		}
+		if(!deadband_pass(w->deadband, &r->s, r->state_change || r->s.mem_predicted_change))
+			return 0;
+		struct sample s = r->s;
+		s.skipped = w->deadband->skipped;
+		w->deadband->skipped = 0;
+		if(r->state_change) emit_state_change(out, &s);
+		if(s.mem_predicted_change) emit_predicted_state(out, &s);
+		emit_sample(out, &s);
+		return 0;
+	}
+	case REC_SUMMARY:
+		emit_summary(out, "summary", &r->sum);
+		return 0;
+	case REC_TOP:
+		emit_top(out, &r->top);
+		return 0;
+	case REC_CGROUP:
+		emit_cgroups(out, &r->cg);
+		return 0;
+	case REC_SELF: {
+		// the writer's own share is only known on this thread
+		struct self_stat m = r->self;
+		m.writer_cpu_s = self_thread_cpu_s();
+		m.bytes_written = out->bytes_written + out->len;
+		emit_self(out, &m);
+		return 0;
+	}
+	case REC_END:
+		emit_summary(out, "end", &r->sum);
+		return 1;
+	}
+	return 0;
+}
+
+static void *writer_main(void *arg){
+	struct writer *w = arg;
+	int done = 0;
+	while(!done){
+		struct ring_rec *r = ring_peek(w->ring);
+		if(!r){
+			if(atomic_load(&w->stop)) break;
+			out_poll(w->out);
+			if(w->push) pusher_poll(w->push);
+			ring_wait(w->ring, WRITER_IDLE_MS);
+			continue;
+		}
+		done = writer_emit(w, r);
+		ring_release(w->ring);
+		if(w->out->error){
+			atomic_store(&w->failed, 1);
+			break;
+		}
+	}
+	out_flush(w->out);
+	if(w->push) pusher_flush(w->push);
+	return NULL;
+}
+
+int writer_start(struct writer *w, struct spsc_ring *ring, struct out_buf *out,
+		struct flight *flight, struct pusher *push, struct metrics_server *metrics,
+		struct deadband *deadband){
+	w->ring = ring;
+	w->out = out;
+	w->flight = flight;
+	w->push = push;
+	w->metrics = metrics;
+	w->deadband = deadband;
+	w->started = 0;
+	atomic_init(&w->stop, 0);
+	atomic_init(&w->failed, 0);
+
+	// signals stay with the sampler thread, whose sleep they interrupt
+	sigset_t block, old;
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &old);
+	int rc = pthread_create(&w->thread, NULL, writer_main, w);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if(rc != 0){
+		fprintf(stderr, "pthread_create: writer failed\n");
+		return -1;
+	}
+	w->started = 1;
+	return 0;
+}
+
+void writer_stop(struct writer *w){
+	if(!w->started) return;
+	atomic_store(&w->stop, 1);
+	pthread_join(w->thread, NULL);
+	w->started = 0;
+}
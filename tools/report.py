@@ -5,9 +5,13 @@ Generate an HTML report (plots + summary) from sysprobe JSONL traces.
 
 Input: JSON Lines file with records like:
   {"type":"meta", ...}
-  {"type":"sample", "ts":..., "cpu":..., "cpu_avg":..., "mem_used":..., "mem_avail":..., ...}
+  {"type":"sample", "ts":..., "cpu":..., "cpu_avg":..., "mem_used":..., "mem_avail":..., "cpu_cores":[...], ...}
   {"type":"event", ...}   (optional, will be ignored unless it has ts)
-  {"type":"end", ...}
+  {"type":"summary", ...} (periodic p50/p95/p99, ignored)
+  {"type":"end", ...}     (whole-run p50/p95/p99)
+  {"type":"top", ...}     (top processes by CPU/RSS, ignored)
+  {"type":"self", ...}    (sysprobe's own overhead, --self, ignored)
+  {"type":"cgroups", ...} (per-cgroup states, --cgroup-root, ignored)
 
 Outputs:
   - report.html
@@ -16,6 +20,23 @@ Outputs:
 
 Usage:
   python3 tools/sysprobe_report.py output.jsonl -o report_dir
+
+Binary traces (sysprobe --format=bin) and flight files are read
+through sysprobe-decode, looked up next to this script's repository
+and then in PATH.
+
+The input is read once, as a stream: the summary comes from running
+aggregates and the plots from a fixed number of min/max/mean buckets
+(--points), so memory and plotting time depend on the plot resolution,
+not on the length of the trace.
+
+--from/--to limit the report to a stretch of trace time; on an indexed
+binary trace the decoder seeks straight to it. --blocks answers the
+aggregates of that stretch from the trace index alone, at block
+granularity, without decoding any sample:
+  python3 tools/report.py trace.bin --blocks --from 3600 --to 4200
+An index the probe had to stop early comes out with "truncated": true
+and "indexed_to", the end of what its blocks cover.
 """
 
 from __future__ import annotations
@@ -26,8 +47,11 @@ import datetime as dt
 import json
 import math
 import os
+import shutil
+import subprocess
+import sys
 from dataclasses import dataclass
-from typing import Any, Dict, List, Optional, Tuple
+from typing import Any, Dict, Iterator, List, Optional
 
 import matplotlib.pyplot as plt
 
@@ -36,41 +60,55 @@ import matplotlib.pyplot as plt
 # Helpers
 # -------------------------
 
-def read_jsonl(path: str) -> Tuple[Optional[dict], List[dict], List[dict], Optional[dict]]:
-    meta = None
-    samples: List[dict] = []
-    events: List[dict] = []
-    end = None
+BINARY_MAGICS = (b"SPTRACE", b"SPFLIGHT")
 
-    with open(path, "r", encoding="utf-8") as f:
-        for line_no, line in enumerate(f, start=1):
-            line = line.strip()
-            if not line:
-                continue
-            try:
-                rec = json.loads(line)
-            except json.JSONDecodeError:
-                # If any non-JSON slips in, skip it rather than failing hard
-                # (but you should aim for pure JSONL on stdout)
-                continue
 
-            rtype = rec.get("type")
-            if rtype == "meta" and meta is None:
-                meta = rec
-            elif rtype == "sample":
-                # Require ts
-                if "ts" in rec:
-                    samples.append(rec)
-            elif rtype == "event":
-                if "ts" in rec:
-                    events.append(rec)
-            elif rtype == "end":
-                end = rec
-            else:
-                # Unknown type: ignore
-                pass
+def find_decoder() -> str:
+    here = os.path.dirname(os.path.abspath(__file__))
+    local = os.path.join(os.path.dirname(here), "sysprobe-decode")
+    if os.access(local, os.X_OK):
+        return local
+    found = shutil.which("sysprobe-decode")
+    if not found:
+        raise SystemExit("binary input needs sysprobe-decode (run make, or put it in PATH)")
+    return found
+
 
-    return meta, samples, events, end
+def is_binary(path: str) -> bool:
+    with open(path, "rb") as f:
+        return f.read(8).startswith(BINARY_MAGICS)
+
+
+def iter_lines(path: str, decoder_args: List[str]) -> Iterator[str]:
+    if not is_binary(path):
+        with open(path, "r", encoding="utf-8") as f:
+            yield from f
+        return
+    # decoded on the fly; nothing but the current line is held
+    proc = subprocess.Popen([find_decoder(), *decoder_args, path], stdout=subprocess.PIPE,
+                            encoding="utf-8")
+    assert proc.stdout is not None
+    try:
+        yield from proc.stdout
+    finally:
+        proc.stdout.close()
+        if proc.wait() != 0:
+            raise SystemExit(f"sysprobe-decode failed on {path}")
+
+
+def iter_records(path: str, decoder_args: Optional[List[str]] = None) -> Iterator[dict]:
+    for line in iter_lines(path, decoder_args or []):
+        line = line.strip()
+        if not line:
+            continue
+        try:
+            rec = json.loads(line)
+        except json.JSONDecodeError:
+            # If any non-JSON slips in, skip it rather than failing hard
+            # (but you should aim for pure JSONL on stdout)
+            continue
+        if isinstance(rec, dict):
+            yield rec
 
 
 def safe_float(x: Any, default: float = float("nan")) -> float:
@@ -80,23 +118,165 @@ def safe_float(x: Any, default: float = float("nan")) -> float:
         return default
 
 
-def percentile(vals: List[float], p: float) -> float:
-    """p in [0, 100]"""
-    clean = sorted(v for v in vals if not (math.isnan(v) or math.isinf(v)))
-    if not clean:
-        return float("nan")
-    if p <= 0:
-        return clean[0]
-    if p >= 100:
-        return clean[-1]
-    k = (len(clean) - 1) * (p / 100.0)
-    f = math.floor(k)
-    c = math.ceil(k)
-    if f == c:
-        return clean[int(k)]
-    d0 = clean[f] * (c - k)
-    d1 = clean[c] * (k - f)
-    return d0 + d1
+def nan_min(a: float, b: float) -> float:
+    """min ignoring NaN; NaN only if both are."""
+    return b if math.isnan(a) or b < a else a
+
+
+def nan_max(a: float, b: float) -> float:
+    return b if math.isnan(a) or b > a else a
+
+
+class Histogram:
+    """Fixed-width bins over [lo, hi]; percentiles to within one bin."""
+
+    def __init__(self, lo: float, hi: float, bins: int):
+        self.lo = lo
+        self.width = (hi - lo) / bins
+        self.counts = [0] * (bins + 1)
+        self.n = 0
+
+    def add(self, v: float, times: int = 1):
+        k = int((v - self.lo) / self.width)
+        self.counts[min(max(k, 0), len(self.counts) - 1)] += times
+        self.n += times
+
+    def percentile(self, p: float) -> float:
+        if self.n == 0:
+            return float("nan")
+        rank = (self.n - 1) * (p / 100.0)
+        seen = 0
+        for k, c in enumerate(self.counts):
+            seen += c
+            if seen > rank:
+                return self.lo + (k + 0.5) * self.width
+        return self.lo + (len(self.counts) - 0.5) * self.width
+
+
+STATE_RANK = {"ok": 0, "warn": 1, "danger": 2}
+
+
+class Buckets:
+    """
+    Min/max/mean downsampling to at most `points` time buckets, for a
+    stream of unknown length: when a sample lands past the last bucket
+    the bucket width doubles and neighbours are merged pairwise.
+
+    Each bucket is [count, then sum/min/max per series, then the worst
+    state per state series]; None is a bucket without samples, i.e. a
+    gap in the trace. With hold (--deadband traces) an empty bucket
+    carries the values of the last sample before it instead.
+    """
+
+    def __init__(self, series: List[str], states: List[str], points: int, width: float,
+                 hold: bool = False):
+        self.hold = hold
+        self.series = series
+        self.states = states
+        self.points = max(2, points)
+        self.width = width if width > 0 else 1.0
+        self.t0: Optional[float] = None
+        self.b: List[Optional[list]] = []
+
+    def _merge(self, a: Optional[list], c: Optional[list]) -> Optional[list]:
+        if a is None:
+            return c
+        if c is None:
+            return a
+        ns = len(self.series)
+        out = [a[0] + c[0]]
+        for i in range(ns):
+            j = 1 + 3 * i
+            out += [a[j] + c[j], min(a[j + 1], c[j + 1]), max(a[j + 2], c[j + 2])]
+        base = 1 + 3 * ns
+        out += [max(a[base + i], c[base + i]) for i in range(len(self.states))]
+        return out
+
+    def _reach(self, k: int) -> int:
+        """Grows the buckets to hold index k; returns k at the final width."""
+        while k >= self.points:
+            self.b = [self._merge(self.b[i], self.b[i + 1] if i + 1 < len(self.b) else None)
+                      for i in range(0, len(self.b), 2)]
+            self.width *= 2
+            k //= 2
+        while len(self.b) <= k:
+            self.b.append(None)
+        return k
+
+    def add(self, t: float, values: List[float], states: List[int]):
+        if self.t0 is None:
+            self.t0 = t
+        k = self._reach(int((t - self.t0) / self.width) if t >= self.t0 else 0)
+        cur = self.b[k]
+        if cur is None:
+            cur = [0]
+            for _ in self.series:
+                cur += [0.0, math.inf, -math.inf]
+            cur += [0] * len(self.states)
+            self.b[k] = cur
+        cur[0] += 1
+        for i, v in enumerate(values):
+            j = 1 + 3 * i
+            if math.isnan(v):
+                continue
+            cur[j] += v
+            if v < cur[j + 1]:
+                cur[j + 1] = v
+            if v > cur[j + 2]:
+                cur[j + 2] = v
+        base = 1 + 3 * len(self.series)
+        for i, st in enumerate(states):
+            if st > cur[base + i]:
+                cur[base + i] = st
+
+    def extend(self, t: float):
+        """Makes the buckets reach t, e.g. the end record of a held trace."""
+        if not self.hold or self.t0 is None or math.isnan(t) or t < self.t0:
+            return
+        self._reach(int((t - self.t0) / self.width))
+
+    def _filled(self) -> List[Optional[list]]:
+        if not self.hold:
+            return self.b
+        out, last = [], None
+        ns = len(self.series)
+        for b in self.b:
+            if b is not None:
+                # what is held after this bucket: its means, its states
+                last = [1]
+                for i in range(ns):
+                    j = 1 + 3 * i
+                    m = b[j] / b[0] if not math.isinf(b[j + 1]) else float("nan")
+                    last += [m, m, m] if not math.isnan(m) else [0.0, math.inf, -math.inf]
+                last += b[1 + 3 * ns:]
+                out.append(b)
+            else:
+                out.append(last)
+        return out
+
+    def x(self) -> List[float]:
+        t0 = self.t0 or 0.0
+        return [t0 + (i + 0.5) * self.width for i in range(len(self.b))]
+
+    def column(self, name: str):
+        """(mean, min, max) lists for a series, NaN in gaps."""
+        i = 1 + 3 * self.series.index(name)
+        nan = float("nan")
+        mean, lo, hi = [], [], []
+        for b in self._filled():
+            if b is None or math.isinf(b[i + 1]):
+                mean.append(nan)
+                lo.append(nan)
+                hi.append(nan)
+            else:
+                mean.append(b[i] / b[0])
+                lo.append(b[i + 1])
+                hi.append(b[i + 2])
+        return mean, lo, hi
+
+    def state(self, name: str) -> List[int]:
+        i = 1 + 3 * len(self.series) + self.states.index(name)
+        return [-1 if b is None else b[i] for b in self._filled()]
 
 
 @dataclass
@@ -115,33 +295,138 @@ class Summary:
     mem_danger_s: float
 
 
-def compute_time_in_state(ts: List[float], state: List[str], target: str) -> float:
-    """Approximate time spent in a given state using sample-to-sample dt."""
-    if len(ts) < 2:
-        return 0.0
-    total = 0.0
-    for i in range(1, len(ts)):
-        dt_i = ts[i] - ts[i - 1]
-        if state[i - 1] == target:
-            total += max(0.0, dt_i)
-    return total
+class Accumulator:
+    """
+    Running aggregates over the sample stream.
 
+    Time in state: a sample describes the interval that ends at its
+    timestamp. Newer traces record that interval per sample, which stays
+    right when the probe changes its rate (--adaptive) or samples early
+    on a PSI trigger; older ones fall back to sample-to-sample dt.
 
-def shade_state(ax, ts: List[float], state: List[str], label: str, alpha: float = 0.15):
+    With --deadband (meta heartbeat_s) a written sample stands for the
+    ones left out after it: the state holds from one written sample
+    until the next one's own interval begins, or until the end record.
     """
-    Shade background regions where state == label.
+
+    def __init__(self, held: bool = False):
+        self.held = held
+        self.n = 0
+        self.first_ts = self.last_ts = float("nan")
+        self.cpu_sum = 0.0
+        self.cpu_n = 0
+        self.cpu_max = float("nan")
+        self.last_cpu = float("nan")
+        self.cpu_hist = Histogram(0.0, 100.0, 1000)
+        self.mem_avail_min = float("nan")
+        self.mem_used_max = float("nan")
+        self.swap_used_max = float("nan")
+        self.in_state = {(g, st): 0.0 for g in ("CPU", "MEM") for st in ("warn", "danger")}
+        self.prev_state = {"CPU": None, "MEM": None}
+
+    def add(self, ts: float, cpu: float, mem_used: float, mem_avail: float,
+            swap_used: float, interval: float, cpu_state: str, mem_state: str,
+            skipped: int = 0):
+        prev_ts = self.last_ts
+        if self.n == 0:
+            self.first_ts = ts
+        self.last_ts = ts
+        self.n += 1 + skipped
+        # the samples left out were within the deadband of the last one
+        # written, which stands in for them
+        if skipped and not math.isnan(self.last_cpu):
+            self.cpu_sum += self.last_cpu * skipped
+            self.cpu_n += skipped
+            self.cpu_hist.add(self.last_cpu, skipped)
+        self.last_cpu = cpu
+        if not math.isnan(cpu):
+            self.cpu_sum += cpu
+            self.cpu_n += 1
+            self.cpu_hist.add(cpu)
+            self.cpu_max = nan_max(self.cpu_max, cpu)
+        self.mem_avail_min = nan_min(self.mem_avail_min, mem_avail)
+        self.mem_used_max = nan_max(self.mem_used_max, mem_used)
+        self.swap_used_max = nan_max(self.swap_used_max, swap_used)
+        for g, st in (("CPU", cpu_state), ("MEM", mem_state)):
+            if not math.isnan(interval):
+                if (g, st) in self.in_state:
+                    self.in_state[(g, st)] += max(0.0, interval)
+                if self.held and not math.isnan(prev_ts):
+                    self.hold(g, ts - interval - prev_ts)
+            elif (g, self.prev_state[g]) in self.in_state and not math.isnan(prev_ts):
+                self.in_state[(g, self.prev_state[g])] += max(0.0, ts - prev_ts)
+            self.prev_state[g] = st
+
+    def hold(self, group: str, span: float):
+        if (group, self.prev_state[group]) in self.in_state:
+            self.in_state[(group, self.prev_state[group])] += max(0.0, span)
+
+    def finish(self, end_ts: float):
+        """The stretch after the last written sample, up to the end record."""
+        if self.held and not math.isnan(self.last_ts) and not math.isnan(end_ts):
+            for g in ("CPU", "MEM"):
+                self.hold(g, end_ts - self.last_ts)
+            self.last_ts = max(self.last_ts, end_ts)
+
+    def summary(self, end: Optional[dict]) -> Summary:
+        # The probe's own sketch saw every sample, even if the trace was
+        # thinned out; prefer it when the end record carries one.
+        if end and end.get("cpu_p95") is not None:
+            cpu_p95 = safe_float(end.get("cpu_p95"))
+        else:
+            cpu_p95 = self.cpu_hist.percentile(95)
+        return Summary(
+            runtime_s=(self.last_ts - self.first_ts) if self.n > 1 else 0.0,
+            n_samples=self.n,
+            cpu_mean=self.cpu_sum / max(1, self.cpu_n),
+            cpu_p95=cpu_p95,
+            cpu_max=self.cpu_max,
+            mem_avail_min=self.mem_avail_min,
+            mem_used_max=self.mem_used_max,
+            swap_used_max=self.swap_used_max,
+            cpu_warn_s=self.in_state[("CPU", "warn")],
+            cpu_danger_s=self.in_state[("CPU", "danger")],
+            mem_warn_s=self.in_state[("MEM", "warn")],
+            mem_danger_s=self.in_state[("MEM", "danger")],
+        )
+
+
+def shade_state(ax, x: List[float], width: float, state: List[int], rank: int,
+                alpha: float = 0.15):
+    """
+    Shade background regions where the bucket's worst state == rank.
     """
-    if len(ts) < 2:
-        return
     start = None
-    for i in range(len(ts)):
-        s = state[i]
-        if s == label and start is None:
-            start = ts[i]
-        if (s != label or i == len(ts) - 1) and start is not None:
-            end = ts[i] if s != label else ts[i]
-            ax.axvspan(start, end, alpha=alpha)
+    for xi, s in zip(x, state):
+        if s == rank and start is None:
+            start = xi - width / 2
+        elif s != rank and start is not None:
+            ax.axvspan(start, xi - width / 2, alpha=alpha)
             start = None
+    if start is not None:
+        ax.axvspan(start, x[-1] + width / 2, alpha=alpha)
+
+
+def plot_series(path: str, buckets: Buckets, lines: List[tuple], ylabel: str,
+                state: Optional[str], shading: bool):
+    x = buckets.x()
+    plt.figure()
+    for name, label in lines:
+        mean, lo, hi = buckets.column(name)
+        line, = plt.plot(x, mean, label=label)
+        # the envelope keeps spikes that averaging would hide
+        plt.fill_between(x, lo, hi, alpha=0.25, color=line.get_color(), linewidth=0)
+    ax = plt.gca()
+    if shading and state and x:
+        st = buckets.state(state)
+        shade_state(ax, x, buckets.width, st, STATE_RANK["warn"], alpha=0.12)
+        shade_state(ax, x, buckets.width, st, STATE_RANK["danger"], alpha=0.18)
+    plt.xlabel("time (s)")
+    plt.ylabel(ylabel)
+    plt.legend()
+    plt.tight_layout()
+    plt.savefig(path, dpi=150)
+    plt.close()
 
 
 def write_html_report(
@@ -213,111 +498,141 @@ def write_html_report(
         f.write(html)
 
 
+def block_summary(path: str, decoder_args: List[str]) -> dict:
+    """Aggregates of the index blocks overlapping the window."""
+    if not is_binary(path):
+        raise SystemExit("--blocks needs a binary trace (sysprobe --format=bin)")
+    n = 0
+    out: Dict[str, Any] = {"blocks": 0, "samples": 0}
+    cpu_sum = mem_sum = 0.0
+    worst = {k: "ok" for k in ("CPU_STATE", "MEM_STATE", "IO_STATE", "NET_STATE")}
+    changes = 0
+    truncated = False
+    for rec in iter_records(path, ["--index", *decoder_args]):
+        if rec.get("type") == "index":
+            # indexing stopped early: the aggregates miss the rest of the trace
+            truncated = bool(rec.get("truncated"))
+            if truncated:
+                out["indexed_to"] = rec["ts_last"]
+            continue
+        if rec.get("type") != "block":
+            continue
+        k = int(rec.get("samples", 0))
+        out["blocks"] += 1
+        if out["blocks"] == 1:
+            out["ts_first"] = rec["ts_first"]
+            out["cpu_min"] = rec["cpu_min"]
+            out["cpu_max"] = rec["cpu_max"]
+            out["mem_used_min"] = rec["mem_used_min"]
+            out["mem_used_max"] = rec["mem_used_max"]
+        out["ts_last"] = rec["ts_last"]
+        out["cpu_min"] = min(out["cpu_min"], rec["cpu_min"])
+        out["cpu_max"] = max(out["cpu_max"], rec["cpu_max"])
+        out["mem_used_min"] = min(out["mem_used_min"], rec["mem_used_min"])
+        out["mem_used_max"] = max(out["mem_used_max"], rec["mem_used_max"])
+        cpu_sum += rec["cpu_mean"] * k
+        mem_sum += rec["mem_used_mean"] * k
+        n += k
+        for g in worst:
+            if STATE_RANK.get(rec.get(g), 0) > STATE_RANK[worst[g]]:
+                worst[g] = rec[g]
+        changes += int(rec.get("state_changes", 0))
+    out["samples"] = n
+    out["cpu_mean"] = cpu_sum / n if n else float("nan")
+    out["mem_used_mean"] = mem_sum / n if n else float("nan")
+    out.update(worst)
+    out["state_changes"] = changes
+    out["truncated"] = truncated
+    if truncated:
+        print(f"warning: the trace index stops at ts {out['indexed_to']:.3f}; "
+              "these aggregates do not cover the rest of the trace", file=sys.stderr)
+    return out
+
+
 # -------------------------
 # Main plotting/report
 # -------------------------
 
+SERIES = ["cpu", "cpu_avg", "mem_used", "mem_avail", "mem_swap_used", "mem_swap_avail"]
+STATES = ["CPU_STATE", "MEM_STATE"]
+
+
 def main():
     ap = argparse.ArgumentParser(description="Generate an HTML report from sysprobe JSONL output.")
-    ap.add_argument("input", help="Path to sysprobe JSONL output")
+    ap.add_argument("input", help="Path to sysprobe JSONL output, binary trace or flight file")
     ap.add_argument("-o", "--outdir", default="sysprobe_report", help="Output directory (default: sysprobe_report)")
     ap.add_argument("--no-shading", action="store_true", help="Disable WARN/DANGER background shading")
+    ap.add_argument("--points", type=int, default=2000,
+                    help="Time buckets per plot, each drawn as mean with a min/max band (default: 2000)")
+    ap.add_argument("--from", dest="t_from", type=float, help="Start of the window, trace seconds (ts)")
+    ap.add_argument("--to", dest="t_to", type=float, help="End of the window, trace seconds (ts)")
+    ap.add_argument("--blocks", action="store_true",
+                    help="Print the window's aggregates from the trace index only, as JSON")
     args = ap.parse_args()
 
-    meta, samples, events, end = read_jsonl(args.input)
-    if not samples:
+    t_from = args.t_from if args.t_from is not None else -math.inf
+    t_to = args.t_to if args.t_to is not None else math.inf
+    decoder_args: List[str] = []
+    if args.t_from is not None:
+        decoder_args += ["--from", repr(max(0.0, args.t_from))]
+    if args.t_to is not None:
+        decoder_args += ["--to", repr(max(0.0, args.t_to))]
+
+    if args.blocks:
+        print(json.dumps(block_summary(args.input, decoder_args), indent=2))
+        return
+
+    meta = None
+    end = None
+    acc = Accumulator()
+    buckets: Optional[Buckets] = None
+    for rec in iter_records(args.input, decoder_args):
+        rtype = rec.get("type")
+        if rtype == "meta" and meta is None:
+            meta = rec
+            acc.held = safe_float(meta.get("heartbeat_s"), 0.0) > 0
+        elif rtype == "end":
+            end_ts = min(safe_float(rec.get("ts")), t_to)
+            acc.finish(end_ts)
+            if buckets is not None:
+                buckets.extend(end_ts)
+            # whole-run quantiles do not describe a window
+            if args.t_from is None and args.t_to is None:
+                end = rec
+        elif rtype == "sample" and "ts" in rec:
+            ts = safe_float(rec.get("ts"))
+            # the decoder already cut a binary trace, JSONL is cut here
+            if math.isnan(ts) or ts < t_from or ts > t_to:
+                continue
+            if buckets is None:
+                width = safe_float((meta or {}).get("interval_s"), 1.0)
+                buckets = Buckets(SERIES, STATES, args.points, width, hold=acc.held)
+            values = [safe_float(rec.get(k)) for k in SERIES]
+            cpu_state = str(rec.get("CPU_STATE", "unknown"))
+            mem_state = str(rec.get("MEM_STATE", "unknown"))
+            acc.add(ts, values[0], values[2], values[3], values[4],
+                    safe_float(rec.get("interval")), cpu_state, mem_state,
+                    int(safe_float(rec.get("skipped"), 0.0)))
+            buckets.add(ts, values, [STATE_RANK.get(cpu_state, -1), STATE_RANK.get(mem_state, -1)])
+        # other types (event, summary, top, self) do not feed the report
+
+    if buckets is None:
         raise SystemExit("No sample records found. Ensure stdout contains JSONL with type=sample and a ts field.")
 
     os.makedirs(args.outdir, exist_ok=True)
+    summary = acc.summary(end)
+    shading = not args.no_shading
 
-    # Extract vectors
-    ts = [safe_float(s.get("ts")) for s in samples]
-    cpu = [safe_float(s.get("cpu")) for s in samples]
-    cpu_avg = [safe_float(s.get("cpu_avg")) for s in samples]
-
-    mem_used = [safe_float(s.get("mem_used")) for s in samples]
-    mem_avail = [safe_float(s.get("mem_avail")) for s in samples]
-
-    swap_used = [safe_float(s.get("mem_swap_used")) for s in samples]
-    swap_avail = [safe_float(s.get("mem_swap_avail")) for s in samples]
-
-    cpu_state = [str(s.get("CPU_STATE", "unknown")) for s in samples]
-    mem_state = [str(s.get("MEM_STATE", "unknown")) for s in samples]
-
-    runtime_s = (ts[-1] - ts[0]) if len(ts) > 1 else 0.0
-
-    # Summary stats
-    cpu_mean = sum(v for v in cpu if not math.isnan(v)) / max(1, sum(1 for v in cpu if not math.isnan(v)))
-    cpu_p95 = percentile(cpu, 95)
-    cpu_max = max((v for v in cpu if not math.isnan(v)), default=float("nan"))
-
-    mem_avail_min = min((v for v in mem_avail if not math.isnan(v)), default=float("nan"))
-    mem_used_max = max((v for v in mem_used if not math.isnan(v)), default=float("nan"))
-    swap_used_max = max((v for v in swap_used if not math.isnan(v)), default=float("nan"))
-
-    cpu_warn_s = compute_time_in_state(ts, cpu_state, "warn")
-    cpu_danger_s = compute_time_in_state(ts, cpu_state, "danger")
-    mem_warn_s = compute_time_in_state(ts, mem_state, "warn")
-    mem_danger_s = compute_time_in_state(ts, mem_state, "danger")
-
-    summary = Summary(
-        runtime_s=runtime_s,
-        n_samples=len(samples),
-        cpu_mean=cpu_mean,
-        cpu_p95=cpu_p95,
-        cpu_max=cpu_max,
-        mem_avail_min=mem_avail_min,
-        mem_used_max=mem_used_max,
-        swap_used_max=swap_used_max,
-        cpu_warn_s=cpu_warn_s,
-        cpu_danger_s=cpu_danger_s,
-        mem_warn_s=mem_warn_s,
-        mem_danger_s=mem_danger_s,
-    )
-
-    # Plot: CPU
     cpu_png = os.path.join(args.outdir, "cpu.png")
-    plt.figure()
-    plt.plot(ts, cpu, label="cpu (%)")
-    plt.plot(ts, cpu_avg, label="cpu_avg (%)")
-    ax = plt.gca()
-    if not args.no_shading:
-        shade_state(ax, ts, cpu_state, "warn", alpha=0.12)
-        shade_state(ax, ts, cpu_state, "danger", alpha=0.18)
-    plt.xlabel("time (s)")
-    plt.ylabel("cpu (%)")
-    plt.legend()
-    plt.tight_layout()
-    plt.savefig(cpu_png, dpi=150)
-    plt.close()
-
-    # Plot: Memory
+    plot_series(cpu_png, buckets, [("cpu", "cpu (%)"), ("cpu_avg", "cpu_avg (%)")],
+                "cpu (%)", "CPU_STATE", shading)
     mem_png = os.path.join(args.outdir, "mem.png")
-    plt.figure()
-    plt.plot(ts, mem_used, label="mem_used (GB)")
-    plt.plot(ts, mem_avail, label="mem_avail (GB)")
-    ax = plt.gca()
-    if not args.no_shading:
-        shade_state(ax, ts, mem_state, "warn", alpha=0.12)
-        shade_state(ax, ts, mem_state, "danger", alpha=0.18)
-    plt.xlabel("time (s)")
-    plt.ylabel("GB")
-    plt.legend()
-    plt.tight_layout()
-    plt.savefig(mem_png, dpi=150)
-    plt.close()
-
-    # Plot: Swap
+    plot_series(mem_png, buckets, [("mem_used", "mem_used (GB)"), ("mem_avail", "mem_avail (GB)")],
+                "GB", "MEM_STATE", shading)
     swap_png = os.path.join(args.outdir, "swap.png")
-    plt.figure()
-    plt.plot(ts, swap_used, label="swap_used (GB)")
-    plt.plot(ts, swap_avail, label="swap_avail (GB)")
-    plt.xlabel("time (s)")
-    plt.ylabel("GB")
-    plt.legend()
-    plt.tight_layout()
-    plt.savefig(swap_png, dpi=150)
-    plt.close()
+    plot_series(swap_png, buckets, [("mem_swap_used", "swap_used (GB)"),
+                                    ("mem_swap_avail", "swap_avail (GB)")],
+                "GB", None, shading)
 
     # Write report.html
     report_html = os.path.join(args.outdir, "report.html")
@@ -340,4 +655,3 @@ def main():
 
 if __name__ == "__main__":
     main()
-